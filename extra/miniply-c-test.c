@@ -0,0 +1,212 @@
+// Copyright 2019 Vilya Harvey
+//
+// Smoke test for the C API. This is compiled as C, so it also checks that
+// miniply_c.h is usable from a C compiler. It writes a small PLY file into
+// the current directory, then opens, loads, extracts from and takes data out
+// of it.
+#include "miniply_c.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+static const char* kTestFilename = "miniply-c-test.ply";
+
+static const char* kTestFile =
+  "ply\n"
+  "format ascii 1.0\n"
+  "element vertex 4\n"
+  "property float x\n"
+  "property float y\n"
+  "property float z\n"
+  "property uchar red\n"
+  "element face 2\n"
+  "property list uchar int vertex_indices\n"
+  "end_header\n"
+  "0 0 0 10\n"
+  "1 0 0 20\n"
+  "1 1 0 30\n"
+  "0 1 0 40\n"
+  "3 0 1 2\n"
+  "4 0 1 2 3\n";
+
+
+static int g_failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      ++g_failures; \
+    } \
+  } while (0)
+
+
+static int write_test_file(void)
+{
+  FILE* f = fopen(kTestFilename, "wb");
+  if (f == NULL) {
+    return 0;
+  }
+  int ok = fputs(kTestFile, f) >= 0;
+  ok = (fclose(f) == 0) && ok;
+  return ok;
+}
+
+
+static void test_null_reader(void)
+{
+  miniply_element_info elemInfo;
+  uint32_t idxs[3];
+
+  CHECK(miniply_open(NULL) == NULL);
+  CHECK(miniply_open("this-file-does-not-exist.ply") == NULL);
+  miniply_close(NULL);
+
+  CHECK(miniply_num_elements(NULL) == 0);
+  CHECK(miniply_version_major(NULL) == 0);
+  CHECK(miniply_find_element(NULL, "vertex") == MINIPLY_INVALID_INDEX);
+  CHECK(miniply_element_info_at(NULL, 0, &elemInfo) == 0);
+  CHECK(miniply_has_element(NULL) == 0);
+  CHECK(miniply_element_index(NULL) == MINIPLY_INVALID_INDEX);
+  CHECK(miniply_load_element(NULL) == 0);
+  CHECK(miniply_find_pos(NULL, idxs) == 0);
+  CHECK(miniply_take_element_data(NULL) == NULL);
+  miniply_next_element(NULL);
+  miniply_buffer_free(NULL);
+}
+
+
+static void test_schema(miniply_reader* reader)
+{
+  miniply_element_info elemInfo;
+  miniply_property_info propInfo;
+
+  CHECK(miniply_file_type_of(reader) == MINIPLY_FILE_ASCII);
+  CHECK(miniply_version_major(reader) == 1);
+  CHECK(miniply_num_elements(reader) == 2);
+  CHECK(miniply_find_element(reader, "face") == 1);
+  CHECK(miniply_find_element(reader, "edge") == MINIPLY_INVALID_INDEX);
+  CHECK(miniply_find_element(reader, NULL) == MINIPLY_INVALID_INDEX);
+
+  CHECK(miniply_element_info_at(reader, 0, &elemInfo));
+  CHECK(strcmp(elemInfo.name, "vertex") == 0);
+  CHECK(elemInfo.count == 4);
+  CHECK(elemInfo.num_properties == 4);
+  CHECK(elemInfo.row_stride == 13);
+  CHECK(elemInfo.fixed_size == 1);
+  CHECK(miniply_element_info_at(reader, 2, &elemInfo) == 0);
+  CHECK(miniply_element_info_at(reader, 0, NULL) == 0);
+
+  CHECK(miniply_property_info_at(reader, 1, 0, &propInfo));
+  CHECK(strcmp(propInfo.name, "vertex_indices") == 0);
+  CHECK(propInfo.type == MINIPLY_TYPE_INT);
+  CHECK(propInfo.count_type == MINIPLY_TYPE_UCHAR);
+  CHECK(miniply_property_info_at(reader, 1, 1, &propInfo) == 0);
+}
+
+
+static void test_vertices(miniply_reader* reader, float pos[12])
+{
+  uint32_t posIdxs[3];
+  uint32_t redIdx;
+  uint8_t red[4];
+  miniply_buffer* buffer;
+
+  CHECK(miniply_element_is(reader, "vertex"));
+  CHECK(miniply_num_rows(reader) == 4);
+  CHECK(miniply_load_element(reader));
+  CHECK(miniply_num_loaded_rows(reader) == 4);
+
+  CHECK(miniply_find_pos(reader, posIdxs));
+  CHECK(miniply_extract_properties(reader, posIdxs, 3, MINIPLY_TYPE_FLOAT, pos, 0));
+  CHECK(pos[3] == 1.0f && pos[7] == 1.0f && pos[10] == 1.0f);
+  CHECK(miniply_extract_properties(reader, posIdxs, 3, MINIPLY_TYPE_FLOAT, NULL, 0) == 0);
+
+  redIdx = miniply_find_property(reader, "red");
+  CHECK(redIdx == 3);
+  CHECK(miniply_extract_properties(reader, &redIdx, 1, MINIPLY_TYPE_UCHAR, red, 0));
+  CHECK(red[0] == 10 && red[3] == 40);
+
+  // The taken data must outlive the reader, so it's freed by the caller
+  // after miniply_close. Here we just check its size and contents.
+  buffer = miniply_take_element_data(reader);
+  CHECK(buffer != NULL);
+  CHECK(miniply_buffer_size(buffer) == 4 * 13);
+  if (miniply_buffer_data(buffer) != NULL) {
+    const uint8_t* bytes = (const uint8_t*)miniply_buffer_data(buffer);
+    CHECK(bytes[13 + 12] == 20);
+  }
+  CHECK(miniply_num_loaded_rows(reader) == 0);
+  miniply_buffer_free(buffer);
+
+  miniply_next_element(reader);
+}
+
+
+static void test_faces(miniply_reader* reader, const float pos[12])
+{
+  uint32_t indicesIdx;
+  uint32_t counts[2];
+  int32_t listValues[7];
+  int32_t tris[9];
+  miniply_buffer* buffer;
+
+  CHECK(miniply_element_is(reader, "face"));
+  CHECK(miniply_find_indices(reader, &indicesIdx));
+  CHECK(miniply_load_element(reader));
+
+  CHECK(miniply_sum_of_list_counts(reader, indicesIdx) == 7);
+  CHECK(miniply_list_counts(reader, indicesIdx) != NULL);
+  if (miniply_list_counts(reader, indicesIdx) != NULL) {
+    memcpy(counts, miniply_list_counts(reader, indicesIdx), sizeof(counts));
+    CHECK(counts[0] == 3 && counts[1] == 4);
+  }
+  CHECK(miniply_extract_list_property(reader, indicesIdx, MINIPLY_TYPE_INT, listValues));
+  CHECK(listValues[3] == 0 && listValues[6] == 3);
+
+  CHECK(miniply_requires_triangulation(reader, indicesIdx));
+  CHECK(miniply_num_triangles(reader, indicesIdx) == 3);
+  CHECK(miniply_extract_triangles(reader, indicesIdx, pos, 4, MINIPLY_TYPE_INT, tris));
+  CHECK(tris[0] == 0 && tris[1] == 1 && tris[2] == 2);
+
+  // Keep this one past miniply_close.
+  buffer = miniply_take_element_data(reader);
+  CHECK(buffer != NULL);
+  miniply_next_element(reader);
+  CHECK(!miniply_has_element(reader));
+  CHECK(miniply_take_element_data(reader) == NULL);
+
+  miniply_close(reader);
+  miniply_buffer_free(buffer);
+}
+
+
+int main(void)
+{
+  miniply_reader* reader;
+  float pos[12];
+
+  if (!write_test_file()) {
+    fprintf(stderr, "Failed to write %s\n", kTestFilename);
+    return 1;
+  }
+
+  test_null_reader();
+
+  reader = miniply_open(kTestFilename);
+  CHECK(reader != NULL);
+  if (reader != NULL) {
+    test_schema(reader);
+    test_vertices(reader, pos);
+    test_faces(reader, pos);
+  }
+
+  remove(kTestFilename);
+  if (g_failures > 0) {
+    fprintf(stderr, "%d check(s) failed\n", g_failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
@@ -0,0 +1,592 @@
+// Copyright 2019 Vilya Harvey
+#include "miniply.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(MINIPLY_COMPARE_TINYPLY) || defined(MINIPLY_COMPARE_HAPPLY)
+#include <fstream>
+#include <stdexcept>
+#endif
+
+#ifdef MINIPLY_COMPARE_TINYPLY
+#ifdef MINIPLY_COMPARE_TINYPLY_HEADER_ONLY
+#define TINYPLY_IMPLEMENTATION
+#endif
+#include "tinyply.h"
+#endif
+
+#ifdef MINIPLY_COMPARE_HAPPLY
+#include "happly.h"
+#endif
+
+#ifdef MINIPLY_COMPARE_RPLY
+extern "C" {
+#include "rply.h"
+}
+#endif
+
+
+//
+// Types
+//
+
+// The output every reader has to produce: vertex positions as floats, and
+// triangle indices. Polygons are triangulated as fans by all of the readers,
+// so that the outputs can be compared directly.
+struct Mesh {
+  std::vector<float> pos;         // 3 floats per vertex.
+  std::vector<uint32_t> indices;  // 3 indices per triangle.
+
+  void clear()
+  {
+    pos.clear();
+    indices.clear();
+  }
+};
+
+
+// What we learned about each input file from loading it with miniply first.
+// The other readers use this to request the right properties.
+struct CorpusFile {
+  std::string filename;
+  uint64_t fileSize   = 0;
+  bool hasFaces       = false;
+  bool allTriangles   = true;           // False if any face needs triangulating.
+  std::string indicesName;              // Name of the vertex index list property, if there are faces.
+  Mesh reference;                       // The miniply output, which the other readers are checked against.
+};
+
+
+enum class Status {
+  OK,
+  Failed,       // The reader couldn't load the file.
+  Unsupported,  // The reader can't produce equivalent output for this file.
+  Mismatch,     // The output differs from miniply's.
+};
+
+
+typedef bool (*LoadFunc)(const CorpusFile& file, Mesh& mesh, std::string& error);
+
+struct Reader {
+  const char* name;
+  LoadFunc load;
+};
+
+
+struct Result {
+  Status status = Status::Failed;
+  double bestMS = 0.0;
+  std::string error;
+};
+
+
+//
+// Helpers
+//
+
+static bool has_extension(const char* filename, const char* ext)
+{
+  int j = int(strlen(ext));
+  int i = int(strlen(filename)) - j;
+  if (i <= 0 || filename[i - 1] != '.') {
+    return false;
+  }
+  return strcmp(filename + i, ext) == 0;
+}
+
+
+static uint64_t file_size(const char* filename)
+{
+  FILE* f = fopen(filename, "rb");
+  if (f == nullptr) {
+    return 0;
+  }
+#ifdef _WIN32
+  _fseeki64(f, 0, SEEK_END);
+  uint64_t size = uint64_t(_ftelli64(f));
+#else
+  fseeko(f, 0, SEEK_END);
+  uint64_t size = uint64_t(ftello(f));
+#endif
+  fclose(f);
+  return size;
+}
+
+
+// Appends a fan triangulation of one polygon.
+template <class T>
+static void add_fan(const T polygon[], size_t n, std::vector<uint32_t>& indices)
+{
+  for (size_t i = 2; i < n; i++) {
+    indices.push_back(uint32_t(polygon[0]));
+    indices.push_back(uint32_t(polygon[i - 1]));
+    indices.push_back(uint32_t(polygon[i]));
+  }
+}
+
+
+static bool same_positions(const std::vector<float>& a, const std::vector<float>& b)
+{
+  if (a.size() != b.size()) {
+    return false;
+  }
+  // ASCII files go through each reader's own number parsing, which may not
+  // round the same way as miniply's, so allow a little slack.
+  for (size_t i = 0; i < a.size(); i++) {
+    if (std::fabs(a[i] - b[i]) > 1e-6f * std::max(1.0f, std::fabs(a[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+//
+// miniply
+//
+
+static bool load_with_miniply(const CorpusFile& file, Mesh& mesh, std::string& error)
+{
+  miniply::PLYReader reader(file.filename.c_str());
+  if (!reader.valid()) {
+    error = "invalid file";
+    return false;
+  }
+
+  bool gotVerts = false;
+  bool gotFaces = false;
+  while (reader.has_element() && (!gotVerts || !gotFaces)) {
+    uint32_t propIdxs[3];
+    if (!gotVerts && reader.element_is(miniply::kPLYVertexElement) && reader.load_element() && reader.find_pos(propIdxs)) {
+      mesh.pos.resize(size_t(reader.num_rows()) * 3);
+      reader.extract_properties(propIdxs, 3, miniply::PLYPropertyType::Float, mesh.pos.data());
+      gotVerts = true;
+    }
+    else if (!gotFaces && reader.element_is(miniply::kPLYFaceElement) && reader.load_element() && reader.find_indices(propIdxs)) {
+      if (!reader.requires_triangulation(propIdxs[0])) {
+        mesh.indices.resize(size_t(reader.num_rows()) * 3);
+        reader.extract_list_property(propIdxs[0], miniply::PLYPropertyType::UInt, mesh.indices.data());
+      }
+      else {
+        std::vector<uint32_t> polygons(reader.sum_of_list_counts(propIdxs[0]));
+        reader.extract_list_property(propIdxs[0], miniply::PLYPropertyType::UInt, polygons.data());
+        const uint32_t* counts = reader.get_list_counts(propIdxs[0]);
+        mesh.indices.reserve(size_t(reader.num_triangles(propIdxs[0])) * 3);
+        size_t start = 0;
+        for (uint32_t i = 0, endI = reader.num_rows(); i < endI; i++) {
+          add_fan(polygons.data() + start, counts[i], mesh.indices);
+          start += counts[i];
+        }
+      }
+      gotFaces = true;
+    }
+    reader.next_element();
+  }
+
+  if (!gotVerts) {
+    error = "no vertex positions";
+  }
+  return gotVerts;
+}
+
+
+// Loads the file with miniply to find out what it contains and to get the
+// reference output. Returns false if miniply can't load it.
+static bool prepare_corpus_file(const char* filename, CorpusFile& file)
+{
+  file.filename = filename;
+  file.fileSize = file_size(filename);
+
+  {
+    miniply::PLYReader reader(filename);
+    if (!reader.valid()) {
+      return false;
+    }
+    while (reader.has_element()) {
+      uint32_t indicesIdx;
+      if (reader.element_is(miniply::kPLYFaceElement) && reader.load_element() && reader.find_indices(&indicesIdx)) {
+        file.hasFaces = true;
+        file.allTriangles = !reader.requires_triangulation(indicesIdx);
+        file.indicesName = reader.element()->properties[indicesIdx].name;
+        break;
+      }
+      reader.next_element();
+    }
+  }
+
+  std::string error;
+  return load_with_miniply(file, file.reference, error);
+}
+
+
+//
+// tinyply
+//
+
+#ifdef MINIPLY_COMPARE_TINYPLY
+template <class T>
+static void tinyply_copy_values(const uint8_t* src, size_t n, float dst[])
+{
+  for (size_t i = 0; i < n; i++) {
+    T val;
+    std::memcpy(&val, src + i * sizeof(T), sizeof(T));
+    dst[i] = float(val);
+  }
+}
+
+
+template <class T>
+static void tinyply_copy_indices(const uint8_t* src, size_t n, uint32_t dst[])
+{
+  for (size_t i = 0; i < n; i++) {
+    T val;
+    std::memcpy(&val, src + i * sizeof(T), sizeof(T));
+    dst[i] = uint32_t(val);
+  }
+}
+
+
+static bool load_with_tinyply(const CorpusFile& file, Mesh& mesh, std::string& error)
+{
+  // tinyply reads lists into a flat buffer without their counts, so it can
+  // only give us triangles if every face is already a triangle.
+  if (file.hasFaces && !file.allTriangles) {
+    error = "polygons";
+    return false;
+  }
+
+  try {
+    std::ifstream in(file.filename, std::ios::binary);
+    tinyply::PlyFile ply;
+    if (!in || !ply.parse_header(in)) {
+      error = "invalid file";
+      return false;
+    }
+
+    std::shared_ptr<tinyply::PlyData> verts = ply.request_properties_from_element("vertex", { "x", "y", "z" });
+    std::shared_ptr<tinyply::PlyData> faces;
+    if (file.hasFaces) {
+      faces = ply.request_properties_from_element("face", { file.indicesName }, 3);
+    }
+    ply.read(in);
+
+    mesh.pos.resize(verts->count * 3);
+    switch (verts->t) {
+    case tinyply::Type::FLOAT32: tinyply_copy_values<float>(verts->buffer.get(), mesh.pos.size(), mesh.pos.data()); break;
+    case tinyply::Type::FLOAT64: tinyply_copy_values<double>(verts->buffer.get(), mesh.pos.size(), mesh.pos.data()); break;
+    default:
+      error = "unsupported position type";
+      return false;
+    }
+
+    if (faces) {
+      mesh.indices.resize(faces->count * 3);
+      switch (faces->t) {
+      case tinyply::Type::INT32:  tinyply_copy_indices<int32_t>(faces->buffer.get(), mesh.indices.size(), mesh.indices.data()); break;
+      case tinyply::Type::UINT32: tinyply_copy_indices<uint32_t>(faces->buffer.get(), mesh.indices.size(), mesh.indices.data()); break;
+      case tinyply::Type::INT16:  tinyply_copy_indices<int16_t>(faces->buffer.get(), mesh.indices.size(), mesh.indices.data()); break;
+      case tinyply::Type::UINT16: tinyply_copy_indices<uint16_t>(faces->buffer.get(), mesh.indices.size(), mesh.indices.data()); break;
+      default:
+        error = "unsupported index type";
+        return false;
+      }
+    }
+  }
+  catch (const std::exception& e) {
+    error = e.what();
+    return false;
+  }
+  return true;
+}
+#endif
+
+
+//
+// happly
+//
+
+#ifdef MINIPLY_COMPARE_HAPPLY
+static bool load_with_happly(const CorpusFile& file, Mesh& mesh, std::string& error)
+{
+  try {
+    happly::PLYData ply(file.filename);
+
+    std::vector<std::array<double, 3>> pos = ply.getVertexPositions();
+    mesh.pos.resize(pos.size() * 3);
+    for (size_t i = 0; i < pos.size(); i++) {
+      mesh.pos[i * 3 + 0] = float(pos[i][0]);
+      mesh.pos[i * 3 + 1] = float(pos[i][1]);
+      mesh.pos[i * 3 + 2] = float(pos[i][2]);
+    }
+
+    if (file.hasFaces) {
+      std::vector<std::vector<size_t>> faces = ply.getFaceIndices<size_t>();
+      for (const std::vector<size_t>& face : faces) {
+        add_fan(face.data(), face.size(), mesh.indices);
+      }
+    }
+  }
+  catch (const std::exception& e) {
+    error = e.what();
+    return false;
+  }
+  return true;
+}
+#endif
+
+
+//
+// rply
+//
+
+#ifdef MINIPLY_COMPARE_RPLY
+struct RPlyContext {
+  Mesh* mesh = nullptr;
+  std::vector<uint32_t> polygon;
+};
+
+
+static int rply_vertex_cb(p_ply_argument arg)
+{
+  void* pdata = nullptr;
+  long axis = 0;
+  ply_get_argument_user_data(arg, &pdata, &axis);
+  RPlyContext* ctx = static_cast<RPlyContext*>(pdata);
+  ctx->mesh->pos.push_back(float(ply_get_argument_value(arg)));
+  return 1;
+}
+
+
+static int rply_face_cb(p_ply_argument arg)
+{
+  void* pdata = nullptr;
+  ply_get_argument_user_data(arg, &pdata, nullptr);
+  RPlyContext* ctx = static_cast<RPlyContext*>(pdata);
+
+  long length = 0;
+  long valueIndex = 0;
+  ply_get_argument_property(arg, nullptr, &length, &valueIndex);
+  if (valueIndex < 0) {
+    // This is the list count.
+    ctx->polygon.clear();
+    return 1;
+  }
+  ctx->polygon.push_back(uint32_t(ply_get_argument_value(arg)));
+  if (valueIndex == length - 1) {
+    add_fan(ctx->polygon.data(), ctx->polygon.size(), ctx->mesh->indices);
+  }
+  return 1;
+}
+
+
+static void rply_error_cb(p_ply /*ply*/, const char* /*message*/)
+{
+  // Errors are reported through the return values instead.
+}
+
+
+static bool load_with_rply(const CorpusFile& file, Mesh& mesh, std::string& error)
+{
+  p_ply ply = ply_open(file.filename.c_str(), rply_error_cb, 0, nullptr);
+  if (ply == nullptr || !ply_read_header(ply)) {
+    if (ply != nullptr) {
+      ply_close(ply);
+    }
+    error = "invalid file";
+    return false;
+  }
+
+  // The position callbacks are called in file order, which is x, y, z for
+  // every file we'd be comparing against.
+  RPlyContext ctx;
+  ctx.mesh = &mesh;
+  long numVerts = ply_set_read_cb(ply, "vertex", "x", rply_vertex_cb, &ctx, 0);
+  ply_set_read_cb(ply, "vertex", "y", rply_vertex_cb, &ctx, 1);
+  ply_set_read_cb(ply, "vertex", "z", rply_vertex_cb, &ctx, 2);
+  mesh.pos.reserve(size_t(numVerts) * 3);
+  if (file.hasFaces) {
+    long numFaces = ply_set_read_cb(ply, "face", file.indicesName.c_str(), rply_face_cb, &ctx, 0);
+    mesh.indices.reserve(size_t(numFaces) * 3);
+  }
+
+  const bool ok = ply_read(ply) != 0;
+  ply_close(ply);
+  if (!ok) {
+    error = "read failed";
+  }
+  return ok;
+}
+#endif
+
+
+//
+// Benchmark
+//
+
+static const Reader kReaders[] = {
+  { "miniply", load_with_miniply },
+#ifdef MINIPLY_COMPARE_TINYPLY
+  { "tinyply", load_with_tinyply },
+#endif
+#ifdef MINIPLY_COMPARE_HAPPLY
+  { "happly",  load_with_happly },
+#endif
+#ifdef MINIPLY_COMPARE_RPLY
+  { "rply",    load_with_rply },
+#endif
+};
+static const size_t kNumReaders = sizeof(kReaders) / sizeof(kReaders[0]);
+
+
+// Loads the file `repeats` times, keeping the fastest time, and checks the
+// output of the last load against the reference.
+static Result run_reader(const Reader& reader, const CorpusFile& file, uint32_t repeats)
+{
+  Result result;
+  Mesh mesh;
+  for (uint32_t i = 0; i < repeats; i++) {
+    mesh.clear();
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    bool ok = reader.load(file, mesh, result.error);
+    std::chrono::duration<double, std::chrono::milliseconds::period> ms = std::chrono::high_resolution_clock::now() - start;
+    if (!ok) {
+      result.status = (result.error == "polygons") ? Status::Unsupported : Status::Failed;
+      return result;
+    }
+    if (i == 0 || ms.count() < result.bestMS) {
+      result.bestMS = ms.count();
+    }
+  }
+
+  const bool same = same_positions(mesh.pos, file.reference.pos) && mesh.indices == file.reference.indices;
+  result.status = same ? Status::OK : Status::Mismatch;
+  return result;
+}
+
+
+static void print_cell(const Result& result)
+{
+  switch (result.status) {
+  case Status::OK:          printf("  %10.2f", result.bestMS); break;
+  case Status::Failed:      printf("  %10s", "failed"); break;
+  case Status::Unsupported: printf("  %10s", "n/a"); break;
+  case Status::Mismatch:    printf("  %10s", "MISMATCH"); break;
+  }
+}
+
+
+int main(int argc, char** argv)
+{
+  const int kFilenameBufferLen = 16 * 1024 - 1;
+  char* filenameBuffer = new char[kFilenameBufferLen + 1];
+  filenameBuffer[kFilenameBufferLen] = '\0';
+
+  uint32_t repeats = 3;   // Load each file this many times with each reader and keep the fastest.
+  std::vector<std::string> filenames;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeats = std::max(1u, uint32_t(strtoul(argv[++i], nullptr, 10)));
+      continue;
+    }
+    else if (argv[i][0] == '-') {
+      continue;
+    }
+    if (has_extension(argv[i], "txt")) {
+      FILE* f = fopen(argv[i], "r");
+      if (f != nullptr) {
+        while (fgets(filenameBuffer, kFilenameBufferLen, f)) {
+          filenames.push_back(filenameBuffer);
+          while (filenames.back().back() == '\n') {
+            filenames.back().pop_back();
+          }
+        }
+        fclose(f);
+      }
+      else {
+        fprintf(stderr, "Failed to open %s\n", argv[i]);
+      }
+    }
+    else {
+      filenames.push_back(argv[i]);
+    }
+  }
+  delete[] filenameBuffer;
+
+  if (filenames.empty()) {
+    fprintf(stderr, "No input files provided.\n");
+    return EXIT_SUCCESS;
+  }
+
+  int width = 4;
+  for (const std::string& filename : filenames) {
+    width = std::max(width, int(filename.size()));
+  }
+
+  // Times are in ms, the best of `repeats` loads.
+  printf("%-*s  %10s", width, "file", "MB");
+  for (const Reader& reader : kReaders) {
+    printf("  %10s", reader.name);
+  }
+  printf("\n");
+
+  // Totals per reader, only counting the files which every reader loaded
+  // correctly so that the throughputs are comparable.
+  std::vector<double> totalMS(kNumReaders, 0.0);
+  uint64_t totalBytes = 0;
+  int numFailed = 0;
+  for (const std::string& filename : filenames) {
+    CorpusFile file;
+    if (!prepare_corpus_file(filename.c_str(), file)) {
+      printf("%-*s  miniply failed to load this file, skipping it\n", width, filename.c_str());
+      ++numFailed;
+      continue;
+    }
+
+    printf("%-*s  %10.2f", width, filename.c_str(), double(file.fileSize) / (1024.0 * 1024.0));
+    std::vector<Result> results(kNumReaders);
+    bool allOK = true;
+    for (size_t r = 0; r < kNumReaders; r++) {
+      results[r] = run_reader(kReaders[r], file, repeats);
+      print_cell(results[r]);
+      fflush(stdout);
+      allOK = allOK && results[r].status == Status::OK;
+      if (results[r].status == Status::Mismatch || (r == 0 && results[r].status != Status::OK)) {
+        ++numFailed;
+      }
+    }
+    printf("\n");
+
+    if (allOK) {
+      for (size_t r = 0; r < kNumReaders; r++) {
+        totalMS[r] += results[r].bestMS;
+      }
+      totalBytes += file.fileSize;
+    }
+  }
+
+  printf("----\n");
+  printf("%-*s  %10.2f", width, "total", double(totalBytes) / (1024.0 * 1024.0));
+  for (size_t r = 0; r < kNumReaders; r++) {
+    printf("  %10.2f", totalMS[r]);
+  }
+  printf("\n");
+  printf("%-*s  %10s", width, "MB/s", "");
+  for (size_t r = 0; r < kNumReaders; r++) {
+    printf("  %10.1f", (totalMS[r] > 0.0) ? double(totalBytes) / (1024.0 * 1024.0) / (totalMS[r] / 1000.0) : 0.0);
+  }
+  printf("\n");
+  printf("%-*s  %10s", width, "vs miniply", "");
+  for (size_t r = 0; r < kNumReaders; r++) {
+    printf("  %9.2fx", (totalMS[0] > 0.0) ? totalMS[r] / totalMS[0] : 0.0);
+  }
+  printf("\n");
+
+  return (numFailed > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
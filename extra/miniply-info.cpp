@@ -1,6 +1,8 @@
 // Copyright 2019 Vilya Harvey
 #include "miniply.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <string>
@@ -20,6 +22,18 @@ static const char* kPropertyTypes[] = {
   "uint",
   "float",
   "double",
+  "half",
+};
+
+
+// Rows per batch when gathering statistics for fixed-size elements.
+static const uint32_t kStatsBatchRows = 1024 * 1024;
+
+
+struct ExplainOptions {
+  bool enabled = false;
+  std::vector<std::string> props;   // Extra property names to explain, from --explain-props.
+  miniply::PLYPropertyType destType = miniply::PLYPropertyType::Float;
 };
 
 
@@ -34,13 +48,123 @@ static bool has_extension(const char* filename, const char* ext)
 }
 
 
-bool print_ply_header(const char* filename)
+static bool parse_property_type(const char* name, miniply::PLYPropertyType* type)
+{
+  for (uint32_t i = 0; i < sizeof(kPropertyTypes) / sizeof(kPropertyTypes[0]); i++) {
+    if (strcmp(name, kPropertyTypes[i]) == 0) {
+      *type = miniply::PLYPropertyType(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+static void print_explanation(const miniply::PLYReader& reader, const char* label, const uint32_t propIdxs[], uint32_t numProps, miniply::PLYPropertyType destType)
+{
+  const miniply::PLYElement* elem = reader.element();
+  miniply::PLYExtractExplanation ex;
+  reader.explain_extraction(propIdxs, numProps, destType, 0, &ex);
+
+  printf("Element '%s', %s [", elem->name.c_str(), label);
+  for (uint32_t i = 0; i < numProps; i++) {
+    printf(i > 0 ? " %s" : "%s", elem->properties[propIdxs[i]].name.c_str());
+  }
+  printf("] as %s: %s path, %llu ops, %llu bytes\n", kPropertyTypes[uint32_t(destType)],
+         miniply::extract_path_name(ex.path), (unsigned long long)ex.numOperations, (unsigned long long)ex.numBytes);
+  printf("  why: %s\n", ex.reason.c_str());
+  if (!ex.suggestion.empty()) {
+    printf("  try: %s\n", ex.suggestion.c_str());
+  }
+}
+
+
+// Explains how the standard attributes, all of the element's fixed-size
+// properties and any properties given with --explain-props would be
+// extracted from the current element.
+static void explain_element(const miniply::PLYReader& reader, const ExplainOptions& options)
+{
+  const miniply::PLYElement* elem = reader.element();
+  uint32_t propIdxs[3];
+  if (reader.find_pos(propIdxs)) {
+    print_explanation(reader, "position", propIdxs, 3, miniply::PLYPropertyType::Float);
+  }
+  if (reader.find_normal(propIdxs)) {
+    print_explanation(reader, "normal", propIdxs, 3, miniply::PLYPropertyType::Float);
+  }
+  if (reader.find_texcoord(propIdxs)) {
+    print_explanation(reader, "texcoord", propIdxs, 2, miniply::PLYPropertyType::Float);
+  }
+  if (reader.find_color(propIdxs)) {
+    print_explanation(reader, "color", propIdxs, 3, elem->properties[propIdxs[0]].type);
+  }
+
+  std::vector<uint32_t> fixedIdxs;
+  bool sameType = true;
+  for (uint32_t i = 0; i < uint32_t(elem->properties.size()); i++) {
+    if (elem->properties[i].countType == miniply::PLYPropertyType::None) {
+      sameType = sameType && (fixedIdxs.empty() || elem->properties[i].type == elem->properties[fixedIdxs[0]].type);
+      fixedIdxs.push_back(i);
+    }
+  }
+  if (!fixedIdxs.empty()) {
+    miniply::PLYPropertyType allType = sameType ? elem->properties[fixedIdxs[0]].type : miniply::PLYPropertyType::Float;
+    print_explanation(reader, "all fixed-size", fixedIdxs.data(), uint32_t(fixedIdxs.size()), allType);
+  }
+
+  if (!options.props.empty()) {
+    std::vector<uint32_t> idxs;
+    for (const std::string& name : options.props) {
+      uint32_t idx = reader.find_property(name.c_str());
+      if (idx == miniply::kInvalidIndex) {
+        return;
+      }
+      idxs.push_back(idx);
+    }
+    print_explanation(reader, "requested", idxs.data(), uint32_t(idxs.size()), options.destType);
+  }
+}
+
+
+static void print_property_stats(const miniply::PLYElement* elem, const std::vector<miniply::PLYPropertyStats>& stats)
+{
+  static const char kLevels[] = " .:-=+*#%@";
+  for (const miniply::PLYPropertyStats& propStats : stats) {
+    printf("Element '%s', property '%s': min %g, max %g, mean %g, std dev %g", elem->name.c_str(),
+           elem->properties[propStats.propIdx].name.c_str(), propStats.minValue, propStats.maxValue, propStats.mean,
+           std::sqrt(propStats.variance()));
+    if (propStats.nonFinite > 0) {
+      printf(", %llu non-finite", (unsigned long long)propStats.nonFinite);
+    }
+    printf("\n");
+    if (propStats.count == 0) {
+      continue;
+    }
+
+    // Draw the histogram as a row of characters, one per bin, getting
+    // denser as the bin gets fuller.
+    uint64_t fullest = *std::max_element(propStats.histogram.begin(), propStats.histogram.end());
+    printf("  [");
+    for (uint64_t binCount : propStats.histogram) {
+      putchar(kLevels[(binCount > 0) ? 1 + (binCount * 8) / fullest : 0]);
+    }
+    printf("] %g to %g\n", propStats.histogramMin,
+           propStats.histogramMin + propStats.binWidth * double(propStats.histogram.size()));
+  }
+}
+
+
+bool print_ply_header(const char* filename, const ExplainOptions& explainOptions, bool reportEdges, bool reportComponents,
+                      bool reportHashes, bool reportStats)
 {
   miniply::PLYReader reader(filename);
   if (!reader.valid()) {
     fprintf(stderr, "Failed to open %s\n", filename);
     return false;
   }
+  if (reportHashes) {
+    reader.set_content_hashing(true);
+  }
 
   printf("ply\n");
   printf("format %s %d.%d\n", kFileTypes[int(reader.file_type())], reader.version_major(), reader.version_minor());
@@ -60,6 +184,18 @@ bool print_ply_header(const char* filename)
 
   while (reader.has_element()) {
     const miniply::PLYElement* elem = reader.element();
+    if (explainOptions.enabled) {
+      explain_element(reader, explainOptions);
+    }
+    if (reportStats && elem->fixedSize && elem->count > 0) {
+      // Stream fixed-size elements through in batches, so that memory use
+      // stays bounded however big the file is.
+      std::vector<miniply::PLYPropertyStats> stats;
+      while (reader.load_element_rows(kStatsBatchRows) > 0) {
+        reader.accumulate_property_stats(nullptr, 0, stats);
+      }
+      print_property_stats(elem, stats);
+    }
     if (elem->fixedSize || elem->count == 0) {
       reader.next_element();
       continue;
@@ -89,9 +225,48 @@ bool print_ply_header(const char* filename)
                elem->name.c_str(), prop.name.c_str(), firstRowCount);
       }
     }
+    if (reportStats) {
+      std::vector<miniply::PLYPropertyStats> stats;
+      reader.accumulate_property_stats(nullptr, 0, stats);
+      print_property_stats(elem, stats);
+    }
+    uint32_t indicesIdx;
+    if (reportEdges && reader.find_indices(&indicesIdx)) {
+      const miniply::PLYElement* vertElem = reader.get_element(reader.find_element(miniply::kPLYVertexElement));
+      miniply::PLYHalfEdges halfEdges;
+      if (vertElem != nullptr && reader.build_half_edges(indicesIdx, vertElem->count, halfEdges)) {
+        printf("Element '%s', edges: %zu half-edges, %zu boundary, %zu on non-manifold edges\n", elem->name.c_str(),
+               halfEdges.vertex.size(), halfEdges.boundaryEdges.size(), halfEdges.nonManifoldEdges.size());
+      }
+      else {
+        printf("Element '%s', edges: invalid vertex indices\n", elem->name.c_str());
+      }
+    }
+    if (reportComponents && reader.find_indices(&indicesIdx)) {
+      const miniply::PLYElement* vertElem = reader.get_element(reader.find_element(miniply::kPLYVertexElement));
+      miniply::PLYComponents components;
+      if (vertElem != nullptr && reader.find_components(indicesIdx, vertElem->count, components)) {
+        uint32_t largest = 0;
+        for (uint32_t count : components.componentFaceCounts) {
+          largest = std::max(largest, count);
+        }
+        printf("Element '%s', components: %zu, largest has %u faces\n", elem->name.c_str(),
+               components.componentFaceCounts.size(), largest);
+      }
+      else {
+        printf("Element '%s', components: invalid vertex indices\n", elem->name.c_str());
+      }
+    }
     reader.next_element();
   }
 
+  if (reportHashes) {
+    for (uint32_t i = 0, endI = reader.num_elements(); i < endI; i++) {
+      printf("Element '%s', hash: %016llx\n", reader.get_element(i)->name.c_str(), (unsigned long long)reader.element_hash(i));
+    }
+    printf("File hash: %016llx\n", (unsigned long long)reader.file_hash());
+  }
+
   return true;
 }
 
@@ -102,9 +277,54 @@ int main(int argc, char** argv)
   char* filenameBuffer = new char[kFilenameBufferLen + 1];
   filenameBuffer[kFilenameBufferLen] = '\0';
 
+  ExplainOptions explainOptions;
+  bool reportEdges = false; // Build half-edges for each face element and report boundary & non-manifold edges.
+  bool reportComponents = false; // Find the connected components of each face element.
+  bool reportHashes = false; // Hash the contents of each element and of the whole file.
+  bool reportStats = false; // Summary statistics and a histogram for each scalar property.
   std::vector<std::string> filenames;
   for (int i = 1; i < argc; i++) {
-    if (has_extension(argv[i], "txt")) {
+    if (strcmp(argv[i], "--explain") == 0) {
+      explainOptions.enabled = true;
+    }
+    else if (strcmp(argv[i], "--edges") == 0) {
+      reportEdges = true;
+    }
+    else if (strcmp(argv[i], "--components") == 0) {
+      reportComponents = true;
+    }
+    else if (strcmp(argv[i], "--hash") == 0) {
+      reportHashes = true;
+    }
+    else if (strcmp(argv[i], "--stats") == 0) {
+      reportStats = true;
+    }
+    else if (strcmp(argv[i], "--explain-props") == 0 && i + 1 < argc) {
+      // A comma separated list of property names, optionally followed by a
+      // colon and the destination type, e.g. "nx,ny,nz:half".
+      explainOptions.enabled = true;
+      std::string arg = argv[++i];
+      size_t colon = arg.find(':');
+      if (colon != std::string::npos) {
+        if (!parse_property_type(arg.c_str() + colon + 1, &explainOptions.destType)) {
+          fprintf(stderr, "Unknown property type '%s'\n", arg.c_str() + colon + 1);
+          return EXIT_FAILURE;
+        }
+        arg.resize(colon);
+      }
+      size_t start = 0;
+      while (start <= arg.size()) {
+        size_t comma = arg.find(',', start);
+        if (comma == std::string::npos) {
+          comma = arg.size();
+        }
+        if (comma > start) {
+          explainOptions.props.push_back(arg.substr(start, comma - start));
+        }
+        start = comma + 1;
+      }
+    }
+    else if (has_extension(argv[i], "txt")) {
       FILE* f = fopen(argv[i], "r");
       if (f != nullptr) {
         while (fgets(filenameBuffer, kFilenameBufferLen, f)) {
@@ -129,13 +349,13 @@ int main(int argc, char** argv)
     return EXIT_SUCCESS;
   }
   else if (filenames.size() == 1) {
-    return print_ply_header(filenames[0].c_str()) ? EXIT_SUCCESS : EXIT_FAILURE;
+    return print_ply_header(filenames[0].c_str(), explainOptions, reportEdges, reportComponents, reportHashes, reportStats) ? EXIT_SUCCESS : EXIT_FAILURE;
   }
 
   bool anyFailed = false;
   for (const std::string& filename : filenames) {
     printf("---- %s ----\n", filename.c_str());
-    if (!print_ply_header(filename.c_str())) {
+    if (!print_ply_header(filename.c_str(), explainOptions, reportEdges, reportComponents, reportHashes, reportStats)) {
       anyFailed = true;
     }
     printf("\n");
@@ -0,0 +1,102 @@
+// Copyright 2019 Vilya Harvey
+#include "miniply.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+static bool has_extension(const char* filename, const char* ext)
+{
+  int j = int(strlen(ext));
+  int i = int(strlen(filename)) - j;
+  if (i <= 0 || filename[i - 1] != '.') {
+    return false;
+  }
+  return strcmp(filename + i, ext) == 0;
+}
+
+
+static void print_usage(const char* argv0)
+{
+  fprintf(stderr,
+          "Usage: %s [options] <output.ply> <input.ply|list.txt>...\n"
+          "\n"
+          "Merges PLY files with identical schemas into a single binary PLY file.\n"
+          "Face indices are offset so they refer to the right merged vertices.\n"
+          "\n"
+          "Options:\n"
+          "  --threads N   Number of threads to use (default: all cores).\n",
+          argv0);
+}
+
+
+int main(int argc, char** argv)
+{
+  const int kFilenameBufferLen = 16 * 1024 - 1;
+  char* filenameBuffer = new char[kFilenameBufferLen + 1];
+  filenameBuffer[kFilenameBufferLen] = '\0';
+
+  uint32_t numThreads = 0;
+  const char* outFilename = nullptr;
+  std::vector<std::string> filenames;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      numThreads = uint32_t(atoi(argv[++i]));
+      continue;
+    }
+    else if (argv[i][0] == '-') {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    else if (outFilename == nullptr) {
+      outFilename = argv[i];
+      continue;
+    }
+
+    if (has_extension(argv[i], "txt")) {
+      FILE* f = fopen(argv[i], "r");
+      if (f != nullptr) {
+        while (fgets(filenameBuffer, kFilenameBufferLen, f)) {
+          filenames.push_back(filenameBuffer);
+          while (filenames.back().back() == '\n') {
+            filenames.back().pop_back();
+          }
+        }
+        fclose(f);
+      }
+      else {
+        fprintf(stderr, "Failed to open %s\n", argv[i]);
+      }
+    }
+    else {
+      filenames.push_back(argv[i]);
+    }
+  }
+  delete[] filenameBuffer;
+
+  if (outFilename == nullptr || filenames.empty()) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::vector<const char*> inputs;
+  inputs.reserve(filenames.size());
+  for (const std::string& filename : filenames) {
+    inputs.push_back(filename.c_str());
+  }
+
+  std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+  bool ok = miniply::merge_ply_files(inputs.data(), uint32_t(inputs.size()), outFilename, numThreads);
+  std::chrono::duration<double, std::chrono::milliseconds::period> ms = std::chrono::high_resolution_clock::now() - start;
+
+  if (!ok) {
+    fprintf(stderr, "Failed to merge into %s (inputs unreadable or incompatible?)\n", outFilename);
+    return EXIT_FAILURE;
+  }
+  printf("Merged %u files into %s in %.3lf ms\n", uint32_t(inputs.size()), outFilename, ms.count());
+  return EXIT_SUCCESS;
+}
@@ -1,10 +1,19 @@
 // Copyright 2019 Vilya Harvey
 #include "miniply.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 
 //
 // Timer class
@@ -58,6 +67,31 @@ double Timer::elapsedMS() const
 }
 
 
+//
+// Page fault counts
+//
+
+struct PageFaults {
+  uint64_t minor = 0;
+  uint64_t major = 0;
+};
+
+
+// Page faults for this process so far. Always zero on Windows.
+static PageFaults page_faults()
+{
+  PageFaults faults;
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    faults.minor = uint64_t(usage.ru_minflt);
+    faults.major = uint64_t(usage.ru_majflt);
+  }
+#endif
+  return faults;
+}
+
+
 //
 // Topology enum
 //
@@ -117,12 +151,16 @@ struct TriMesh {
 };
 
 
-static TriMesh* parse_file_with_miniply(const char* filename, bool assumeTriangles)
+static TriMesh* parse_file_with_miniply(const char* filename, bool assumeTriangles, bool hugePages, bool directIO)
 {
   miniply::PLYReader reader(filename);
   if (!reader.valid()) {
     return nullptr;
   }
+  reader.set_huge_pages(hugePages);
+  if (directIO && !reader.set_direct_io(true)) {
+    fprintf(stderr, "Warning: direct I/O isn't supported for %s\n", filename);
+  }
 
   uint32_t faceIdxs[3];
   if (assumeTriangles) {
@@ -219,6 +257,200 @@ static TriMesh* parse_file_with_miniply(const char* filename, bool assumeTriangl
 }
 
 
+//
+// Concurrency stress test
+//
+
+// Sizes of each PLYPropertyType, in bytes.
+static const size_t kPropertySizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 2 };
+
+
+// One extraction for the stress test: a property, the type to extract it
+// as and the result we expect.
+struct StressJob {
+  uint32_t propIdx;
+  miniply::PLYPropertyType type;
+  bool isList;
+  std::vector<uint8_t> expected;
+};
+
+
+static bool run_stress_job(const miniply::PLYReader& reader, const StressJob& job, uint8_t* dest)
+{
+  if (job.isList) {
+    return reader.extract_list_property(job.propIdx, job.type, dest);
+  }
+  return reader.extract_properties(&job.propIdx, 1, job.type, dest);
+}
+
+
+// Loads each element of the file and extracts every property from it once,
+// as a reference. Then `numThreads` threads all extract the same properties
+// from the same reader at the same time, `numIterations` times each, and
+// check that they get the reference results. Configure CMake with
+// `-DMINIPLY_ENABLE_TSAN=ON` to have ThreadSanitizer check for races too.
+static bool stress_test_file(const char* filename, uint32_t numThreads, uint32_t numIterations)
+{
+  miniply::PLYReader reader(filename);
+  if (!reader.valid()) {
+    return false;
+  }
+
+  while (reader.has_element()) {
+    if (!reader.load_element()) {
+      return false;
+    }
+    const miniply::PLYElement* elem = reader.element();
+    const size_t numRows = reader.num_loaded_rows();
+
+    std::vector<StressJob> jobs;
+    for (uint32_t i = 0, endI = uint32_t(elem->properties.size()); i < endI; i++) {
+      const miniply::PLYProperty& prop = elem->properties[i];
+      if (prop.countType == miniply::PLYPropertyType::None) {
+        jobs.push_back(StressJob{ i, prop.type, false, std::vector<uint8_t>(numRows * kPropertySizes[uint32_t(prop.type)]) });
+        jobs.push_back(StressJob{ i, miniply::PLYPropertyType::Float, false, std::vector<uint8_t>(numRows * sizeof(float)) });
+        jobs.push_back(StressJob{ i, miniply::PLYPropertyType::Half, false, std::vector<uint8_t>(numRows * sizeof(uint16_t)) });
+      }
+      else {
+        jobs.push_back(StressJob{ i, miniply::PLYPropertyType::Int, true, std::vector<uint8_t>(reader.sum_of_list_counts(i) * sizeof(int)) });
+      }
+    }
+    for (StressJob& job : jobs) {
+      if (!run_stress_job(reader, job, job.expected.data())) {
+        return false;
+      }
+    }
+
+    // Each thread starts at a different job, so that different extractions
+    // overlap as well as identical ones.
+    std::atomic<uint32_t> numMismatches(0);
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (uint32_t t = 0; t < numThreads; t++) {
+      threads.emplace_back([&reader, &jobs, &numMismatches, t, numIterations]() {
+        std::vector<uint8_t> dest;
+        for (uint32_t iter = 0; iter < numIterations; iter++) {
+          for (size_t j = 0; j < jobs.size(); j++) {
+            const StressJob& job = jobs[(j + t) % jobs.size()];
+            dest.assign(job.expected.size(), 0xCD);
+            if (!run_stress_job(reader, job, dest.data()) ||
+                (!dest.empty() && memcmp(dest.data(), job.expected.data(), dest.size()) != 0)) {
+              ++numMismatches;
+            }
+          }
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+
+    if (numMismatches > 0) {
+      fprintf(stderr, "Element '%s': %u concurrent extractions gave the wrong result\n",
+              elem->name.c_str(), numMismatches.load());
+      return false;
+    }
+    reader.next_element();
+  }
+  return true;
+}
+
+
+//
+// Worker placement benchmark
+//
+
+static const char* kPlacementNames[] = { "serial", "first-touch", "bind-to-nodes" };
+
+
+// Sums the bytes of the loaded rows using one thread per hardware thread,
+// each reading a contiguous block of rows. For `BindToNodes` the threads are
+// pinned to nodes the same way the loader's workers are.
+static uint64_t scan_element_data(const miniply::PLYReader& reader, miniply::PLYWorkerPlacement placement)
+{
+  const uint8_t* data = reader.get_element_data();
+  const size_t numRows = reader.num_loaded_rows();
+  const size_t rowStride = reader.element()->rowStride;
+  const uint32_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+  const uint32_t numNodes = miniply::num_numa_nodes();
+  const size_t chunkSize = (numRows + numThreads - 1) / numThreads;
+
+  std::vector<uint64_t> sums(numThreads, 0);
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads);
+  for (uint32_t t = 0; t < numThreads; t++) {
+    threads.emplace_back([=, &sums]() {
+      if (placement == miniply::PLYWorkerPlacement::BindToNodes && numNodes > 1) {
+        miniply::bind_thread_to_numa_node(uint32_t(uint64_t(t) * numNodes / numThreads));
+      }
+      const size_t start = std::min(numRows, t * chunkSize);
+      const size_t end = std::min(numRows, start + chunkSize);
+      uint64_t sum = 0;
+      for (const uint8_t* p = data + start * rowStride, *pEnd = data + end * rowStride; p < pEnd; p++) {
+        sum += *p;
+      }
+      sums[t] = sum;
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  uint64_t total = 0;
+  for (uint64_t sum : sums) {
+    total += sum;
+  }
+  return total;
+}
+
+
+// Loads every fixed-size element of the file with each worker placement in
+// turn and times both the load and a parallel scan over the loaded rows, to
+// show how placement affects the threads consuming the data afterwards. The
+// scan results must match across placements.
+static bool placement_benchmark_file(const char* filename)
+{
+  uint64_t expected = 0;
+  for (uint32_t p = 0; p < 3; p++) {
+    const miniply::PLYWorkerPlacement placement = miniply::PLYWorkerPlacement(p);
+    miniply::PLYReader reader(filename);
+    if (!reader.valid()) {
+      return false;
+    }
+    reader.set_worker_placement(placement);
+
+    double loadMS = 0.0, scanMS = 0.0;
+    uint64_t checksum = 0;
+    for (; reader.has_element(); reader.next_element()) {
+      if (!reader.element()->fixedSize) {
+        continue;
+      }
+      Timer loadTimer(true);
+      if (!reader.load_element()) {
+        return false;
+      }
+      loadTimer.stop();
+      loadMS += loadTimer.elapsedMS();
+
+      Timer scanTimer(true);
+      checksum += scan_element_data(reader, placement);
+      scanTimer.stop();
+      scanMS += scanTimer.elapsedMS();
+    }
+
+    printf("  %-14s load %9.3lf ms  scan %9.3lf ms\n", kPlacementNames[p], loadMS, scanMS);
+    if (p == 0) {
+      expected = checksum;
+    }
+    else if (checksum != expected) {
+      fprintf(stderr, "Loading with %s placement gave different data\n", kPlacementNames[p]);
+      return false;
+    }
+  }
+  return true;
+}
+
+
 static bool has_extension(const char* filename, const char* ext)
 {
   int j = int(strlen(ext));
@@ -237,16 +469,63 @@ int main(int argc, char** argv)
   filenameBuffer[kFilenameBufferLen] = '\0';
 
   bool assumeTriangles = false;
+  uint32_t stressThreads = 0;    // Run the concurrency stress test with this many threads instead of the benchmark.
+  uint32_t stressIterations = 4;
+  bool placementBenchmark = false;  // Compare worker placements (see PLYWorkerPlacement) instead of the benchmark.
+  bool hugePages = false;           // Load with PLYReader::set_huge_pages(true).
+  bool reportFaults = false;        // Print the page faults taken while loading each file.
+  bool directIO = false;            // Load with PLYReader::set_direct_io(true).
+  uint32_t prefetchFiles = 0;       // Number of files to read ahead with a PLYPrefetcher; 0 turns it off.
+  uint64_t prefetchBudgetMB = 256;  // Maximum MB to read ahead of the current file.
+  bool meshlets = false;            // Also build meshlets from each loaded mesh.
+  float simplifyRatio = 0.0f;       // Also simplify each loaded mesh to this fraction of its triangles; 0 turns it off.
+  std::vector<std::string> filenames;
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "--assume-triangles") == 0) {
       assumeTriangles = true;
-      break;
+      continue;
     }
-  }
-
-  std::vector<std::string> filenames;
-  for (int i = 1; i < argc; i++) {
-    if (argv[i][0] == '-') {
+    else if (strcmp(argv[i], "--stress") == 0 && i + 1 < argc) {
+      stressThreads = uint32_t(strtoul(argv[++i], nullptr, 10));
+      continue;
+    }
+    else if (strcmp(argv[i], "--huge-pages") == 0) {
+      hugePages = true;
+      continue;
+    }
+    else if (strcmp(argv[i], "--prefetch") == 0 && i + 1 < argc) {
+      prefetchFiles = uint32_t(strtoul(argv[++i], nullptr, 10));
+      continue;
+    }
+    else if (strcmp(argv[i], "--prefetch-budget") == 0 && i + 1 < argc) {
+      prefetchBudgetMB = strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+    else if (strcmp(argv[i], "--meshlets") == 0) {
+      meshlets = true;
+      continue;
+    }
+    else if (strcmp(argv[i], "--simplify") == 0 && i + 1 < argc) {
+      simplifyRatio = float(strtod(argv[++i], nullptr));
+      continue;
+    }
+    else if (strcmp(argv[i], "--direct-io") == 0) {
+      directIO = true;
+      continue;
+    }
+    else if (strcmp(argv[i], "--faults") == 0) {
+      reportFaults = true;
+      continue;
+    }
+    else if (strcmp(argv[i], "--placement") == 0) {
+      placementBenchmark = true;
+      continue;
+    }
+    else if (strcmp(argv[i], "--stress-iterations") == 0 && i + 1 < argc) {
+      stressIterations = uint32_t(strtoul(argv[++i], nullptr, 10));
+      continue;
+    }
+    else if (argv[i][0] == '-') {
       continue;
     }
     if (has_extension(argv[i], "txt")) {
@@ -285,15 +564,65 @@ int main(int argc, char** argv)
   Timer overallTimer(true); // true ==> autostart the timer.
   int numPassed = 0;
   int numFailed = 0;
-  for (const std::string& filename : filenames) {
+  miniply::PLYPrefetcher prefetcher(filenames, prefetchFiles, prefetchBudgetMB * 1024 * 1024);
+  for (size_t fileIdx = 0; fileIdx < filenames.size(); fileIdx++) {
+    const std::string& filename = filenames[fileIdx];
+    prefetcher.set_current(fileIdx);
     Timer timer(true); // true ==> autostart the timer.
 
-    TriMesh* trimesh = parse_file_with_miniply(filename.c_str(), assumeTriangles);
-    bool ok = trimesh != nullptr;
+    bool ok;
+    if (placementBenchmark) {
+      printf("%s (%u NUMA nodes)\n", filename.c_str(), miniply::num_numa_nodes());
+      ok = placement_benchmark_file(filename.c_str());
+      timer.stop();
+    }
+    else if (stressThreads > 0) {
+      ok = stress_test_file(filename.c_str(), stressThreads, stressIterations);
+      timer.stop();
+    }
+    else {
+      const PageFaults faultsBefore = page_faults();
+      TriMesh* trimesh = parse_file_with_miniply(filename.c_str(), assumeTriangles, hugePages, directIO);
+      ok = trimesh != nullptr;
+
+      miniply::PLYMeshlets meshletData;
+      if (ok && meshlets && trimesh->topology == Topology::Soup) {
+        ok = miniply::build_meshlets(trimesh->pos, trimesh->numVerts, reinterpret_cast<const uint32_t*>(trimesh->indices),
+                                     trimesh->numIndices / 3, meshletData);
+      }
 
-    timer.stop();
-    
-    delete trimesh;
+      std::vector<uint32_t> simplified;
+      float simplifyError = 0.0f;
+      if (ok && simplifyRatio > 0.0f && trimesh->topology == Topology::Soup) {
+        miniply::PLYSimplifyOptions options;
+        options.targetTriangles = uint32_t(double(trimesh->numIndices / 3) * double(simplifyRatio));
+        options.targetError = 1.0f;
+        options.normals = trimesh->normal;
+        options.uvs = trimesh->uv;
+        ok = miniply::simplify_mesh(trimesh->pos, trimesh->numVerts, reinterpret_cast<const uint32_t*>(trimesh->indices),
+                                    trimesh->numIndices / 3, options, simplified, &simplifyError);
+      }
+
+      timer.stop();
+      const PageFaults faultsAfter = page_faults();
+
+      const uint32_t numTris = (trimesh != nullptr) ? trimesh->numIndices / 3 : 0;
+      delete trimesh;
+
+      if (simplifyRatio > 0.0f && ok) {
+        printf("%-*s  simplified %u -> %zu triangles, error %.5f\n", width, filename.c_str(), numTris,
+               simplified.size() / 3, double(simplifyError));
+      }
+      if (meshlets && ok) {
+        printf("%-*s  %zu meshlets, %.2f vertices per triangle\n", width, filename.c_str(), meshletData.meshlets.size(),
+               meshletData.triangles.empty() ? 0.0 : double(meshletData.vertices.size()) * 3.0 / double(meshletData.triangles.size()));
+      }
+      if (reportFaults) {
+        printf("%-*s  %llu minor, %llu major page faults\n", width, filename.c_str(),
+               (unsigned long long)(faultsAfter.minor - faultsBefore.minor),
+               (unsigned long long)(faultsAfter.major - faultsBefore.major));
+      }
+    }
 
     printf("%-*s  %s  %8.3lf ms\n", width, filename.c_str(), ok ? "passed" : "FAILED", timer.elapsedMS());
     if (!ok) {
@@ -0,0 +1,900 @@
+// Copyright 2019 Vilya Harvey
+//
+// Python bindings for miniply, using only the CPython C API. Data is
+// exchanged through the buffer protocol, so NumPy arrays (or anything else
+// that supports it) can be used as destinations without copying, and the
+// loaded rows of an element can be viewed as a structured NumPy array with
+// `numpy.asarray(reader.take_element_data())`.
+//
+// The GIL is released while files are opened, loaded and extracted from, so
+// several Python threads can load different files in parallel. A single
+// Reader must only be used by one thread at a time; this is checked.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "miniply.h"
+
+#include <cstring>
+#include <exception>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+static const char* kFileTypes[] = {
+  "ascii",
+  "binary_little_endian",
+  "binary_big_endian",
+};
+static const char* kPropertyTypes[] = {
+  "char",
+  "uchar",
+  "short",
+  "ushort",
+  "int",
+  "uint",
+  "float",
+  "double",
+  "half",
+};
+
+// Buffer protocol format characters for each PLYPropertyType.
+static const char kPropertyFormats[] = { 'b', 'B', 'h', 'H', 'i', 'I', 'f', 'd', 'e' };
+static const Py_ssize_t kPropertySizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 2 };
+
+
+static bool property_type_from_buffer(const Py_buffer& view, miniply::PLYPropertyType* type)
+{
+  const char* fmt = (view.format != nullptr) ? view.format : "B";
+  if (*fmt == '@' || *fmt == '=' || *fmt == '<') {
+    fmt++;
+  }
+  if (fmt[0] == '\0' || fmt[1] != '\0') {
+    return false;
+  }
+  char ch = fmt[0];
+  // 'l' and 'L' are 32 bits on some platforms.
+  if (ch == 'l' && view.itemsize == 4) {
+    ch = 'i';
+  }
+  else if (ch == 'L' && view.itemsize == 4) {
+    ch = 'I';
+  }
+  for (uint32_t i = 0; i < sizeof(kPropertyFormats); i++) {
+    if (kPropertyFormats[i] == ch && kPropertySizes[i] == view.itemsize) {
+      *type = miniply::PLYPropertyType(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// Acquires a writable, C-contiguous buffer from `obj` with room for at least
+// `numValues` values, and works out the matching property type. Sets a Python
+// exception and returns false on failure; otherwise the caller must release
+// the buffer.
+static bool get_dest_buffer(PyObject* obj, size_t numValues, Py_buffer* view, miniply::PLYPropertyType* type)
+{
+  if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | PyBUF_WRITABLE) != 0) {
+    return false;
+  }
+  if (!property_type_from_buffer(*view, type)) {
+    PyErr_Format(PyExc_TypeError, "unsupported destination format '%s'", view->format ? view->format : "B");
+    PyBuffer_Release(view);
+    return false;
+  }
+  if (size_t(view->len / view->itemsize) < numValues) {
+    PyErr_Format(PyExc_ValueError, "destination is too small: need %zu values, have %zd",
+                 numValues, view->len / view->itemsize);
+    PyBuffer_Release(view);
+    return false;
+  }
+  return true;
+}
+
+
+// C++ exceptions must never unwind through the interpreter. Call this from a
+// catch block to turn the exception being handled into a Python one; it
+// always returns nullptr so it can be used as a method's result.
+static PyObject* set_error_from_exception()
+{
+  try {
+    throw;
+  }
+  catch (const std::bad_alloc&) {
+    return PyErr_NoMemory();
+  }
+  catch (const std::exception& e) {
+    PyErr_SetString(PyExc_RuntimeError, e.what());
+  }
+  catch (...) {
+    PyErr_SetString(PyExc_RuntimeError, "unknown C++ exception");
+  }
+  return nullptr;
+}
+
+
+// Runs `func` with the GIL released. An exception can't be allowed to escape
+// before the GIL is re-acquired, so it's caught, turned into a Python
+// exception afterwards and false is returned; the caller should clean up and
+// return nullptr.
+template <class Func>
+static bool run_without_gil(Func func)
+{
+  std::exception_ptr error;
+  Py_BEGIN_ALLOW_THREADS
+  try {
+    func();
+  }
+  catch (...) {
+    error = std::current_exception();
+  }
+  Py_END_ALLOW_THREADS
+  if (error) {
+    try {
+      std::rethrow_exception(error);
+    }
+    catch (...) {
+      set_error_from_exception();
+    }
+    return false;
+  }
+  return true;
+}
+
+
+//
+// ElementData type
+//
+
+// Owns row data moved out of a PLYReader and exposes it through the buffer
+// protocol as a 1D array of structs, one per row.
+struct ElementDataObject {
+  PyObject_HEAD
+  miniply::PLYDataBuffer* data;
+  std::string* format;
+  Py_ssize_t rowStride;
+  Py_ssize_t numRows;
+  Py_ssize_t shape[1];
+  Py_ssize_t strides[1];
+};
+
+
+static void ElementData_dealloc(ElementDataObject* self)
+{
+  PyTypeObject* type = Py_TYPE(self);
+  delete self->data;
+  delete self->format;
+  type->tp_free(reinterpret_cast<PyObject*>(self));
+  Py_DECREF(type);
+}
+
+
+static int ElementData_getbuffer(ElementDataObject* self, Py_buffer* view, int flags)
+{
+  static uint8_t empty = 0;
+  uint8_t* buf = self->data->empty() ? &empty : self->data->data();
+  if (PyBuffer_FillInfo(view, reinterpret_cast<PyObject*>(self), buf, self->numRows * self->rowStride, 0, flags) != 0) {
+    return -1;
+  }
+  // Consumers which ask for a format get one item per row; everyone else sees
+  // plain bytes.
+  if ((flags & PyBUF_FORMAT) == PyBUF_FORMAT && self->rowStride > 0) {
+    view->format = const_cast<char*>(self->format->c_str());
+    view->itemsize = self->rowStride;
+    self->shape[0] = self->numRows;
+    self->strides[0] = self->rowStride;
+    view->shape = ((flags & PyBUF_ND) == PyBUF_ND) ? self->shape : nullptr;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : nullptr;
+  }
+  return 0;
+}
+
+
+static PyObject* ElementData_len_getter(ElementDataObject* self, void*)
+{
+  return PyLong_FromSsize_t(self->numRows);
+}
+
+
+static PyObject* ElementData_format_getter(ElementDataObject* self, void*)
+{
+  return PyUnicode_FromString(self->format->c_str());
+}
+
+
+static PyGetSetDef ElementData_getset[] = {
+  { "num_rows", reinterpret_cast<getter>(ElementData_len_getter), nullptr, "Number of rows.", nullptr },
+  { "format", reinterpret_cast<getter>(ElementData_format_getter), nullptr, "Buffer protocol format string for a row.", nullptr },
+  { nullptr, nullptr, nullptr, nullptr, nullptr },
+};
+
+static PyType_Slot ElementData_slots[] = {
+  { Py_tp_doc, const_cast<char*>("Row data moved out of a Reader. Supports the buffer protocol.") },
+  { Py_tp_dealloc, reinterpret_cast<void*>(ElementData_dealloc) },
+  { Py_tp_getset, ElementData_getset },
+  { Py_bf_getbuffer, reinterpret_cast<void*>(ElementData_getbuffer) },
+  { 0, nullptr },
+};
+
+static PyType_Spec ElementData_spec = {
+  "miniply.ElementData",
+  int(sizeof(ElementDataObject)),
+  0,
+  Py_TPFLAGS_DEFAULT,
+  ElementData_slots,
+};
+
+// Created by PyInit_miniply.
+static PyTypeObject* ElementDataType = nullptr;
+
+
+//
+// Reader type
+//
+
+struct ReaderObject {
+  PyObject_HEAD
+  miniply::PLYReader* reader;
+  bool busy;
+};
+
+
+// Marks a reader as busy for the lifetime of the guard, so that another
+// Python thread can't use it while we've released the GIL.
+class BusyGuard {
+public:
+  explicit BusyGuard(ReaderObject* self) : m_self(self), m_ok(false) {
+    if (self->reader == nullptr) {
+      PyErr_SetString(PyExc_ValueError, "reader is not open");
+    }
+    else if (self->busy) {
+      PyErr_SetString(PyExc_RuntimeError, "reader is being used by another thread");
+    }
+    else {
+      self->busy = true;
+      m_ok = true;
+    }
+  }
+  ~BusyGuard() {
+    if (m_ok) {
+      m_self->busy = false;
+    }
+  }
+  bool ok() const { return m_ok; }
+
+private:
+  ReaderObject* m_self;
+  bool m_ok;
+};
+
+
+// Most methods need a current element, so optionally check for that up
+// front too.
+#define READER_GUARD(self, needElement) \
+  BusyGuard guard(self); \
+  if (!guard.ok()) { \
+    return nullptr; \
+  } \
+  if ((needElement) && !(self)->reader->has_element()) { \
+    PyErr_SetString(PyExc_ValueError, "no current element"); \
+    return nullptr; \
+  }
+
+
+// Wraps a Reader method for the method table, translating any C++ exception
+// (e.g. std::bad_alloc while loading a large element) into a Python one.
+template <PyObject* (*Method)(ReaderObject*, PyObject*)>
+static PyObject* guarded(ReaderObject* self, PyObject* args)
+{
+  try {
+    return Method(self, args);
+  }
+  catch (...) {
+    return set_error_from_exception();
+  }
+}
+
+
+static PyObject* index_tuple(const uint32_t idxs[], uint32_t n)
+{
+  PyObject* tuple = PyTuple_New(n);
+  if (tuple == nullptr) {
+    return nullptr;
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    PyTuple_SET_ITEM(tuple, i, PyLong_FromUnsignedLong(idxs[i]));
+  }
+  return tuple;
+}
+
+
+static bool index_vector(PyObject* seq, std::vector<uint32_t>& idxs)
+{
+  PyObject* fast = PySequence_Fast(seq, "property indexes must be a sequence");
+  if (fast == nullptr) {
+    return false;
+  }
+  Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+  idxs.resize(size_t(n));
+  for (Py_ssize_t i = 0; i < n; i++) {
+    unsigned long idx = PyLong_AsUnsignedLong(PySequence_Fast_GET_ITEM(fast, i));
+    if (PyErr_Occurred()) {
+      Py_DECREF(fast);
+      return false;
+    }
+    idxs[size_t(i)] = uint32_t(idx);
+  }
+  Py_DECREF(fast);
+  return true;
+}
+
+
+static void Reader_dealloc(ReaderObject* self)
+{
+  PyTypeObject* type = Py_TYPE(self);
+  delete self->reader;
+  type->tp_free(reinterpret_cast<PyObject*>(self));
+  Py_DECREF(type);
+}
+
+
+static int Reader_init(ReaderObject* self, PyObject* args, PyObject*)
+{
+  PyObject* pathObj = nullptr;
+  if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &pathObj)) {
+    return -1;
+  }
+  if (self->busy) {
+    Py_DECREF(pathObj);
+    PyErr_SetString(PyExc_RuntimeError, "reader is being used by another thread");
+    return -1;
+  }
+  // pathObj is immutable and we hold a reference, so its contents can be read
+  // without the GIL.
+  const char* path = PyBytes_AS_STRING(pathObj);
+
+  miniply::PLYReader* reader = nullptr;
+  if (!run_without_gil([&]() { reader = new miniply::PLYReader(path); })) {
+    Py_DECREF(pathObj);
+    return -1;
+  }
+  if (!reader->valid()) {
+    delete reader;
+    PyErr_Format(PyExc_OSError, "failed to open or parse PLY file '%s'", path);
+    Py_DECREF(pathObj);
+    return -1;
+  }
+  Py_DECREF(pathObj);
+  delete self->reader;
+  self->reader = reader;
+  return 0;
+}
+
+
+static PyObject* Reader_file_type(ReaderObject* self, PyObject*)
+{
+  READER_GUARD(self, false);
+  return PyUnicode_FromString(kFileTypes[int(self->reader->file_type())]);
+}
+
+
+static PyObject* Reader_elements(ReaderObject* self, PyObject*)
+{
+  READER_GUARD(self, false);
+  PyObject* result = PyList_New(0);
+  for (uint32_t i = 0, n = self->reader->num_elements(); result != nullptr && i < n; i++) {
+    const miniply::PLYElement* elem = self->reader->get_element(i);
+    PyObject* props = PyList_New(0);
+    for (const miniply::PLYProperty& prop : elem->properties) {
+      PyObject* item;
+      if (prop.countType != miniply::PLYPropertyType::None) {
+        item = Py_BuildValue("(sss)", prop.name.c_str(), kPropertyTypes[uint32_t(prop.type)], kPropertyTypes[uint32_t(prop.countType)]);
+      }
+      else {
+        item = Py_BuildValue("(ssO)", prop.name.c_str(), kPropertyTypes[uint32_t(prop.type)], Py_None);
+      }
+      PyList_Append(props, item);
+      Py_DECREF(item);
+    }
+    PyObject* elemTuple = Py_BuildValue("(sIN)", elem->name.c_str(), elem->count, props);
+    PyList_Append(result, elemTuple);
+    Py_DECREF(elemTuple);
+  }
+  return result;
+}
+
+
+static PyObject* Reader_has_element(ReaderObject* self, PyObject*)
+{
+  READER_GUARD(self, false);
+  return PyBool_FromLong(self->reader->has_element());
+}
+
+
+static PyObject* Reader_element_name(ReaderObject* self, PyObject*)
+{
+  READER_GUARD(self, false);
+  if (!self->reader->has_element()) {
+    Py_RETURN_NONE;
+  }
+  return PyUnicode_FromString(self->reader->element()->name.c_str());
+}
+
+
+static PyObject* Reader_element_is(ReaderObject* self, PyObject* args)
+{
+  const char* name;
+  if (!PyArg_ParseTuple(args, "s", &name)) {
+    return nullptr;
+  }
+  READER_GUARD(self, false);
+  return PyBool_FromLong(self->reader->element_is(name));
+}
+
+
+static PyObject* Reader_num_rows(ReaderObject* self, PyObject*)
+{
+  READER_GUARD(self, false);
+  return PyLong_FromUnsignedLong(self->reader->num_rows());
+}
+
+
+static PyObject* Reader_num_loaded_rows(ReaderObject* self, PyObject*)
+{
+  READER_GUARD(self, false);
+  return PyLong_FromUnsignedLong(self->reader->num_loaded_rows());
+}
+
+
+static PyObject* Reader_next_element(ReaderObject* self, PyObject*)
+{
+  READER_GUARD(self, true);
+  if (!run_without_gil([&]() { self->reader->next_element(); })) {
+    return nullptr;
+  }
+  Py_RETURN_NONE;
+}
+
+
+static PyObject* Reader_load_element(ReaderObject* self, PyObject*)
+{
+  READER_GUARD(self, true);
+  bool ok = false;
+  if (!run_without_gil([&]() { ok = self->reader->load_element(); })) {
+    return nullptr;
+  }
+  return PyBool_FromLong(ok);
+}
+
+
+static PyObject* Reader_load_element_rows(ReaderObject* self, PyObject* args)
+{
+  unsigned int maxRows;
+  if (!PyArg_ParseTuple(args, "I", &maxRows)) {
+    return nullptr;
+  }
+  READER_GUARD(self, true);
+  uint32_t numRows = 0;
+  if (!run_without_gil([&]() { numRows = self->reader->load_element_rows(maxRows); })) {
+    return nullptr;
+  }
+  return PyLong_FromUnsignedLong(numRows);
+}
+
+
+static PyObject* Reader_find_property(ReaderObject* self, PyObject* args)
+{
+  const char* name;
+  if (!PyArg_ParseTuple(args, "s", &name)) {
+    return nullptr;
+  }
+  READER_GUARD(self, true);
+  uint32_t idx = self->reader->find_property(name);
+  if (idx == miniply::kInvalidIndex) {
+    Py_RETURN_NONE;
+  }
+  return PyLong_FromUnsignedLong(idx);
+}
+
+
+static PyObject* Reader_find_properties(ReaderObject* self, PyObject* args)
+{
+  READER_GUARD(self, true);
+  const Py_ssize_t n = PyTuple_GET_SIZE(args);
+  std::vector<uint32_t> idxs(static_cast<size_t>(n));
+  for (Py_ssize_t i = 0; i < n; i++) {
+    const char* name = PyUnicode_AsUTF8(PyTuple_GET_ITEM(args, i));
+    if (name == nullptr) {
+      return nullptr;
+    }
+    idxs[size_t(i)] = self->reader->find_property(name);
+    if (idxs[size_t(i)] == miniply::kInvalidIndex) {
+      Py_RETURN_NONE;
+    }
+  }
+  return index_tuple(idxs.data(), uint32_t(n));
+}
+
+
+// The find_pos, find_normal etc. methods all have the same shape.
+#define READER_FIND_METHOD(method, n) \
+  static PyObject* Reader_##method(ReaderObject* self, PyObject*) \
+  { \
+    READER_GUARD(self, true); \
+    uint32_t idxs[n]; \
+    if (!self->reader->method(idxs)) { \
+      Py_RETURN_NONE; \
+    } \
+    return index_tuple(idxs, n); \
+  }
+
+READER_FIND_METHOD(find_pos, 3)
+READER_FIND_METHOD(find_normal, 3)
+READER_FIND_METHOD(find_texcoord, 2)
+READER_FIND_METHOD(find_color, 3)
+READER_FIND_METHOD(find_indices, 1)
+
+
+static PyObject* Reader_convert_list_to_fixed_size(ReaderObject* self, PyObject* args)
+{
+  unsigned int propIdx, listSize;
+  if (!PyArg_ParseTuple(args, "II", &propIdx, &listSize)) {
+    return nullptr;
+  }
+  READER_GUARD(self, true);
+  miniply::PLYElement* elem = self->reader->get_element(self->reader->find_element(self->reader->element()->name.c_str()));
+  if (elem == nullptr || propIdx >= elem->properties.size()) {
+    PyErr_SetString(PyExc_IndexError, "property index out of range");
+    return nullptr;
+  }
+  std::vector<uint32_t> newIdxs(listSize);
+  if (!elem->convert_list_to_fixed_size(propIdx, listSize, newIdxs.data())) {
+    PyErr_SetString(PyExc_ValueError, "not a list property, or the element has already been loaded");
+    return nullptr;
+  }
+  return index_tuple(newIdxs.data(), listSize);
+}
+
+
+// Builds a buffer protocol struct format for the fixed-size part of the
+// current element's rows, e.g. "T{=f:x:=f:y:=f:z:=B:red:}". Row data is
+// always held in native byte order with no padding between properties.
+static std::string element_format(const miniply::PLYElement* elem)
+{
+  std::string fmt = "T{";
+  for (const miniply::PLYProperty& prop : elem->properties) {
+    if (prop.countType != miniply::PLYPropertyType::None) {
+      continue;
+    }
+    fmt += '=';
+    fmt += kPropertyFormats[uint32_t(prop.type)];
+    fmt += ':';
+    fmt += prop.name;
+    fmt += ':';
+  }
+  fmt += '}';
+  return fmt;
+}
+
+
+static PyObject* Reader_element_format(ReaderObject* self, PyObject*)
+{
+  READER_GUARD(self, true);
+  return PyUnicode_FromString(element_format(self->reader->element()).c_str());
+}
+
+
+static PyObject* Reader_take_element_data(ReaderObject* self, PyObject*)
+{
+  READER_GUARD(self, true);
+  const miniply::PLYElement* elem = self->reader->element();
+
+  ElementDataObject* data = PyObject_New(ElementDataObject, ElementDataType);
+  if (data == nullptr) {
+    return nullptr;
+  }
+  data->numRows = self->reader->num_loaded_rows();
+  data->rowStride = elem->rowStride;
+  data->format = nullptr;
+  data->data = nullptr;
+  try {
+    data->format = new std::string(element_format(elem));
+    data->data = new miniply::PLYDataBuffer(self->reader->take_element_data());
+  }
+  catch (...) {
+    Py_DECREF(data);
+    throw;
+  }
+  return reinterpret_cast<PyObject*>(data);
+}
+
+
+static PyObject* Reader_extract_properties(ReaderObject* self, PyObject* args)
+{
+  PyObject* idxsObj;
+  PyObject* destObj;
+  if (!PyArg_ParseTuple(args, "OO", &idxsObj, &destObj)) {
+    return nullptr;
+  }
+  READER_GUARD(self, true);
+  std::vector<uint32_t> idxs;
+  if (!index_vector(idxsObj, idxs) || idxs.empty()) {
+    if (!PyErr_Occurred()) {
+      PyErr_SetString(PyExc_ValueError, "no property indexes given");
+    }
+    return nullptr;
+  }
+
+  Py_buffer view;
+  miniply::PLYPropertyType destType;
+  if (!get_dest_buffer(destObj, size_t(self->reader->num_loaded_rows()) * idxs.size(), &view, &destType)) {
+    return nullptr;
+  }
+  bool ok = false;
+  const bool completed = run_without_gil([&]() {
+    ok = self->reader->extract_properties(idxs.data(), uint32_t(idxs.size()), destType, view.buf);
+  });
+  PyBuffer_Release(&view);
+  if (!completed) {
+    return nullptr;
+  }
+  return PyBool_FromLong(ok);
+}
+
+
+static PyObject* Reader_sum_of_list_counts(ReaderObject* self, PyObject* args)
+{
+  unsigned int propIdx;
+  if (!PyArg_ParseTuple(args, "I", &propIdx)) {
+    return nullptr;
+  }
+  READER_GUARD(self, true);
+  return PyLong_FromUnsignedLong(self->reader->sum_of_list_counts(propIdx));
+}
+
+
+static PyObject* Reader_get_list_counts(ReaderObject* self, PyObject* args)
+{
+  unsigned int propIdx;
+  PyObject* destObj;
+  if (!PyArg_ParseTuple(args, "IO", &propIdx, &destObj)) {
+    return nullptr;
+  }
+  READER_GUARD(self, true);
+  const uint32_t* counts = self->reader->get_list_counts(propIdx);
+  if (counts == nullptr) {
+    PyErr_SetString(PyExc_ValueError, "not a loaded list property");
+    return nullptr;
+  }
+  const size_t numRows = self->reader->element()->properties[propIdx].rowCount.size();
+  Py_buffer view;
+  miniply::PLYPropertyType destType;
+  if (!get_dest_buffer(destObj, numRows, &view, &destType)) {
+    return nullptr;
+  }
+  if (destType != miniply::PLYPropertyType::UInt && destType != miniply::PLYPropertyType::Int) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_TypeError, "list counts need a 32-bit integer destination");
+    return nullptr;
+  }
+  std::memcpy(view.buf, counts, numRows * sizeof(uint32_t));
+  PyBuffer_Release(&view);
+  Py_RETURN_TRUE;
+}
+
+
+static PyObject* Reader_extract_list_property(ReaderObject* self, PyObject* args)
+{
+  unsigned int propIdx;
+  PyObject* destObj;
+  if (!PyArg_ParseTuple(args, "IO", &propIdx, &destObj)) {
+    return nullptr;
+  }
+  READER_GUARD(self, true);
+  Py_buffer view;
+  miniply::PLYPropertyType destType;
+  if (!get_dest_buffer(destObj, self->reader->sum_of_list_counts(propIdx), &view, &destType)) {
+    return nullptr;
+  }
+  bool ok = false;
+  const bool completed = run_without_gil([&]() {
+    ok = self->reader->extract_list_property(propIdx, destType, view.buf);
+  });
+  PyBuffer_Release(&view);
+  if (!completed) {
+    return nullptr;
+  }
+  return PyBool_FromLong(ok);
+}
+
+
+static PyObject* Reader_num_triangles(ReaderObject* self, PyObject* args)
+{
+  unsigned int propIdx;
+  if (!PyArg_ParseTuple(args, "I", &propIdx)) {
+    return nullptr;
+  }
+  READER_GUARD(self, true);
+  return PyLong_FromUnsignedLong(self->reader->num_triangles(propIdx));
+}
+
+
+static PyObject* Reader_requires_triangulation(ReaderObject* self, PyObject* args)
+{
+  unsigned int propIdx;
+  if (!PyArg_ParseTuple(args, "I", &propIdx)) {
+    return nullptr;
+  }
+  READER_GUARD(self, true);
+  return PyBool_FromLong(self->reader->requires_triangulation(propIdx));
+}
+
+
+static PyObject* Reader_extract_triangles(ReaderObject* self, PyObject* args)
+{
+  unsigned int propIdx;
+  PyObject* posObj;
+  PyObject* destObj;
+  if (!PyArg_ParseTuple(args, "IOO", &propIdx, &posObj, &destObj)) {
+    return nullptr;
+  }
+  READER_GUARD(self, true);
+
+  Py_buffer posView;
+  if (PyObject_GetBuffer(posObj, &posView, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+    return nullptr;
+  }
+  miniply::PLYPropertyType posType;
+  if (!property_type_from_buffer(posView, &posType) || posType != miniply::PLYPropertyType::Float) {
+    PyBuffer_Release(&posView);
+    PyErr_SetString(PyExc_TypeError, "positions must be a float32 buffer");
+    return nullptr;
+  }
+  const uint32_t numVerts = uint32_t(posView.len / (3 * sizeof(float)));
+
+  Py_buffer view;
+  miniply::PLYPropertyType destType;
+  if (!get_dest_buffer(destObj, size_t(self->reader->num_triangles(propIdx)) * 3, &view, &destType)) {
+    PyBuffer_Release(&posView);
+    return nullptr;
+  }
+  bool ok = false;
+  const bool completed = run_without_gil([&]() {
+    ok = self->reader->extract_triangles(propIdx, reinterpret_cast<const float*>(posView.buf), numVerts, destType, view.buf);
+  });
+  PyBuffer_Release(&view);
+  PyBuffer_Release(&posView);
+  if (!completed) {
+    return nullptr;
+  }
+  return PyBool_FromLong(ok);
+}
+
+
+static PyMethodDef Reader_methods[] = {
+  { "file_type", reinterpret_cast<PyCFunction>(guarded<Reader_file_type>), METH_NOARGS,
+    "file_type() -> str\n\nThe file's format: 'ascii', 'binary_little_endian' or 'binary_big_endian'." },
+  { "elements", reinterpret_cast<PyCFunction>(guarded<Reader_elements>), METH_NOARGS,
+    "elements() -> list\n\nThe schema from the header, as a list of (name, count, properties) tuples. Each property is "
+    "a (name, type, list_count_type) tuple, where list_count_type is None for non-list properties." },
+  { "has_element", reinterpret_cast<PyCFunction>(guarded<Reader_has_element>), METH_NOARGS,
+    "has_element() -> bool\n\nWhether there's a current element." },
+  { "element_name", reinterpret_cast<PyCFunction>(guarded<Reader_element_name>), METH_NOARGS,
+    "element_name() -> str or None\n\nName of the current element." },
+  { "element_is", reinterpret_cast<PyCFunction>(guarded<Reader_element_is>), METH_VARARGS,
+    "element_is(name) -> bool\n\nWhether the current element has the given name." },
+  { "num_rows", reinterpret_cast<PyCFunction>(guarded<Reader_num_rows>), METH_NOARGS,
+    "num_rows() -> int\n\nNumber of rows in the current element." },
+  { "num_loaded_rows", reinterpret_cast<PyCFunction>(guarded<Reader_num_loaded_rows>), METH_NOARGS,
+    "num_loaded_rows() -> int\n\nNumber of rows of the current element held in memory." },
+  { "next_element", reinterpret_cast<PyCFunction>(guarded<Reader_next_element>), METH_NOARGS,
+    "next_element()\n\nMove on to the next element. Releases the GIL." },
+  { "load_element", reinterpret_cast<PyCFunction>(guarded<Reader_load_element>), METH_NOARGS,
+    "load_element() -> bool\n\nLoad all rows of the current element. Releases the GIL." },
+  { "load_element_rows", reinterpret_cast<PyCFunction>(guarded<Reader_load_element_rows>), METH_VARARGS,
+    "load_element_rows(max_rows) -> int\n\nLoad the next batch of rows of a fixed-size element. Releases the GIL." },
+  { "find_property", reinterpret_cast<PyCFunction>(guarded<Reader_find_property>), METH_VARARGS,
+    "find_property(name) -> int or None" },
+  { "find_properties", reinterpret_cast<PyCFunction>(guarded<Reader_find_properties>), METH_VARARGS,
+    "find_properties(*names) -> tuple or None\n\nIndexes of all the named properties, or None if any are missing." },
+  { "find_pos", reinterpret_cast<PyCFunction>(guarded<Reader_find_pos>), METH_NOARGS, "find_pos() -> tuple or None" },
+  { "find_normal", reinterpret_cast<PyCFunction>(guarded<Reader_find_normal>), METH_NOARGS, "find_normal() -> tuple or None" },
+  { "find_texcoord", reinterpret_cast<PyCFunction>(guarded<Reader_find_texcoord>), METH_NOARGS, "find_texcoord() -> tuple or None" },
+  { "find_color", reinterpret_cast<PyCFunction>(guarded<Reader_find_color>), METH_NOARGS, "find_color() -> tuple or None" },
+  { "find_indices", reinterpret_cast<PyCFunction>(guarded<Reader_find_indices>), METH_NOARGS, "find_indices() -> tuple or None" },
+  { "convert_list_to_fixed_size", reinterpret_cast<PyCFunction>(guarded<Reader_convert_list_to_fixed_size>), METH_VARARGS,
+    "convert_list_to_fixed_size(prop_idx, list_size) -> tuple\n\nCall before loading when every list has the same size. "
+    "Returns the indexes of the new per-item properties." },
+  { "element_format", reinterpret_cast<PyCFunction>(guarded<Reader_element_format>), METH_NOARGS,
+    "element_format() -> str\n\nBuffer protocol format string for one row of the current element's fixed-size data." },
+  { "take_element_data", reinterpret_cast<PyCFunction>(guarded<Reader_take_element_data>), METH_NOARGS,
+    "take_element_data() -> ElementData\n\nMove the loaded rows out of the reader without copying. The result supports "
+    "the buffer protocol, so numpy.asarray() gives a structured array with one field per fixed-size property." },
+  { "extract_properties", reinterpret_cast<PyCFunction>(guarded<Reader_extract_properties>), METH_VARARGS,
+    "extract_properties(prop_idxs, dest) -> bool\n\nExtract the given properties of the loaded rows into a writable "
+    "contiguous buffer. The destination type comes from the buffer's format. Releases the GIL." },
+  { "sum_of_list_counts", reinterpret_cast<PyCFunction>(guarded<Reader_sum_of_list_counts>), METH_VARARGS,
+    "sum_of_list_counts(prop_idx) -> int" },
+  { "get_list_counts", reinterpret_cast<PyCFunction>(guarded<Reader_get_list_counts>), METH_VARARGS,
+    "get_list_counts(prop_idx, dest) -> bool\n\nCopy the per-row list sizes into a 32-bit integer buffer." },
+  { "extract_list_property", reinterpret_cast<PyCFunction>(guarded<Reader_extract_list_property>), METH_VARARGS,
+    "extract_list_property(prop_idx, dest) -> bool\n\nExtract all list values into a writable buffer. Releases the GIL." },
+  { "num_triangles", reinterpret_cast<PyCFunction>(guarded<Reader_num_triangles>), METH_VARARGS,
+    "num_triangles(prop_idx) -> int" },
+  { "requires_triangulation", reinterpret_cast<PyCFunction>(guarded<Reader_requires_triangulation>), METH_VARARGS,
+    "requires_triangulation(prop_idx) -> bool" },
+  { "extract_triangles", reinterpret_cast<PyCFunction>(guarded<Reader_extract_triangles>), METH_VARARGS,
+    "extract_triangles(prop_idx, pos, dest) -> bool\n\nTriangulate the faces into dest, which needs room for "
+    "3 * num_triangles(prop_idx) indexes. pos is the float32 vertex positions. Releases the GIL." },
+  { nullptr, nullptr, 0, nullptr },
+};
+
+static PyType_Slot Reader_slots[] = {
+  { Py_tp_doc, const_cast<char*>("Reader(path)\n\nOpens a PLY file and parses its header. Releases the GIL while doing so.") },
+  { Py_tp_new, reinterpret_cast<void*>(PyType_GenericNew) },
+  { Py_tp_init, reinterpret_cast<void*>(Reader_init) },
+  { Py_tp_dealloc, reinterpret_cast<void*>(Reader_dealloc) },
+  { Py_tp_methods, Reader_methods },
+  { 0, nullptr },
+};
+
+static PyType_Spec Reader_spec = {
+  "miniply.Reader",
+  int(sizeof(ReaderObject)),
+  0,
+  Py_TPFLAGS_DEFAULT,
+  Reader_slots,
+};
+
+
+//
+// Module
+//
+
+static PyModuleDef miniply_module = {
+  PyModuleDef_HEAD_INIT,
+  "miniply",
+  "Fast PLY file reader.",
+  -1,
+  nullptr, nullptr, nullptr, nullptr, nullptr,
+};
+
+
+PyMODINIT_FUNC PyInit_miniply(void)
+{
+  // ElementDataType keeps its reference for the life of the process, since
+  // take_element_data needs it.
+  if (ElementDataType == nullptr) {
+    ElementDataType = reinterpret_cast<PyTypeObject*>(PyType_FromSpec(&ElementData_spec));
+    if (ElementDataType == nullptr) {
+      return nullptr;
+    }
+  }
+  PyObject* readerType = PyType_FromSpec(&Reader_spec);
+  if (readerType == nullptr) {
+    return nullptr;
+  }
+
+  PyObject* module = PyModule_Create(&miniply_module);
+  if (module == nullptr) {
+    Py_DECREF(readerType);
+    return nullptr;
+  }
+  // PyModule_AddObject steals a reference only when it succeeds.
+  Py_INCREF(ElementDataType);
+  if (PyModule_AddObject(module, "ElementData", reinterpret_cast<PyObject*>(ElementDataType)) != 0) {
+    Py_DECREF(ElementDataType);
+    Py_DECREF(readerType);
+    Py_DECREF(module);
+    return nullptr;
+  }
+  if (PyModule_AddObject(module, "Reader", readerType) != 0) {
+    Py_DECREF(readerType);
+    Py_DECREF(module);
+    return nullptr;
+  }
+  return module;
+}
@@ -0,0 +1,394 @@
+// Copyright 2019 Vilya Harvey
+#include "miniply.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+
+//
+// Tiler settings
+//
+
+static const uint64_t kMaxTiles = 1u << 18;                 // Enough for a uniform octree of depth 6.
+static const size_t kMinWriteBufferSize = 64 * 1024;        // Don't keep a tile open with a smaller buffer than this...
+static const size_t kMaxWriteBufferSize = 4 * 1024 * 1024;  // ...or give one a bigger buffer than this.
+
+struct TileSettings {
+  uint32_t gridSize[3]  = { 4, 4, 1 };          // Number of tiles along each axis.
+  uint32_t batchRows    = 1024 * 1024;          // Max number of rows to hold in memory at once.
+  uint32_t numThreads   = 0;                    // 0 means use all available cores.
+  size_t memoryBudget   = 256 * 1024 * 1024;    // Total bytes for all of the tile write buffers.
+  uint32_t dataAlignment = 0;                   // If non-zero, align the start of each output's data section to this many bytes.
+  uint32_t rowAlignment  = 0;                   // If non-zero, pad each output row to a multiple of this many bytes.
+};
+
+
+//
+// Helpers
+//
+
+// Calls `func(t, start, end)` for each thread `t`, splitting [0, n) into
+// equal-sized contiguous ranges.
+template <class Func>
+static void parallel_ranges(uint32_t numThreads, size_t n, Func func)
+{
+  const size_t chunkSize = (n + numThreads - 1) / numThreads;
+  std::vector<std::thread> workers;
+  for (uint32_t t = 1; t < numThreads; t++) {
+    size_t start = std::min(n, t * chunkSize);
+    size_t end = std::min(n, start + chunkSize);
+    workers.push_back(std::thread(func, t, start, end));
+  }
+  func(0u, size_t(0), std::min(n, chunkSize));
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+
+// Raises the open file limit as far as we're allowed to, then returns how
+// many tile files we can keep open at once, leaving some handles spare for
+// the input file and anything else.
+static uint32_t max_open_tile_files()
+{
+  const uint64_t kSpareFiles = 32;
+#ifndef _WIN32
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+    return 64;
+  }
+  if (limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+      getrlimit(RLIMIT_NOFILE, &limit);
+    }
+  }
+  uint64_t available = (limit.rlim_cur == RLIM_INFINITY) ? kMaxTiles : uint64_t(limit.rlim_cur);
+  return uint32_t(std::min(kMaxTiles, std::max(uint64_t(1), (available > kSpareFiles * 2) ? available - kSpareFiles : available / 2)));
+#else
+  // The C runtime allows 512 open streams by default.
+  return uint32_t(512 - kSpareFiles);
+#endif
+}
+
+
+// Opens the file and moves the reader to the vertex element. Returns false if
+// there's no vertex element, or if it has any list properties.
+static bool seek_to_vertex_element(miniply::PLYReader& reader, uint32_t posIdxs[3])
+{
+  if (!reader.valid()) {
+    return false;
+  }
+  while (reader.has_element() && !reader.element_is(miniply::kPLYVertexElement)) {
+    reader.next_element();
+  }
+  return reader.has_element() && reader.element()->fixedSize && reader.find_pos(posIdxs);
+}
+
+
+//
+// Tiling passes
+//
+
+// First pass: calculate the bounding box of the vertex positions.
+static bool find_bounds(const char* filename, const TileSettings& settings, float lo[3], float hi[3])
+{
+  miniply::PLYReader reader(filename);
+  uint32_t posIdxs[3];
+  if (!seek_to_vertex_element(reader, posIdxs)) {
+    fprintf(stderr, "%s: no fixed-size vertex element with x, y and z properties\n", filename);
+    return false;
+  }
+
+  for (uint32_t c = 0; c < 3; c++) {
+    lo[c] = INFINITY;
+    hi[c] = -INFINITY;
+  }
+
+  std::vector<float> pos;
+  std::vector<float> threadBounds(size_t(settings.numThreads) * 6);
+  while (uint32_t numRows = reader.load_element_rows(settings.batchRows)) {
+    pos.resize(size_t(numRows) * 3);
+    reader.extract_properties(posIdxs, 3, miniply::PLYPropertyType::Float, pos.data());
+
+    parallel_ranges(settings.numThreads, numRows, [&](uint32_t t, size_t start, size_t end) {
+      float* b = threadBounds.data() + size_t(t) * 6;
+      for (uint32_t c = 0; c < 3; c++) {
+        b[c] = INFINITY;
+        b[c + 3] = -INFINITY;
+      }
+      for (size_t i = start; i < end; i++) {
+        for (uint32_t c = 0; c < 3; c++) {
+          b[c] = std::min(b[c], pos[i * 3 + c]);
+          b[c + 3] = std::max(b[c + 3], pos[i * 3 + c]);
+        }
+      }
+    });
+    for (uint32_t t = 0; t < settings.numThreads; t++) {
+      const float* b = threadBounds.data() + size_t(t) * 6;
+      for (uint32_t c = 0; c < 3; c++) {
+        lo[c] = std::min(lo[c], b[c]);
+        hi[c] = std::max(hi[c], b[c + 3]);
+      }
+    }
+  }
+  return reader.valid();
+}
+
+
+// Second pass: distribute the vertex rows into per-tile output files.
+static bool distribute_rows(const char* filename, const char* outPrefix, const TileSettings& settings, const float lo[3], const float hi[3])
+{
+  miniply::PLYReader reader(filename);
+  uint32_t posIdxs[3];
+  if (!seek_to_vertex_element(reader, posIdxs)) {
+    return false;
+  }
+
+  // main() has already checked that the product fits comfortably.
+  const uint32_t* grid = settings.gridSize;
+  const uint32_t numTiles = uint32_t(uint64_t(grid[0]) * grid[1] * grid[2]);
+  float scale[3];
+  for (uint32_t c = 0; c < 3; c++) {
+    scale[c] = (hi[c] > lo[c]) ? float(grid[c]) / (hi[c] - lo[c]) : 0.0f;
+  }
+
+  // Each output file has a copy of the vertex element and nothing else. We
+  // don't know the counts yet, so we reserve space for them in the header.
+  std::vector<miniply::PLYElement> outElements(1);
+  outElements[0].name = reader.element()->name;
+  outElements[0].properties = reader.element()->properties;
+  outElements[0].calculate_offsets();
+  outElements[0].add_row_padding(settings.rowAlignment);
+  const uint32_t rowStride = reader.element()->rowStride;
+  const uint32_t outRowStride = outElements[0].rowStride;
+
+  // Only a limited number of tiles are open at a time, each with a write
+  // buffer; the others are suspended, which closes the file and frees the
+  // buffer. The number open is limited by the open file limit and by how
+  // many buffers of at least kMinWriteBufferSize fit in the memory budget,
+  // so the total for all buffers never goes over the budget.
+  uint32_t maxOpen = std::min(numTiles, max_open_tile_files());
+  maxOpen = uint32_t(std::max<size_t>(1, std::min<size_t>(maxOpen, settings.memoryBudget / kMinWriteBufferSize)));
+  const size_t bufferSize = std::max<size_t>(1, std::min(kMaxWriteBufferSize, settings.memoryBudget / maxOpen));
+
+  std::vector<miniply::PLYWriter*> writers(numTiles, nullptr);
+  std::vector<uint32_t> tileCounts(numTiles, 0);
+
+  // Open tiles, most recently used first.
+  std::list<uint32_t> openTiles;
+  std::vector<std::list<uint32_t>::iterator> openPos(numTiles, openTiles.end());
+
+  std::vector<float> pos;
+  std::vector<uint32_t> tileOfRow;
+  std::vector<uint32_t> hist(size_t(settings.numThreads) * numTiles);
+  std::vector<uint32_t> tileStart(numTiles + 1);
+  std::vector<uint8_t> binned;
+
+  bool ok = true;
+  while (ok) {
+    uint32_t numRows = reader.load_element_rows(settings.batchRows);
+    if (numRows == 0) {
+      break;
+    }
+    pos.resize(size_t(numRows) * 3);
+    tileOfRow.resize(numRows);
+    binned.resize(size_t(numRows) * rowStride);
+    reader.extract_properties(posIdxs, 3, miniply::PLYPropertyType::Float, pos.data());
+
+    // Work out which tile each row belongs in and count the rows per tile,
+    // per thread.
+    parallel_ranges(settings.numThreads, numRows, [&](uint32_t t, size_t start, size_t end) {
+      uint32_t* h = hist.data() + size_t(t) * numTiles;
+      std::fill(h, h + numTiles, 0u);
+      for (size_t i = start; i < end; i++) {
+        uint32_t cell[3];
+        for (uint32_t c = 0; c < 3; c++) {
+          float q = (pos[i * 3 + c] - lo[c]) * scale[c];
+          cell[c] = (q > 0.0f) ? std::min(uint32_t(q), grid[c] - 1) : 0u;
+        }
+        uint32_t tile = (cell[2] * grid[1] + cell[1]) * grid[0] + cell[0];
+        tileOfRow[i] = tile;
+        ++h[tile];
+      }
+    });
+
+    // Turn the counts into write offsets, then scatter the rows so that each
+    // tile's rows are contiguous.
+    uint32_t offset = 0;
+    for (uint32_t tile = 0; tile < numTiles; tile++) {
+      tileStart[tile] = offset;
+      for (uint32_t t = 0; t < settings.numThreads; t++) {
+        uint32_t count = hist[size_t(t) * numTiles + tile];
+        hist[size_t(t) * numTiles + tile] = offset;
+        offset += count;
+      }
+    }
+    tileStart[numTiles] = offset;
+
+    const uint8_t* rows = reader.get_element_data();
+    parallel_ranges(settings.numThreads, numRows, [&](uint32_t t, size_t start, size_t end) {
+      uint32_t* h = hist.data() + size_t(t) * numTiles;
+      for (size_t i = start; i < end; i++) {
+        uint32_t dst = h[tileOfRow[i]]++;
+        std::memcpy(binned.data() + size_t(dst) * rowStride, rows + i * rowStride, rowStride);
+      }
+    });
+
+    for (uint32_t tile = 0; tile < numTiles && ok; tile++) {
+      uint32_t count = tileStart[tile + 1] - tileStart[tile];
+      if (count == 0) {
+        continue;
+      }
+      if (openPos[tile] != openTiles.end()) {
+        openTiles.splice(openTiles.begin(), openTiles, openPos[tile]);
+      }
+      else {
+        if (openTiles.size() >= maxOpen) {
+          uint32_t lru = openTiles.back();
+          openTiles.pop_back();
+          openPos[lru] = openTiles.end();
+          if (!writers[lru]->suspend()) {
+            fprintf(stderr, "Failed to write tile %u\n", lru);
+            ok = false;
+            break;
+          }
+        }
+        openTiles.push_front(tile);
+        openPos[tile] = openTiles.begin();
+      }
+      if (writers[tile] == nullptr) {
+        uint32_t x = tile % grid[0];
+        uint32_t y = (tile / grid[0]) % grid[1];
+        uint32_t z = tile / (grid[0] * grid[1]);
+        char tileFilename[1024];
+        snprintf(tileFilename, sizeof(tileFilename), "%s_%u_%u_%u.ply", outPrefix, x, y, z);
+        writers[tile] = new miniply::PLYWriter(tileFilename, bufferSize);
+        writers[tile]->add_comment("generated by miniply-tile");
+        writers[tile]->set_data_alignment(settings.dataAlignment);
+        if (!writers[tile]->write_header(outElements, true)) {
+          fprintf(stderr, "Failed to create %s\n", tileFilename);
+          ok = false;
+          break;
+        }
+      }
+      ok = writers[tile]->write_padded_rows(binned.data() + size_t(tileStart[tile]) * rowStride, count, rowStride, outRowStride);
+      tileCounts[tile] += count;
+    }
+  }
+
+  uint32_t numWritten = 0;
+  for (uint32_t tile = 0; tile < numTiles; tile++) {
+    if (writers[tile] == nullptr) {
+      continue;
+    }
+    ok = writers[tile]->set_element_count(0, tileCounts[tile]) && ok;
+    ok = writers[tile]->close() && ok;
+    delete writers[tile];
+    ++numWritten;
+  }
+
+  if (ok && !reader.valid()) {
+    fprintf(stderr, "%s: error reading vertex data\n", filename);
+    ok = false;
+  }
+  printf("Wrote %u non-empty tiles out of %u\n", numWritten, numTiles);
+  return ok;
+}
+
+
+static void print_usage(const char* argv0)
+{
+  fprintf(stderr,
+          "Usage: %s [options] <input.ply> <output-prefix>\n"
+          "\n"
+          "Splits the vertex element of a PLY file into a grid of spatial tiles,\n"
+          "writing each non-empty tile to <output-prefix>_X_Y_Z.ply.\n"
+          "\n"
+          "Options:\n"
+          "  --grid NX NY NZ   Number of tiles along each axis (default 4 4 1).\n"
+          "  --depth D         Use a uniform octree of depth D, i.e. 2^D tiles along each axis (max 6).\n"
+          "  --batch N         Number of rows to load at a time (default 1048576).\n"
+          "  --threads N       Number of threads to use for binning (default: all cores).\n"
+          "  --memory MB       Total memory for tile write buffers (default 256).\n"
+          "  --align N         Start the data section of each output at a multiple of N bytes.\n"
+          "  --pad-rows N      Pad each output row to a multiple of N bytes.\n",
+          argv0);
+}
+
+
+int main(int argc, char** argv)
+{
+  TileSettings settings;
+  const char* positional[2] = { nullptr, nullptr };
+  int numPositional = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--grid") == 0 && i + 3 < argc) {
+      for (uint32_t c = 0; c < 3; c++) {
+        settings.gridSize[c] = uint32_t(std::max(1, atoi(argv[++i])));
+      }
+    }
+    else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+      // Anything above 6 is rejected by the tile count check below.
+      int depth = std::min(10, std::max(0, atoi(argv[++i])));
+      settings.gridSize[0] = settings.gridSize[1] = settings.gridSize[2] = 1u << depth;
+    }
+    else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      settings.batchRows = uint32_t(std::max(1, atoi(argv[++i])));
+    }
+    else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      settings.numThreads = uint32_t(std::max(1, atoi(argv[++i])));
+    }
+    else if (strcmp(argv[i], "--memory") == 0 && i + 1 < argc) {
+      settings.memoryBudget = size_t(std::max(1, atoi(argv[++i]))) * 1024 * 1024;
+    }
+    else if (strcmp(argv[i], "--align") == 0 && i + 1 < argc) {
+      settings.dataAlignment = uint32_t(std::max(0, atoi(argv[++i])));
+    }
+    else if (strcmp(argv[i], "--pad-rows") == 0 && i + 1 < argc) {
+      settings.rowAlignment = uint32_t(std::max(0, atoi(argv[++i])));
+    }
+    else if (argv[i][0] == '-' || numPositional == 2) {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    else {
+      positional[numPositional++] = argv[i];
+    }
+  }
+
+  if (numPositional != 2) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (settings.numThreads == 0) {
+    settings.numThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  const uint64_t numTiles = uint64_t(settings.gridSize[0]) * settings.gridSize[1] * settings.gridSize[2];
+  if (numTiles > kMaxTiles) {
+    fprintf(stderr, "Too many tiles: %llu requested, the maximum is %llu\n", (unsigned long long)numTiles, (unsigned long long)kMaxTiles);
+    return EXIT_FAILURE;
+  }
+
+  float lo[3], hi[3];
+  if (!find_bounds(positional[0], settings, lo, hi)) {
+    return EXIT_FAILURE;
+  }
+  printf("Bounds: (%g, %g, %g) - (%g, %g, %g)\n", double(lo[0]), double(lo[1]), double(lo[2]), double(hi[0]), double(hi[1]), double(hi[2]));
+
+  return distribute_rows(positional[0], positional[1], settings, lo, hi) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,56 @@
+// Copyright 2019 Vilya Harvey
+#include "miniply.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+
+static void print_usage(const char* argv0)
+{
+  fprintf(stderr,
+          "Usage: %s [options] <input.ply> <output.ply>\n"
+          "\n"
+          "Converts an ASCII PLY file into a binary little-endian PLY file.\n"
+          "\n"
+          "Options:\n"
+          "  --threads N   Number of threads to use (default: all cores).\n",
+          argv0);
+}
+
+
+int main(int argc, char** argv)
+{
+  uint32_t numThreads = 0;
+  const char* filenames[2] = { nullptr, nullptr };
+  int numFilenames = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      numThreads = uint32_t(atoi(argv[++i]));
+    }
+    else if (argv[i][0] == '-' || numFilenames == 2) {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    else {
+      filenames[numFilenames++] = argv[i];
+    }
+  }
+
+  if (numFilenames != 2) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+  bool ok = miniply::transcode_ascii_to_binary(filenames[0], filenames[1], numThreads);
+  std::chrono::duration<double, std::chrono::milliseconds::period> ms = std::chrono::high_resolution_clock::now() - start;
+
+  if (!ok) {
+    fprintf(stderr, "Failed to convert %s to %s\n", filenames[0], filenames[1]);
+    return EXIT_FAILURE;
+  }
+  printf("Converted %s to %s in %.3lf ms\n", filenames[0], filenames[1], ms.count());
+  return EXIT_SUCCESS;
+}
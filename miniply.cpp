@@ -24,16 +24,67 @@ SOFTWARE.
 
 #include "miniply.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <cfloat>
 #include <cmath>
 #include <cstdarg>
 #include <cstdio>
+#include <cstdlib>
+#include <condition_variable>
 #include <cstring>
+#include <mutex>
 #include <string>
+#include <thread>
 
-#ifndef _WIN32
+#ifdef _WIN32
+#include <malloc.h>
+#else
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MINIPLY_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Static tracepoints (USDT probes) which can be attached to with bpftrace,
+// perf, SystemTap, etc. These are only compiled in if MINIPLY_ENABLE_PROBES
+// is defined, which requires <sys/sdt.h>; otherwise they expand to nothing.
+// Each probe is a single nop instruction when nothing is attached to it. See
+// the README for the list of probes and their arguments.
+#ifdef MINIPLY_ENABLE_PROBES
+#include <sys/sdt.h>
+#define MINIPLY_PROBES_ENABLED 1
+#define MINIPLY_PROBE(name, ...) STAP_PROBEV(miniply, name, __VA_ARGS__)
+#else
+#define MINIPLY_PROBES_ENABLED 0
+#define MINIPLY_PROBE(name, ...) do {} while (0)
+#endif
+
+// F16C is used for converting to half precision floats. If the compiler's
+// been told it can assume F16C we use it directly; otherwise with GCC and
+// Clang on x86 we compile the F16C code paths anyway and check for CPU
+// support at runtime.
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define MINIPLY_HAS_F16C 1
+#define MINIPLY_F16C_TARGET
+#include <immintrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MINIPLY_HAS_F16C 1
+#define MINIPLY_F16C_RUNTIME_CHECK 1
+#define MINIPLY_F16C_TARGET __attribute__((target("f16c")))
+#include <cpuid.h>
+#include <immintrin.h>
 #endif
 
 
@@ -55,8 +106,26 @@ namespace miniply {
   static constexpr uint32_t kPLYReadBufferSize = 128 * 1024;
   static constexpr uint32_t kPLYTempBufferSize = kPLYReadBufferSize;
 
+  // Fixed-size binary elements at least this big are read directly into the
+  // element storage instead of going through the read buffer.
+  static constexpr size_t kPLYDirectReadMinSize = 4 * kPLYReadBufferSize;
+
+  // Size of a transparent huge page on x86-64 and most AArch64 kernels.
+  // Allocations at least this big are aligned to it, so that they can be
+  // backed entirely by huge pages.
+  static constexpr size_t kPLYHugePageSize = 2 * 1024 * 1024;
+  static constexpr size_t kPLYPageSize = 4096;
+
+  // Reads with `O_DIRECT` must use buffers, offsets and sizes which are
+  // multiples of the device's logical block size. 4 KiB covers all common
+  // devices. Parts of a read which can't be done in place go through a bounce
+  // buffer of `kPLYDirectIOChunkSize` bytes.
+  static constexpr size_t kPLYDirectIOAlignment = 4096;
+  static constexpr size_t kPLYDirectIOChunkSize = 1024 * 1024;
+
   static const char* kPLYFileTypes[] = { "ascii", "binary_little_endian", "binary_big_endian", nullptr };
-  static const uint32_t kPLYPropertySize[]= { 1, 1, 2, 2, 4, 4, 4, 8 };
+  static const char* kPLYPropertyTypeNames[] = { "char", "uchar", "short", "ushort", "int", "uint", "float", "double", "half", nullptr };
+  static const uint32_t kPLYPropertySize[]= { 1, 1, 2, 2, 4, 4, 4, 8, 2 };
 
   struct PLYTypeAlias {
     const char* name;
@@ -95,6 +164,10 @@ namespace miniply {
 
   static constexpr float kPi = 3.14159265358979323846f;
 
+  // Don't bother spinning up extra threads unless each one will get at least
+  // this many items to work on.
+  static constexpr size_t kMinItemsPerThread = 64 * 1024;
+
 
   //
   // Vec2 type
@@ -119,12 +192,18 @@ namespace miniply {
     float x, y, z;
   };
 
+  static inline Vec3 operator + (Vec3 lhs, Vec3 rhs) { return Vec3{ lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z }; }
   static inline Vec3 operator - (Vec3 lhs, Vec3 rhs) { return Vec3{ lhs.x - rhs.x, lhs.y - rhs.y, lhs.z - rhs.z }; }
+  static inline Vec3 operator * (Vec3 lhs, float rhs) { return Vec3{ lhs.x * rhs, lhs.y * rhs, lhs.z * rhs }; }
 
   static inline float dot(Vec3 lhs, Vec3 rhs) { return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z; }
   static inline float length(Vec3 v) { return std::sqrt(dot(v, v)); }
   static inline Vec3 normalize(Vec3 v) { float len = length(v); return Vec3{ v.x / len, v.y / len, v.z / len }; }
   static inline Vec3 cross(Vec3 lhs, Vec3 rhs) { return Vec3{ lhs.y * rhs.z - lhs.z * rhs.y, lhs.z * rhs.x - lhs.x * rhs.z, lhs.x * rhs.y - lhs.y * rhs.x }; }
+  static inline Vec3 min(Vec3 lhs, Vec3 rhs) { return Vec3{ std::min(lhs.x, rhs.x), std::min(lhs.y, rhs.y), std::min(lhs.z, rhs.z) }; }
+  static inline Vec3 max(Vec3 lhs, Vec3 rhs) { return Vec3{ std::max(lhs.x, rhs.x), std::max(lhs.y, rhs.y), std::max(lhs.z, rhs.z) }; }
+
+  static inline Vec3 load_vec3(const float pos[], size_t idx) { return Vec3{ pos[idx * 3], pos[idx * 3 + 1], pos[idx * 3 + 2] }; }
 
 
   //
@@ -196,6 +275,143 @@ namespace miniply {
   }
 
 
+  // Positioned reads & writes which don't disturb (or depend on) the current
+  // file position, so several threads can use the same file at once.
+  static bool file_pread(FILE* file, void* dst, size_t numBytes, int64_t offset)
+  {
+  #ifdef _WIN32
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+    return _fseeki64(file, offset, SEEK_SET) == 0 && fread(dst, 1, numBytes, file) == numBytes;
+  #else
+    uint8_t* to = reinterpret_cast<uint8_t*>(dst);
+    while (numBytes > 0) {
+      ssize_t n = pread(fileno(file), to, numBytes, static_cast<off_t>(offset));
+      if (n <= 0) {
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      to += n;
+      offset += n;
+      numBytes -= size_t(n);
+    }
+    return true;
+  #endif
+  }
+
+
+  // Opens a second descriptor for `filename` which bypasses the page cache:
+  // `O_DIRECT` on Linux, `F_NOCACHE` on macOS. Returns -1 if that isn't
+  // supported by the platform or the file system.
+  static int file_open_direct(const char* filename)
+  {
+  #if defined(__linux__) && defined(O_DIRECT)
+    return open(filename, O_RDONLY | O_DIRECT);
+  #elif defined(__APPLE__)
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) == -1) {
+      close(fd);
+      fd = -1;
+    }
+    return fd;
+  #else
+    (void)filename;
+    return -1;
+  #endif
+  }
+
+
+  // Positioned read from a descriptor opened by `file_open_direct`. The
+  // parts of the range where `dst` and `offset` are both aligned are read in
+  // place; everything else (typically the start and end of an element, or
+  // all of it if the element's file offset and its place in memory aren't
+  // aligned the same way) is read in aligned blocks into a bounce buffer and
+  // copied out. If a read fails with EINVAL, e.g. because the device needs
+  // a larger alignment, the rest is read from `fallback` instead.
+  static bool file_pread_direct(int fd, FILE* fallback, void* dst, size_t numBytes, int64_t offset)
+  {
+  #ifdef _WIN32
+    (void)fd;
+    return file_pread(fallback, dst, numBytes, offset);
+  #else
+    const size_t kAlign = kPLYDirectIOAlignment;
+    uint8_t* to = reinterpret_cast<uint8_t*>(dst);
+    uint8_t* bounce = nullptr;
+    bool ok = true;
+    while (ok && numBytes > 0) {
+      const size_t misalign = size_t(offset) % kAlign;
+      if (misalign == 0 && uintptr_t(to) % kAlign == 0 && numBytes >= kAlign) {
+        const size_t n = numBytes & ~(kAlign - 1);
+        ssize_t got = pread(fd, to, n, static_cast<off_t>(offset));
+        if (got < 0 && errno == EINTR) {
+          continue;
+        }
+        if (got <= 0) {
+          ok = got < 0 && errno == EINVAL && file_pread(fallback, to, numBytes, offset);
+          break;
+        }
+        to += got;
+        offset += got;
+        numBytes -= size_t(got);
+        continue;
+      }
+
+      if (bounce == nullptr) {
+        bounce = static_cast<uint8_t*>(aligned_malloc(kPLYDirectIOChunkSize));
+        if (bounce == nullptr) {
+          ok = false;
+          break;
+        }
+      }
+      const size_t want = std::min(kPLYDirectIOChunkSize, (misalign + numBytes + kAlign - 1) & ~(kAlign - 1));
+      ssize_t got = pread(fd, bounce, want, static_cast<off_t>(offset - int64_t(misalign)));
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      if (got <= ssize_t(misalign)) {
+        // A short read here means we hit the end of the file.
+        ok = got < 0 && errno == EINVAL && file_pread(fallback, to, numBytes, offset);
+        break;
+      }
+      const size_t n = std::min(numBytes, size_t(got) - misalign);
+      std::memcpy(to, bounce + misalign, n);
+      to += n;
+      offset += int64_t(n);
+      numBytes -= n;
+    }
+    aligned_free(bounce);
+    return ok;
+  #endif
+  }
+
+
+  static bool file_pwrite(FILE* file, const void* src, size_t numBytes, int64_t offset)
+  {
+  #ifdef _WIN32
+    static std::mutex lock;
+    std::lock_guard<std::mutex> guard(lock);
+    return _fseeki64(file, offset, SEEK_SET) == 0 && fwrite(src, 1, numBytes, file) == numBytes;
+  #else
+    const uint8_t* from = reinterpret_cast<const uint8_t*>(src);
+    while (numBytes > 0) {
+      ssize_t n = pwrite(fileno(file), from, numBytes, static_cast<off_t>(offset));
+      if (n <= 0) {
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      from += n;
+      offset += n;
+      numBytes -= size_t(n);
+    }
+    return true;
+  #endif
+  }
+
+
   static bool int_literal(const char* start, char const** end, int* val)
   {
     const char* pos = start;
@@ -380,6 +596,32 @@ namespace miniply {
     *reinterpret_cast<uint64_t*>(data) = tmp;
   }
 
+  // Swaps the byte order of every value in `numRows` consecutive rows of a
+  // fixed-size element.
+  static void endian_swap_rows(const PLYElement& elem, uint8_t* data, size_t numRows)
+  {
+    for (size_t row = 0; row < numRows; row++) {
+      for (const PLYProperty& prop : elem.properties) {
+        size_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
+        switch (numBytes) {
+        case 2:
+          endian_swap_2(data);
+          break;
+        case 4:
+          endian_swap_4(data);
+          break;
+        case 8:
+          endian_swap_8(data);
+          break;
+        default:
+          break;
+        }
+        data += numBytes;
+      }
+    }
+  }
+
+
 
   static inline void endian_swap(uint8_t* data, PLYPropertyType type)
   {
@@ -416,6 +658,74 @@ namespace miniply {
   }
 
 
+  static float half_to_float(uint16_t h)
+  {
+    const uint32_t sign = uint32_t(h & 0x8000u) << 16;
+    uint32_t exponent = (h >> 10) & 0x1Fu;
+    uint32_t mantissa = h & 0x3FFu;
+    uint32_t bits;
+    if (exponent == 0x1Fu) {
+      bits = sign | 0x7F800000u | (mantissa << 13); // Inf or NaN
+    }
+    else if (exponent != 0) {
+      bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    else if (mantissa != 0) {
+      // Denormal half, which becomes a normal float.
+      exponent = 113;
+      while ((mantissa & 0x400u) == 0) {
+        mantissa <<= 1;
+        exponent--;
+      }
+      bits = sign | (exponent << 23) | ((mantissa & 0x3FFu) << 13);
+    }
+    else {
+      bits = sign; // +/- zero
+    }
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+  }
+
+
+  // Round-to-nearest-even conversion. Gives the same bits as the F16C
+  // instructions for every input, including NaN payloads.
+  static uint16_t float_to_half(float f)
+  {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    bits &= 0x7FFFFFFFu;
+
+    uint32_t h;
+    if (bits > 0x7F800000u) {
+      // NaN: quieted, keeping the top of the payload as F16C does.
+      h = 0x7E00u | ((bits & 0x7FFFFFu) >> 13);
+    }
+    else if (bits >= 0x47800000u) {
+      // Too big for a half, or Inf.
+      h = 0x7C00u;
+    }
+    else if (bits < 0x38800000u) {
+      // Becomes a denormal half or zero. Adding this magic number lets the
+      // FPU do the shifting and rounding for us.
+      const uint32_t kDenormMagicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+      float magic, tmp;
+      std::memcpy(&magic, &kDenormMagicBits, sizeof(magic));
+      std::memcpy(&tmp, &bits, sizeof(tmp));
+      tmp += magic;
+      std::memcpy(&bits, &tmp, sizeof(bits));
+      h = bits - kDenormMagicBits;
+    }
+    else {
+      const uint32_t mantissaOdd = (bits >> 13) & 1u;
+      bits += (uint32_t(15 - 127) << 23) + 0xFFFu + mantissaOdd;
+      h = bits >> 13;
+    }
+    return uint16_t(h | sign);
+  }
+
+
   template <class T>
   static void copy_and_convert_to(T* dest, const uint8_t* src, PLYPropertyType srcType)
   {
@@ -428,6 +738,7 @@ namespace miniply {
     case PLYPropertyType::UInt:   *dest = static_cast<T>(*reinterpret_cast<const uint32_t*>(src)); break;
     case PLYPropertyType::Float:  *dest = static_cast<T>(*reinterpret_cast<const float*>(src)); break;
     case PLYPropertyType::Double: *dest = static_cast<T>(*reinterpret_cast<const double*>(src)); break;
+    case PLYPropertyType::Half:   *dest = static_cast<T>(half_to_float(*reinterpret_cast<const uint16_t*>(src))); break;
     case PLYPropertyType::None:   break;
     }
   }
@@ -444,6 +755,13 @@ namespace miniply {
     case PLYPropertyType::UInt:   copy_and_convert_to(reinterpret_cast<uint32_t*>(dest), src, srcType); break;
     case PLYPropertyType::Float:  copy_and_convert_to(reinterpret_cast<float*>   (dest), src, srcType); break;
     case PLYPropertyType::Double: copy_and_convert_to(reinterpret_cast<double*>  (dest), src, srcType); break;
+    case PLYPropertyType::Half:
+      {
+        float tmp;
+        copy_and_convert_to(&tmp, src, srcType);
+        *reinterpret_cast<uint16_t*>(dest) = float_to_half(tmp);
+      }
+      break;
     case PLYPropertyType::None:   break;
     }
   }
@@ -456,1489 +774,5539 @@ namespace miniply {
   }
 
 
+  static inline float load_as_float(const uint8_t* src, PLYPropertyType srcType)
+  {
+    float val = 0.0f;
+    if (srcType == PLYPropertyType::Float) {
+      std::memcpy(&val, src, sizeof(float));
+    }
+    else {
+      copy_and_convert_to(&val, src, srcType);
+    }
+    return val;
+  }
+
+
   //
-  // PLYElement methods
+  // Half precision conversion
   //
 
-  void PLYElement::calculate_offsets()
+  // Number of values converted to float at a time when extracting as half.
+  static constexpr size_t kHalfChunkSize = 4096;
+
+#ifdef MINIPLY_F16C_RUNTIME_CHECK
+  static bool cpu_has_f16c()
   {
-    fixedSize = true;
-    for (PLYProperty& prop : properties) {
-      if (prop.countType != PLYPropertyType::None) {
-        fixedSize = false;
-        break;
-      }
+    // F16C instructions are VEX encoded, so the OS must also be saving the
+    // AVX register state.
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+      return false;
     }
-
-    // Note that each list property gets its own separate storage. Only fixed
-    // size properties go into the common data block. The `rowStride` is the
-    // size of a row in the common data block.
-    rowStride = 0;
-    for (PLYProperty& prop : properties) {
-      if (prop.countType != PLYPropertyType::None) {
-        continue;
-      }
-      prop.offset = rowStride;
-      rowStride += kPLYPropertySize[uint32_t(prop.type)];
+    const unsigned int kOSXSAVE = 1u << 27, kAVX = 1u << 28, kF16C = 1u << 29;
+    if ((ecx & (kOSXSAVE | kAVX | kF16C)) != (kOSXSAVE | kAVX | kF16C)) {
+      return false;
     }
+    unsigned int xcr0Lo, xcr0Hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0Lo), "=d"(xcr0Hi) : "c"(0));
+    return (xcr0Lo & 0x6u) == 0x6u;
   }
+#endif
 
 
-  uint32_t PLYElement::find_property(const char *propName) const
+#ifdef MINIPLY_HAS_F16C
+  MINIPLY_F16C_TARGET
+  static void floats_to_halfs_f16c(const float* src, size_t n, uint16_t* dest)
   {
-    for (uint32_t i = 0, endI = uint32_t(properties.size()); i < endI; i++) {
-      if (strcmp(propName, properties.at(i).name.c_str()) == 0) {
-        return i;
-      }
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      __m128i lo = _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+      __m128i hi = _mm_cvtps_ph(_mm_loadu_ps(src + i + 4), _MM_FROUND_TO_NEAREST_INT);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_unpacklo_epi64(lo, hi));
+    }
+    for (; i < n; i++) {
+      dest[i] = float_to_half(src[i]);
     }
-    return kInvalidIndex;
   }
+#endif
 
 
-  bool PLYElement::find_properties(uint32_t propIdxs[], uint32_t numIdxs, ...) const
+  static void floats_to_halfs(const float* src, size_t n, uint16_t* dest)
   {
-    va_list args;
-    va_start(args, numIdxs);
-    bool foundAll = find_properties_va(propIdxs, numIdxs, args);
-    va_end(args);
-    return foundAll;
+#if defined(MINIPLY_F16C_RUNTIME_CHECK)
+    static const bool hasF16C = cpu_has_f16c();
+    if (hasF16C) {
+      floats_to_halfs_f16c(src, n, dest);
+      return;
+    }
+#elif defined(MINIPLY_HAS_F16C)
+    floats_to_halfs_f16c(src, n, dest);
+    return;
+#endif
+    for (size_t i = 0; i < n; i++) {
+      dest[i] = float_to_half(src[i]);
+    }
   }
 
 
-  bool PLYElement::find_properties_va(uint32_t propIdxs[], uint32_t numIdxs, va_list names) const
+  // Converts `numRows` rows of the given non-list properties to half floats.
+  // Each chunk of rows is converted to float in a small temporary buffer
+  // first, which is then converted to half in bulk.
+  static void extract_rows_as_half(const PLYElement* elem, const uint8_t* rows, size_t numRows,
+                                   const uint32_t propIdxs[], uint32_t numProps,
+                                   uint8_t* dest, size_t destStride)
   {
-    for (uint32_t i = 0; i < numIdxs; i++) {
-      propIdxs[i] = find_property(va_arg(names, const char*));
-      if (propIdxs[i] == kInvalidIndex) {
-        return false;
+    const size_t rowsPerChunk = std::max(kHalfChunkSize / numProps, size_t(1));
+    const size_t destRowBytes = numProps * sizeof(uint16_t);
+    std::vector<float> tmp(rowsPerChunk * numProps);
+
+    for (size_t chunkStart = 0; chunkStart < numRows; chunkStart += rowsPerChunk) {
+      const size_t chunkRows = std::min(rowsPerChunk, numRows - chunkStart);
+      const uint8_t* row = rows + chunkStart * elem->rowStride;
+      float* to = tmp.data();
+      for (size_t r = 0; r < chunkRows; r++, row += elem->rowStride) {
+        for (uint32_t i = 0; i < numProps; i++) {
+          const PLYProperty& prop = elem->properties[propIdxs[i]];
+          *to++ = load_as_float(row + prop.offset, prop.type);
+        }
+      }
+
+      uint8_t* chunkDest = dest + chunkStart * destStride;
+      if (destStride == destRowBytes) {
+        floats_to_halfs(tmp.data(), chunkRows * numProps, reinterpret_cast<uint16_t*>(chunkDest));
+      }
+      else {
+        for (size_t r = 0; r < chunkRows; r++) {
+          floats_to_halfs(tmp.data() + r * numProps, numProps, reinterpret_cast<uint16_t*>(chunkDest + r * destStride));
+        }
       }
     }
-    return true;
   }
 
 
-  bool PLYElement::convert_list_to_fixed_size(uint32_t listPropIdx, uint32_t listSize, uint32_t newPropIdxs[])
+  // Converts `n` values of type `srcType` to half floats.
+  static void values_to_halfs(const uint8_t* src, PLYPropertyType srcType, size_t n, uint16_t* dest)
   {
-    if (fixedSize || listPropIdx >= properties.size() || properties[listPropIdx].countType == PLYPropertyType::None) {
-      return false;
+    if (srcType == PLYPropertyType::Float) {
+      floats_to_halfs(reinterpret_cast<const float*>(src), n, dest);
+      return;
+    }
+    float tmp[kHalfChunkSize];
+    const size_t srcBytes = kPLYPropertySize[uint32_t(srcType)];
+    for (size_t chunkStart = 0; chunkStart < n; chunkStart += kHalfChunkSize) {
+      const size_t chunkSize = std::min(kHalfChunkSize, n - chunkStart);
+      for (size_t i = 0; i < chunkSize; i++, src += srcBytes) {
+        tmp[i] = load_as_float(src, srcType);
+      }
+      floats_to_halfs(tmp, chunkSize, dest + chunkStart);
     }
+  }
 
-    PLYProperty oldListProp = properties[listPropIdx];
 
-    // If the generated names are less than 256 chars, we will use an array on
-    // the stack as temporary storage. In the rare case that they're longer,
-    // we'll allocate an array of sufficient size on the heap and use that
-    // instead. This means we'll avoid allocating in all but the most extreme
-    // cases.
-    char inlineBuf[256];
-    size_t nameBufSize = oldListProp.name.size() + 12; // the +12 allows space for an '_', a number up to 10 digits long and the terminating null.
-    char* nameBuf = inlineBuf;
-    if (nameBufSize > sizeof(inlineBuf)) {
-      nameBuf = new char[nameBufSize];
+  //
+  // Colour conversion
+  //
+
+  // Scale which maps the range of an integer type onto [0, 1], or [-1, 1]
+  // for signed types. Floating point values are assumed to be normalised
+  // already.
+  static float normalizing_scale(PLYPropertyType type)
+  {
+    switch (type) {
+    case PLYPropertyType::Char:   return 1.0f / 127.0f;
+    case PLYPropertyType::UChar:  return 1.0f / 255.0f;
+    case PLYPropertyType::Short:  return 1.0f / 32767.0f;
+    case PLYPropertyType::UShort: return 1.0f / 65535.0f;
+    case PLYPropertyType::Int:    return float(1.0 / 2147483647.0);
+    case PLYPropertyType::UInt:   return float(1.0 / 4294967295.0);
+    default:                      return 1.0f;
     }
+  }
 
-    // Set up a property for the list count column.
-    PLYProperty& countProp = properties[listPropIdx];
-    snprintf(nameBuf, nameBufSize, "%s_count", oldListProp.name.c_str());
-    countProp.name = nameBuf;
-    countProp.type = oldListProp.countType;
-    countProp.countType = PLYPropertyType::None;
-    countProp.stride = kPLYPropertySize[uint32_t(oldListProp.countType)];
 
-    if (listSize > 0) {
-      // Set up additional properties for the list entries, 1 per entry.
-      if (listPropIdx + 1 == properties.size()) {
-        properties.resize(properties.size() + listSize);
-      }
-      else {
-        properties.insert(properties.begin() + listPropIdx + 1, listSize, PLYProperty());
-      }
+  static inline float load_normalized(const uint8_t* src, PLYPropertyType type)
+  {
+    float val = load_as_float(src, type) * normalizing_scale(type);
+    // The most negative value of a signed integer type would fall just
+    // below -1.
+    if (type == PLYPropertyType::Char || type == PLYPropertyType::Short || type == PLYPropertyType::Int) {
+      val = std::max(val, -1.0f);
+    }
+    return val;
+  }
 
-      for (uint32_t i = 0; i < listSize; i++) {
-        uint32_t propIdx = listPropIdx + 1 + i;
 
-        PLYProperty& itemProp = properties[propIdx];
-        snprintf(nameBuf, nameBufSize, "%s_%u", oldListProp.name.c_str(), i);
-        itemProp.name = nameBuf;
-        itemProp.type = oldListProp.type;
-        itemProp.countType = PLYPropertyType::None;
-        itemProp.stride = kPLYPropertySize[uint32_t(oldListProp.type)];
+  // Clamps to [0, 1] and scales to [0, 255] with rounding. NaN becomes 0.
+  static inline uint8_t pack_unorm8(float val)
+  {
+    val = (val > 0.0f) ? std::min(val, 1.0f) : 0.0f;
+    return uint8_t(val * 255.0f + 0.5f);
+  }
 
-        newPropIdxs[i] = propIdx;
+
+  // True if the channels are stored next to each other in each row, in
+  // channel order, so that all of a row's channels can be loaded at once.
+  static bool channels_are_adjacent(const PLYProperty* const props[], uint32_t numProps)
+  {
+    const uint32_t size = kPLYPropertySize[uint32_t(props[0]->type)];
+    for (uint32_t c = 1; c < numProps; c++) {
+      if (props[c]->type != props[0]->type || props[c]->offset != props[0]->offset + c * size) {
+        return false;
       }
     }
+    return true;
+  }
 
-    if (nameBuf != inlineBuf) {
-      delete[] nameBuf;
-    }
 
-    calculate_offsets();
-    return true;
+#ifdef MINIPLY_HAS_SSE2
+  // Loads 4 bytes from each of four rows `stride` bytes apart into the four
+  // 32-bit lanes of a vector. Building it in registers rather than through
+  // a small array on the stack avoids a store forwarding stall.
+  static inline __m128i load_row_words(const uint8_t* src, size_t stride)
+  {
+    uint32_t w[4];
+    for (uint32_t r = 0; r < 4; r++) {
+      std::memcpy(&w[r], src + r * stride, sizeof(uint32_t));
+    }
+    return _mm_unpacklo_epi64(_mm_unpacklo_epi32(_mm_cvtsi32_si128(int32_t(w[0])), _mm_cvtsi32_si128(int32_t(w[1]))),
+                              _mm_unpacklo_epi32(_mm_cvtsi32_si128(int32_t(w[2])), _mm_cvtsi32_si128(int32_t(w[3]))));
   }
+#endif
 
 
   //
-  // PLYReader methods
+  // Huge pages
   //
 
-  PLYReader::PLYReader(const char* filename)
+  // Asks the kernel to back the whole huge pages within [ptr, ptr + numBytes)
+  // with transparent huge pages. This only has an effect on pages which
+  // haven't been touched yet, so call it before writing to new memory.
+  static void advise_huge_pages(void* ptr, size_t numBytes)
   {
-    m_buf = new char[kPLYReadBufferSize + 1];
-    m_buf[kPLYReadBufferSize] = '\0';
+  #if defined(__linux__) && defined(MADV_HUGEPAGE)
+    const uintptr_t start = (uintptr_t(ptr) + kPLYHugePageSize - 1) & ~uintptr_t(kPLYHugePageSize - 1);
+    const uintptr_t end = (uintptr_t(ptr) + numBytes) & ~uintptr_t(kPLYHugePageSize - 1);
+    if (end > start) {
+      madvise(reinterpret_cast<void*>(start), end - start, MADV_HUGEPAGE);
+    }
+  #else
+    (void)ptr;
+    (void)numBytes;
+  #endif
+  }
 
-    m_tmpBuf = new char[kPLYTempBufferSize + 1];
-    m_tmpBuf[kPLYTempBufferSize] = '\0';
 
-    m_bufEnd = m_buf + kPLYReadBufferSize;
-    m_pos = m_bufEnd;
-    m_end = m_bufEnd;
+  //
+  // List data
+  //
 
-    if (file_open(&m_f, filename, "rb") != 0) {
-      m_f = nullptr;
-      m_valid = false;
-      return;
+  // Resizes a list property's value storage. Fires the `list__grow` probe
+  // whenever this causes a reallocation. With `hugePages` set, the capacity
+  // at least doubles each time it grows, and the new block is advised for
+  // huge pages after `reserve()` has copied the old values into it. Those
+  // values have already been faulted in as 4 KiB pages by then, and the
+  // vector's block isn't 2 MiB aligned, so only the whole huge pages in the
+  // part of the block which hasn't been written yet benefit (about half of
+  // it, after a doubling). The rest is left for khugepaged to collapse.
+  static inline void resize_list_data(PLYProperty& prop, size_t newSize, bool hugePages)
+  {
+    const size_t oldCapacity = prop.listData.capacity();
+    if (hugePages && newSize > oldCapacity) {
+      prop.listData.reserve(std::max(newSize, oldCapacity * 2));
+      advise_huge_pages(prop.listData.data(), prop.listData.capacity());
     }
-    m_valid = true;
+    prop.listData.resize(newSize);
+#if MINIPLY_PROBES_ENABLED
+    if (prop.listData.capacity() != oldCapacity) {
+      MINIPLY_PROBE(list__grow, prop.name.c_str(), uint64_t(oldCapacity), uint64_t(prop.listData.capacity()));
+    }
+#else
+    (void)oldCapacity;
+#endif
+  }
 
-    refill_buffer();
 
-    m_valid = keyword("ply") && next_line() &&
-              keyword("format") && advance() &&
-              typed_which(kPLYFileTypes, &m_fileType) && advance() &&
-              int_literal(&m_majorVersion) && advance() &&
-              match(".") && advance() &&
-              int_literal(&m_minorVersion) && next_line() &&
-              parse_elements() &&
-              keyword("end_header") && advance() && match("\n") && accept();
-    if (!m_valid) {
-      return;
-    }
-    m_inDataSection = true;
-    if (m_fileType == PLYFileType::ASCII) {
-      advance();
-    }
-
-    for (PLYElement& elem : m_elements) {
-      elem.calculate_offsets();
-    }
-  }
-
-
-  PLYReader::~PLYReader()
+  // Fills `offsets` with the position of the first value of each row of a
+  // loaded list property, plus one past the last value. Returns false if
+  // there are too many values to index with 32 bits.
+  static bool list_row_offsets(const PLYProperty& prop, std::vector<uint32_t>& offsets)
   {
-    if (m_f != nullptr) {
-      fclose(m_f);
+    const size_t numRows = prop.rowCount.size();
+    offsets.resize(numRows + 1);
+    uint64_t total = 0;
+    for (size_t i = 0; i < numRows; i++) {
+      offsets[i] = uint32_t(total);
+      total += prop.rowCount[i];
+      if (total >= kInvalidIndex) {
+        return false;
+      }
     }
-    delete[] m_buf;
-    delete[] m_tmpBuf;
+    offsets[numRows] = uint32_t(total);
+    return true;
   }
 
 
-  bool PLYReader::valid() const
+  // Reads a list value as a vertex index. Returns false if it's negative or
+  // not less than `numVerts`.
+  static inline bool load_vertex_index(const uint8_t* src, PLYPropertyType type, uint32_t numVerts, uint32_t* idx)
   {
-    return m_valid;
+    int64_t val = -1;
+    copy_and_convert_to(&val, src, type);
+    if (val < 0 || val >= int64_t(numVerts)) {
+      return false;
+    }
+    *idx = uint32_t(val);
+    return true;
   }
 
 
-  bool PLYReader::has_element() const
-  {
-    return m_valid && m_currentElement < m_elements.size();
-  }
-
+  //
+  // Extraction planning
+  //
 
-  const PLYElement* PLYReader::element() const
-  {
-    assert(has_element());
-    return &m_elements[m_currentElement];
-  }
+  // The analysis behind the choice of strategy in `extract_properties` and
+  // `extract_properties_with_stride`. It's shared with `explain_extraction`
+  // so that explanations always match what the extraction really does.
+  struct PLYExtractPlan {
+    PLYExtractPath path     = PLYExtractPath::Invalid;
+    bool contiguousCols     = false; // The properties are adjacent in each row, in the order requested.
+    bool contiguousRows     = false; // ...and they cover the whole row.
+    bool conversionRequired = false;
+    uint32_t firstOffset    = 0;     // Row offset of the first property.
+    uint32_t numBytes       = 0;     // Bytes per row covered by the properties, if they're contiguous.
+  };
 
 
-  bool PLYReader::load_element()
+  static PLYExtractPlan plan_extraction(const PLYElement* elem, const uint32_t propIdxs[], uint32_t numProps,
+                                        PLYPropertyType destType, bool packedDest)
   {
-    assert(has_element());
-    if (m_elementLoaded) {
-      return true;
+    PLYExtractPlan plan;
+    if (elem == nullptr || numProps == 0 || destType >= PLYPropertyType::None) {
+      return plan;
     }
 
-    PLYElement& elem = m_elements[m_currentElement];
-    return elem.fixedSize ? load_fixed_size_element(elem) : load_variable_size_element(elem);
-  }
-
+    // Make sure all property indexes are valid and that none of the properties
+    // are lists (this only handles non-list data).
+    for (uint32_t i = 0; i < numProps; i++) {
+      if (propIdxs[i] >= elem->properties.size() || elem->properties[propIdxs[i]].countType != PLYPropertyType::None) {
+        return plan;
+      }
+    }
 
-  void PLYReader::next_element()
-  {
-    if (!has_element()) {
-      return;
+    // Find out whether we have contiguous columns. If so, we may be able to
+    // use a more efficient data extraction technique.
+    plan.contiguousCols = true;
+    plan.firstOffset = elem->properties[propIdxs[0]].offset;
+    uint32_t expectedOffset = plan.firstOffset;
+    for (uint32_t i = 0; i < numProps; i++) {
+      const PLYProperty& prop = elem->properties[propIdxs[i]];
+      if (prop.offset != expectedOffset) {
+        plan.contiguousCols = false;
+        break;
+      }
+      expectedOffset = prop.offset + kPLYPropertySize[uint32_t(prop.type)];
     }
+    plan.numBytes = plan.contiguousCols ? expectedOffset - plan.firstOffset : 0;
 
-    // If the element was loaded, the read buffer should already be positioned at
-    // the start of the next element.
-    PLYElement& elem = m_elements[m_currentElement];
-    m_currentElement++;
+    // If the row we're extracting is contiguous in memory (i.e. there are no
+    // gaps anywhere in a row - start, end or middle), we can use an even MORE
+    // efficient data extraction technique.
+    plan.contiguousRows = plan.contiguousCols && (plan.firstOffset == 0) && (expectedOffset == elem->rowStride);
 
-    if (m_elementLoaded) {
-      // Clear any temporary storage used for list properties in the current element.
-      for (PLYProperty& prop : elem.properties) {
-        if (prop.countType == PLYPropertyType::None) {
-          continue;
-        }
-        prop.listData.clear();
-        prop.listData.shrink_to_fit();
-        prop.rowCount.clear();
-        prop.rowCount.shrink_to_fit();
+    // If no data conversion is required, we can memcpy chunks of data
+    // directly over to `dest`. How big those chunks will be depends on whether
+    // the columns and/or rows are contiguous, as determined above.
+    for (uint32_t i = 0; i < numProps; i++) {
+      if (!compatible_types(elem->properties[propIdxs[i]].type, destType)) {
+        plan.conversionRequired = true;
+        break;
       }
-
-      // Clear temporary storage for the non-list properties in the current element.
-      m_elementData.clear();
-      m_elementLoaded = false;
-      return;
     }
 
-    // If the element wasn't loaded, we have to move the file pointer past its
-    // contents. How we do that depends on whether this is an ASCII or binary
-    // file and, if it's a binary, whether the element is fixed or variable
-    // size.
-    if (m_fileType == PLYFileType::ASCII) {
-      for (uint32_t row = 0; row < elem.count; row++) {
-        next_line();
-      }
+    if (destType == PLYPropertyType::Half) {
+      plan.path = PLYExtractPath::HalfChunks;
     }
-    else if (elem.fixedSize) {
-      int64_t elementStart = static_cast<int64_t>(m_pos - m_buf);
-      int64_t elementSize = elem.rowStride * elem.count;
-      int64_t elementEnd = elementStart + elementSize;
-      if (elementEnd >= kPLYReadBufferSize) {
-        m_bufOffset += elementEnd;
-        file_seek(m_f, m_bufOffset, SEEK_SET);
-        m_bufEnd = m_buf + kPLYReadBufferSize;
-        m_pos = m_bufEnd;
-        m_end = m_bufEnd;
-        refill_buffer();
-      }
-      else {
-        m_pos = m_buf + elementEnd;
-        m_end = m_pos;
-      }
+    else if (plan.conversionRequired) {
+      plan.path = PLYExtractPath::PerValue;
     }
-    else if (m_fileType == PLYFileType::Binary) {
-      for (uint32_t row = 0; row < elem.count; row++) {
-        for (const PLYProperty& prop : elem.properties) {
-          if (prop.countType == PLYPropertyType::None) {
-            uint32_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
-            if (m_pos + numBytes > m_bufEnd) {
-              if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
-                m_valid = false;
-                return;
-              }
-            }
-            m_pos += numBytes;
-            m_end = m_pos;
-            continue;
-          }
-
-          uint32_t numBytes = kPLYPropertySize[uint32_t(prop.countType)];
-          if (m_pos + numBytes > m_bufEnd) {
-            if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
-              m_valid = false;
-              return;
-            }
-          }
-
-          int count = 0;
-          copy_and_convert_to(&count, reinterpret_cast<const uint8_t*>(m_pos), prop.countType);
-
-          if (count < 0) {
-            m_valid = false;
-            return;
-          }
-
-          numBytes += uint32_t(count) * kPLYPropertySize[uint32_t(prop.type)];
-          if (m_pos + numBytes > m_bufEnd) {
-            if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
-              m_valid = false;
-              return;
-            }
-          }
-          m_pos += numBytes;
-          m_end = m_pos;
-        }
-      }
+    else if (plan.contiguousRows && packedDest) {
+      plan.path = PLYExtractPath::Block;
     }
-    else { // PLYFileType::BinaryBigEndian
-      for (uint32_t row = 0; row < elem.count; row++) {
-        for (const PLYProperty& prop : elem.properties) {
-          if (prop.countType == PLYPropertyType::None) {
-            uint32_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
-            if (m_pos + numBytes > m_bufEnd) {
-              if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
-                m_valid = false;
-                return;
-              }
-            }
-            m_pos += numBytes;
-            m_end = m_pos;
-            continue;
-          }
+    else if (plan.contiguousCols) {
+      plan.path = PLYExtractPath::PerRow;
+    }
+    else {
+      plan.path = PLYExtractPath::PerColumn;
+    }
+    return plan;
+  }
 
-          uint32_t numBytes = kPLYPropertySize[uint32_t(prop.countType)];
-          if (m_pos + numBytes > m_bufEnd) {
-            if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
-              m_valid = false;
-              return;
-            }
-          }
 
-          int count = 0;
-          uint8_t tmp[8];
-          memcpy(tmp, m_pos, numBytes);
-          endian_swap(tmp, prop.countType);
-          copy_and_convert_to(&count, tmp, prop.countType);
+  //
+  // Threading helpers
+  //
 
-          if (count < 0) {
-            m_valid = false;
-            return;
-          }
+  static uint32_t num_worker_threads(size_t numItems)
+  {
+    uint32_t maxThreads = std::thread::hardware_concurrency();
+    if (maxThreads == 0) {
+      maxThreads = 1;
+    }
+    size_t wanted = numItems / kMinItemsPerThread;
+    if (wanted < 1) {
+      return 1;
+    }
+    return (wanted < maxThreads) ? uint32_t(wanted) : maxThreads;
+  }
 
-          numBytes += uint32_t(count) * kPLYPropertySize[uint32_t(prop.type)];
-          if (m_pos + numBytes > m_bufEnd) {
-            if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
-              m_valid = false;
-              return;
-            }
-          }
 
-          m_pos += numBytes;
-          m_end = m_pos;
+#ifdef __linux__
+  // Parses a Linux list of ranges like "0-3,8,10-11" (as used for CPU and
+  // node lists in sysfs) into `ids`.
+  static bool parse_id_list(const char* str, std::vector<uint32_t>& ids)
+  {
+    const char* pos = str;
+    while (*pos != '\0' && *pos != '\n') {
+      char* end = nullptr;
+      unsigned long first = strtoul(pos, &end, 10);
+      if (end == pos) {
+        return false;
+      }
+      unsigned long last = first;
+      pos = end;
+      if (*pos == '-') {
+        ++pos;
+        last = strtoul(pos, &end, 10);
+        if (end == pos || last < first) {
+          return false;
         }
+        pos = end;
+      }
+      for (unsigned long id = first; id <= last; id++) {
+        ids.push_back(uint32_t(id));
+      }
+      if (*pos == ',') {
+        ++pos;
       }
     }
+    return true;
   }
 
 
-  PLYFileType PLYReader::file_type() const
+  static bool read_id_list(const char* path, std::vector<uint32_t>& ids)
   {
-    return m_fileType;
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) {
+      return false;
+    }
+    char line[4096];
+    bool ok = fgets(line, sizeof(line), f) != nullptr && parse_id_list(line, ids);
+    fclose(f);
+    return ok;
   }
 
 
-  int PLYReader::version_major() const
+  // The CPUs belonging to each online NUMA node, read from sysfs once.
+  static const std::vector<std::vector<uint32_t>>& numa_node_cpus()
   {
-    return m_majorVersion;
+    static const std::vector<std::vector<uint32_t>> nodeCPUs = []() {
+      std::vector<std::vector<uint32_t>> result;
+      std::vector<uint32_t> nodes;
+      if (!read_id_list("/sys/devices/system/node/online", nodes)) {
+        return result;
+      }
+      for (uint32_t node : nodes) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+        std::vector<uint32_t> cpus;
+        if (read_id_list(path, cpus) && !cpus.empty()) {
+          result.push_back(cpus);
+        }
+      }
+      return result;
+    }();
+    return nodeCPUs;
   }
+#endif
 
 
-  int PLYReader::version_minor() const
+  // Calls `func(i)` once for each `i` in [0, numTasks), each on its own
+  // thread. Task 0 runs on the calling thread, unless `bindToNodes` is set
+  // and there's more than one NUMA node: then every task gets a new thread,
+  // pinned so that consecutive tasks share a node, and the calling thread's
+  // affinity is left alone.
+  template <class Func>
+  static void parallel_for(uint32_t numTasks, Func func, bool bindToNodes = false)
   {
-    return m_minorVersion;
+    const uint32_t numNodes = bindToNodes ? num_numa_nodes() : 1;
+    if (numNodes > 1 && numTasks > 0) {
+      std::vector<std::thread> workers;
+      workers.reserve(numTasks);
+      for (uint32_t i = 0; i < numTasks; i++) {
+        workers.push_back(std::thread([&func, i, numTasks, numNodes]() {
+          bind_thread_to_numa_node(uint32_t(uint64_t(i) * numNodes / numTasks));
+          func(i);
+        }));
+      }
+      for (std::thread& worker : workers) {
+        worker.join();
+      }
+      return;
+    }
+
+    if (numTasks <= 1) {
+      if (numTasks == 1) {
+        func(0u);
+      }
+      return;
+    }
+    std::vector<std::thread> workers;
+    workers.reserve(numTasks - 1);
+    for (uint32_t i = 1; i < numTasks; i++) {
+      workers.push_back(std::thread(func, i));
+    }
+    func(0u);
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
   }
 
 
-  uint32_t PLYReader::num_elements() const
+  // Prepares freshly allocated element storage for `numRows` rows: advises
+  // it for huge pages, then writes to every page using the same split of
+  // rows across workers as the loading and extraction paths, so the page
+  // faults are taken in parallel and each page is first touched by the
+  // worker which will use it.
+  static void prefault_rows(PLYDataBuffer& data, size_t numRows, size_t rowStride, bool bindToNodes)
   {
-    return m_valid ? static_cast<uint32_t>(m_elements.size()) : 0;
+    const size_t numBytes = numRows * rowStride;
+    if (numBytes == 0) {
+      return;
+    }
+    advise_huge_pages(data.data(), numBytes);
+
+    const uint32_t numThreads = num_worker_threads(numRows);
+    const size_t chunkSize = (numRows + numThreads - 1) / numThreads;
+    parallel_for(numThreads, [&](uint32_t t) {
+      const size_t start = std::min(numRows, t * chunkSize) * rowStride;
+      const size_t end = std::min(numRows * rowStride, start + chunkSize * rowStride);
+      for (size_t offset = start; offset < end; offset += kPLYPageSize) {
+        data[offset] = 0;
+      }
+    }, bindToNodes);
   }
 
 
-  uint32_t PLYReader::find_element(const char* name) const
+  //
+  // Radix sort
+  //
+
+  // Converts a value of the given type into an unsigned integer whose natural
+  // ordering matches the ordering of the original values.
+  static uint64_t sortable_key(const uint8_t* src, PLYPropertyType type)
   {
-    for (uint32_t i = 0, endI = num_elements(); i < endI; i++) {
-      const PLYElement& elem = m_elements[i];
-      if (strcmp(elem.name.c_str(), name) == 0) {
-        return i;
+    switch (type) {
+    case PLYPropertyType::Char:   return uint64_t(int64_t(*reinterpret_cast<const int8_t*>(src))) ^ 0x8000000000000000ull;
+    case PLYPropertyType::UChar:  return *src;
+    case PLYPropertyType::Short:  return uint64_t(int64_t(*reinterpret_cast<const int16_t*>(src))) ^ 0x8000000000000000ull;
+    case PLYPropertyType::UShort: return *reinterpret_cast<const uint16_t*>(src);
+    case PLYPropertyType::Int:    return uint64_t(int64_t(*reinterpret_cast<const int32_t*>(src))) ^ 0x8000000000000000ull;
+    case PLYPropertyType::UInt:   return *reinterpret_cast<const uint32_t*>(src);
+    case PLYPropertyType::Float:
+      {
+        uint32_t bits;
+        std::memcpy(&bits, src, sizeof(bits));
+        return (bits & 0x80000000u) ? uint64_t(~bits) : uint64_t(bits | 0x80000000u);
+      }
+    case PLYPropertyType::Double:
+      {
+        uint64_t bits;
+        std::memcpy(&bits, src, sizeof(bits));
+        return (bits & 0x8000000000000000ull) ? ~bits : (bits | 0x8000000000000000ull);
       }
+    case PLYPropertyType::None:
+    default:
+      return 0;
     }
-    return kInvalidIndex;
   }
 
 
-  PLYElement* PLYReader::get_element(uint32_t idx)
+  // Spreads the low 21 bits of `v` out so there are two zero bits between
+  // each of them.
+  static inline uint64_t morton_spread_21(uint64_t v)
   {
-    return (idx < num_elements()) ? &m_elements[idx] : nullptr;
+    v &= 0x1FFFFFull;
+    v = (v | (v << 32)) & 0x001F00000000FFFFull;
+    v = (v | (v << 16)) & 0x001F0000FF0000FFull;
+    v = (v | (v <<  8)) & 0x100F00F00F00F00Full;
+    v = (v | (v <<  4)) & 0x10C30C30C30C30C3ull;
+    v = (v | (v <<  2)) & 0x1249249249249249ull;
+    return v;
   }
 
 
-  bool PLYReader::element_is(const char* name) const
+  // Sets `keys` to a 63-bit Morton code for each of the `n` points returned
+  // by `point(i)`, with x in the lowest bit of each group of three. The points
+  // are quantised to 21 bits relative to their bounding box, using the same
+  // scale for every axis: stretching a thin axis to fill the grid would let
+  // it dominate the ordering and split up neighbours. NaN coordinates are
+  // ignored for the bounds and quantised to zero.
+  template <class PointFunc>
+  static void compute_morton_codes(size_t n, PointFunc point, std::vector<uint64_t>& keys)
   {
-    return has_element() && strcmp(element()->name.c_str(), name) == 0;
-  }
-
-
-  uint32_t PLYReader::num_rows() const
-  {
-    return has_element() ? element()->count : 0;
-  }
-
+    keys.resize(n);
+    if (n == 0) {
+      return;
+    }
+    const uint32_t numThreads = num_worker_threads(n);
+    const size_t chunkSize = (n + numThreads - 1) / numThreads;
+
+    std::vector<Vec3> threadLo(numThreads), threadHi(numThreads);
+    parallel_for(numThreads, [&](uint32_t t) {
+      const size_t start = std::min(n, t * chunkSize);
+      const size_t end = std::min(n, start + chunkSize);
+      Vec3 lo{ INFINITY, INFINITY, INFINITY };
+      Vec3 hi{ -INFINITY, -INFINITY, -INFINITY };
+      for (size_t i = start; i < end; i++) {
+        // min() and max() return their first argument if the second is NaN.
+        Vec3 p = point(i);
+        lo = min(lo, p);
+        hi = max(hi, p);
+      }
+      threadLo[t] = lo;
+      threadHi[t] = hi;
+    });
+    Vec3 lo = threadLo[0], hi = threadHi[0];
+    for (uint32_t t = 1; t < numThreads; t++) {
+      lo = min(lo, threadLo[t]);
+      hi = max(hi, threadHi[t]);
+    }
 
-  uint32_t PLYReader::find_property(const char* name) const
-  {
-    return has_element() ? element()->find_property(name) : kInvalidIndex;
+    const float kMaxCoord = float(0x1FFFFF);
+    const float size = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+    const float scale = (size > 0.0f && size < INFINITY) ? kMaxCoord / size : 0.0f;
+    // The comparisons are written so that NaNs end up as zero.
+    auto quantize = [&](float v, float base) -> uint64_t {
+      float q = (v - base) * scale;
+      return (q > 0.0f) ? uint64_t(std::min(q, kMaxCoord)) : 0;
+    };
+    parallel_for(numThreads, [&](uint32_t t) {
+      const size_t start = std::min(n, t * chunkSize);
+      const size_t end = std::min(n, start + chunkSize);
+      for (size_t i = start; i < end; i++) {
+        Vec3 p = point(i);
+        keys[i] = morton_spread_21(quantize(p.x, lo.x)) |
+                  (morton_spread_21(quantize(p.y, lo.y)) << 1) |
+                  (morton_spread_21(quantize(p.z, lo.z)) << 2);
+      }
+    });
   }
 
 
-  bool PLYReader::find_properties(uint32_t propIdxs[], uint32_t numIdxs, ...) const
+  // Sorts `order` (which must be the same length as `keys`) so that
+  // `keys[order[i]]` is ascending, using a stable LSD radix sort with 8-bit
+  // digits. `order` is filled in with the identity permutation first.
+  //
+  // Passes where every key has the same digit are skipped, so sorting keys
+  // which only use the low 32 bits costs no more than sorting 32 bit keys.
+  static void radix_sort_indices(const std::vector<uint64_t>& keys, std::vector<uint32_t>& order)
   {
-    if (!has_element()) {
-      return false;
+    const size_t n = keys.size();
+    order.resize(n);
+    if (n == 0) {
+      return;
     }
-    va_list args;
-    va_start(args, numIdxs);
-    bool foundAll = element()->find_properties_va(propIdxs, numIdxs, args);
-    va_end(args);
-    return foundAll;
-  }
 
+    const uint32_t numThreads = num_worker_threads(n);
+    const size_t chunkSize = (n + numThreads - 1) / numThreads;
 
-  bool PLYReader::extract_properties(const uint32_t propIdxs[], uint32_t numProps, PLYPropertyType destType, void *dest) const
-  {
-    if (numProps == 0) {
-      return false;
+    std::vector<uint64_t> keysA(keys), keysB(n);
+    std::vector<uint32_t> valsA(n), valsB(n);
+    for (uint32_t i = 0; i < uint32_t(n); i++) {
+      valsA[i] = i;
     }
 
-    const PLYElement* elem = element();
-
-    // Make sure all property indexes are valid and that none of the properties
-    // are lists (this function only extracts non-list data).
-    for (uint32_t i = 0; i < numProps; i++) {
-      if (propIdxs[i] >= elem->properties.size()) {
-        return false;
+    // One 256-entry histogram per thread for the current digit.
+    std::vector<size_t> hist(size_t(numThreads) * 256);
+
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+      parallel_for(numThreads, [&](uint32_t t) {
+        size_t* h = hist.data() + size_t(t) * 256;
+        std::fill(h, h + 256, size_t(0));
+        const size_t start = std::min(n, t * chunkSize);
+        const size_t end = std::min(n, start + chunkSize);
+        for (size_t i = start; i < end; i++) {
+          ++h[(keysA[i] >> shift) & 0xFF];
+        }
+      });
+
+      // If every key has the same value for this digit, the pass would leave
+      // the order unchanged so we can skip it.
+      bool trivial = false;
+      for (uint32_t digit = 0; digit < 256; digit++) {
+        size_t total = 0;
+        for (uint32_t t = 0; t < numThreads; t++) {
+          total += hist[size_t(t) * 256 + digit];
+        }
+        if (total == n) {
+          trivial = true;
+          break;
+        }
+        else if (total != 0) {
+          break;
+        }
+      }
+      if (trivial) {
+        continue;
       }
-    }
 
-    // Find out whether we have contiguous columns. If so, we may be able to
-    // use a more efficient data extraction technique.
-    bool contiguousCols = true;
-    uint32_t expectedOffset = elem->properties[propIdxs[0]].offset;
-    for (uint32_t i = 0; i < numProps; i++) {
-      uint32_t propIdx = propIdxs[i];
-      const PLYProperty& prop = elem->properties[propIdx];
-      if (prop.offset != expectedOffset) {
-        contiguousCols = false;
-        break;
+      // Convert the histograms into starting offsets, ordered by digit first
+      // and thread second so that the sort stays stable.
+      size_t offset = 0;
+      for (uint32_t digit = 0; digit < 256; digit++) {
+        for (uint32_t t = 0; t < numThreads; t++) {
+          size_t count = hist[size_t(t) * 256 + digit];
+          hist[size_t(t) * 256 + digit] = offset;
+          offset += count;
+        }
       }
-      expectedOffset = prop.offset + kPLYPropertySize[uint32_t(prop.type)];
+
+      parallel_for(numThreads, [&](uint32_t t) {
+        size_t* h = hist.data() + size_t(t) * 256;
+        const size_t start = std::min(n, t * chunkSize);
+        const size_t end = std::min(n, start + chunkSize);
+        for (size_t i = start; i < end; i++) {
+          size_t dst = h[(keysA[i] >> shift) & 0xFF]++;
+          keysB[dst] = keysA[i];
+          valsB[dst] = valsA[i];
+        }
+      });
+
+      keysA.swap(keysB);
+      valsA.swap(valsB);
     }
 
-    // If the row we're extracting is contiguous in memory (i.e. there are no
-    // gaps anywhere in a row - start, end or middle), we can use an even MORE
-    // efficient data extraction technique.
-    bool contiguousRows = contiguousCols &&
-                          (elem->properties[propIdxs[0]].offset == 0) &&
-                          (expectedOffset == elem->rowStride);
+    order.swap(valsA);
+  }
 
-    // If no data conversion is required, we can memcpy chunks of data
-    // directly over to `dest`. How big those chunks will be depends on whether
-    // the columns and/or rows are contiguous, as determined above.
-    bool conversionRequired = false;
-    for (uint32_t i = 0; i < numProps; i++) {
-      uint32_t propIdx = propIdxs[i];
-      const PLYProperty& prop = elem->properties[propIdx];
-      if (!compatible_types(prop.type, destType)) {
-        conversionRequired = true;
-        break;
+
+  //
+  // Union-find
+  //
+
+  // A disjoint set forest which any number of threads can update at once
+  // without locks. Roots are linked with a compare-and-swap, always making
+  // the larger index a child of the smaller, so no cycles can form; paths
+  // are halved as they're followed, and a failed halving step is harmless
+  // because the parent it would have replaced is still an ancestor.
+  class ConcurrentUnionFind {
+  public:
+    explicit ConcurrentUnionFind(uint32_t n) : m_parent(n) {}
+
+    void reset(uint32_t begin, uint32_t end)
+    {
+      for (uint32_t i = begin; i < end; i++) {
+        m_parent[i].store(i, std::memory_order_relaxed);
       }
     }
 
-    uint8_t* to = reinterpret_cast<uint8_t*>(dest);
-    if (!conversionRequired) {
-      // If no data conversion is required, we can just use memcpy to get
-      // values into dest.
-      if (contiguousRows) {
-        // Most efficient case is when the rows are contiguous. It means we're
-        // simply copying the entire data block for this element, which we can
-        // do with a single memcpy.
-        std::memcpy(to, m_elementData.data(), m_elementData.size());
-      }
-      else if (contiguousCols) {
-        // If the rows aren't contiguous, but the columns we're extracting
-        // within each row are, then we can do a single memcpy per row.
-        const uint8_t* from = m_elementData.data() + elem->properties[propIdxs[0]].offset;
-        const uint8_t* end = m_elementData.data() + m_elementData.size();
-        const size_t numBytes = expectedOffset - elem->properties[propIdxs[0]].offset;
-        while (from < end) {
-          std::memcpy(to, from, numBytes);
-          from += elem->rowStride;
-          to += numBytes;
-        }
-      }
-      else {
-        // If the columns aren't contiguous, we must memcpy each one separately.
-        const uint8_t* row = m_elementData.data();
-        const uint8_t* end = m_elementData.data() + m_elementData.size();
-        uint8_t* to = reinterpret_cast<uint8_t*>(dest);
-        size_t colBytes = kPLYPropertySize[uint32_t(destType)]; // size of an output column in bytes.
-        while (row < end) {
-          for (uint32_t i = 0; i < numProps; i++) {
-            uint32_t propIdx = propIdxs[i];
-            const PLYProperty& prop = elem->properties[propIdx];
-            std::memcpy(to, row + prop.offset, colBytes);
-            to += colBytes;
-          }
-          row += elem->rowStride;
+    uint32_t find(uint32_t x)
+    {
+      uint32_t parent = m_parent[x].load(std::memory_order_relaxed);
+      while (parent != x) {
+        uint32_t grandparent = m_parent[parent].load(std::memory_order_relaxed);
+        if (grandparent != parent) {
+          m_parent[x].compare_exchange_weak(parent, grandparent, std::memory_order_relaxed);
         }
+        x = grandparent;
+        parent = m_parent[x].load(std::memory_order_relaxed);
       }
+      return x;
     }
-    else {
-      // We will have to do data type conversions on the column values here. We
-      // cannot simply use memcpy in this case, every column has to be
-      // processed separately.
-      const uint8_t* row = m_elementData.data();
-      const uint8_t* end = m_elementData.data() + m_elementData.size();
-      uint8_t* to = reinterpret_cast<uint8_t*>(dest);
-      size_t colBytes = kPLYPropertySize[uint32_t(destType)]; // size of an output column in bytes.
-      while (row < end) {
-        for (uint32_t i = 0; i < numProps; i++) {
-          uint32_t propIdx = propIdxs[i];
-          const PLYProperty& prop = elem->properties[propIdx];
-          copy_and_convert(to, destType, row + prop.offset, prop.type);
-          to += colBytes;
+
+    void unite(uint32_t a, uint32_t b)
+    {
+      while (true) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+          return;
+        }
+        if (a < b) {
+          std::swap(a, b);
+        }
+        uint32_t expected = a;
+        if (m_parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)) {
+          return;
         }
-        row += elem->rowStride;
       }
     }
 
-    return true;
-  }
+  private:
+    std::vector<std::atomic<uint32_t>> m_parent;
+  };
 
 
-  bool PLYReader::extract_properties_with_stride(const uint32_t propIdxs[], uint32_t numProps, PLYPropertyType destType, void *dest, uint32_t destStride) const
+  //
+  // Gaussian splat helpers
+  //
+
+  // Splat rows are processed in blocks of this many, so that the activation
+  // inputs for a block stay in L1 cache. Must be a multiple of 4.
+  static constexpr uint32_t kSplatBlockSize = 256;
+
+  // Columns of the per-block scratch space used for activations.
+  enum SplatColumn : uint32_t {
+    kSplatScale0, kSplatScale1, kSplatScale2,
+    kSplatOpacity,
+    kSplatRotW, kSplatRotX, kSplatRotY, kSplatRotZ,
+    kNumSplatColumns
+  };
+
+
+  static constexpr uint32_t kMaxSplatProperties = 3 + 3 + 4 + 1 + 3 + 45;
+
+  // Copies all of the property indexes in `props` into `idxs`, which must
+  // have room for `kMaxSplatProperties` entries, and returns how many there
+  // are. Assumes `props.numRest` is valid.
+  static uint32_t splat_property_indexes(const PLYSplatProperties& props, uint32_t idxs[])
   {
-    if (numProps == 0) {
-      return false;
-    }
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < 3; i++) { idxs[n++] = props.pos[i]; }
+    for (uint32_t i = 0; i < 3; i++) { idxs[n++] = props.scale[i]; }
+    for (uint32_t i = 0; i < 4; i++) { idxs[n++] = props.rot[i]; }
+    idxs[n++] = props.opacity;
+    for (uint32_t i = 0; i < 3; i++) { idxs[n++] = props.dc[i]; }
+    for (uint32_t i = 0; i < props.numRest; i++) { idxs[n++] = props.rest[i]; }
+    return n;
+  }
 
-    // The destination stride must be greater than or equal to the combined
-    // size of all properties we're extracting. Zero is treated as a special
-    // value meaning packed with no spacing.
-    const uint32_t minDestStride = numProps * kPLYPropertySize[uint32_t(destType)];
-    if (destStride == 0 || destStride == minDestStride) {
-      return extract_properties(propIdxs, numProps, destType, dest);
-    }
-    else if (destStride < minDestStride) {
-      return false;
-    }
 
-    const PLYElement* elem = element();
+#ifdef MINIPLY_HAS_SSE2
+  // Single precision exp using the Cephes polynomial, accurate to a couple of
+  // ulp. Inputs are clamped so the result is always finite and non-negative.
+  static inline __m128 exp_ps(__m128 x)
+  {
+    const __m128 one = _mm_set1_ps(1.0f);
+    x = _mm_min_ps(x, _mm_set1_ps(88.0f));
+    x = _mm_max_ps(x, _mm_set1_ps(-87.0f));
+
+    // exp(x) = 2^n * exp(r), where n = floor(x / ln(2) + 0.5).
+    __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+    __m128 rounded = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+    fx = _mm_sub_ps(rounded, _mm_and_ps(_mm_cmpgt_ps(rounded, fx), one));
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+
+    __m128 y = _mm_set1_ps(1.9875691500e-4f);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073e-3f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894e-2f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201e-1f));
+    y = _mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), x);
+    y = _mm_add_ps(y, one);
+
+    __m128i n = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(y, _mm_castsi128_ps(n));
+  }
+#endif
 
-    // Make sure all property indexes are valid and that none of the properties
-    // are lists (this function only extracts non-list data).
-    for (uint32_t i = 0; i < numProps; i++) {
-      if (propIdxs[i] >= elem->properties.size()) {
-        return false;
-      }
-    }
 
-    // Find out whether we have contiguous columns. If so, we may be able to
-    // use a more efficient data extraction technique.
-    bool contiguousCols = true;
-    uint32_t expectedOffset = elem->properties[propIdxs[0]].offset;
-    for (uint32_t i = 0; i < numProps; i++) {
-      uint32_t propIdx = propIdxs[i];
-      const PLYProperty& prop = elem->properties[propIdx];
-      if (prop.offset != expectedOffset) {
-        contiguousCols = false;
-        break;
+  // Applies the splat activations in place to the first `n` rows of `cols`,
+  // where `n` is a multiple of 4: exp for the scales, a sigmoid for the
+  // opacity and normalisation for the rotation. A zero-length rotation
+  // becomes the identity quaternion.
+  static void apply_splat_activations(float cols[kNumSplatColumns][kSplatBlockSize], uint32_t n)
+  {
+    uint32_t i = 0;
+#ifdef MINIPLY_HAS_SSE2
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i < n; i += 4) {
+      for (uint32_t c = kSplatScale0; c <= kSplatScale2; c++) {
+        _mm_storeu_ps(cols[c] + i, exp_ps(_mm_loadu_ps(cols[c] + i)));
       }
-      expectedOffset = prop.offset + kPLYPropertySize[uint32_t(prop.type)];
-    }
 
-    // If no data conversion is required, we can memcpy chunks of data
-    // directly over to `dest`. How big those chunks will be depends on whether
-    // the columns and/or rows are contiguous, as determined above.
-    bool conversionRequired = false;
-    for (uint32_t i = 0; i < numProps; i++) {
-      uint32_t propIdx = propIdxs[i];
-      const PLYProperty& prop = elem->properties[propIdx];
-      if (!compatible_types(prop.type, destType)) {
-        conversionRequired = true;
-        break;
-      }
-    }
+      __m128 opacity = _mm_loadu_ps(cols[kSplatOpacity] + i);
+      opacity = _mm_div_ps(one, _mm_add_ps(one, exp_ps(_mm_sub_ps(zero, opacity))));
+      _mm_storeu_ps(cols[kSplatOpacity] + i, opacity);
 
-    uint8_t* to = reinterpret_cast<uint8_t*>(dest);
-    if (!conversionRequired) {
-      // If no data conversion is required, we can just use memcpy to get
-      // values into dest. When the destination requires some padding between
-      // rows, the best we can do is a memcpy per row.
-      if (contiguousCols) {
-        // If the rows aren't contiguous, but the columns we're extracting
-        // within each row are, then we can do a single memcpy per row.
-        const uint8_t* from = m_elementData.data() + elem->properties[propIdxs[0]].offset;
-        const uint8_t* end = m_elementData.data() + m_elementData.size();
-        const size_t numBytes = expectedOffset - elem->properties[propIdxs[0]].offset;
-        while (from < end) {
-          std::memcpy(to, from, numBytes);
-          from += elem->rowStride;
-          to += destStride;
-        }
+      __m128 q[4];
+      __m128 len2 = zero;
+      for (uint32_t c = 0; c < 4; c++) {
+        q[c] = _mm_loadu_ps(cols[kSplatRotW + c] + i);
+        len2 = _mm_add_ps(len2, _mm_mul_ps(q[c], q[c]));
       }
-      else {
-        // If the columns aren't contiguous, we must memcpy each one separately.
-        const uint8_t* row = m_elementData.data();
-        const uint8_t* end = m_elementData.data() + m_elementData.size();
-        uint8_t* to = reinterpret_cast<uint8_t*>(dest);
-        const size_t colBytes = kPLYPropertySize[uint32_t(destType)]; // size of an output column in bytes.
-        const size_t colPadding = destStride - minDestStride;
-        while (row < end) {
-          for (uint32_t i = 0; i < numProps; i++) {
-            uint32_t propIdx = propIdxs[i];
-            const PLYProperty& prop = elem->properties[propIdx];
-            std::memcpy(to, row + prop.offset, colBytes);
-            to += colBytes;
-          }
-          row += elem->rowStride;
-          to += colPadding;
+      __m128 valid = _mm_cmpgt_ps(len2, zero);
+      __m128 invLen = _mm_div_ps(one, _mm_sqrt_ps(len2));
+      for (uint32_t c = 0; c < 4; c++) {
+        __m128 v = _mm_and_ps(valid, _mm_mul_ps(q[c], invLen));
+        if (c == 0) {
+          v = _mm_or_ps(v, _mm_andnot_ps(valid, one));
         }
+        _mm_storeu_ps(cols[kSplatRotW + c] + i, v);
       }
     }
-    else {
-      // We will have to do data type conversions on the column values here. We
-      // cannot simply use memcpy in this case, every column has to be
-      // processed separately.
-      const uint8_t* row = m_elementData.data();
-      const uint8_t* end = m_elementData.data() + m_elementData.size();
-      uint8_t* to = reinterpret_cast<uint8_t*>(dest);
-      size_t colBytes = kPLYPropertySize[uint32_t(destType)]; // size of an output column in bytes.
-      size_t colPadding = destStride - minDestStride;
-      while (row < end) {
-        for (uint32_t i = 0; i < numProps; i++) {
-          uint32_t propIdx = propIdxs[i];
-          const PLYProperty& prop = elem->properties[propIdx];
-          copy_and_convert(to, destType, row + prop.offset, prop.type);
-          to += colBytes;
+#endif
+    for (; i < n; i++) {
+      for (uint32_t c = kSplatScale0; c <= kSplatScale2; c++) {
+        cols[c][i] = std::exp(cols[c][i]);
+      }
+      cols[kSplatOpacity][i] = 1.0f / (1.0f + std::exp(-cols[kSplatOpacity][i]));
+
+      float len2 = 0.0f;
+      for (uint32_t c = kSplatRotW; c <= kSplatRotZ; c++) {
+        len2 += cols[c][i] * cols[c][i];
+      }
+      if (len2 > 0.0f) {
+        float invLen = 1.0f / std::sqrt(len2);
+        for (uint32_t c = kSplatRotW; c <= kSplatRotZ; c++) {
+          cols[c][i] *= invLen;
         }
-        row += elem->rowStride;
-        to += colPadding;
+      }
+      else {
+        cols[kSplatRotW][i] = 1.0f;
+        cols[kSplatRotX][i] = cols[kSplatRotY][i] = cols[kSplatRotZ][i] = 0.0f;
       }
     }
-
-    return true;
   }
 
 
-  const uint32_t* PLYReader::get_list_counts(uint32_t propIdx) const
+  //
+  // Aligned memory
+  //
+
+  void* aligned_malloc(size_t numBytes)
   {
-    if (!has_element() || propIdx >= element()->properties.size() || element()->properties[propIdx].countType == PLYPropertyType::None) {
-      return nullptr;
-    }
-    return element()->properties[propIdx].rowCount.data();
+  #ifdef _WIN32
+    return _aligned_malloc(numBytes, kPLYDataAlignment);
+  #else
+    // Big allocations are aligned to a huge page boundary, so they can be
+    // backed by huge pages from the first byte (see `set_huge_pages`).
+    const size_t alignment = (numBytes >= kPLYHugePageSize) ? kPLYHugePageSize : kPLYDataAlignment;
+    void* ptr = nullptr;
+    return (posix_memalign(&ptr, alignment, numBytes) == 0) ? ptr : nullptr;
+  #endif
   }
 
 
-  uint32_t PLYReader::sum_of_list_counts(uint32_t propIdx) const
+  void aligned_free(void* ptr)
   {
-    if (!has_element() || propIdx >= element()->properties.size() || element()->properties[propIdx].countType == PLYPropertyType::None) {
-      return 0;
-    }
-    const PLYProperty& prop = element()->properties[propIdx];
-    return prop.listData.size() / kPLYPropertySize[uint32_t(prop.type)];
+  #ifdef _WIN32
+    _aligned_free(ptr);
+  #else
+    free(ptr);
+  #endif
   }
 
 
-  const uint8_t* PLYReader::get_list_data(uint32_t propIdx) const
+  uint32_t num_numa_nodes()
   {
-    if (!has_element() || propIdx >= element()->properties.size() || element()->properties[propIdx].countType == PLYPropertyType::None) {
-      return nullptr;
-    }
-    return element()->properties[propIdx].listData.data();
+  #ifdef __linux__
+    return std::max(uint32_t(numa_node_cpus().size()), 1u);
+  #else
+    return 1;
+  #endif
   }
 
 
-  bool PLYReader::extract_list_property(uint32_t propIdx, PLYPropertyType destType, void *dest) const
+  bool bind_thread_to_numa_node(uint32_t node)
   {
-    if (!has_element() || propIdx >= element()->properties.size() || element()->properties[propIdx].countType == PLYPropertyType::None) {
+  #ifdef __linux__
+    const std::vector<std::vector<uint32_t>>& nodeCPUs = numa_node_cpus();
+    if (node >= nodeCPUs.size()) {
       return false;
     }
-
-    const PLYProperty& prop = element()->properties[propIdx];
-    if (compatible_types(prop.type, destType)) {
-      // If no type conversion is required, we can just copy the list data
-      // directly over with a single memcpy.
-      std::memcpy(dest, prop.listData.data(), prop.listData.size());
-    }
-    else {
-      // If type conversion is required we'll have to process each list value separately.
-      const uint8_t* from = prop.listData.data();
-      const uint8_t* end = prop.listData.data() + prop.listData.size();
-      uint8_t* to = reinterpret_cast<uint8_t*>(dest);
-      const size_t toBytes = kPLYPropertySize[uint32_t(destType)];
-      const size_t fromBytes = kPLYPropertySize[uint32_t(prop.type)];
-      while (from < end) {
-        copy_and_convert(to, destType, from, prop.type);
-        to += toBytes;
-        from += fromBytes;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (uint32_t cpu : nodeCPUs[node]) {
+      if (cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &cpus);
       }
     }
-
-    return true;
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+  #else
+    (void)node;
+    return false;
+  #endif
   }
 
 
-  uint32_t PLYReader::num_triangles(uint32_t propIdx) const
+  //
+  // Extraction paths
+  //
+
+  const char* extract_path_name(PLYExtractPath path)
   {
-    const uint32_t* counts = get_list_counts(propIdx);
-    if (counts == nullptr) {
-      return 0;
+    switch (path) {
+    case PLYExtractPath::Block:      return "block";
+    case PLYExtractPath::PerRow:     return "per-row";
+    case PLYExtractPath::PerColumn:  return "per-column";
+    case PLYExtractPath::PerValue:   return "per-value";
+    case PLYExtractPath::HalfChunks: return "half-chunks";
+    case PLYExtractPath::Invalid:    break;
     }
+    return "invalid";
+  }
 
-    const uint32_t numRows = element()->count;
-    uint32_t num = 0;
-    for (uint32_t i = 0; i < numRows; i++) {
-      if (counts[i] >= 3) {
-        num += counts[i] - 2;
-      }
+
+  //
+  // Statistics
+  //
+
+  // Number of rows gathered into a column at a time when computing property
+  // statistics.
+  static constexpr uint32_t kStatsBlockSize = 256;
+
+
+  template <class T>
+  static void gather_column(const uint8_t* src, size_t stride, uint32_t n, double dest[])
+  {
+    for (uint32_t i = 0; i < n; i++, src += stride) {
+      T val;
+      std::memcpy(&val, src, sizeof(T));
+      dest[i] = static_cast<double>(val);
     }
-    return num;
   }
 
 
-  bool PLYReader::requires_triangulation(uint32_t propIdx) const
+  // Gathers the values of a property for `n` consecutive rows into `dest`,
+  // leaving out any NaNs or infinities. Returns the number of values kept.
+  static uint32_t gather_finite_values(const uint8_t* src, size_t stride, PLYPropertyType type, uint32_t n, double dest[])
   {
-    const uint32_t* counts = get_list_counts(propIdx);
-    if (counts == nullptr) {
-      return false;
+    switch (type) {
+    case PLYPropertyType::Char:   gather_column<int8_t>(src, stride, n, dest); return n;
+    case PLYPropertyType::UChar:  gather_column<uint8_t>(src, stride, n, dest); return n;
+    case PLYPropertyType::Short:  gather_column<int16_t>(src, stride, n, dest); return n;
+    case PLYPropertyType::UShort: gather_column<uint16_t>(src, stride, n, dest); return n;
+    case PLYPropertyType::Int:    gather_column<int32_t>(src, stride, n, dest); return n;
+    case PLYPropertyType::UInt:   gather_column<uint32_t>(src, stride, n, dest); return n;
+    case PLYPropertyType::Float:  gather_column<float>(src, stride, n, dest); break;
+    case PLYPropertyType::Double: gather_column<double>(src, stride, n, dest); break;
+    case PLYPropertyType::Half:
+      for (uint32_t i = 0; i < n; i++, src += stride) {
+        uint16_t val;
+        std::memcpy(&val, src, sizeof(val));
+        dest[i] = static_cast<double>(half_to_float(val));
+      }
+      break;
+    case PLYPropertyType::None:
+      return 0;
     }
 
-    const uint32_t numRows = element()->count;
-    for (uint32_t i = 0; i < numRows; i++) {
-      if (counts[i] != 3) {
-        return true;
+    uint32_t numFinite = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      if (std::isfinite(dest[i])) {
+        dest[numFinite++] = dest[i];
       }
     }
-    return false;
+    return numFinite;
   }
 
 
-  bool PLYReader::extract_triangles(uint32_t propIdx, const float pos[], uint32_t numVerts, PLYPropertyType destType, void *dest) const
-  {
-    if (!requires_triangulation(propIdx)) {
-      return extract_list_property(propIdx, destType, dest);
-    }
+  struct StatsMoments {
+    uint64_t count  = 0;
+    double minValue = 0.0;
+    double maxValue = 0.0;
+    double mean     = 0.0;
+    double m2       = 0.0;
 
-    const PLYElement* elem = element();
-    const PLYProperty& prop = elem->properties[propIdx];
+    void add_block(const double vals[], uint32_t n)
+    {
+      if (n == 0) {
+        return;
+      }
 
-    const uint32_t* counts = prop.rowCount.data();
-    const uint8_t*  data   = prop.listData.data();
-
-    uint8_t* to = reinterpret_cast<uint8_t*>(dest);
-
-    bool convertSrc = !compatible_types(elem->properties[propIdx].type, PLYPropertyType::Int);
-    bool convertDst = !compatible_types(PLYPropertyType::Int, destType);
-
-    size_t srcValBytes  = kPLYPropertySize[uint32_t(prop.type)];
-    size_t destValBytes = kPLYPropertySize[uint32_t(destType)];
-
-    if (convertSrc && convertDst) {
-      std::vector<int> faceIndices, triIndices;
-      faceIndices.reserve(32);
-      triIndices.reserve(64);
-      const uint8_t* face = data;
-      for (uint32_t faceIdx = 0; faceIdx < elem->count; faceIdx++) {
-        const uint8_t* faceEnd = face + srcValBytes * counts[faceIdx];
-        faceIndices.clear();
-        faceIndices.reserve(counts[faceIdx]);
-        for (; face < faceEnd; face += srcValBytes) {
-          int idx = -1;
-          copy_and_convert_to(&idx, face, prop.type);
-          faceIndices.push_back(idx);
+      // Four independent lanes so that the compiler can vectorise the loops
+      // without having to reorder the floating point operations.
+      double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+      double lo[4] = { vals[0], vals[0], vals[0], vals[0] };
+      double hi[4] = { vals[0], vals[0], vals[0], vals[0] };
+      uint32_t i = 0;
+      for (; i + 4 <= n; i += 4) {
+        for (uint32_t j = 0; j < 4; j++) {
+          sum[j] += vals[i + j];
+          lo[j] = std::min(lo[j], vals[i + j]);
+          hi[j] = std::max(hi[j], vals[i + j]);
         }
+      }
+      for (; i < n; i++) {
+        sum[0] += vals[i];
+        lo[0] = std::min(lo[0], vals[i]);
+        hi[0] = std::max(hi[0], vals[i]);
+      }
 
-        triIndices.resize((counts[faceIdx] - 2) * 3);
-        triangulate_polygon(counts[faceIdx], pos, numVerts, faceIndices.data(), triIndices.data());
-        for (int idx : triIndices) {
-          copy_and_convert(to, destType, reinterpret_cast<const uint8_t*>(&idx), PLYPropertyType::Int);
-          to += destValBytes;
+      StatsMoments block;
+      block.count = n;
+      block.minValue = std::min(std::min(lo[0], lo[1]), std::min(lo[2], lo[3]));
+      block.maxValue = std::max(std::max(hi[0], hi[1]), std::max(hi[2], hi[3]));
+      block.mean = ((sum[0] + sum[1]) + (sum[2] + sum[3])) / double(n);
+
+      // The block is still in L1, so take a second pass over it for the
+      // squared differences rather than using the less accurate sum of
+      // squares.
+      double m2Lanes[4] = { 0.0, 0.0, 0.0, 0.0 };
+      for (i = 0; i + 4 <= n; i += 4) {
+        for (uint32_t j = 0; j < 4; j++) {
+          const double d = vals[i + j] - block.mean;
+          m2Lanes[j] += d * d;
         }
       }
+      for (; i < n; i++) {
+        const double d = vals[i] - block.mean;
+        m2Lanes[0] += d * d;
+      }
+      block.m2 = (m2Lanes[0] + m2Lanes[1]) + (m2Lanes[2] + m2Lanes[3]);
+
+      merge(block);
     }
-    else if (convertSrc) {
-      std::vector<int> faceIndices;
-      faceIndices.reserve(32);
-      const uint8_t* face = data;
-      for (uint32_t faceIdx = 0; faceIdx < elem->count; faceIdx++) {
-        const uint8_t* faceEnd = face + srcValBytes * counts[faceIdx];
-        faceIndices.clear();
-        faceIndices.reserve(counts[faceIdx]);
-        for (; face < faceEnd; face += srcValBytes) {
-          int idx = -1;
-          copy_and_convert_to(&idx, face, prop.type);
-          faceIndices.push_back(idx);
-        }
 
-        uint32_t numTris = triangulate_polygon(counts[faceIdx], pos, numVerts, faceIndices.data(), reinterpret_cast<int*>(to));
-        to += numTris * 3 * destValBytes;
+    // Chan, Golub & LeVeque's formula for combining the mean and M2 of two
+    // sets of values.
+    void merge(const StatsMoments& other)
+    {
+      if (other.count == 0) {
+        return;
       }
-    }
-    else if (convertDst) {
-      std::vector<int> triIndices;
-      triIndices.reserve(64);
-      const uint8_t* face = data;
-      for (uint32_t faceIdx = 0; faceIdx < elem->count; faceIdx++) {
-        triIndices.resize((counts[faceIdx] - 2) * 3);
-        triangulate_polygon(counts[faceIdx], pos, numVerts, reinterpret_cast<const int*>(face), triIndices.data());
-        for (int idx : triIndices) {
-          copy_and_convert(to, destType, reinterpret_cast<const uint8_t*>(&idx), PLYPropertyType::Int);
-          to += destValBytes;
-        }
-        face += srcValBytes * counts[faceIdx];
+      else if (count == 0) {
+        *this = other;
+        return;
       }
+      const double total = double(count + other.count);
+      const double delta = other.mean - mean;
+      mean += delta * (double(other.count) / total);
+      m2 += other.m2 + delta * delta * (double(count) * double(other.count) / total);
+      count += other.count;
+      minValue = std::min(minValue, other.minValue);
+      maxValue = std::max(maxValue, other.maxValue);
     }
-    else {
-      const uint8_t* face = data;
-      for (uint32_t faceIdx = 0; faceIdx < elem->count; faceIdx++) {
-        uint32_t numTris = triangulate_polygon(counts[faceIdx], pos, numVerts, reinterpret_cast<const int*>(face), reinterpret_cast<int*>(to));
-        face += counts[faceIdx] * srcValBytes;
-        to += numTris * 3 * destValBytes;
+  };
+
+
+  // Makes sure the histogram in `stats` covers all values from `lo` to `hi`
+  // inclusive. The first time, the range is fitted to exactly that; after
+  // that the bin width is doubled, merging pairs of bins, until it fits.
+  static void fit_histogram(PLYPropertyStats& stats, double lo, double hi)
+  {
+    const size_t numBins = stats.histogram.size();
+    if (stats.binWidth <= 0.0) {
+      stats.histogramMin = lo;
+      stats.binWidth = (hi > lo) ? (hi - lo) / double(numBins) : std::max(std::fabs(lo), 1.0) * 1e-6;
+      while (stats.histogramMin + double(numBins) * stats.binWidth < hi) {
+        stats.binWidth = std::nextafter(stats.binWidth, HUGE_VAL);
       }
+      return;
     }
 
-    return true;
+    while (lo < stats.histogramMin || hi > stats.histogramMin + double(numBins) * stats.binWidth) {
+      // Grow downwards if we need to, so the old bins become the top half of
+      // the new histogram; otherwise grow upwards.
+      const bool down = lo < stats.histogramMin;
+      const size_t base = down ? numBins / 2 : 0;
+      std::vector<uint64_t> merged(numBins, 0);
+      for (size_t i = 0; i < numBins; i++) {
+        merged[base + i / 2] += stats.histogram[i];
+      }
+      stats.histogram.swap(merged);
+      if (down) {
+        stats.histogramMin -= double(numBins) * stats.binWidth;
+      }
+      stats.binWidth *= 2.0;
+    }
   }
 
 
-  bool PLYReader::find_pos(uint32_t propIdxs[3]) const
+  static void add_to_histogram(const double vals[], uint32_t n, double histogramMin, double binWidth,
+                               uint32_t numBins, uint64_t bins[])
   {
-    return find_properties(propIdxs, 3, "x", "y", "z");
+    const double scale = 1.0 / binWidth;
+    const double lastBin = double(numBins - 1);
+    for (uint32_t i = 0; i < n; i++) {
+      const double f = (vals[i] - histogramMin) * scale;
+      bins[(f > 0.0) ? uint32_t(std::min(f, lastBin)) : 0]++;
+    }
   }
 
 
-  bool PLYReader::find_normal(uint32_t propIdxs[3]) const
-  {
-    return find_properties(propIdxs, 3, "nx", "ny", "nz");
-  }
-
+  //
+  // Random numbers
+  //
 
-  bool PLYReader::find_texcoord(uint32_t propIdxs[2]) const
-  {
-    return find_properties(propIdxs, 2, "u", "v") ||
-           find_properties(propIdxs, 2, "s", "t") ||
-           find_properties(propIdxs, 2, "texture_u", "texture_v") ||
-           find_properties(propIdxs, 2, "texture_s", "texture_t");
-  }
+  // splitmix64: tiny and fast, and plenty good enough for sampling.
+  struct SplitMix64 {
+    uint64_t state;
 
+    explicit SplitMix64(uint64_t seed) : state(seed) {}
 
-  bool PLYReader::find_color(uint32_t propIdxs[3]) const
-  {
-    return find_properties(propIdxs, 3, "r", "g", "b") ||
-           find_properties(propIdxs, 3, "red", "green", "blue"); 
-  }
+    uint64_t next()
+    {
+      state += 0x9E3779B97F4A7C15ull;
+      uint64_t z = state;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      return z ^ (z >> 31);
+    }
 
+    // Uniformly distributed in the open interval (0, 1), so it's always safe
+    // to take the log of the result.
+    double next_double()
+    {
+      return (double(next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+    }
 
-  bool PLYReader::find_indices(uint32_t propIdxs[1]) const
-  {
-    return find_properties(propIdxs, 1, "vertex_indices") || 
-           find_properties(propIdxs, 1, "vertex_index");
-  }
+    // Uniformly distributed in [0, n).
+    uint32_t next_below(uint32_t n)
+    {
+      return uint32_t(((next() >> 32) * n) >> 32);
+    }
+  };
 
 
   //
-  // PLYReader private methods
+  // Content hashing
   //
 
-  bool PLYReader::refill_buffer()
-  {
-    if (m_f == nullptr || m_atEOF) {
-      // Nothing left to read.
-      return false;
+  // The hash works through its input in 64-byte stripes, mixing each one into
+  // eight 64-bit accumulators with a different window of a 192-byte secret,
+  // and scrambles the accumulators after every 16 stripes. This is the same
+  // structure as the xxHash3 main loop: each stripe is just independent adds
+  // and 32x32 -> 64 bit multiplies, which map directly onto SSE2.
+  static constexpr size_t kHashStripeSize = 64;
+  static constexpr size_t kHashStripesPerBlock = 16;
+  static constexpr size_t kHashSecretSize = kHashStripeSize + kHashStripesPerBlock * 8;
+
+  static constexpr uint64_t kHashPrime32_1 = 0x9E3779B1ull;
+  static constexpr uint64_t kHashPrime32_2 = 0x85EBCA77ull;
+  static constexpr uint64_t kHashPrime32_3 = 0xC2B2AE3Dull;
+  static constexpr uint64_t kHashPrime64_1 = 0x9E3779B185EBCA87ull;
+  static constexpr uint64_t kHashPrime64_2 = 0xC2B2AE3D27D4EB4Full;
+  static constexpr uint64_t kHashPrime64_3 = 0x165667B19E3779F9ull;
+  static constexpr uint64_t kHashPrime64_4 = 0x85EBCA77C2B2AE63ull;
+  static constexpr uint64_t kHashPrime64_5 = 0x27D4EB2F165667C5ull;
+
+
+  struct HashSecret {
+    uint8_t bytes[kHashSecretSize];
+
+    HashSecret()
+    {
+      SplitMix64 rng(kHashPrime64_1);
+      for (size_t i = 0; i < kHashSecretSize; i += 8) {
+        const uint64_t val = rng.next();
+        std::memcpy(bytes + i, &val, sizeof(val));
+      }
     }
+  };
 
-    if (m_pos == m_buf && m_end == m_bufEnd) {
-      // Can't make any more room in the buffer!
-      return false;
-    }
 
-    // Move everything from the start of the current token onwards, to the
-    // start of the read buffer.
-    int64_t bufSize = static_cast<int64_t>(m_bufEnd - m_buf);
-    if (bufSize < kPLYReadBufferSize) {
-      m_buf[bufSize] = m_buf[kPLYReadBufferSize];
-      m_buf[kPLYReadBufferSize] = '\0';
-      m_bufEnd = m_buf + kPLYReadBufferSize;
-    }
-    size_t keep = static_cast<size_t>(m_bufEnd - m_pos);
-    if (keep > 0 && m_pos > m_buf) {
-      std::memmove(m_buf, m_pos, sizeof(char) * keep);
-      m_bufOffset += static_cast<int64_t>(m_pos - m_buf);
-    }
-    m_end = m_buf + (m_end - m_pos);
-    m_pos = m_buf;
+  static const uint8_t* hash_secret()
+  {
+    static const HashSecret secret;
+    return secret.bytes;
+  }
 
-    // Fill the remaining space in the buffer with data from the file.
-    size_t fetched = fread(m_buf + keep, sizeof(char), kPLYReadBufferSize - keep, m_f) + keep;
-    m_atEOF = fetched < kPLYReadBufferSize;
-    m_bufEnd = m_buf + fetched;
 
-    if (!m_inDataSection || m_fileType == PLYFileType::ASCII) {
-      return rewind_to_safe_char();
-    }
-    return true;
+  static inline uint64_t read_u64(const uint8_t* src)
+  {
+    uint64_t val;
+    std::memcpy(&val, src, sizeof(val));
+    return val;
   }
 
 
-  bool PLYReader::rewind_to_safe_char()
+  static inline void hash_accumulate_stripe(uint64_t acc[8], const uint8_t* data, const uint8_t* key)
   {
-    // If it looks like a token might run past the end of this buffer, move
-    // the buffer end pointer back before it & rewind the file. This way the
-    // next refill will pick up the whole of the token.
-    if (!m_atEOF && (m_bufEnd[-1] == '\n' || !is_safe_buffer_end(m_bufEnd[-1]))) {
-      const char* safe = m_bufEnd - 2;
-      // If '\n' is the last char in the buffer, then a call to `next_line()`
-      // will move `m_pos` to point at the null terminator but won't refresh
-      // the buffer. It would be clearer to fix this in `next_line()` but I
-      // believe it'll be more performant to simply treat `\n` as an unsafe
-      // character here.
-      while (safe >= m_end && (*safe == '\n' || !is_safe_buffer_end(*safe))) {
-        --safe;
-      }
-      if (safe < m_end) {
-        // No safe places to rewind to in the whole buffer!
-        return false;
-      }
-      ++safe;
-      m_buf[kPLYReadBufferSize] = *safe;
-      m_bufEnd = safe;
+  #ifdef MINIPLY_HAS_SSE2
+    for (int i = 0; i < 4; i++) {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc) + i);
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data) + i);
+      __m128i dk = _mm_xor_si128(d, _mm_loadu_si128(reinterpret_cast<const __m128i*>(key) + i));
+      __m128i product = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+      __m128i swapped = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(acc) + i, _mm_add_epi64(a, _mm_add_epi64(product, swapped)));
     }
-    m_buf[m_bufEnd - m_buf] = '\0';
-
-    return true;
+  #else
+    for (int i = 0; i < 8; i++) {
+      const uint64_t d = read_u64(data + i * 8);
+      const uint64_t dk = d ^ read_u64(key + i * 8);
+      acc[i ^ 1] += d;
+      acc[i] += (dk & 0xFFFFFFFFull) * (dk >> 32);
+    }
+  #endif
   }
 
 
-  bool PLYReader::accept()
+  static inline void hash_scramble(uint64_t acc[8], const uint8_t* key)
   {
-    m_pos = m_end;
-    return true;
+    for (int i = 0; i < 8; i++) {
+      uint64_t a = acc[i];
+      a ^= a >> 47;
+      a ^= read_u64(key + i * 8);
+      acc[i] = a * kHashPrime32_1;
+    }
   }
 
 
-  // Advances to end of line or to next non-whitespace char.
-  bool PLYReader::advance()
+  // Multiply two 64-bit values and xor the high and low halves of the 128-bit
+  // product together.
+  static inline uint64_t hash_mul_fold(uint64_t a, uint64_t b)
   {
-    m_pos = m_end;
-    while (true) {
-      while (is_whitespace(*m_pos)) {
-        ++m_pos;
-      }
-      if (m_pos == m_bufEnd) {
-        m_end = m_pos;
-        if (refill_buffer()) {
-          continue;
-        }
-        return false;
-      }
-      break;
-    }
-    m_end = m_pos;
-    return true;
+  #if defined(__SIZEOF_INT128__)
+    const __uint128_t product = __uint128_t(a) * b;
+    return uint64_t(product) ^ uint64_t(product >> 64);
+  #else
+    const uint64_t lolo = (a & 0xFFFFFFFFull) * (b & 0xFFFFFFFFull);
+    const uint64_t hilo = (a >> 32) * (b & 0xFFFFFFFFull);
+    const uint64_t lohi = (a & 0xFFFFFFFFull) * (b >> 32);
+    const uint64_t hihi = (a >> 32) * (b >> 32);
+    const uint64_t cross = (lolo >> 32) + (hilo & 0xFFFFFFFFull) + lohi;
+    const uint64_t upper = (hilo >> 32) + (cross >> 32) + hihi;
+    const uint64_t lower = (cross << 32) | (lolo & 0xFFFFFFFFull);
+    return lower ^ upper;
+  #endif
   }
 
 
-  bool PLYReader::next_line()
-  {
-    m_pos = m_end;
-    do {
-      while (*m_pos != '\n') {
-        if (m_pos == m_bufEnd) {
-          m_end = m_pos;
-          if (refill_buffer()) {
-            continue;
-          }
-          return false;
+  // Streaming version of `content_hash()`: the result is the same however the
+  // input is split up between calls to `update()`.
+  struct StreamingHash {
+    uint64_t acc[8];
+    uint8_t buffer[kHashStripeSize];  //!< Partial stripe left over from the last `update()`.
+    size_t bufferedBytes  = 0;
+    size_t stripesInBlock = 0;
+    uint64_t totalBytes   = 0;
+
+    StreamingHash() { reset(); }
+
+    void reset()
+    {
+      const uint64_t init[8] = {
+        kHashPrime32_3, kHashPrime64_1, kHashPrime64_2, kHashPrime64_3,
+        kHashPrime64_4, kHashPrime32_2, kHashPrime64_5, kHashPrime32_1
+      };
+      std::memcpy(acc, init, sizeof(acc));
+      bufferedBytes = 0;
+      stripesInBlock = 0;
+      totalBytes = 0;
+    }
+
+    void update(const void* data, size_t numBytes)
+    {
+      const uint8_t* secret = hash_secret();
+      const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+      totalBytes += numBytes;
+
+      if (bufferedBytes > 0) {
+        const size_t n = std::min(numBytes, kHashStripeSize - bufferedBytes);
+        std::memcpy(buffer + bufferedBytes, src, n);
+        bufferedBytes += n;
+        src += n;
+        numBytes -= n;
+        if (bufferedBytes < kHashStripeSize) {
+          return;
         }
-        ++m_pos;
+        consume_stripe(buffer, secret);
+        bufferedBytes = 0;
       }
-      ++m_pos; // move past the newline char
-      m_end = m_pos;
-    } while (match("comment") || match("obj_info"));
-
-    return true;
-  }
 
+      while (numBytes >= kHashStripeSize) {
+        consume_stripe(src, secret);
+        src += kHashStripeSize;
+        numBytes -= kHashStripeSize;
+      }
 
-  bool PLYReader::match(const char* str)
-  {
-    m_end = m_pos;
-    while (m_end < m_bufEnd && *str != '\0' && *m_end == *str) {
-      ++m_end;
-      ++str;
-    }
-    if (*str != '\0') {
-      return false;
+      if (numBytes > 0) {
+        std::memcpy(buffer, src, numBytes);
+        bufferedBytes = numBytes;
+      }
     }
-    return true;
-  }
 
+    uint64_t digest() const
+    {
+      const uint8_t* secret = hash_secret();
+      uint64_t finalAcc[8];
+      std::memcpy(finalAcc, acc, sizeof(finalAcc));
+      if (bufferedBytes > 0) {
+        // Zero padding is fine here because the length gets mixed in below.
+        uint8_t last[kHashStripeSize] = {};
+        std::memcpy(last, buffer, bufferedBytes);
+        hash_accumulate_stripe(finalAcc, last, secret + stripesInBlock * 8);
+      }
 
-  bool PLYReader::which(const char* values[], uint32_t* index)
-  {
-    for (uint32_t i = 0; values[i] != nullptr; i++) {
-      if (keyword(values[i])) {
-        *index = i;
-        return true;
+      uint64_t h = totalBytes * kHashPrime64_1;
+      for (int i = 0; i < 4; i++) {
+        h += hash_mul_fold(finalAcc[i * 2] ^ read_u64(secret + 11 + i * 16),
+                           finalAcc[i * 2 + 1] ^ read_u64(secret + 19 + i * 16));
       }
+      h ^= h >> 37;
+      h *= 0x165667919E3779F9ull;
+      h ^= h >> 32;
+      return h;
     }
-    return false;
-  }
-
 
-  bool PLYReader::which_property_type(PLYPropertyType* type)
-  {
-    for (uint32_t i = 0; kTypeAliases[i].name != nullptr; i++) {
-      if (keyword(kTypeAliases[i].name)) {
-        *type = kTypeAliases[i].type;
-        return true;
+  private:
+    void consume_stripe(const uint8_t* stripe, const uint8_t* secret)
+    {
+      hash_accumulate_stripe(acc, stripe, secret + stripesInBlock * 8);
+      if (++stripesInBlock == kHashStripesPerBlock) {
+        hash_scramble(acc, secret + kHashSecretSize - kHashStripeSize);
+        stripesInBlock = 0;
       }
     }
-    return false;
-  }
+  };
 
 
-  bool PLYReader::keyword(const char* kw)
+  struct PLYReader::HashState {
+    StreamingHash element;              //!< Running hash of the current element.
+    int64_t offset = 0;                 //!< File offset up to which the data has been hashed.
+    uint64_t header = 0;
+    std::vector<uint64_t> elements;     //!< Hash for each element, or zero if it hasn't been finished yet.
+    size_t numFinished = 0;             //!< Elements before this index have been completely hashed.
+  };
+
+
+  uint64_t content_hash(const void* data, size_t numBytes)
   {
-    return match(kw) && !is_keyword_part(*m_end);
+    StreamingHash hash;
+    hash.update(data, numBytes);
+    return hash.digest();
   }
 
 
-  bool PLYReader::identifier(char* dest, size_t destLen)
-  {
-    m_end = m_pos;
-    if (!is_keyword_start(*m_end) || destLen == 0) {
+  //
+  // PLYElement methods
+  //
+
+  void PLYElement::calculate_offsets()
+  {
+    fixedSize = true;
+    for (PLYProperty& prop : properties) {
+      if (prop.countType != PLYPropertyType::None) {
+        fixedSize = false;
+        break;
+      }
+    }
+
+    // Note that each list property gets its own separate storage. Only fixed
+    // size properties go into the common data block. The `rowStride` is the
+    // size of a row in the common data block.
+    rowStride = 0;
+    for (PLYProperty& prop : properties) {
+      if (prop.countType != PLYPropertyType::None) {
+        continue;
+      }
+      prop.offset = rowStride;
+      rowStride += kPLYPropertySize[uint32_t(prop.type)];
+    }
+  }
+
+
+  uint32_t PLYElement::find_property(const char *propName) const
+  {
+    for (uint32_t i = 0, endI = uint32_t(properties.size()); i < endI; i++) {
+      if (strcmp(propName, properties.at(i).name.c_str()) == 0) {
+        return i;
+      }
+    }
+    return kInvalidIndex;
+  }
+
+
+  bool PLYElement::find_properties(uint32_t propIdxs[], uint32_t numIdxs, ...) const
+  {
+    va_list args;
+    va_start(args, numIdxs);
+    bool foundAll = find_properties_va(propIdxs, numIdxs, args);
+    va_end(args);
+    return foundAll;
+  }
+
+
+  bool PLYElement::find_properties_va(uint32_t propIdxs[], uint32_t numIdxs, va_list names) const
+  {
+    for (uint32_t i = 0; i < numIdxs; i++) {
+      propIdxs[i] = find_property(va_arg(names, const char*));
+      if (propIdxs[i] == kInvalidIndex) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+
+  bool PLYElement::convert_list_to_fixed_size(uint32_t listPropIdx, uint32_t listSize, uint32_t newPropIdxs[])
+  {
+    if (fixedSize || listPropIdx >= properties.size() || properties[listPropIdx].countType == PLYPropertyType::None) {
+      return false;
+    }
+
+    PLYProperty oldListProp = properties[listPropIdx];
+
+    // If the generated names are less than 256 chars, we will use an array on
+    // the stack as temporary storage. In the rare case that they're longer,
+    // we'll allocate an array of sufficient size on the heap and use that
+    // instead. This means we'll avoid allocating in all but the most extreme
+    // cases.
+    char inlineBuf[256];
+    size_t nameBufSize = oldListProp.name.size() + 12; // the +12 allows space for an '_', a number up to 10 digits long and the terminating null.
+    char* nameBuf = inlineBuf;
+    if (nameBufSize > sizeof(inlineBuf)) {
+      nameBuf = new char[nameBufSize];
+    }
+
+    // Set up a property for the list count column.
+    PLYProperty& countProp = properties[listPropIdx];
+    snprintf(nameBuf, nameBufSize, "%s_count", oldListProp.name.c_str());
+    countProp.name = nameBuf;
+    countProp.type = oldListProp.countType;
+    countProp.countType = PLYPropertyType::None;
+    countProp.stride = kPLYPropertySize[uint32_t(oldListProp.countType)];
+
+    if (listSize > 0) {
+      // Set up additional properties for the list entries, 1 per entry.
+      if (listPropIdx + 1 == properties.size()) {
+        properties.resize(properties.size() + listSize);
+      }
+      else {
+        properties.insert(properties.begin() + listPropIdx + 1, listSize, PLYProperty());
+      }
+
+      for (uint32_t i = 0; i < listSize; i++) {
+        uint32_t propIdx = listPropIdx + 1 + i;
+
+        PLYProperty& itemProp = properties[propIdx];
+        snprintf(nameBuf, nameBufSize, "%s_%u", oldListProp.name.c_str(), i);
+        itemProp.name = nameBuf;
+        itemProp.type = oldListProp.type;
+        itemProp.countType = PLYPropertyType::None;
+        itemProp.stride = kPLYPropertySize[uint32_t(oldListProp.type)];
+
+        newPropIdxs[i] = propIdx;
+      }
+    }
+
+    if (nameBuf != inlineBuf) {
+      delete[] nameBuf;
+    }
+
+    calculate_offsets();
+    return true;
+  }
+
+
+  uint32_t PLYElement::add_row_padding(uint32_t alignment)
+  {
+    if (!fixedSize || alignment <= 1 || rowStride % alignment == 0) {
+      return 0;
+    }
+
+    const uint32_t padding = alignment - rowStride % alignment;
+    char name[32];
+    for (uint32_t i = 0; i < padding; i++) {
+      snprintf(name, sizeof(name), "pad_%u", i);
+      properties.push_back(PLYProperty());
+      PLYProperty& pad = properties.back();
+      pad.name = name;
+      pad.type = PLYPropertyType::UChar;
+      pad.stride = 1;
+    }
+    calculate_offsets();
+    return padding;
+  }
+
+
+  //
+  // PLYReader methods
+  //
+
+  PLYReader::PLYReader(const char* filename) :
+    m_filename(filename)
+  {
+    m_buf = new char[kPLYReadBufferSize + 1];
+    m_buf[kPLYReadBufferSize] = '\0';
+
+    m_tmpBuf = new char[kPLYTempBufferSize + 1];
+    m_tmpBuf[kPLYTempBufferSize] = '\0';
+
+    m_bufEnd = m_buf + kPLYReadBufferSize;
+    m_pos = m_bufEnd;
+    m_end = m_bufEnd;
+
+    if (file_open(&m_f, filename, "rb") != 0) {
+      m_f = nullptr;
+      m_valid = false;
+      return;
+    }
+    m_valid = true;
+
+    refill_buffer();
+
+    m_valid = keyword("ply") && next_line() &&
+              keyword("format") && advance() &&
+              typed_which(kPLYFileTypes, &m_fileType) && advance() &&
+              int_literal(&m_majorVersion) && advance() &&
+              match(".") && advance() &&
+              int_literal(&m_minorVersion) && next_line() &&
+              parse_elements() &&
+              keyword("end_header") && advance() && match("\n") && accept();
+
+    // The temp buffer is only needed for parsing the header. Freeing it here
+    // means the reader holds no scratch memory which the const methods could
+    // share (see the thread safety notes on `PLYReader`).
+    delete[] m_tmpBuf;
+    m_tmpBuf = nullptr;
+
+    if (!m_valid) {
+      return;
+    }
+    m_inDataSection = true;
+    m_dataOffset = m_bufOffset + static_cast<int64_t>(m_pos - m_buf);
+    if (m_fileType == PLYFileType::ASCII) {
+      advance();
+    }
+
+    for (PLYElement& elem : m_elements) {
+      elem.calculate_offsets();
+    }
+  }
+
+
+  PLYReader::~PLYReader()
+  {
+    if (m_f != nullptr) {
+      fclose(m_f);
+    }
+  #ifndef _WIN32
+    if (m_directFD >= 0) {
+      close(m_directFD);
+    }
+  #endif
+    delete[] m_buf;
+    delete[] m_tmpBuf;
+    delete m_hash;
+  }
+
+
+  bool PLYReader::valid() const
+  {
+    return m_valid;
+  }
+
+
+  bool PLYReader::has_element() const
+  {
+    return m_valid && m_currentElement < m_elements.size();
+  }
+
+
+  const PLYElement* PLYReader::element() const
+  {
+    assert(has_element());
+    return &m_elements[m_currentElement];
+  }
+
+
+  bool PLYReader::load_element()
+  {
+    assert(has_element());
+    if (m_elementLoaded) {
+      return true;
+    }
+    else if (m_rowsRead > 0) {
+      // Some rows have already been consumed by `load_element_rows`.
+      return false;
+    }
+
+    PLYElement& elem = m_elements[m_currentElement];
+    MINIPLY_PROBE(element__load__start, elem.name.c_str(), elem.count, int(m_fileType));
+    bool ok = elem.fixedSize ? load_fixed_size_element(elem) : load_variable_size_element(elem);
+    MINIPLY_PROBE(element__load__done, elem.name.c_str(), elem.count, uint64_t(m_elementData.size()), int(ok));
+    if (ok) {
+      finish_element_hash(m_currentElement);
+    }
+    return ok;
+  }
+
+
+  void PLYReader::set_worker_placement(PLYWorkerPlacement placement)
+  {
+    m_placement = placement;
+  }
+
+
+  PLYWorkerPlacement PLYReader::worker_placement() const
+  {
+    return m_placement;
+  }
+
+
+  void PLYReader::set_huge_pages(bool enable)
+  {
+    m_hugePages = enable;
+  }
+
+
+  bool PLYReader::huge_pages() const
+  {
+    return m_hugePages;
+  }
+
+
+  bool PLYReader::set_direct_io(bool enable)
+  {
+  #ifndef _WIN32
+    if (!enable && m_directFD >= 0) {
+      close(m_directFD);
+      m_directFD = -1;
+    }
+    else if (enable && m_directFD < 0) {
+      m_directFD = file_open_direct(m_filename.c_str());
+    }
+  #endif
+    return (m_directFD >= 0) == enable;
+  }
+
+
+  bool PLYReader::direct_io() const
+  {
+    return m_directFD >= 0;
+  }
+
+
+  bool PLYReader::set_content_hashing(bool enable)
+  {
+    if (!enable) {
+      delete m_hash;
+      m_hash = nullptr;
+      return true;
+    }
+    else if (m_hash != nullptr) {
+      return true;
+    }
+    else if (!m_valid || m_currentElement > 0 || m_elementLoaded || m_rowsRead > 0) {
+      return false;
+    }
+
+    // The header has already been parsed by now, so this hashes it from the
+    // read buffer if it's all still there, or reads it again if not.
+    m_hash = new HashState();
+    m_hash->elements.resize(m_elements.size(), 0);
+    if (!hash_file_range(0, m_dataOffset)) {
+      delete m_hash;
+      m_hash = nullptr;
+      return false;
+    }
+    m_hash->header = m_hash->element.digest();
+    m_hash->element.reset();
+    return true;
+  }
+
+
+  bool PLYReader::content_hashing() const
+  {
+    return m_hash != nullptr;
+  }
+
+
+  uint64_t PLYReader::header_hash() const
+  {
+    return (m_hash != nullptr) ? m_hash->header : 0;
+  }
+
+
+  uint64_t PLYReader::element_hash(uint32_t idx) const
+  {
+    return (m_hash != nullptr && idx < m_hash->numFinished) ? m_hash->elements[idx] : 0;
+  }
+
+
+  uint64_t PLYReader::file_hash() const
+  {
+    if (m_hash == nullptr || m_hash->numFinished < m_elements.size()) {
+      return 0;
+    }
+    StreamingHash hash;
+    hash.update(&m_hash->header, sizeof(uint64_t));
+    hash.update(m_hash->elements.data(), m_hash->elements.size() * sizeof(uint64_t));
+    return hash.digest();
+  }
+
+
+  uint32_t PLYReader::load_element_rows(uint32_t maxRows)
+  {
+    assert(has_element());
+    PLYElement& elem = m_elements[m_currentElement];
+    if (!elem.fixedSize || m_elementLoaded) {
+      return 0;
+    }
+
+    uint32_t numRows = elem.count - m_rowsRead;
+    if (numRows > maxRows) {
+      numRows = maxRows;
+    }
+    MINIPLY_PROBE(rows__load, elem.name.c_str(), m_rowsRead, numRows);
+    if (!load_fixed_size_rows(elem, numRows)) {
+      m_numLoadedRows = 0;
+      return 0;
+    }
+    m_rowsRead += numRows;
+    m_numLoadedRows = numRows;
+    if (m_rowsRead == elem.count) {
+      finish_element_hash(m_currentElement);
+    }
+    return numRows;
+  }
+
+
+  uint32_t PLYReader::sample_element_rows(uint32_t numSamples, uint64_t seed, uint32_t rowIndices[])
+  {
+    assert(has_element());
+    PLYElement& elem = m_elements[m_currentElement];
+    if (!elem.fixedSize || m_elementLoaded || m_rowsRead > 0 || numSamples == 0) {
+      return 0;
+    }
+
+    // Fill the reservoir with the first rows of the element.
+    const uint32_t numRows = std::min(numSamples, elem.count);
+    MINIPLY_PROBE(rows__load, elem.name.c_str(), m_rowsRead, numRows);
+    if (!load_fixed_size_rows(elem, numRows)) {
+      m_numLoadedRows = 0;
+      return 0;
+    }
+    m_rowsRead = numRows;
+
+    std::vector<uint32_t> sampled(numRows);
+    for (uint32_t i = 0; i < numRows; i++) {
+      sampled[i] = i;
+    }
+
+    // Algorithm L (Li, 1994). Rather than drawing a random number for every
+    // row, this draws the number of rows to skip before the next one which
+    // replaces a random entry in the reservoir. The skips get longer as we
+    // go, so only about numRows * log(count / numRows) rows are ever read.
+    SplitMix64 rng(seed);
+    double w = std::exp(std::log(rng.next_double()) / numRows);
+    uint64_t row = numRows - 1;
+    while (true) {
+      const double skip = std::floor(std::log(rng.next_double()) / std::log1p(-w));
+      if (!(skip < double(elem.count))) {
+        break;
+      }
+      row += uint64_t(skip) + 1;
+      if (row >= elem.count) {
+        break;
+      }
+
+      const uint32_t slot = rng.next_below(numRows);
+      if (!skip_rows(elem, uint32_t(row) - m_rowsRead) || !load_fixed_size_row(elem, size_t(slot) * elem.rowStride)) {
+        m_numLoadedRows = 0;
+        return 0;
+      }
+      m_rowsRead = uint32_t(row) + 1;
+      sampled[slot] = uint32_t(row);
+      w *= std::exp(std::log(rng.next_double()) / numRows);
+    }
+
+    if (!skip_rows(elem, elem.count - m_rowsRead)) {
+      m_numLoadedRows = 0;
+      return 0;
+    }
+    m_rowsRead = elem.count;
+    finish_element_hash(m_currentElement);
+
+    // Put the sampled rows back into file order.
+    std::vector<uint32_t> order(numRows);
+    for (uint32_t i = 0; i < numRows; i++) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sampled[a] < sampled[b]; });
+    PLYDataBuffer rows(m_elementData.size());
+    for (uint32_t i = 0; i < numRows; i++) {
+      std::memcpy(rows.data() + size_t(i) * elem.rowStride, m_elementData.data() + size_t(order[i]) * elem.rowStride, elem.rowStride);
+      if (rowIndices != nullptr) {
+        rowIndices[i] = sampled[order[i]];
+      }
+    }
+    m_elementData.swap(rows);
+
+    m_numLoadedRows = numRows;
+    return numRows;
+  }
+
+
+  uint32_t PLYReader::num_loaded_rows() const
+  {
+    return m_numLoadedRows;
+  }
+
+
+  const uint8_t* PLYReader::get_element_data() const
+  {
+    return m_elementData.data();
+  }
+
+
+  PLYDataBuffer PLYReader::take_element_data()
+  {
+    PLYDataBuffer data;
+    data.swap(m_elementData);
+    m_numLoadedRows = 0;
+    return data;
+  }
+
+
+  const uint8_t* PLYReader::get_property_data(uint32_t propIdx, uint32_t* stride) const
+  {
+    if (!has_element() || propIdx >= element()->properties.size() || element()->properties[propIdx].countType != PLYPropertyType::None) {
+      return nullptr;
+    }
+    if (stride != nullptr) {
+      *stride = element()->rowStride;
+    }
+    return m_elementData.data() + element()->properties[propIdx].offset;
+  }
+
+
+  void PLYReader::next_element()
+  {
+    if (!has_element()) {
+      return;
+    }
+
+    // If the element was loaded, the read buffer should already be positioned at
+    // the start of the next element.
+    PLYElement& elem = m_elements[m_currentElement];
+    m_currentElement++;
+
+    // If some rows were loaded via `load_element_rows`, we only need to skip
+    // past the remaining ones.
+    const uint32_t rowsRemaining = elem.count - m_rowsRead;
+    const bool anyRowsRead = m_rowsRead > 0;
+    m_rowsRead = 0;
+    m_numLoadedRows = 0;
+
+    if (anyRowsRead && !m_elementLoaded) {
+      m_elementData.clear();
+    }
+
+    if (m_elementLoaded) {
+      // Clear any temporary storage used for list properties in the current element.
+      for (PLYProperty& prop : elem.properties) {
+        if (prop.countType == PLYPropertyType::None) {
+          continue;
+        }
+        prop.listData.clear();
+        prop.listData.shrink_to_fit();
+        prop.rowCount.clear();
+        prop.rowCount.shrink_to_fit();
+      }
+
+      // Clear temporary storage for the non-list properties in the current element.
+      m_elementData.clear();
+      m_elementLoaded = false;
+      return;
+    }
+
+    // If the element wasn't loaded, we have to move the file pointer past its
+    // contents. How we do that depends on whether this is an ASCII or binary
+    // file and, if it's a binary, whether the element is fixed or variable
+    // size.
+    if (m_fileType == PLYFileType::ASCII || elem.fixedSize) {
+      if (!skip_rows(elem, rowsRemaining)) {
+        return;
+      }
+    }
+    else if (m_fileType == PLYFileType::Binary) {
+      for (uint32_t row = 0; row < rowsRemaining; row++) {
+        for (const PLYProperty& prop : elem.properties) {
+          if (prop.countType == PLYPropertyType::None) {
+            uint32_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
+            if (m_pos + numBytes > m_bufEnd) {
+              if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
+                m_valid = false;
+                return;
+              }
+            }
+            m_pos += numBytes;
+            m_end = m_pos;
+            continue;
+          }
+
+          uint32_t numBytes = kPLYPropertySize[uint32_t(prop.countType)];
+          if (m_pos + numBytes > m_bufEnd) {
+            if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
+              m_valid = false;
+              return;
+            }
+          }
+
+          int count = 0;
+          copy_and_convert_to(&count, reinterpret_cast<const uint8_t*>(m_pos), prop.countType);
+
+          if (count < 0) {
+            m_valid = false;
+            return;
+          }
+
+          numBytes += uint32_t(count) * kPLYPropertySize[uint32_t(prop.type)];
+          if (m_pos + numBytes > m_bufEnd) {
+            if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
+              m_valid = false;
+              return;
+            }
+          }
+          m_pos += numBytes;
+          m_end = m_pos;
+        }
+      }
+    }
+    else { // PLYFileType::BinaryBigEndian
+      for (uint32_t row = 0; row < rowsRemaining; row++) {
+        for (const PLYProperty& prop : elem.properties) {
+          if (prop.countType == PLYPropertyType::None) {
+            uint32_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
+            if (m_pos + numBytes > m_bufEnd) {
+              if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
+                m_valid = false;
+                return;
+              }
+            }
+            m_pos += numBytes;
+            m_end = m_pos;
+            continue;
+          }
+
+          uint32_t numBytes = kPLYPropertySize[uint32_t(prop.countType)];
+          if (m_pos + numBytes > m_bufEnd) {
+            if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
+              m_valid = false;
+              return;
+            }
+          }
+
+          int count = 0;
+          uint8_t tmp[8];
+          memcpy(tmp, m_pos, numBytes);
+          endian_swap(tmp, prop.countType);
+          copy_and_convert_to(&count, tmp, prop.countType);
+
+          if (count < 0) {
+            m_valid = false;
+            return;
+          }
+
+          numBytes += uint32_t(count) * kPLYPropertySize[uint32_t(prop.type)];
+          if (m_pos + numBytes > m_bufEnd) {
+            if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
+              m_valid = false;
+              return;
+            }
+          }
+
+          m_pos += numBytes;
+          m_end = m_pos;
+        }
+      }
+    }
+
+    finish_element_hash(m_currentElement - 1);
+  }
+
+
+  PLYFileType PLYReader::file_type() const
+  {
+    return m_fileType;
+  }
+
+
+  int PLYReader::version_major() const
+  {
+    return m_majorVersion;
+  }
+
+
+  int PLYReader::version_minor() const
+  {
+    return m_minorVersion;
+  }
+
+
+  int64_t PLYReader::data_offset() const
+  {
+    return m_dataOffset;
+  }
+
+
+  uint32_t PLYReader::num_elements() const
+  {
+    return m_valid ? static_cast<uint32_t>(m_elements.size()) : 0;
+  }
+
+
+  uint32_t PLYReader::find_element(const char* name) const
+  {
+    for (uint32_t i = 0, endI = num_elements(); i < endI; i++) {
+      const PLYElement& elem = m_elements[i];
+      if (strcmp(elem.name.c_str(), name) == 0) {
+        return i;
+      }
+    }
+    return kInvalidIndex;
+  }
+
+
+  PLYElement* PLYReader::get_element(uint32_t idx)
+  {
+    return (idx < num_elements()) ? &m_elements[idx] : nullptr;
+  }
+
+
+  const PLYElement* PLYReader::get_element(uint32_t idx) const
+  {
+    return (idx < num_elements()) ? &m_elements[idx] : nullptr;
+  }
+
+
+  bool PLYReader::element_is(const char* name) const
+  {
+    return has_element() && strcmp(element()->name.c_str(), name) == 0;
+  }
+
+
+  uint32_t PLYReader::num_rows() const
+  {
+    return has_element() ? element()->count : 0;
+  }
+
+
+  uint32_t PLYReader::find_property(const char* name) const
+  {
+    return has_element() ? element()->find_property(name) : kInvalidIndex;
+  }
+
+
+  bool PLYReader::find_properties(uint32_t propIdxs[], uint32_t numIdxs, ...) const
+  {
+    if (!has_element()) {
+      return false;
+    }
+    va_list args;
+    va_start(args, numIdxs);
+    bool foundAll = element()->find_properties_va(propIdxs, numIdxs, args);
+    va_end(args);
+    return foundAll;
+  }
+
+
+  bool PLYReader::extract_properties(const uint32_t propIdxs[], uint32_t numProps, PLYPropertyType destType, void *dest) const
+  {
+    const PLYElement* elem = element();
+    const PLYExtractPlan plan = plan_extraction(elem, propIdxs, numProps, destType, true);
+    if (plan.path == PLYExtractPath::Invalid) {
+      return false;
+    }
+
+    MINIPLY_PROBE(extract__properties, elem->name.c_str(), numProps, m_numLoadedRows, int(destType));
+
+    const uint8_t* row = m_elementData.data();
+    const uint8_t* end = row + size_t(m_numLoadedRows) * elem->rowStride;
+    uint8_t* to = reinterpret_cast<uint8_t*>(dest);
+    const size_t colBytes = kPLYPropertySize[uint32_t(destType)]; // size of an output column in bytes.
+
+    switch (plan.path) {
+    case PLYExtractPath::Block:
+      // Most efficient case is when the rows are contiguous. It means we're
+      // simply copying the entire data block for this element, which we can
+      // do with a single memcpy.
+      std::memcpy(to, row, size_t(end - row));
+      break;
+
+    case PLYExtractPath::PerRow:
+      // If the rows aren't contiguous, but the columns we're extracting
+      // within each row are, then we can do a single memcpy per row.
+      for (row += plan.firstOffset; row < end; row += elem->rowStride) {
+        std::memcpy(to, row, plan.numBytes);
+        to += plan.numBytes;
+      }
+      break;
+
+    case PLYExtractPath::PerColumn:
+      // If the columns aren't contiguous, we must memcpy each one separately.
+      for (; row < end; row += elem->rowStride) {
+        for (uint32_t i = 0; i < numProps; i++) {
+          const PLYProperty& prop = elem->properties[propIdxs[i]];
+          std::memcpy(to, row + prop.offset, colBytes);
+          to += colBytes;
+        }
+      }
+      break;
+
+    case PLYExtractPath::PerValue:
+      // We will have to do data type conversions on the column values here. We
+      // cannot simply use memcpy in this case, every column has to be
+      // processed separately.
+      for (; row < end; row += elem->rowStride) {
+        for (uint32_t i = 0; i < numProps; i++) {
+          const PLYProperty& prop = elem->properties[propIdxs[i]];
+          copy_and_convert(to, destType, row + prop.offset, prop.type);
+          to += colBytes;
+        }
+      }
+      break;
+
+    case PLYExtractPath::HalfChunks:
+      extract_rows_as_half(elem, m_elementData.data(), m_numLoadedRows, propIdxs, numProps, to, numProps * sizeof(uint16_t));
+      break;
+
+    case PLYExtractPath::Invalid:
+      break;
+    }
+
+    return true;
+  }
+
+
+  bool PLYReader::extract_properties_with_stride(const uint32_t propIdxs[], uint32_t numProps, PLYPropertyType destType, void *dest, uint32_t destStride) const
+  {
+    if (numProps == 0) {
+      return false;
+    }
+
+    // The destination stride must be greater than or equal to the combined
+    // size of all properties we're extracting. Zero is treated as a special
+    // value meaning packed with no spacing.
+    const uint32_t minDestStride = numProps * kPLYPropertySize[uint32_t(destType)];
+    if (destStride == 0 || destStride == minDestStride) {
+      return extract_properties(propIdxs, numProps, destType, dest);
+    }
+    else if (destStride < minDestStride) {
+      return false;
+    }
+
+    const PLYElement* elem = element();
+    const PLYExtractPlan plan = plan_extraction(elem, propIdxs, numProps, destType, false);
+    if (plan.path == PLYExtractPath::Invalid) {
+      return false;
+    }
+
+    MINIPLY_PROBE(extract__properties, elem->name.c_str(), numProps, m_numLoadedRows, int(destType));
+
+    const uint8_t* row = m_elementData.data();
+    const uint8_t* end = row + size_t(m_numLoadedRows) * elem->rowStride;
+    uint8_t* to = reinterpret_cast<uint8_t*>(dest);
+    const size_t colBytes = kPLYPropertySize[uint32_t(destType)]; // size of an output column in bytes.
+    const size_t colPadding = destStride - minDestStride;
+
+    // When the destination requires some padding between rows, the best we
+    // can do is a memcpy per row, so the planner never picks Block here.
+    switch (plan.path) {
+    case PLYExtractPath::PerRow:
+      for (row += plan.firstOffset; row < end; row += elem->rowStride) {
+        std::memcpy(to, row, plan.numBytes);
+        to += destStride;
+      }
+      break;
+
+    case PLYExtractPath::PerColumn:
+      for (; row < end; row += elem->rowStride) {
+        for (uint32_t i = 0; i < numProps; i++) {
+          const PLYProperty& prop = elem->properties[propIdxs[i]];
+          std::memcpy(to, row + prop.offset, colBytes);
+          to += colBytes;
+        }
+        to += colPadding;
+      }
+      break;
+
+    case PLYExtractPath::PerValue:
+      for (; row < end; row += elem->rowStride) {
+        for (uint32_t i = 0; i < numProps; i++) {
+          const PLYProperty& prop = elem->properties[propIdxs[i]];
+          copy_and_convert(to, destType, row + prop.offset, prop.type);
+          to += colBytes;
+        }
+        to += colPadding;
+      }
+      break;
+
+    case PLYExtractPath::HalfChunks:
+      extract_rows_as_half(elem, m_elementData.data(), m_numLoadedRows, propIdxs, numProps, to, destStride);
+      break;
+
+    case PLYExtractPath::Block:
+    case PLYExtractPath::Invalid:
+      break;
+    }
+
+    return true;
+  }
+
+
+  bool PLYReader::explain_extraction(const uint32_t propIdxs[], uint32_t numProps, PLYPropertyType destType, uint32_t destStride, PLYExtractExplanation* explanation) const
+  {
+    if (explanation == nullptr) {
+      return false;
+    }
+    *explanation = PLYExtractExplanation();
+    PLYExtractExplanation& ex = *explanation;
+
+    if (!has_element()) {
+      ex.reason = "there is no current element";
+      return false;
+    }
+    if (numProps == 0) {
+      ex.reason = "no properties were requested";
+      return false;
+    }
+    if (destType >= PLYPropertyType::None) {
+      ex.reason = "the destination type is invalid";
+      return false;
+    }
+
+    const PLYElement* elem = element();
+    for (uint32_t i = 0; i < numProps; i++) {
+      if (propIdxs[i] >= elem->properties.size()) {
+        ex.reason = "property index " + std::to_string(propIdxs[i]) + " is out of range";
+        return false;
+      }
+      if (elem->properties[propIdxs[i]].countType != PLYPropertyType::None) {
+        ex.reason = "'" + elem->properties[propIdxs[i]].name + "' is a list property; use extract_list_property instead";
+        return false;
+      }
+    }
+
+    const uint32_t destValBytes = kPLYPropertySize[uint32_t(destType)];
+    const uint32_t minDestStride = numProps * destValBytes;
+    if (destStride != 0 && destStride < minDestStride) {
+      ex.reason = "the destination stride (" + std::to_string(destStride) + " bytes) is smaller than the " +
+                  std::to_string(minDestStride) + " bytes needed for each row";
+      return false;
+    }
+    const bool packedDest = (destStride == 0 || destStride == minDestStride);
+
+    const PLYExtractPlan plan = plan_extraction(elem, propIdxs, numProps, destType, packedDest);
+    const uint64_t numRows = (m_elementLoaded || m_numLoadedRows > 0) ? m_numLoadedRows : elem->count;
+    ex.path = plan.path;
+    ex.contiguousColumns = plan.contiguousCols;
+    ex.wholeRow = plan.contiguousRows;
+    ex.conversionRequired = plan.conversionRequired;
+    ex.numBytes = numRows * minDestStride;
+
+    // Whether all of the properties have the same type, which would let the
+    // caller avoid conversions by extracting to that type instead.
+    const PLYPropertyType srcType = elem->properties[propIdxs[0]].type;
+    bool sameSrcType = true;
+    for (uint32_t i = 1; i < numProps; i++) {
+      sameSrcType = sameSrcType && (elem->properties[propIdxs[i]].type == srcType);
+    }
+
+    // Whether the properties would be contiguous if they were requested in
+    // file order instead.
+    std::vector<uint32_t> sortedIdxs(propIdxs, propIdxs + numProps);
+    std::sort(sortedIdxs.begin(), sortedIdxs.end(), [elem](uint32_t a, uint32_t b) {
+      return elem->properties[a].offset < elem->properties[b].offset;
+    });
+    bool contiguousWhenSorted = true;
+    for (uint32_t i = 1; i < numProps; i++) {
+      const PLYProperty& prev = elem->properties[sortedIdxs[i - 1]];
+      contiguousWhenSorted = contiguousWhenSorted &&
+          (elem->properties[sortedIdxs[i]].offset == prev.offset + kPLYPropertySize[uint32_t(prev.type)]);
+    }
+
+    const std::string destTypeName = kPLYPropertyTypeNames[uint32_t(destType)];
+    switch (plan.path) {
+    case PLYExtractPath::Block:
+      ex.numOperations = 1;
+      ex.reason = "the properties cover every byte of each row in file order and need no conversion, "
+                  "so all rows are copied with a single memcpy";
+      break;
+
+    case PLYExtractPath::PerRow:
+      ex.numOperations = numRows;
+      if (plan.contiguousRows) {
+        ex.reason = "the properties cover the whole row, but the destination stride (" + std::to_string(destStride) +
+                    " bytes) adds padding after each row, so each row needs its own memcpy";
+        ex.suggestion = "use a packed destination (stride 0) to copy everything with a single memcpy";
+      }
+      else {
+        ex.reason = "the properties are adjacent in each row, but they only cover " + std::to_string(plan.numBytes) +
+                    " of the " + std::to_string(elem->rowStride) + " bytes in the row, so each row needs its own memcpy";
+        if (packedDest) {
+          ex.suggestion = "extract all of the element's properties in one call, or store only these properties in the "
+                          "file, to copy everything with a single memcpy";
+        }
+      }
+      break;
+
+    case PLYExtractPath::PerColumn:
+      ex.numOperations = numRows * numProps;
+      ex.reason = "the properties are not adjacent in each row in the order requested, so each value needs its own memcpy";
+      if (contiguousWhenSorted) {
+        ex.suggestion = "request the properties in file order (";
+        for (uint32_t i = 0; i < numProps; i++) {
+          ex.suggestion += (i > 0) ? ", " : "";
+          ex.suggestion += elem->properties[sortedIdxs[i]].name;
+        }
+        ex.suggestion += ") to copy one block per row";
+      }
+      else {
+        ex.suggestion = "the properties are not adjacent in the file; a schema that stores them next to each other, "
+                        "in this order, would allow one memcpy per row";
+      }
+      break;
+
+    case PLYExtractPath::PerValue:
+      ex.numOperations = numRows * numProps;
+      for (uint32_t i = 0; i < numProps; i++) {
+        const PLYProperty& prop = elem->properties[propIdxs[i]];
+        if (!compatible_types(prop.type, destType)) {
+          ex.reason = "'" + prop.name + "' is " + kPLYPropertyTypeNames[uint32_t(prop.type)] +
+                      " but the destination type is " + destTypeName + ", so every value is converted individually";
+          break;
+        }
+      }
+      if (sameSrcType) {
+        ex.suggestion = std::string("extract as ") + kPLYPropertyTypeNames[uint32_t(srcType)] +
+                        " to avoid converting each value";
+      }
+      else {
+        ex.suggestion = "the properties have different types; extracting each group of same-typed properties "
+                        "as its own type would avoid converting each value";
+      }
+      break;
+
+    case PLYExtractPath::HalfChunks:
+      ex.numOperations = numRows * numProps;
+      ex.reason = "the destination type is half, so values are converted to float a chunk at a time and then to "
+                  "half in bulk";
+      break;
+
+    case PLYExtractPath::Invalid:
+      ex.reason = "the extraction would fail";
+      return false;
+    }
+
+    return true;
+  }
+
+
+  bool PLYReader::extract_normalized_colors(const uint32_t propIdxs[], uint32_t numProps, uint32_t destChannels, float fill, float* dest) const
+  {
+    if (!has_element() || numProps == 0 || numProps > 4 || destChannels < numProps || destChannels > 4) {
+      return false;
+    }
+
+    const PLYElement* elem = element();
+    const PLYProperty* props[4];
+    bool allUChar = true, allUShort = true;
+    for (uint32_t i = 0; i < numProps; i++) {
+      if (propIdxs[i] >= elem->properties.size() || elem->properties[propIdxs[i]].countType != PLYPropertyType::None) {
+        return false;
+      }
+      props[i] = &elem->properties[propIdxs[i]];
+      allUChar = allUChar && (props[i]->type == PLYPropertyType::UChar);
+      allUShort = allUShort && (props[i]->type == PLYPropertyType::UShort);
+    }
+
+    const uint8_t* row = m_elementData.data();
+    const uint8_t* end = row + size_t(m_numLoadedRows) * elem->rowStride;
+
+#ifdef MINIPLY_HAS_SSE2
+    if ((allUChar || allUShort) && channels_are_adjacent(props, numProps)) {
+      // Four rows at a time: load four channels' worth of each row in one go,
+      // widen them to 32-bit lanes with unpacks and convert to float. Lanes
+      // without a source property have a scale of zero and a bias of `fill`,
+      // so whatever was loaded into them doesn't matter. The loads can read
+      // past the last channel, so the remaining rows are left for the scalar
+      // loop below.
+      const size_t stride = elem->rowStride;
+      const size_t base = props[0]->offset;
+      const size_t loadBytes = allUChar ? 4 : 8;
+      float scale[4], bias[4];
+      for (uint32_t c = 0; c < 4; c++) {
+        const bool hasSource = c < numProps;
+        scale[c] = hasSource ? normalizing_scale(props[0]->type) : 0.0f;
+        bias[c] = hasSource ? 0.0f : fill;
+      }
+      const __m128 scaleV = _mm_loadu_ps(scale);
+      const __m128 biasV = _mm_loadu_ps(bias);
+      const __m128i zero = _mm_setzero_si128();
+
+      float tmp[4];
+      for (; size_t(end - row) >= 3 * stride + base + loadBytes; row += 4 * stride) {
+        __m128i vals[4];
+        if (allUChar) {
+          const __m128i bytes = load_row_words(row + base, stride);
+          const __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+          const __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+          vals[0] = _mm_unpacklo_epi16(lo, zero);
+          vals[1] = _mm_unpackhi_epi16(lo, zero);
+          vals[2] = _mm_unpacklo_epi16(hi, zero);
+          vals[3] = _mm_unpackhi_epi16(hi, zero);
+        }
+        else {
+          const __m128i r01 = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + base)),
+                                                 _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + stride + base)));
+          const __m128i r23 = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + 2 * stride + base)),
+                                                 _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + 3 * stride + base)));
+          vals[0] = _mm_unpacklo_epi16(r01, zero);
+          vals[1] = _mm_unpackhi_epi16(r01, zero);
+          vals[2] = _mm_unpacklo_epi16(r23, zero);
+          vals[3] = _mm_unpackhi_epi16(r23, zero);
+        }
+        __m128 f[4];
+        for (uint32_t r = 0; r < 4; r++) {
+          f[r] = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(vals[r]), scaleV), biasV);
+        }
+        if (destChannels == 4) {
+          for (uint32_t r = 0; r < 4; r++) {
+            _mm_storeu_ps(dest + r * 4, f[r]);
+          }
+          dest += 16;
+          continue;
+        }
+        // A full 4-float store is fine for any row whose overhang lands on
+        // rows after it in this block; only the others go via `tmp`.
+        for (uint32_t r = 0; r < 4; r++, dest += destChannels) {
+          if (r * destChannels + 4 <= 4 * destChannels) {
+            _mm_storeu_ps(dest, f[r]);
+          }
+          else {
+            _mm_storeu_ps(tmp, f[r]);
+            std::memcpy(dest, tmp, destChannels * sizeof(float));
+          }
+        }
+      }
+    }
+#endif
+
+    for (; row < end; row += elem->rowStride, dest += destChannels) {
+      for (uint32_t c = 0; c < destChannels; c++) {
+        dest[c] = (c < numProps) ? load_normalized(row + props[c]->offset, props[c]->type) : fill;
+      }
+    }
+    return true;
+  }
+
+
+  bool PLYReader::extract_rgba8_colors(const uint32_t propIdxs[], uint32_t numProps, uint8_t fill, uint8_t* dest) const
+  {
+    if (!has_element() || numProps == 0 || numProps > 4) {
+      return false;
+    }
+
+    const PLYElement* elem = element();
+    const PLYProperty* props[4];
+    bool allUChar = true, allFloat = true;
+    for (uint32_t i = 0; i < numProps; i++) {
+      if (propIdxs[i] >= elem->properties.size() || elem->properties[propIdxs[i]].countType != PLYPropertyType::None) {
+        return false;
+      }
+      props[i] = &elem->properties[propIdxs[i]];
+      allUChar = allUChar && (props[i]->type == PLYPropertyType::UChar);
+      allFloat = allFloat && (props[i]->type == PLYPropertyType::Float);
+    }
+
+    const uint8_t* row = m_elementData.data();
+    const uint8_t* end = row + size_t(m_numLoadedRows) * elem->rowStride;
+
+#ifdef MINIPLY_HAS_SSE2
+    if ((allUChar || allFloat) && channels_are_adjacent(props, numProps)) {
+      // Four rows at a time, producing 16 bytes of output per iteration.
+      // Each row's channels are loaded together and any lanes without a
+      // source property are masked and replaced with the fill value. As
+      // above, the loads can read past the last channel so the remaining
+      // rows are left for the paths below.
+      const size_t stride = elem->rowStride;
+      const size_t base = props[0]->offset;
+      int32_t keep[4];
+      for (uint32_t c = 0; c < 4; c++) {
+        keep[c] = (c < numProps) ? -1 : 0;
+      }
+      if (allUChar) {
+        uint32_t keepBytes = 0, fillBytes = 0;
+        for (uint32_t c = 0; c < 4; c++) {
+          keepBytes |= uint32_t(keep[c] & 0xFF) << (c * 8);
+          fillBytes |= uint32_t(keep[c] ? 0 : fill) << (c * 8);
+        }
+        const __m128i keepV = _mm_set1_epi32(int32_t(keepBytes));
+        const __m128i fillV = _mm_set1_epi32(int32_t(fillBytes));
+        for (; size_t(end - row) >= 3 * stride + base + 4; row += 4 * stride, dest += 16) {
+          __m128i v = load_row_words(row + base, stride);
+          v = _mm_or_si128(_mm_and_si128(v, keepV), fillV);
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), v);
+        }
+      }
+      else {
+        // Clamp, scale and round, then narrow the 32-bit lanes of all four
+        // rows down to bytes with saturating packs. _mm_max_ps returns its
+        // second operand if either is NaN, so NaNs become zero, matching
+        // pack_unorm8.
+        const __m128 keepV = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keep)));
+        const __m128 fillV = _mm_andnot_ps(keepV, _mm_set1_ps(float(fill) / 255.0f));
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (; size_t(end - row) >= 3 * stride + base + 16; row += 4 * stride, dest += 16) {
+          __m128i i32[4];
+          for (uint32_t r = 0; r < 4; r++) {
+            __m128 f = _mm_loadu_ps(reinterpret_cast<const float*>(row + r * stride + base));
+            f = _mm_or_ps(_mm_and_ps(f, keepV), fillV);
+            f = _mm_min_ps(_mm_max_ps(f, zero), one);
+            i32[r] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), half));
+          }
+          __m128i packed = _mm_packus_epi16(_mm_packs_epi32(i32[0], i32[1]), _mm_packs_epi32(i32[2], i32[3]));
+          _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), packed);
+        }
+      }
+    }
+#endif
+
+    if (allUChar) {
+      // No conversion required, just gather the bytes.
+      for (; row < end; row += elem->rowStride, dest += 4) {
+        for (uint32_t c = 0; c < 4; c++) {
+          dest[c] = (c < numProps) ? row[props[c]->offset] : fill;
+        }
+      }
+      return true;
+    }
+
+#ifdef MINIPLY_HAS_SSE2
+    if (allFloat) {
+      // One row at a time, for channels that aren't adjacent and for the
+      // rows left over from the loop above: clamp, scale and round the four
+      // channels together, then narrow them to bytes with saturating packs.
+      // The fill value is pre-divided so it comes out of the same arithmetic
+      // unchanged.
+      const float fillVal = float(fill) / 255.0f;
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 one = _mm_set1_ps(1.0f);
+      const __m128 scale = _mm_set1_ps(255.0f);
+      const __m128 half = _mm_set1_ps(0.5f);
+      float vals[4] = { fillVal, fillVal, fillVal, fillVal };
+      for (; row < end; row += elem->rowStride, dest += 4) {
+        for (uint32_t c = 0; c < numProps; c++) {
+          std::memcpy(&vals[c], row + props[c]->offset, sizeof(float));
+        }
+        // _mm_max_ps returns its second operand if either is NaN, so NaNs
+        // become zero here, matching pack_unorm8.
+        __m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(vals), zero), one);
+        __m128i i32 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), half));
+        __m128i i16 = _mm_packs_epi32(i32, i32);
+        uint32_t packed = uint32_t(_mm_cvtsi128_si32(_mm_packus_epi16(i16, i16)));
+        std::memcpy(dest, &packed, sizeof(packed));
+      }
+      return true;
+    }
+#endif
+
+    for (; row < end; row += elem->rowStride, dest += 4) {
+      for (uint32_t c = 0; c < 4; c++) {
+        dest[c] = (c < numProps) ? pack_unorm8(load_normalized(row + props[c]->offset, props[c]->type)) : fill;
+      }
+    }
+    return true;
+  }
+
+
+  const uint32_t* PLYReader::get_list_counts(uint32_t propIdx) const
+  {
+    if (!has_element() || propIdx >= element()->properties.size() || element()->properties[propIdx].countType == PLYPropertyType::None) {
+      return nullptr;
+    }
+    return element()->properties[propIdx].rowCount.data();
+  }
+
+
+  uint32_t PLYReader::sum_of_list_counts(uint32_t propIdx) const
+  {
+    if (!has_element() || propIdx >= element()->properties.size() || element()->properties[propIdx].countType == PLYPropertyType::None) {
+      return 0;
+    }
+    const PLYProperty& prop = element()->properties[propIdx];
+    return prop.listData.size() / kPLYPropertySize[uint32_t(prop.type)];
+  }
+
+
+  const uint8_t* PLYReader::get_list_data(uint32_t propIdx) const
+  {
+    if (!has_element() || propIdx >= element()->properties.size() || element()->properties[propIdx].countType == PLYPropertyType::None) {
+      return nullptr;
+    }
+    return element()->properties[propIdx].listData.data();
+  }
+
+
+  bool PLYReader::extract_list_property(uint32_t propIdx, PLYPropertyType destType, void *dest) const
+  {
+    if (!has_element() || propIdx >= element()->properties.size() || element()->properties[propIdx].countType == PLYPropertyType::None) {
+      return false;
+    }
+
+    const PLYProperty& prop = element()->properties[propIdx];
+    MINIPLY_PROBE(extract__list, element()->name.c_str(), prop.name.c_str(), uint64_t(prop.listData.size()), int(destType));
+    if (compatible_types(prop.type, destType)) {
+      // If no type conversion is required, we can just copy the list data
+      // directly over with a single memcpy.
+      std::memcpy(dest, prop.listData.data(), prop.listData.size());
+    }
+    else if (destType == PLYPropertyType::Half) {
+      const size_t numValues = prop.listData.size() / kPLYPropertySize[uint32_t(prop.type)];
+      values_to_halfs(prop.listData.data(), prop.type, numValues, reinterpret_cast<uint16_t*>(dest));
+    }
+    else {
+      // If type conversion is required we'll have to process each list value separately.
+      const uint8_t* from = prop.listData.data();
+      const uint8_t* end = prop.listData.data() + prop.listData.size();
+      uint8_t* to = reinterpret_cast<uint8_t*>(dest);
+      const size_t toBytes = kPLYPropertySize[uint32_t(destType)];
+      const size_t fromBytes = kPLYPropertySize[uint32_t(prop.type)];
+      while (from < end) {
+        copy_and_convert(to, destType, from, prop.type);
+        to += toBytes;
+        from += fromBytes;
+      }
+    }
+
+    return true;
+  }
+
+
+  uint32_t PLYReader::num_triangles(uint32_t propIdx) const
+  {
+    const uint32_t* counts = get_list_counts(propIdx);
+    if (counts == nullptr) {
+      return 0;
+    }
+
+    const uint32_t numRows = element()->count;
+    uint32_t num = 0;
+    for (uint32_t i = 0; i < numRows; i++) {
+      if (counts[i] >= 3) {
+        num += counts[i] - 2;
+      }
+    }
+    return num;
+  }
+
+
+  bool PLYReader::requires_triangulation(uint32_t propIdx) const
+  {
+    const uint32_t* counts = get_list_counts(propIdx);
+    if (counts == nullptr) {
+      return false;
+    }
+
+    const uint32_t numRows = element()->count;
+    for (uint32_t i = 0; i < numRows; i++) {
+      if (counts[i] != 3) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+
+  bool PLYReader::extract_triangles(uint32_t propIdx, const float pos[], uint32_t numVerts, PLYPropertyType destType, void *dest) const
+  {
+    if (!requires_triangulation(propIdx)) {
+      return extract_list_property(propIdx, destType, dest);
+    }
+
+    const PLYElement* elem = element();
+    const PLYProperty& prop = elem->properties[propIdx];
+
+    const uint32_t* counts = prop.rowCount.data();
+    const uint8_t*  data   = prop.listData.data();
+
+    uint8_t* to = reinterpret_cast<uint8_t*>(dest);
+    MINIPLY_PROBE(triangulate__start, elem->name.c_str(), elem->count, int(destType));
+
+    bool convertSrc = !compatible_types(elem->properties[propIdx].type, PLYPropertyType::Int);
+    bool convertDst = !compatible_types(PLYPropertyType::Int, destType);
+
+    size_t srcValBytes  = kPLYPropertySize[uint32_t(prop.type)];
+    size_t destValBytes = kPLYPropertySize[uint32_t(destType)];
+
+    if (convertSrc && convertDst) {
+      std::vector<int> faceIndices, triIndices;
+      faceIndices.reserve(32);
+      triIndices.reserve(64);
+      const uint8_t* face = data;
+      for (uint32_t faceIdx = 0; faceIdx < elem->count; faceIdx++) {
+        const uint8_t* faceEnd = face + srcValBytes * counts[faceIdx];
+        faceIndices.clear();
+        faceIndices.reserve(counts[faceIdx]);
+        for (; face < faceEnd; face += srcValBytes) {
+          int idx = -1;
+          copy_and_convert_to(&idx, face, prop.type);
+          faceIndices.push_back(idx);
+        }
+
+        triIndices.resize((counts[faceIdx] - 2) * 3);
+        triangulate_polygon(counts[faceIdx], pos, numVerts, faceIndices.data(), triIndices.data());
+        for (int idx : triIndices) {
+          copy_and_convert(to, destType, reinterpret_cast<const uint8_t*>(&idx), PLYPropertyType::Int);
+          to += destValBytes;
+        }
+      }
+    }
+    else if (convertSrc) {
+      std::vector<int> faceIndices;
+      faceIndices.reserve(32);
+      const uint8_t* face = data;
+      for (uint32_t faceIdx = 0; faceIdx < elem->count; faceIdx++) {
+        const uint8_t* faceEnd = face + srcValBytes * counts[faceIdx];
+        faceIndices.clear();
+        faceIndices.reserve(counts[faceIdx]);
+        for (; face < faceEnd; face += srcValBytes) {
+          int idx = -1;
+          copy_and_convert_to(&idx, face, prop.type);
+          faceIndices.push_back(idx);
+        }
+
+        uint32_t numTris = triangulate_polygon(counts[faceIdx], pos, numVerts, faceIndices.data(), reinterpret_cast<int*>(to));
+        to += numTris * 3 * destValBytes;
+      }
+    }
+    else if (convertDst) {
+      std::vector<int> triIndices;
+      triIndices.reserve(64);
+      const uint8_t* face = data;
+      for (uint32_t faceIdx = 0; faceIdx < elem->count; faceIdx++) {
+        triIndices.resize((counts[faceIdx] - 2) * 3);
+        triangulate_polygon(counts[faceIdx], pos, numVerts, reinterpret_cast<const int*>(face), triIndices.data());
+        for (int idx : triIndices) {
+          copy_and_convert(to, destType, reinterpret_cast<const uint8_t*>(&idx), PLYPropertyType::Int);
+          to += destValBytes;
+        }
+        face += srcValBytes * counts[faceIdx];
+      }
+    }
+    else {
+      const uint8_t* face = data;
+      for (uint32_t faceIdx = 0; faceIdx < elem->count; faceIdx++) {
+        uint32_t numTris = triangulate_polygon(counts[faceIdx], pos, numVerts, reinterpret_cast<const int*>(face), reinterpret_cast<int*>(to));
+        face += counts[faceIdx] * srcValBytes;
+        to += numTris * 3 * destValBytes;
+      }
+    }
+
+    MINIPLY_PROBE(triangulate__done, elem->name.c_str(), uint32_t((to - reinterpret_cast<uint8_t*>(dest)) / (3 * destValBytes)));
+    return true;
+  }
+
+
+  bool PLYReader::extract_meshlets(uint32_t propIdx, const float pos[], uint32_t numVerts, PLYMeshlets& meshlets,
+                                   uint32_t maxVerts, uint32_t maxTris) const
+  {
+    if (get_list_counts(propIdx) == nullptr) {
+      return false;
+    }
+    std::vector<uint32_t> indices(size_t(num_triangles(propIdx)) * 3);
+    if (!extract_triangles(propIdx, pos, numVerts, PLYPropertyType::UInt, indices.data())) {
+      return false;
+    }
+    return build_meshlets(pos, numVerts, indices.data(), uint32_t(indices.size() / 3), meshlets, maxVerts, maxTris);
+  }
+
+
+  bool PLYReader::build_half_edges(uint32_t propIdx, uint32_t numVerts, PLYHalfEdges& halfEdges) const
+  {
+    halfEdges = PLYHalfEdges();
+
+    const uint32_t* counts = get_list_counts(propIdx);
+    if (counts == nullptr) {
+      return false;
+    }
+    const PLYElement* elem = element();
+    const PLYProperty& prop = elem->properties[propIdx];
+    const uint32_t numFaces = uint32_t(prop.rowCount.size());
+    const size_t srcValBytes = kPLYPropertySize[uint32_t(prop.type)];
+
+    if (!list_row_offsets(prop, halfEdges.faceEdges)) {
+      halfEdges = PLYHalfEdges();
+      return false;
+    }
+    const uint32_t numHalfEdges = halfEdges.faceEdges[numFaces];
+
+    halfEdges.vertex.resize(numHalfEdges);
+    halfEdges.next.resize(numHalfEdges);
+    halfEdges.twin.resize(numHalfEdges);
+    halfEdges.face.resize(numHalfEdges);
+    std::vector<uint64_t> keys(numHalfEdges);
+
+    // Convert the indices and fill in everything except the twins. Each
+    // half-edge's key is its vertex pair with the smaller index first, so
+    // both halves of an edge get the same key.
+    const uint32_t numThreads = num_worker_threads(numFaces);
+    const size_t chunkSize = (size_t(numFaces) + numThreads - 1) / numThreads;
+    std::vector<uint8_t> threadOK(numThreads, 1);
+    parallel_for(numThreads, [&](uint32_t t) {
+      const uint32_t start = uint32_t(std::min(size_t(numFaces), t * chunkSize));
+      const uint32_t end = uint32_t(std::min(size_t(numFaces), start + chunkSize));
+      for (uint32_t f = start; f < end; f++) {
+        const uint32_t first = halfEdges.faceEdges[f];
+        const uint32_t last = halfEdges.faceEdges[f + 1];
+        const uint8_t* src = prop.listData.data() + size_t(first) * srcValBytes;
+        for (uint32_t h = first; h < last; h++, src += srcValBytes) {
+          if (!load_vertex_index(src, prop.type, numVerts, &halfEdges.vertex[h])) {
+            threadOK[t] = 0;
+            return;
+          }
+          halfEdges.next[h] = (h + 1 < last) ? h + 1 : first;
+          halfEdges.face[h] = f;
+        }
+        for (uint32_t h = first; h < last; h++) {
+          uint64_t a = halfEdges.vertex[h];
+          uint64_t b = halfEdges.vertex[halfEdges.next[h]];
+          keys[h] = (a < b) ? ((a << 32) | b) : ((b << 32) | a);
+        }
+      }
+    });
+    for (uint8_t ok : threadOK) {
+      if (!ok) {
+        halfEdges = PLYHalfEdges();
+        return false;
+      }
+    }
+
+    std::vector<uint32_t> order;
+    radix_sort_indices(keys, order);
+
+    // Every edge is now a run of equal keys. Split the sorted list into one
+    // chunk per thread, moving each split point forward to the start of a
+    // run so that no run is shared between threads. The split points stay
+    // in order because any two that land in the same run both move to its
+    // end.
+    const uint32_t numMatchThreads = num_worker_threads(numHalfEdges);
+    std::vector<size_t> splits(size_t(numMatchThreads) + 1, numHalfEdges);
+    for (uint32_t t = 0; t < numMatchThreads; t++) {
+      size_t split = size_t(numHalfEdges) * t / numMatchThreads;
+      while (split > 0 && split < numHalfEdges && keys[order[split]] == keys[order[split - 1]]) {
+        ++split;
+      }
+      splits[t] = split;
+    }
+
+    std::vector<std::vector<uint32_t>> threadBoundary(numMatchThreads), threadNonManifold(numMatchThreads);
+    parallel_for(numMatchThreads, [&](uint32_t t) {
+      const size_t end = splits[t + 1];
+      size_t i = splits[t];
+      while (i < end) {
+        size_t runEnd = i + 1;
+        while (runEnd < numHalfEdges && keys[order[runEnd]] == keys[order[i]]) {
+          ++runEnd;
+        }
+        const uint32_t h0 = order[i];
+        if (runEnd - i == 1) {
+          halfEdges.twin[h0] = kInvalidIndex;
+          threadBoundary[t].push_back(h0);
+        }
+        else if (runEnd - i == 2 && halfEdges.vertex[h0] != halfEdges.vertex[order[i + 1]]) {
+          const uint32_t h1 = order[i + 1];
+          halfEdges.twin[h0] = h1;
+          halfEdges.twin[h1] = h0;
+        }
+        else {
+          for (size_t j = i; j < runEnd; j++) {
+            halfEdges.twin[order[j]] = kInvalidIndex;
+            threadNonManifold[t].push_back(order[j]);
+          }
+        }
+        i = runEnd;
+      }
+    });
+
+    for (uint32_t t = 0; t < numMatchThreads; t++) {
+      halfEdges.boundaryEdges.insert(halfEdges.boundaryEdges.end(), threadBoundary[t].begin(), threadBoundary[t].end());
+      halfEdges.nonManifoldEdges.insert(halfEdges.nonManifoldEdges.end(), threadNonManifold[t].begin(), threadNonManifold[t].end());
+    }
+    return true;
+  }
+
+
+  bool PLYReader::find_components(uint32_t propIdx, uint32_t numVerts, PLYComponents& components) const
+  {
+    components = PLYComponents();
+
+    if (get_list_counts(propIdx) == nullptr) {
+      return false;
+    }
+    const PLYProperty& prop = element()->properties[propIdx];
+    const uint32_t numFaces = uint32_t(prop.rowCount.size());
+    const size_t srcValBytes = kPLYPropertySize[uint32_t(prop.type)];
+
+    std::vector<uint32_t> offsets;
+    if (!list_row_offsets(prop, offsets)) {
+      return false;
+    }
+
+    const uint32_t numVertThreads = num_worker_threads(numVerts);
+    const size_t vertChunkSize = (size_t(numVerts) + numVertThreads - 1) / numVertThreads;
+    const uint32_t numFaceThreads = num_worker_threads(numFaces);
+    const size_t faceChunkSize = (size_t(numFaces) + numFaceThreads - 1) / numFaceThreads;
+
+    ConcurrentUnionFind sets(numVerts);
+    parallel_for(numVertThreads, [&](uint32_t t) {
+      const size_t start = std::min(size_t(numVerts), t * vertChunkSize);
+      const size_t end = std::min(size_t(numVerts), start + vertChunkSize);
+      sets.reset(uint32_t(start), uint32_t(end));
+    });
+
+    // Merge the vertices of each face. The first vertex of each face is
+    // kept for labelling the faces afterwards; faces with no vertices get
+    // `kInvalidIndex`.
+    std::vector<uint32_t> faceVert(numFaces, kInvalidIndex);
+    std::vector<uint8_t> threadOK(numFaceThreads, 1);
+    parallel_for(numFaceThreads, [&](uint32_t t) {
+      const uint32_t start = uint32_t(std::min(size_t(numFaces), t * faceChunkSize));
+      const uint32_t end = uint32_t(std::min(size_t(numFaces), start + faceChunkSize));
+      for (uint32_t f = start; f < end; f++) {
+        const uint8_t* src = prop.listData.data() + size_t(offsets[f]) * srcValBytes;
+        for (uint32_t i = offsets[f]; i < offsets[f + 1]; i++, src += srcValBytes) {
+          uint32_t v;
+          if (!load_vertex_index(src, prop.type, numVerts, &v)) {
+            threadOK[t] = 0;
+            return;
+          }
+          if (faceVert[f] == kInvalidIndex) {
+            faceVert[f] = v;
+          }
+          else {
+            sets.unite(faceVert[f], v);
+          }
+        }
+      }
+    });
+    for (uint8_t ok : threadOK) {
+      if (!ok) {
+        return false;
+      }
+    }
+
+    // Number the components in order of their first face, so the labels
+    // don't depend on how the work was split between threads.
+    std::vector<uint32_t> rootLabel(numVerts, kInvalidIndex);
+    uint32_t numComponents = 0;
+    components.faceComponent.resize(numFaces);
+    for (uint32_t f = 0; f < numFaces; f++) {
+      if (faceVert[f] == kInvalidIndex) {
+        components.faceComponent[f] = kInvalidIndex;
+        continue;
+      }
+      uint32_t root = sets.find(faceVert[f]);
+      if (rootLabel[root] == kInvalidIndex) {
+        rootLabel[root] = numComponents++;
+      }
+      components.faceComponent[f] = rootLabel[root];
+    }
+
+    // Label the vertices. A vertex which no face uses was never merged with
+    // anything, so it's its own root and that root has no label.
+    components.vertexComponent.resize(numVerts);
+    parallel_for(numVertThreads, [&](uint32_t t) {
+      const size_t start = std::min(size_t(numVerts), t * vertChunkSize);
+      const size_t end = std::min(size_t(numVerts), start + vertChunkSize);
+      for (size_t v = start; v < end; v++) {
+        components.vertexComponent[v] = rootLabel[sets.find(uint32_t(v))];
+      }
+    });
+
+    components.componentFaceCounts.assign(numComponents, 0);
+    components.componentVertexCounts.assign(numComponents, 0);
+    for (uint32_t c : components.faceComponent) {
+      if (c != kInvalidIndex) {
+        ++components.componentFaceCounts[c];
+      }
+    }
+    for (uint32_t c : components.vertexComponent) {
+      if (c != kInvalidIndex) {
+        ++components.componentVertexCounts[c];
+      }
+    }
+    return true;
+  }
+
+
+  bool PLYReader::split_components(uint32_t propIdx, const PLYComponents& components, std::vector<PLYComponentMesh>& meshes,
+                                   uint32_t minFaces) const
+  {
+    meshes.clear();
+
+    if (get_list_counts(propIdx) == nullptr) {
+      return false;
+    }
+    const PLYProperty& prop = element()->properties[propIdx];
+    const uint32_t numFaces = uint32_t(prop.rowCount.size());
+    const uint32_t numVerts = uint32_t(components.vertexComponent.size());
+    const uint32_t numComponents = uint32_t(components.componentFaceCounts.size());
+    const size_t srcValBytes = kPLYPropertySize[uint32_t(prop.type)];
+    if (components.faceComponent.size() != numFaces || components.componentVertexCounts.size() != numComponents) {
+      return false;
+    }
+
+    std::vector<uint32_t> offsets;
+    if (!list_row_offsets(prop, offsets)) {
+      return false;
+    }
+
+    // Map each kept component to its output mesh.
+    std::vector<uint32_t> meshIdx(numComponents, kInvalidIndex);
+    for (uint32_t c = 0; c < numComponents; c++) {
+      if (components.componentFaceCounts[c] >= minFaces) {
+        meshIdx[c] = uint32_t(meshes.size());
+        meshes.push_back(PLYComponentMesh());
+        PLYComponentMesh& mesh = meshes.back();
+        mesh.component = c;
+        mesh.vertices.reserve(components.componentVertexCounts[c]);
+        mesh.faces.reserve(components.componentFaceCounts[c]);
+        mesh.faceSizes.reserve(components.componentFaceCounts[c]);
+      }
+    }
+
+    // Visiting vertices and faces in order keeps each mesh's lists sorted,
+    // and gives every vertex its position within its mesh.
+    std::vector<uint32_t> localIdx(numVerts, kInvalidIndex);
+    for (uint32_t v = 0; v < numVerts; v++) {
+      uint32_t c = components.vertexComponent[v];
+      if (c != kInvalidIndex && c < numComponents && meshIdx[c] != kInvalidIndex) {
+        PLYComponentMesh& mesh = meshes[meshIdx[c]];
+        localIdx[v] = uint32_t(mesh.vertices.size());
+        mesh.vertices.push_back(v);
+      }
+    }
+    for (uint32_t f = 0; f < numFaces; f++) {
+      uint32_t c = components.faceComponent[f];
+      if (c != kInvalidIndex && c < numComponents && meshIdx[c] != kInvalidIndex) {
+        PLYComponentMesh& mesh = meshes[meshIdx[c]];
+        mesh.faces.push_back(f);
+        mesh.faceSizes.push_back(prop.rowCount[f]);
+      }
+    }
+
+    // Remap the indices, with the threads taking meshes one at a time.
+    std::atomic<uint32_t> nextMesh(0);
+    std::atomic<bool> ok(true);
+    parallel_for(num_worker_threads(prop.listData.size() / srcValBytes), [&](uint32_t /*t*/) {
+      for (uint32_t m = nextMesh++; m < uint32_t(meshes.size()); m = nextMesh++) {
+        PLYComponentMesh& mesh = meshes[m];
+        size_t numIndices = 0;
+        for (uint32_t size : mesh.faceSizes) {
+          numIndices += size;
+        }
+        mesh.indices.resize(numIndices);
+        uint32_t* dst = mesh.indices.data();
+        for (uint32_t f : mesh.faces) {
+          const uint8_t* src = prop.listData.data() + size_t(offsets[f]) * srcValBytes;
+          for (uint32_t i = offsets[f]; i < offsets[f + 1]; i++, src += srcValBytes) {
+            uint32_t v;
+            if (!load_vertex_index(src, prop.type, numVerts, &v) || localIdx[v] == kInvalidIndex) {
+              ok = false;
+              return;
+            }
+            *dst++ = localIdx[v];
+          }
+        }
+      }
+    });
+    if (!ok) {
+      meshes.clear();
+      return false;
+    }
+    return true;
+  }
+
+
+  bool PLYReader::accumulate_property_stats(const uint32_t propIdxs[], uint32_t numProps, std::vector<PLYPropertyStats>& stats,
+                                            uint32_t numBins) const
+  {
+    if (!has_element()) {
+      return false;
+    }
+
+    const PLYElement* elem = element();
+    std::vector<uint32_t> idxs;
+    if (propIdxs == nullptr) {
+      for (uint32_t i = 0, endI = uint32_t(elem->properties.size()); i < endI; i++) {
+        if (elem->properties[i].countType == PLYPropertyType::None) {
+          idxs.push_back(i);
+        }
+      }
+    }
+    else {
+      for (uint32_t i = 0; i < numProps; i++) {
+        if (propIdxs[i] >= elem->properties.size() || elem->properties[propIdxs[i]].countType != PLYPropertyType::None) {
+          return false;
+        }
+        idxs.push_back(propIdxs[i]);
+      }
+    }
+
+    const uint32_t numStats = uint32_t(idxs.size());
+    if (stats.empty()) {
+      numBins = std::max(2u, (numBins + 1) & ~1u);
+      stats.resize(numStats);
+      for (uint32_t p = 0; p < numStats; p++) {
+        stats[p].propIdx = idxs[p];
+        stats[p].histogram.assign(numBins, 0);
+      }
+    }
+    else if (stats.size() != numStats) {
+      return false;
+    }
+    else {
+      numBins = uint32_t(stats[0].histogram.size());
+      for (uint32_t p = 0; p < numStats; p++) {
+        if (stats[p].propIdx != idxs[p] || stats[p].histogram.size() != numBins || numBins < 2 || (numBins & 1) != 0) {
+          return false;
+        }
+      }
+    }
+
+    const size_t numRows = m_numLoadedRows;
+    if (numRows == 0 || numStats == 0) {
+      return true;
+    }
+
+    // First pass: per-thread moments for each property. The histograms can't
+    // be filled in until we know the range of values in this batch.
+    const uint32_t numThreads = num_worker_threads(numRows);
+    const size_t chunkSize = (numRows + numThreads - 1) / numThreads;
+    std::vector<StatsMoments> threadMoments(size_t(numThreads) * numStats);
+    std::vector<uint64_t> threadNonFinite(size_t(numThreads) * numStats, 0);
+    parallel_for(numThreads, [&](uint32_t t) {
+      const size_t start = std::min(numRows, t * chunkSize);
+      const size_t end = std::min(numRows, start + chunkSize);
+      double vals[kStatsBlockSize];
+      for (size_t blockStart = start; blockStart < end; blockStart += kStatsBlockSize) {
+        const uint32_t n = uint32_t(std::min(end - blockStart, size_t(kStatsBlockSize)));
+        const uint8_t* rows = m_elementData.data() + blockStart * elem->rowStride;
+        for (uint32_t p = 0; p < numStats; p++) {
+          const PLYProperty& prop = elem->properties[idxs[p]];
+          const uint32_t numFinite = gather_finite_values(rows + prop.offset, elem->rowStride, prop.type, n, vals);
+          threadNonFinite[t * numStats + p] += n - numFinite;
+          threadMoments[t * numStats + p].add_block(vals, numFinite);
+        }
+      }
+    }, m_placement == PLYWorkerPlacement::BindToNodes);
+
+    std::vector<StatsMoments> batchMoments(numStats);
+    for (uint32_t p = 0; p < numStats; p++) {
+      for (uint32_t t = 0; t < numThreads; t++) {
+        batchMoments[p].merge(threadMoments[t * numStats + p]);
+        stats[p].nonFinite += threadNonFinite[t * numStats + p];
+      }
+      if (batchMoments[p].count > 0) {
+        fit_histogram(stats[p], batchMoments[p].minValue, batchMoments[p].maxValue);
+      }
+    }
+
+    // Second pass: per-thread histograms, which are then summed.
+    std::vector<uint64_t> threadBins(size_t(numThreads) * numStats * numBins, 0);
+    parallel_for(numThreads, [&](uint32_t t) {
+      const size_t start = std::min(numRows, t * chunkSize);
+      const size_t end = std::min(numRows, start + chunkSize);
+      double vals[kStatsBlockSize];
+      for (size_t blockStart = start; blockStart < end; blockStart += kStatsBlockSize) {
+        const uint32_t n = uint32_t(std::min(end - blockStart, size_t(kStatsBlockSize)));
+        const uint8_t* rows = m_elementData.data() + blockStart * elem->rowStride;
+        for (uint32_t p = 0; p < numStats; p++) {
+          const PLYProperty& prop = elem->properties[idxs[p]];
+          const uint32_t numFinite = gather_finite_values(rows + prop.offset, elem->rowStride, prop.type, n, vals);
+          add_to_histogram(vals, numFinite, stats[p].histogramMin, stats[p].binWidth, numBins,
+                           threadBins.data() + (size_t(t) * numStats + p) * numBins);
+        }
+      }
+    }, m_placement == PLYWorkerPlacement::BindToNodes);
+
+    for (uint32_t p = 0; p < numStats; p++) {
+      for (uint32_t t = 0; t < numThreads; t++) {
+        const uint64_t* bins = threadBins.data() + (size_t(t) * numStats + p) * numBins;
+        for (uint32_t b = 0; b < numBins; b++) {
+          stats[p].histogram[b] += bins[b];
+        }
+      }
+
+      StatsMoments total;
+      total.count = stats[p].count;
+      total.minValue = stats[p].minValue;
+      total.maxValue = stats[p].maxValue;
+      total.mean = stats[p].mean;
+      total.m2 = stats[p].m2;
+      total.merge(batchMoments[p]);
+      stats[p].count = total.count;
+      stats[p].minValue = total.minValue;
+      stats[p].maxValue = total.maxValue;
+      stats[p].mean = total.mean;
+      stats[p].m2 = total.m2;
+    }
+    return true;
+  }
+
+
+  bool PLYReader::find_pos(uint32_t propIdxs[3]) const
+  {
+    return find_properties(propIdxs, 3, "x", "y", "z");
+  }
+
+
+  bool PLYReader::find_normal(uint32_t propIdxs[3]) const
+  {
+    return find_properties(propIdxs, 3, "nx", "ny", "nz");
+  }
+
+
+  bool PLYReader::find_texcoord(uint32_t propIdxs[2]) const
+  {
+    return find_properties(propIdxs, 2, "u", "v") ||
+           find_properties(propIdxs, 2, "s", "t") ||
+           find_properties(propIdxs, 2, "texture_u", "texture_v") ||
+           find_properties(propIdxs, 2, "texture_s", "texture_t");
+  }
+
+
+  bool PLYReader::find_color(uint32_t propIdxs[3]) const
+  {
+    return find_properties(propIdxs, 3, "r", "g", "b") ||
+           find_properties(propIdxs, 3, "red", "green", "blue"); 
+  }
+
+
+  bool PLYReader::find_indices(uint32_t propIdxs[1]) const
+  {
+    return find_properties(propIdxs, 1, "vertex_indices") || 
+           find_properties(propIdxs, 1, "vertex_index");
+  }
+
+
+  bool PLYReader::find_splat(PLYSplatProperties* props) const
+  {
+    if (props == nullptr || !has_element()) {
+      return false;
+    }
+    if (!find_pos(props->pos) ||
+        !find_properties(props->scale, 3, "scale_0", "scale_1", "scale_2") ||
+        !find_properties(props->rot, 4, "rot_0", "rot_1", "rot_2", "rot_3") ||
+        !find_properties(&props->opacity, 1, "opacity") ||
+        !find_properties(props->dc, 3, "f_dc_0", "f_dc_1", "f_dc_2")) {
+      return false;
+    }
+
+    props->numRest = 0;
+    char name[16];
+    while (props->numRest < 45) {
+      std::snprintf(name, sizeof(name), "f_rest_%u", props->numRest);
+      uint32_t propIdx = find_property(name);
+      if (propIdx == kInvalidIndex) {
+        break;
+      }
+      props->rest[props->numRest++] = propIdx;
+    }
+    if (props->numRest != 0 && props->numRest != 9 && props->numRest != 24 && props->numRest != 45) {
+      return false;
+    }
+
+    const PLYElement* elem = element();
+    uint32_t idxs[kMaxSplatProperties];
+    const uint32_t numIdxs = splat_property_indexes(*props, idxs);
+    for (uint32_t i = 0; i < numIdxs; i++) {
+      if (elem->properties[idxs[i]].countType != PLYPropertyType::None) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+
+  bool PLYReader::extract_splats(const PLYSplatProperties& props, const PLYSplatBuffers& dest) const
+  {
+    if (!has_element() || props.numRest > 45 || props.numRest % 3 != 0) {
+      return false;
+    }
+
+    const PLYElement* elem = element();
+    uint32_t idxs[kMaxSplatProperties];
+    const uint32_t numIdxs = splat_property_indexes(props, idxs);
+    for (uint32_t i = 0; i < numIdxs; i++) {
+      if (idxs[i] >= elem->properties.size() || elem->properties[idxs[i]].countType != PLYPropertyType::None) {
+        return false;
+      }
+    }
+
+    // Source locations for the activation inputs, in SplatColumn order.
+    const PLYProperty* actProps[kNumSplatColumns] = {
+      &elem->properties[props.scale[0]], &elem->properties[props.scale[1]], &elem->properties[props.scale[2]],
+      &elem->properties[props.opacity],
+      &elem->properties[props.rot[0]], &elem->properties[props.rot[1]], &elem->properties[props.rot[2]], &elem->properties[props.rot[3]],
+    };
+
+    // Source locations for the SH coefficients, in output order. The file
+    // stores f_rest as all the red coefficients, then all green, then all
+    // blue; we want them interleaved.
+    const uint32_t numSH = 3 + props.numRest;
+    const uint32_t restPerChannel = props.numRest / 3;
+    const PLYProperty* shProps[48];
+    for (uint32_t c = 0; c < 3; c++) {
+      shProps[c] = &elem->properties[props.dc[c]];
+      for (uint32_t k = 0; k < restPerChannel; k++) {
+        shProps[3 + k * 3 + c] = &elem->properties[props.rest[c * restPerChannel + k]];
+      }
+    }
+
+    const PLYProperty* posProps[3] = {
+      &elem->properties[props.pos[0]], &elem->properties[props.pos[1]], &elem->properties[props.pos[2]],
+    };
+
+    const size_t posStride     = dest.stride ? dest.stride : sizeof(float) * 3;
+    const size_t scaleStride   = dest.stride ? dest.stride : sizeof(float) * 3;
+    const size_t rotStride     = dest.stride ? dest.stride : sizeof(float) * 4;
+    const size_t opacityStride = dest.stride ? dest.stride : sizeof(float);
+    const size_t shStride      = dest.stride ? dest.stride : sizeof(float) * numSH;
+
+    const size_t numRows = m_numLoadedRows;
+    const uint32_t numThreads = num_worker_threads(numRows);
+    const size_t chunkSize = (numRows + numThreads - 1) / numThreads;
+    parallel_for(numThreads, [&](uint32_t t) {
+      const size_t start = std::min(numRows, t * chunkSize);
+      const size_t end = std::min(numRows, start + chunkSize);
+
+      std::vector<float> scratch(kNumSplatColumns * kSplatBlockSize);
+      float (*cols)[kSplatBlockSize] = reinterpret_cast<float (*)[kSplatBlockSize]>(scratch.data());
+
+      for (size_t blockStart = start; blockStart < end; blockStart += kSplatBlockSize) {
+        const uint32_t n = uint32_t(std::min(end - blockStart, size_t(kSplatBlockSize)));
+        const uint8_t* rows = m_elementData.data() + blockStart * elem->rowStride;
+
+        // Gather the activation inputs into columns, padding the block out to
+        // a multiple of 4 rows.
+        if (dest.scale != nullptr || dest.rot != nullptr || dest.opacity != nullptr) {
+          const uint8_t* row = rows;
+          for (uint32_t i = 0; i < n; i++, row += elem->rowStride) {
+            for (uint32_t c = 0; c < kNumSplatColumns; c++) {
+              cols[c][i] = load_as_float(row + actProps[c]->offset, actProps[c]->type);
+            }
+          }
+          const uint32_t paddedN = (n + 3) & ~3u;
+          for (uint32_t c = 0; c < kNumSplatColumns; c++) {
+            std::fill(cols[c] + n, cols[c] + paddedN, 0.0f);
+          }
+          apply_splat_activations(cols, paddedN);
+        }
+
+        // Scatter everything out to the destination buffers.
+        const uint8_t* row = rows;
+        for (uint32_t i = 0; i < n; i++, row += elem->rowStride) {
+          const size_t s = blockStart + i;
+          if (dest.pos != nullptr) {
+            float* to = reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(dest.pos) + s * posStride);
+            for (uint32_t c = 0; c < 3; c++) {
+              to[c] = load_as_float(row + posProps[c]->offset, posProps[c]->type);
+            }
+          }
+          if (dest.scale != nullptr) {
+            float* to = reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(dest.scale) + s * scaleStride);
+            to[0] = cols[kSplatScale0][i];
+            to[1] = cols[kSplatScale1][i];
+            to[2] = cols[kSplatScale2][i];
+          }
+          if (dest.rot != nullptr) {
+            float* to = reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(dest.rot) + s * rotStride);
+            to[0] = cols[kSplatRotW][i];
+            to[1] = cols[kSplatRotX][i];
+            to[2] = cols[kSplatRotY][i];
+            to[3] = cols[kSplatRotZ][i];
+          }
+          if (dest.opacity != nullptr) {
+            float* to = reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(dest.opacity) + s * opacityStride);
+            to[0] = cols[kSplatOpacity][i];
+          }
+          if (dest.sh != nullptr) {
+            float* to = reinterpret_cast<float*>(reinterpret_cast<uint8_t*>(dest.sh) + s * shStride);
+            for (uint32_t j = 0; j < numSH; j++) {
+              to[j] = load_as_float(row + shProps[j]->offset, shProps[j]->type);
+            }
+          }
+        }
+      }
+    }, m_placement == PLYWorkerPlacement::BindToNodes);
+
+    return true;
+  }
+
+
+  bool PLYReader::sort_rows(uint32_t keyPropIdx, uint32_t newRowIndex[])
+  {
+    if (!has_element() || (!m_elementLoaded && m_numLoadedRows == 0)) {
+      return false;
+    }
+
+    const PLYElement* elem = element();
+    if (keyPropIdx >= elem->properties.size() || elem->properties[keyPropIdx].countType != PLYPropertyType::None) {
+      return false;
+    }
+
+    const PLYProperty& keyProp = elem->properties[keyPropIdx];
+    const size_t numRows = m_numLoadedRows;
+
+    std::vector<uint64_t> keys(numRows);
+    const uint32_t numThreads = num_worker_threads(numRows);
+    const size_t chunkSize = (numRows + numThreads - 1) / numThreads;
+    parallel_for(numThreads, [&](uint32_t t) {
+      const size_t start = std::min(numRows, t * chunkSize);
+      const size_t end = std::min(numRows, start + chunkSize);
+      const uint8_t* src = m_elementData.data() + start * elem->rowStride + keyProp.offset;
+      for (size_t i = start; i < end; i++, src += elem->rowStride) {
+        keys[i] = sortable_key(src, keyProp.type);
+      }
+    });
+
+    return sort_rows_by_key(keys, newRowIndex);
+  }
+
+
+  bool PLYReader::sort_rows_by_morton_code(const uint32_t posPropIdxs[3], uint32_t newRowIndex[])
+  {
+    if (!has_element() || (!m_elementLoaded && m_numLoadedRows == 0)) {
+      return false;
+    }
+
+    const PLYElement* elem = element();
+    for (uint32_t i = 0; i < 3; i++) {
+      if (posPropIdxs[i] >= elem->properties.size() || elem->properties[posPropIdxs[i]].countType != PLYPropertyType::None) {
+        return false;
+      }
+    }
+
+    const size_t numRows = m_numLoadedRows;
+    std::vector<float> pos(numRows * 3);
+    if (!extract_properties(posPropIdxs, 3, PLYPropertyType::Float, pos.data())) {
+      return false;
+    }
+
+    std::vector<uint64_t> keys;
+    compute_morton_codes(numRows, [&](size_t i) { return load_vec3(pos.data(), i); }, keys);
+    std::vector<float>().swap(pos);
+
+    return sort_rows_by_key(keys, newRowIndex);
+  }
+
+
+  bool PLYReader::remap_indices(const uint32_t propIdxs[], uint32_t numProps, const uint32_t remap[], uint32_t remapSize)
+  {
+    if (!has_element() || (!m_elementLoaded && m_numLoadedRows == 0)) {
+      return false;
+    }
+
+    PLYElement& elem = m_elements[m_currentElement];
+    for (uint32_t i = 0; i < numProps; i++) {
+      if (propIdxs[i] >= elem.properties.size() || elem.properties[propIdxs[i]].type >= PLYPropertyType::Float) {
+        return false;
+      }
+    }
+
+    auto remap_value = [remap, remapSize](uint8_t* val, PLYPropertyType type) {
+      int64_t idx = 0;
+      switch (type) {
+      case PLYPropertyType::Char:   idx = *reinterpret_cast<int8_t*>(val); break;
+      case PLYPropertyType::UChar:  idx = *val; break;
+      case PLYPropertyType::Short:  idx = *reinterpret_cast<int16_t*>(val); break;
+      case PLYPropertyType::UShort: idx = *reinterpret_cast<uint16_t*>(val); break;
+      case PLYPropertyType::Int:    idx = *reinterpret_cast<int32_t*>(val); break;
+      case PLYPropertyType::UInt:   idx = *reinterpret_cast<uint32_t*>(val); break;
+      default: return;
+      }
+      if (idx < 0 || idx >= int64_t(remapSize)) {
+        return;
+      }
+      uint32_t newIdx = remap[idx];
+      copy_and_convert(val, type, reinterpret_cast<const uint8_t*>(&newIdx), PLYPropertyType::UInt);
+    };
+
+    for (uint32_t i = 0; i < numProps; i++) {
+      PLYProperty& prop = elem.properties[propIdxs[i]];
+      const size_t valBytes = kPLYPropertySize[uint32_t(prop.type)];
+      if (prop.countType != PLYPropertyType::None) {
+        uint8_t* data = prop.listData.data();
+        const size_t numVals = prop.listData.size() / valBytes;
+        const uint32_t numThreads = num_worker_threads(numVals);
+        const size_t chunkSize = (numVals + numThreads - 1) / numThreads;
+        parallel_for(numThreads, [&](uint32_t t) {
+          const size_t start = std::min(numVals, t * chunkSize);
+          const size_t end = std::min(numVals, start + chunkSize);
+          for (size_t v = start; v < end; v++) {
+            remap_value(data + v * valBytes, prop.type);
+          }
+        });
+      }
+      else {
+        const size_t numRows = m_numLoadedRows;
+        const uint32_t numThreads = num_worker_threads(numRows);
+        const size_t chunkSize = (numRows + numThreads - 1) / numThreads;
+        parallel_for(numThreads, [&](uint32_t t) {
+          const size_t start = std::min(numRows, t * chunkSize);
+          const size_t end = std::min(numRows, start + chunkSize);
+          uint8_t* row = m_elementData.data() + start * elem.rowStride;
+          for (size_t r = start; r < end; r++, row += elem.rowStride) {
+            remap_value(row + prop.offset, prop.type);
+          }
+        });
+      }
+    }
+    return true;
+  }
+
+
+  //
+  // PLYReader private methods
+  //
+
+  bool PLYReader::sort_rows_by_key(const std::vector<uint64_t>& keys, uint32_t newRowIndex[])
+  {
+    PLYElement& elem = m_elements[m_currentElement];
+    const size_t numRows = keys.size();
+
+    std::vector<uint32_t> order;
+    radix_sort_indices(keys, order);
+
+    const uint32_t numThreads = num_worker_threads(numRows);
+    const size_t chunkSize = (numRows + numThreads - 1) / numThreads;
+
+    // Permute the fixed-size part of each row.
+    if (elem.rowStride > 0) {
+      PLYDataBuffer sorted(m_elementData.size());
+      const size_t rowStride = elem.rowStride;
+      parallel_for(numThreads, [&](uint32_t t) {
+        const size_t start = std::min(numRows, t * chunkSize);
+        const size_t end = std::min(numRows, start + chunkSize);
+        for (size_t i = start; i < end; i++) {
+          std::memcpy(sorted.data() + i * rowStride, m_elementData.data() + size_t(order[i]) * rowStride, rowStride);
+        }
+      }, m_placement == PLYWorkerPlacement::BindToNodes);
+      m_elementData.swap(sorted);
+    }
+
+    // Permute the list properties. Each one has its own storage, with
+    // variable-length rows, so we need the start offset of every old row.
+    for (PLYProperty& prop : elem.properties) {
+      if (prop.countType == PLYPropertyType::None) {
+        continue;
+      }
+      const size_t valBytes = kPLYPropertySize[uint32_t(prop.type)];
+      std::vector<size_t> rowStart(numRows + 1);
+      rowStart[0] = 0;
+      for (size_t i = 0; i < numRows; i++) {
+        rowStart[i + 1] = rowStart[i] + prop.rowCount[i] * valBytes;
+      }
+
+      std::vector<uint32_t> sortedCounts(numRows);
+      std::vector<size_t> sortedStart(numRows + 1);
+      sortedStart[0] = 0;
+      for (size_t i = 0; i < numRows; i++) {
+        sortedCounts[i] = prop.rowCount[order[i]];
+        sortedStart[i + 1] = sortedStart[i] + sortedCounts[i] * valBytes;
+      }
+
+      std::vector<uint8_t> sortedData(prop.listData.size());
+      parallel_for(numThreads, [&](uint32_t t) {
+        const size_t start = std::min(numRows, t * chunkSize);
+        const size_t end = std::min(numRows, start + chunkSize);
+        for (size_t i = start; i < end; i++) {
+          const size_t numBytes = sortedStart[i + 1] - sortedStart[i];
+          if (numBytes > 0) {
+            std::memcpy(sortedData.data() + sortedStart[i], prop.listData.data() + rowStart[order[i]], numBytes);
+          }
+        }
+      });
+      prop.listData.swap(sortedData);
+      prop.rowCount.swap(sortedCounts);
+    }
+
+    if (newRowIndex != nullptr) {
+      for (uint32_t i = 0; i < uint32_t(numRows); i++) {
+        newRowIndex[order[i]] = i;
+      }
+    }
+    return true;
+  }
+
+
+  bool PLYReader::refill_buffer()
+  {
+    if (m_f == nullptr || m_atEOF) {
+      // Nothing left to read.
+      return false;
+    }
+
+    if (m_pos == m_buf && m_end == m_bufEnd) {
+      // Can't make any more room in the buffer!
+      return false;
+    }
+
+    // Everything before `m_pos` is about to be discarded, so hash it first.
+    hash_consumed_bytes();
+
+    // Move everything from the start of the current token onwards, to the
+    // start of the read buffer.
+    int64_t bufSize = static_cast<int64_t>(m_bufEnd - m_buf);
+    if (bufSize < kPLYReadBufferSize) {
+      m_buf[bufSize] = m_buf[kPLYReadBufferSize];
+      m_buf[kPLYReadBufferSize] = '\0';
+      m_bufEnd = m_buf + kPLYReadBufferSize;
+    }
+    size_t keep = static_cast<size_t>(m_bufEnd - m_pos);
+    if (keep > 0 && m_pos > m_buf) {
+      std::memmove(m_buf, m_pos, sizeof(char) * keep);
+    }
+    m_end = m_buf + (m_end - m_pos);
+    m_pos = m_buf;
+
+    // Fill the remaining space in the buffer with data from the file.
+    size_t fetched = fread(m_buf + keep, sizeof(char), kPLYReadBufferSize - keep, m_f);
+    m_fileOffset += static_cast<int64_t>(fetched);
+    fetched += keep;
+    m_atEOF = fetched < kPLYReadBufferSize;
+    m_bufEnd = m_buf + fetched;
+    m_bufOffset = m_fileOffset - static_cast<int64_t>(fetched);
+    MINIPLY_PROBE(refill, m_bufOffset, uint64_t(fetched - keep), uint64_t(keep));
+
+    if (!m_inDataSection || m_fileType == PLYFileType::ASCII) {
+      return rewind_to_safe_char();
+    }
+    return true;
+  }
+
+
+  bool PLYReader::skip_rows(const PLYElement& elem, uint32_t numRows)
+  {
+    if (m_fileType == PLYFileType::ASCII) {
+      for (uint32_t row = 0; row < numRows; row++) {
+        next_line();
+      }
+      return true;
+    }
+
+    assert(elem.fixedSize);
+    int64_t elementStart = static_cast<int64_t>(m_pos - m_buf);
+    int64_t elementSize = static_cast<int64_t>(elem.rowStride) * numRows;
+    int64_t elementEnd = elementStart + elementSize;
+    if (m_hash != nullptr) {
+      // Read through the rows instead of seeking past them, so that they get
+      // hashed as they go through the buffer.
+      while (elementSize > static_cast<int64_t>(m_bufEnd - m_pos)) {
+        elementSize -= static_cast<int64_t>(m_bufEnd - m_pos);
+        m_pos = m_bufEnd;
+        m_end = m_pos;
+        if (!refill_buffer()) {
+          m_valid = false;
+          return false;
+        }
+      }
+      m_pos += elementSize;
+      m_end = m_pos;
+    }
+    else if (elementEnd >= kPLYReadBufferSize) {
+      return seek_to(m_bufOffset + elementEnd);
+    }
+    else {
+      m_pos = m_buf + elementEnd;
+      m_end = m_pos;
+    }
+    return true;
+  }
+
+
+  void PLYReader::hash_consumed_bytes()
+  {
+    if (m_hash == nullptr) {
+      return;
+    }
+    const int64_t pos = m_bufOffset + static_cast<int64_t>(m_pos - m_buf);
+    if (pos > m_hash->offset && !hash_file_range(m_hash->offset, pos)) {
+      m_valid = false;
+    }
+  }
+
+
+  bool PLYReader::hash_file_range(int64_t start, int64_t end)
+  {
+    // Anything from before the start of the read buffer has to be read from
+    // the file again. That only happens for data which was read before
+    // content hashing was turned on.
+    if (start < m_bufOffset) {
+      const int64_t readEnd = std::min(end, m_bufOffset);
+      std::vector<uint8_t> chunk(kPLYReadBufferSize);
+      while (start < readEnd) {
+        const size_t n = static_cast<size_t>(std::min(readEnd - start, int64_t(kPLYReadBufferSize)));
+        if (!file_pread(m_f, chunk.data(), n, start)) {
+          return false;
+        }
+        m_hash->element.update(chunk.data(), n);
+        start += int64_t(n);
+      }
+    #ifdef _WIN32
+      // `file_pread` moves the file position on Windows, so put it back.
+      file_seek(m_f, m_fileOffset, SEEK_SET);
+    #endif
+    }
+    if (start < end) {
+      m_hash->element.update(m_buf + (start - m_bufOffset), static_cast<size_t>(end - start));
+    }
+    m_hash->offset = end;
+    return true;
+  }
+
+
+  void PLYReader::finish_element_hash(size_t idx)
+  {
+    if (m_hash == nullptr || m_hash->numFinished != idx || idx >= m_elements.size()) {
+      return;
+    }
+    hash_consumed_bytes();
+    m_hash->elements[idx] = m_hash->element.digest();
+    m_hash->element.reset();
+    m_hash->numFinished++;
+  }
+
+
+  bool PLYReader::seek_to(int64_t offset)
+  {
+    if (m_f == nullptr || file_seek(m_f, offset, SEEK_SET) != 0) {
+      m_valid = false;
+      return false;
+    }
+
+    // Discard the buffer contents and start again from the new offset.
+    size_t fetched = fread(m_buf, sizeof(char), kPLYReadBufferSize, m_f);
+    m_bufOffset = offset;
+    m_fileOffset = offset + static_cast<int64_t>(fetched);
+    m_atEOF = fetched < kPLYReadBufferSize;
+    m_bufEnd = m_buf + fetched;
+    m_pos = m_buf;
+    m_end = m_buf;
+
+    if (!m_inDataSection || m_fileType == PLYFileType::ASCII) {
+      return rewind_to_safe_char();
+    }
+    m_buf[fetched] = '\0';
+    return true;
+  }
+
+
+  bool PLYReader::rewind_to_safe_char()
+  {
+    // If it looks like a token might run past the end of this buffer, move
+    // the buffer end pointer back before it & rewind the file. This way the
+    // next refill will pick up the whole of the token.
+    if (!m_atEOF && (m_bufEnd[-1] == '\n' || !is_safe_buffer_end(m_bufEnd[-1]))) {
+      const char* safe = m_bufEnd - 2;
+      // If '\n' is the last char in the buffer, then a call to `next_line()`
+      // will move `m_pos` to point at the null terminator but won't refresh
+      // the buffer. It would be clearer to fix this in `next_line()` but I
+      // believe it'll be more performant to simply treat `\n` as an unsafe
+      // character here.
+      while (safe >= m_end && (*safe == '\n' || !is_safe_buffer_end(*safe))) {
+        --safe;
+      }
+      if (safe < m_end) {
+        // No safe places to rewind to in the whole buffer!
+        return false;
+      }
+      ++safe;
+      m_buf[kPLYReadBufferSize] = *safe;
+      m_bufEnd = safe;
+    }
+    m_buf[m_bufEnd - m_buf] = '\0';
+
+    return true;
+  }
+
+
+  bool PLYReader::accept()
+  {
+    m_pos = m_end;
+    return true;
+  }
+
+
+  // Advances to end of line or to next non-whitespace char.
+  bool PLYReader::advance()
+  {
+    m_pos = m_end;
+    while (true) {
+      while (is_whitespace(*m_pos)) {
+        ++m_pos;
+      }
+      if (m_pos == m_bufEnd) {
+        m_end = m_pos;
+        if (refill_buffer()) {
+          continue;
+        }
+        return false;
+      }
+      break;
+    }
+    m_end = m_pos;
+    return true;
+  }
+
+
+  bool PLYReader::next_line()
+  {
+    m_pos = m_end;
+    do {
+      while (*m_pos != '\n') {
+        if (m_pos == m_bufEnd) {
+          m_end = m_pos;
+          if (refill_buffer()) {
+            continue;
+          }
+          return false;
+        }
+        ++m_pos;
+      }
+      ++m_pos; // move past the newline char
+      m_end = m_pos;
+    } while (match("comment") || match("obj_info"));
+
+    return true;
+  }
+
+
+  bool PLYReader::match(const char* str)
+  {
+    m_end = m_pos;
+    while (m_end < m_bufEnd && *str != '\0' && *m_end == *str) {
+      ++m_end;
+      ++str;
+    }
+    if (*str != '\0') {
+      return false;
+    }
+    return true;
+  }
+
+
+  bool PLYReader::which(const char* values[], uint32_t* index)
+  {
+    for (uint32_t i = 0; values[i] != nullptr; i++) {
+      if (keyword(values[i])) {
+        *index = i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+
+  bool PLYReader::which_property_type(PLYPropertyType* type)
+  {
+    for (uint32_t i = 0; kTypeAliases[i].name != nullptr; i++) {
+      if (keyword(kTypeAliases[i].name)) {
+        *type = kTypeAliases[i].type;
+        return true;
+      }
+    }
+    return false;
+  }
+
+
+  bool PLYReader::keyword(const char* kw)
+  {
+    return match(kw) && !is_keyword_part(*m_end);
+  }
+
+
+  bool PLYReader::identifier(char* dest, size_t destLen)
+  {
+    m_end = m_pos;
+    if (!is_keyword_start(*m_end) || destLen == 0) {
+      return false;
+    }
+    do {
+      ++m_end;
+    } while (is_keyword_part(*m_end));
+
+    size_t len = static_cast<size_t>(m_end - m_pos);
+    if (len >= destLen) {
+      return false; // identifier too large for dest!
+    }
+    std::memcpy(dest, m_pos, sizeof(char) * len);
+    dest[len] = '\0';
+    return true;
+  }
+
+
+  bool PLYReader::int_literal(int* value)
+  {
+    return miniply::int_literal(m_pos, &m_end, value);
+  }
+
+
+  bool PLYReader::float_literal(float* value)
+  {
+    return miniply::float_literal(m_pos, &m_end, value);
+  }
+
+
+  bool PLYReader::double_literal(double* value)
+  {
+    return miniply::double_literal(m_pos, &m_end, value);
+  }
+
+
+  bool PLYReader::parse_elements()
+  {
+    m_elements.reserve(4);
+    while (m_valid && keyword("element")) {
+      parse_element();
+    }
+    return true;
+  }
+
+
+  bool PLYReader::parse_element()
+  {
+    int count = 0;
+
+    m_valid = keyword("element") && advance() &&
+              identifier(m_tmpBuf, kPLYTempBufferSize) && advance() &&
+              int_literal(&count) && next_line();
+    if (!m_valid || count < 0) {
+      return false;
+    }
+
+    m_elements.push_back(PLYElement());
+    PLYElement& elem = m_elements.back();
+    elem.name = m_tmpBuf;
+    elem.count = static_cast<uint32_t>(count);
+    elem.properties.reserve(10);
+
+    while (m_valid && keyword("property")) {
+      parse_property(elem.properties);
+    }
+
+    return true;
+  }
+
+
+  bool PLYReader::parse_property(std::vector<PLYProperty>& properties)
+  {
+    PLYPropertyType type      = PLYPropertyType::None;
+    PLYPropertyType countType = PLYPropertyType::None;
+
+    m_valid = keyword("property") && advance();
+    if (!m_valid) {
+      return false;
+    }
+
+    if (keyword("list")) {
+      // This is a list property
+      m_valid = advance() && which_property_type(&countType) && advance();
+      if (!m_valid) {
+        return false;
+      }
+    }
+
+    m_valid = which_property_type(&type) && advance() &&
+              identifier(m_tmpBuf, kPLYTempBufferSize) && next_line();
+    if (!m_valid) {
+      return false;
+    }
+
+    properties.push_back(PLYProperty());
+    PLYProperty& prop = properties.back();
+    prop.name = m_tmpBuf;
+    prop.type = type;
+    prop.countType = countType;
+
+    return true;
+  }
+
+
+  bool PLYReader::load_fixed_size_element(PLYElement& elem)
+  {
+    if (!load_fixed_size_rows(elem, elem.count)) {
+      return false;
+    }
+    m_numLoadedRows = elem.count;
+    m_elementLoaded = true;
+    return true;
+  }
+
+
+  bool PLYReader::load_fixed_size_rows(PLYElement& elem, uint32_t numRows)
+  {
+    size_t numBytes = static_cast<size_t>(numRows) * elem.rowStride;
+
+    m_elementData.resize(numBytes);
+    if (m_hugePages) {
+      prefault_rows(m_elementData, numRows, elem.rowStride, m_placement == PLYWorkerPlacement::BindToNodes);
+    }
+
+    if (m_fileType == PLYFileType::ASCII) {
+      size_t back = 0;
+
+      for (uint32_t row = 0; row < numRows; row++) {
+        for (PLYProperty& prop : elem.properties) {
+          if (!load_ascii_scalar_property(prop, back)) {
+            m_valid = false;
+            return false;
+          }
+        }
+        next_line();
+      }
+    }
+    else if (numBytes >= kPLYDirectReadMinSize && numBytes > static_cast<size_t>(m_bufEnd - m_pos)) {
+      // Large elements are read straight from the file into the element
+      // storage, skipping the copy through the read buffer. If the element
+      // starts at an aligned file offset (e.g. it was written with
+      // `PLYWriter::set_data_alignment`), we read the whole thing from the
+      // file so that the read is aligned at both ends; otherwise we use what's
+      // already in the read buffer first.
+      //
+      // Unless the placement is `Serial`, each worker reads the block of rows
+      // it would be given by the parallel extraction paths, so the pages end
+      // up on the NUMA node of the thread that will use them. Workers also
+      // do the endian swap for their own rows.
+      const int64_t startOffset = m_bufOffset + static_cast<int64_t>(m_pos - m_buf);
+      const size_t prefixBytes = (startOffset % int64_t(kPLYDataAlignment) != 0) ? static_cast<size_t>(m_bufEnd - m_pos) : 0;
+      MINIPLY_PROBE(direct__read, startOffset + int64_t(prefixBytes), uint64_t(numBytes - prefixBytes));
+
+      // The element has to be hashed before it's endian swapped, so if content
+      // hashing is on the workers leave the swap until afterwards.
+      hash_consumed_bytes();
+      const uint32_t numThreads = (m_placement == PLYWorkerPlacement::Serial) ? 1 : num_worker_threads(numRows);
+      const size_t chunkSize = (size_t(numRows) + numThreads - 1) / numThreads;
+      const bool swapEndian = (m_fileType == PLYFileType::BinaryBigEndian) && m_hash == nullptr;
+      std::atomic<bool> readOK(true);
+      parallel_for(numThreads, [&](uint32_t t) {
+        const size_t start = std::min(size_t(numRows), t * chunkSize);
+        const size_t end = std::min(size_t(numRows), start + chunkSize);
+        size_t from = start * elem.rowStride;
+        const size_t to = end * elem.rowStride;
+        if (from < prefixBytes) {
+          const size_t n = std::min(to, prefixBytes) - from;
+          std::memcpy(m_elementData.data() + from, m_pos + from, n);
+          from += n;
+        }
+        if (from < to) {
+          uint8_t* dst = m_elementData.data() + from;
+          const int64_t offset = startOffset + int64_t(from);
+          const bool ok = (m_directFD >= 0) ?
+            file_pread_direct(m_directFD, m_f, dst, to - from, offset) :
+            file_pread(m_f, dst, to - from, offset);
+          if (!ok) {
+            readOK = false;
+            return;
+          }
+        }
+        if (swapEndian) {
+          endian_swap_rows(elem, m_elementData.data() + start * elem.rowStride, end - start);
+        }
+      }, m_placement == PLYWorkerPlacement::BindToNodes);
+
+      if (!readOK) {
+        m_valid = false;
+        return false;
+      }
+      if (m_hash != nullptr) {
+        m_hash->element.update(m_elementData.data(), numBytes);
+        m_hash->offset = startOffset + int64_t(numBytes);
+        if (m_fileType == PLYFileType::BinaryBigEndian) {
+          parallel_for(numThreads, [&](uint32_t t) {
+            const size_t start = std::min(size_t(numRows), t * chunkSize);
+            const size_t end = std::min(size_t(numRows), start + chunkSize);
+            endian_swap_rows(elem, m_elementData.data() + start * elem.rowStride, end - start);
+          }, m_placement == PLYWorkerPlacement::BindToNodes);
+        }
+      }
+      if (!seek_to(startOffset + int64_t(numBytes))) {
+        m_valid = false;
+        return false;
+      }
+      return true;
+    }
+    else {
+      uint8_t* dst = m_elementData.data();
+      uint8_t* dstEnd = dst + numBytes;
+      while (dst < dstEnd) {
+        size_t bytesAvailable = static_cast<size_t>(m_bufEnd - m_pos);
+        if (dst + bytesAvailable > dstEnd) {
+          bytesAvailable = static_cast<size_t>(dstEnd - dst);
+        }
+        std::memcpy(dst, m_pos, bytesAvailable);
+        m_pos += bytesAvailable;
+        m_end = m_pos;
+        dst += bytesAvailable;
+        if (!refill_buffer()) {
+          break;
+        }
+      }
+      if (dst < dstEnd) {
+        m_valid = false;
+        return false;
+      }
+    }
+
+    // We assume the CPU is little endian, so if the file is big-endian we
+    // need to do an endianness swap on every data item in the block.
+    if (m_fileType == PLYFileType::BinaryBigEndian) {
+      endian_swap_rows(elem, m_elementData.data(), numRows);
+    }
+
+    return true;
+  }
+
+
+  bool PLYReader::load_fixed_size_row(PLYElement& elem, size_t destIndex)
+  {
+    if (m_fileType == PLYFileType::ASCII) {
+      for (PLYProperty& prop : elem.properties) {
+        if (!load_ascii_scalar_property(prop, destIndex)) {
+          m_valid = false;
+          return false;
+        }
+      }
+      next_line();
+      return true;
+    }
+
+    if (m_pos + elem.rowStride > m_bufEnd) {
+      if (!refill_buffer() || m_pos + elem.rowStride > m_bufEnd) {
+        m_valid = false;
+        return false;
+      }
+    }
+    std::memcpy(m_elementData.data() + destIndex, m_pos, elem.rowStride);
+    m_pos += elem.rowStride;
+    m_end = m_pos;
+    if (m_fileType == PLYFileType::BinaryBigEndian) {
+      endian_swap_rows(elem, m_elementData.data() + destIndex, 1);
+    }
+    return true;
+  }
+
+
+  bool PLYReader::load_variable_size_element(PLYElement& elem)
+  {
+    m_elementData.resize(static_cast<size_t>(elem.count) * elem.rowStride);
+    if (m_hugePages) {
+      prefault_rows(m_elementData, elem.count, elem.rowStride, m_placement == PLYWorkerPlacement::BindToNodes);
+    }
+
+    // Preallocate enough space for each row in the property to contain three
+    // items. This is based on the assumptions that (a) the most common use for
+    // list properties is vertex indices; and (b) most faces are triangles.
+    // This gives a performance boost because we won't have to grow the
+    // listData vector as many times during loading.
+    for (PLYProperty& prop : elem.properties) {
+      if (prop.countType != PLYPropertyType::None) {
+        prop.listData.reserve(elem.count * kPLYPropertySize[uint32_t(prop.type)] * 3);
+        if (m_hugePages) {
+          advise_huge_pages(prop.listData.data(), prop.listData.capacity());
+        }
+      }
+    }
+
+    if (m_fileType == PLYFileType::Binary) {
+      size_t back = 0;
+      for (uint32_t row = 0; row < elem.count; row++) {
+        for (PLYProperty& prop : elem.properties) {
+          if (prop.countType == PLYPropertyType::None) {
+            m_valid = load_binary_scalar_property(prop, back);
+          }
+          else {
+            load_binary_list_property(prop);
+          }
+        }
+      }
+    }
+    else if (m_fileType == PLYFileType::ASCII) {
+      size_t back = 0;
+      for (uint32_t row = 0; row < elem.count; row++) {
+        for (PLYProperty& prop : elem.properties) {
+          if (prop.countType == PLYPropertyType::None) {
+            m_valid = load_ascii_scalar_property(prop, back);
+          }
+          else {
+            load_ascii_list_property(prop);
+          }
+        }
+        next_line();
+      }
+    }
+    else { // m_fileType == PLYFileType::BinaryBigEndian
+      size_t back = 0;
+      for (uint32_t row = 0; row < elem.count; row++) {
+        for (PLYProperty& prop : elem.properties) {
+          if (prop.countType == PLYPropertyType::None) {
+            m_valid = load_binary_scalar_property_big_endian(prop, back);
+          }
+          else {
+            load_binary_list_property_big_endian(prop);
+          }
+        }
+      }
+    }
+
+    m_numLoadedRows = elem.count;
+    m_elementLoaded = true;
+    return true;
+  }
+
+
+  bool PLYReader::load_ascii_scalar_property(PLYProperty& prop, size_t& destIndex)
+  {
+    uint8_t value[8];
+    if (!ascii_value(prop.type, value)) {
+      return false;
+    }
+
+    size_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
+    std::memcpy(m_elementData.data() + destIndex, value, numBytes);
+    destIndex += numBytes;
+    return true;
+  }
+
+
+  bool PLYReader::load_ascii_list_property(PLYProperty& prop)
+  {
+    int count = 0;
+    m_valid = (prop.countType < PLYPropertyType::Float) && int_literal(&count) && advance() && (count >= 0);
+    if (!m_valid) {
+      return false;
+    }
+
+    const size_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
+
+    size_t back = prop.listData.size();
+    prop.rowCount.push_back(static_cast<uint32_t>(count));
+    resize_list_data(prop, back + numBytes * size_t(count), m_hugePages);
+
+    for (uint32_t i = 0; i < uint32_t(count); i++) {
+      if (!ascii_value(prop.type, prop.listData.data() + back)) {
+        m_valid = false;
+        return false;
+      }
+      back += numBytes;
+    }
+
+    return true;
+  }
+
+
+  bool PLYReader::load_binary_scalar_property(PLYProperty& prop, size_t& destIndex)
+  {
+    size_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
+    if (m_pos + numBytes > m_bufEnd) {
+      if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
+        m_valid = false;
+        return false;
+      }
+    }
+    std::memcpy(m_elementData.data() + destIndex, m_pos, numBytes);
+    m_pos += numBytes;
+    m_end = m_pos;
+    destIndex += numBytes;
+    return true;
+  }
+
+
+  bool PLYReader::load_binary_list_property(PLYProperty& prop)
+  {
+    size_t countBytes = kPLYPropertySize[uint32_t(prop.countType)];
+    if (m_pos + countBytes > m_bufEnd) {
+      if (!refill_buffer() || m_pos + countBytes > m_bufEnd) {
+        m_valid = false;
+        return false;
+      }
+    }
+
+    int count = 0;
+    copy_and_convert_to(&count, reinterpret_cast<const uint8_t*>(m_pos), prop.countType);
+
+    if (count < 0) {
+      m_valid = false;
+      return false;
+    }
+
+    m_pos += countBytes;
+    m_end = m_pos;
+
+    const size_t listBytes = kPLYPropertySize[uint32_t(prop.type)] * uint32_t(count);
+    if (m_pos + listBytes > m_bufEnd) {
+      if (!refill_buffer() || m_pos + listBytes > m_bufEnd) {
+        m_valid = false;
+        return false;
+      }
+    }
+    size_t back = prop.listData.size();
+    prop.rowCount.push_back(static_cast<uint32_t>(count));
+    resize_list_data(prop, back + listBytes, m_hugePages);
+    std::memcpy(prop.listData.data() + back, m_pos, listBytes);
+
+    m_pos += listBytes;
+    m_end = m_pos;
+    return true;
+  }
+
+
+  bool PLYReader::load_binary_scalar_property_big_endian(PLYProperty &prop, size_t &destIndex)
+  {
+    size_t startIndex = destIndex;
+    if (load_binary_scalar_property(prop, destIndex)) {
+      endian_swap(m_elementData.data() + startIndex, prop.type);
+      return true;
+    }
+    else {
+      return false;
+    }
+  }
+
+
+  bool PLYReader::load_binary_list_property_big_endian(PLYProperty &prop)
+  {
+    size_t countBytes = kPLYPropertySize[uint32_t(prop.countType)];
+    if (m_pos + countBytes > m_bufEnd) {
+      if (!refill_buffer() || m_pos + countBytes > m_bufEnd) {
+        m_valid = false;
+        return false;
+      }
+    }
+
+    int count = 0;
+    uint8_t tmp[8];
+    std::memcpy(tmp, m_pos, countBytes);
+    endian_swap(tmp, prop.countType);
+    copy_and_convert_to(&count, tmp, prop.countType);
+
+    if (count < 0) {
+      m_valid = false;
+      return false;
+    }
+
+    m_pos += countBytes;
+    m_end = m_pos;
+
+    const size_t typeBytes = kPLYPropertySize[uint32_t(prop.type)];
+    const size_t listBytes = typeBytes * uint32_t(count);
+    if (m_pos + listBytes > m_bufEnd) {
+      if (!refill_buffer() || m_pos + listBytes > m_bufEnd) {
+        m_valid = false;
+        return false;
+      }
+    }
+    size_t back = prop.listData.size();
+    prop.rowCount.push_back(static_cast<uint32_t>(count));
+    resize_list_data(prop, back + listBytes, m_hugePages);
+
+    uint8_t* list = prop.listData.data() + back;
+    std::memcpy(list, m_pos, listBytes);
+    endian_swap_array(list, prop.type, count);
+
+    m_pos += listBytes;
+    m_end = m_pos;
+    return true;
+  }
+
+
+  bool PLYReader::ascii_value(PLYPropertyType propType, uint8_t value[8])
+  {
+    int tmpInt = 0;
+
+    switch (propType) {
+    case PLYPropertyType::Char:
+    case PLYPropertyType::UChar:
+    case PLYPropertyType::Short:
+    case PLYPropertyType::UShort:
+      m_valid = int_literal(&tmpInt);
+      break;
+    case PLYPropertyType::Int:
+    case PLYPropertyType::UInt:
+      m_valid = int_literal(reinterpret_cast<int*>(value));
+      break;
+    case PLYPropertyType::Float:
+      m_valid = float_literal(reinterpret_cast<float*>(value));
+      break;
+    case PLYPropertyType::Double:
+    default:
+      m_valid = double_literal(reinterpret_cast<double*>(value));
+      break;
+    }
+
+    if (!m_valid) {
+      return false;
+    }
+    advance();
+
+    switch (propType) {
+    case PLYPropertyType::Char:
+      reinterpret_cast<int8_t*>(value)[0] = static_cast<int8_t>(tmpInt);
+      break;
+    case PLYPropertyType::UChar:
+      value[0] = static_cast<uint8_t>(tmpInt);
+      break;
+    case PLYPropertyType::Short:
+      reinterpret_cast<int16_t*>(value)[0] = static_cast<int16_t>(tmpInt);
+      break;
+    case PLYPropertyType::UShort:
+      reinterpret_cast<uint16_t*>(value)[0] = static_cast<uint16_t>(tmpInt);
+      break;
+    default:
+      break;
+    }
+    return true;
+  }
+
+
+  //
+  // PLYWriter methods
+  //
+
+  PLYWriter::PLYWriter(const char* filename, size_t bufferSize) :
+    m_filename(filename)
+  {
+    if (file_open(&m_f, filename, "wb") != 0) {
+      m_f = nullptr;
+      return;
+    }
+    m_bufSize = bufferSize > 0 ? bufferSize : 1;
+    m_buf = new uint8_t[m_bufSize];
+    m_valid = true;
+  }
+
+
+  PLYWriter::~PLYWriter()
+  {
+    close();
+    delete[] m_buf;
+  }
+
+
+  bool PLYWriter::valid() const
+  {
+    return m_valid;
+  }
+
+
+  void PLYWriter::add_comment(const char* comment)
+  {
+    m_comments.push_back(comment);
+  }
+
+
+  void PLYWriter::set_data_alignment(uint32_t alignment)
+  {
+    m_alignment = alignment;
+  }
+
+
+  bool PLYWriter::write_header(const std::vector<PLYElement>& elements, bool reserveCountSpace)
+  {
+    if (!m_valid || m_bytesWritten > 0) {
+      return false;
+    }
+
+    std::string header = "ply\nformat binary_little_endian 1.0\n";
+    for (const std::string& comment : m_comments) {
+      header += "comment ";
+      header += comment;
+      header += "\n";
+    }
+
+    // A uint32_t count never needs more than 10 digits, so when reserving
+    // space we pad every count out to that width with trailing spaces.
+    char line[64];
+    m_countOffsets.clear();
+    for (const PLYElement& elem : elements) {
+      header += "element ";
+      header += elem.name;
+      header += " ";
+      if (reserveCountSpace) {
+        m_countOffsets.push_back(int64_t(header.size()));
+        snprintf(line, sizeof(line), "%-10u\n", elem.count);
+      }
+      else {
+        snprintf(line, sizeof(line), "%u\n", elem.count);
+      }
+      header += line;
+
+      for (const PLYProperty& prop : elem.properties) {
+        // Half is an extraction-only type; it isn't part of the PLY format.
+        if (prop.type == PLYPropertyType::Half || prop.countType == PLYPropertyType::Half) {
+          return false;
+        }
+        if (prop.countType != PLYPropertyType::None) {
+          header += "property list ";
+          header += kPLYPropertyTypeNames[uint32_t(prop.countType)];
+          header += " ";
+        }
+        else {
+          header += "property ";
+        }
+        header += kPLYPropertyTypeNames[uint32_t(prop.type)];
+        header += " ";
+        header += prop.name;
+        header += "\n";
+      }
+    }
+    // Pad the header out with a comment line so the data section starts at
+    // an aligned offset.
+    static const char kPaddingComment[] = "comment padding";
+    static const char kEndHeader[] = "end_header\n";
+    if (m_alignment > 1) {
+      size_t unpadded = header.size() + (sizeof(kPaddingComment) - 1) + 1 + (sizeof(kEndHeader) - 1);
+      size_t numSpaces = (m_alignment - unpadded % m_alignment) % m_alignment;
+      header += kPaddingComment;
+      header.append(numSpaces, ' ');
+      header += "\n";
+    }
+    header += kEndHeader;
+
+    return write_data(header.data(), header.size());
+  }
+
+
+  bool PLYWriter::write_data(const void* data, size_t numBytes)
+  {
+    if (!m_valid || (m_suspended && !resume())) {
+      return false;
+    }
+
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
+    if (m_bufUsed + numBytes > m_bufSize) {
+      if (!flush()) {
+        return false;
+      }
+      // Writes at least as big as the buffer go straight to the file.
+      if (numBytes >= m_bufSize) {
+        if (fwrite(src, 1, numBytes, m_f) != numBytes) {
+          m_valid = false;
+          return false;
+        }
+        m_bytesWritten += int64_t(numBytes);
+        return true;
+      }
+    }
+    std::memcpy(m_buf + m_bufUsed, src, numBytes);
+    m_bufUsed += numBytes;
+    m_bytesWritten += int64_t(numBytes);
+    return true;
+  }
+
+
+  bool PLYWriter::write_padded_rows(const void* rows, uint32_t numRows, uint32_t srcStride, uint32_t destStride)
+  {
+    if (destStride < srcStride) {
       return false;
     }
-    do {
-      ++m_end;
-    } while (is_keyword_part(*m_end));
+    else if (destStride == srcStride) {
+      return write_data(rows, size_t(numRows) * srcStride);
+    }
 
-    size_t len = static_cast<size_t>(m_end - m_pos);
-    if (len >= destLen) {
-      return false; // identifier too large for dest!
+    static const uint8_t kZeroes[64] = { 0 };
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(rows);
+    const uint32_t padding = destStride - srcStride;
+    for (uint32_t row = 0; row < numRows; row++, src += srcStride) {
+      if (!write_data(src, srcStride)) {
+        return false;
+      }
+      for (uint32_t remaining = padding; remaining > 0; ) {
+        uint32_t n = std::min(remaining, uint32_t(sizeof(kZeroes)));
+        if (!write_data(kZeroes, n)) {
+          return false;
+        }
+        remaining -= n;
+      }
     }
-    std::memcpy(dest, m_pos, sizeof(char) * len);
-    dest[len] = '\0';
     return true;
   }
 
 
-  bool PLYReader::int_literal(int* value)
+  bool PLYWriter::set_element_count(uint32_t elemIdx, uint32_t count)
   {
-    return miniply::int_literal(m_pos, &m_end, value);
+    if (!m_valid || elemIdx >= m_countOffsets.size() || (m_suspended && !resume()) || !flush()) {
+      return false;
+    }
+
+    char field[16];
+    snprintf(field, sizeof(field), "%-10u", count);
+    m_valid = file_seek(m_f, m_countOffsets[elemIdx], SEEK_SET) == 0 &&
+              fwrite(field, 1, 10, m_f) == 10 &&
+              file_seek(m_f, 0, SEEK_END) == 0;
+    return m_valid;
   }
 
 
-  bool PLYReader::float_literal(float* value)
+  bool PLYWriter::close()
   {
-    return miniply::float_literal(m_pos, &m_end, value);
+    if (m_suspended) {
+      // Everything was flushed when the writer was suspended.
+      bool ok = m_valid;
+      m_suspended = false;
+      m_valid = false;
+      return ok;
+    }
+    if (m_f == nullptr) {
+      return false;
+    }
+    bool ok = flush();
+    if (fclose(m_f) != 0) {
+      ok = false;
+    }
+    m_f = nullptr;
+    m_valid = false;
+    return ok;
   }
 
 
-  bool PLYReader::double_literal(double* value)
+  bool PLYWriter::suspend()
   {
-    return miniply::double_literal(m_pos, &m_end, value);
+    if (m_suspended) {
+      return m_valid;
+    }
+    if (m_f == nullptr) {
+      return false;
+    }
+    bool ok = flush();
+    if (fclose(m_f) != 0) {
+      ok = false;
+      m_valid = false;
+    }
+    m_f = nullptr;
+    delete[] m_buf;
+    m_buf = nullptr;
+    m_suspended = true;
+    return ok;
   }
 
 
-  bool PLYReader::parse_elements()
+  bool PLYWriter::suspended() const
   {
-    m_elements.reserve(4);
-    while (m_valid && keyword("element")) {
-      parse_element();
+    return m_suspended;
+  }
+
+
+  bool PLYWriter::resume()
+  {
+    if (file_open(&m_f, m_filename.c_str(), "r+b") != 0 || file_seek(m_f, 0, SEEK_END) != 0) {
+      if (m_f != nullptr) {
+        fclose(m_f);
+      }
+      m_f = nullptr;
+      m_valid = false;
+      m_suspended = false;
+      return false;
     }
+    m_buf = new uint8_t[m_bufSize];
+    m_suspended = false;
     return true;
   }
 
 
-  bool PLYReader::parse_element()
+  int64_t PLYWriter::bytes_written() const
   {
-    int count = 0;
+    return m_bytesWritten;
+  }
 
-    m_valid = keyword("element") && advance() &&
-              identifier(m_tmpBuf, kPLYTempBufferSize) && advance() &&
-              int_literal(&count) && next_line();
-    if (!m_valid || count < 0) {
+
+  bool PLYWriter::flush()
+  {
+    if (m_f == nullptr) {
       return false;
     }
+    if (m_bufUsed > 0) {
+      if (fwrite(m_buf, 1, m_bufUsed, m_f) != m_bufUsed) {
+        m_valid = false;
+      }
+      m_bufUsed = 0;
+    }
+    return m_valid;
+  }
 
-    m_elements.push_back(PLYElement());
-    PLYElement& elem = m_elements.back();
-    elem.name = m_tmpBuf;
-    elem.count = static_cast<uint32_t>(count);
-    elem.properties.reserve(10);
 
-    while (m_valid && keyword("property")) {
-      parse_property(elem.properties);
-    }
+  //
+  // Merging
+  //
+
+  static constexpr size_t kMergeCopyChunkSize = 4 * 1024 * 1024;
+
+
+  struct PLYMergeInput {
+    PLYFileType fileType = PLYFileType::ASCII;
+    std::vector<uint32_t> counts;         //!< Row count for each element.
+    std::vector<int64_t> elementOffsets;  //!< File offset for each element, or -1 if it can't be known without parsing.
+    uint32_t vertexBase = 0;              //!< Number of vertices in all of the preceding inputs.
+  };
+
 
+  static bool same_schema(const std::vector<PLYElement>& a, PLYReader& reader)
+  {
+    if (a.size() != reader.num_elements()) {
+      return false;
+    }
+    for (uint32_t e = 0; e < uint32_t(a.size()); e++) {
+      const PLYElement* b = reader.get_element(e);
+      if (a[e].name != b->name || a[e].properties.size() != b->properties.size()) {
+        return false;
+      }
+      for (size_t p = 0; p < a[e].properties.size(); p++) {
+        const PLYProperty& pa = a[e].properties[p];
+        const PLYProperty& pb = b->properties[p];
+        if (pa.name != pb.name || pa.type != pb.type || pa.countType != pb.countType) {
+          return false;
+        }
+      }
+    }
     return true;
   }
 
 
-  bool PLYReader::parse_property(std::vector<PLYProperty>& properties)
+  static void add_to_indices(uint32_t* vals, size_t n, uint32_t delta)
   {
-    PLYPropertyType type      = PLYPropertyType::None;
-    PLYPropertyType countType = PLYPropertyType::None;
+    size_t i = 0;
+  #ifdef MINIPLY_HAS_SSE2
+    const __m128i d = _mm_set1_epi32(int32_t(delta));
+    for (; i + 16 <= n; i += 16) {
+      __m128i* v = reinterpret_cast<__m128i*>(vals + i);
+      _mm_storeu_si128(v + 0, _mm_add_epi32(_mm_loadu_si128(v + 0), d));
+      _mm_storeu_si128(v + 1, _mm_add_epi32(_mm_loadu_si128(v + 1), d));
+      _mm_storeu_si128(v + 2, _mm_add_epi32(_mm_loadu_si128(v + 2), d));
+      _mm_storeu_si128(v + 3, _mm_add_epi32(_mm_loadu_si128(v + 3), d));
+    }
+    for (; i + 4 <= n; i += 4) {
+      __m128i* v = reinterpret_cast<__m128i*>(vals + i);
+      _mm_storeu_si128(v, _mm_add_epi32(_mm_loadu_si128(v), d));
+    }
+  #endif
+    for (; i < n; i++) {
+      vals[i] += delta;
+    }
+  }
 
-    m_valid = keyword("property") && advance();
-    if (!m_valid) {
-      return false;
+
+  // Adds `delta` to every value of an integer list property, in place.
+  static void offset_list_values(PLYProperty& prop, uint32_t delta)
+  {
+    if (delta == 0) {
+      return;
+    }
+    const size_t valBytes = kPLYPropertySize[uint32_t(prop.type)];
+    const size_t numVals = prop.listData.size() / valBytes;
+    if (valBytes == 4) {
+      // Signed and unsigned 32-bit adds are bitwise identical.
+      add_to_indices(reinterpret_cast<uint32_t*>(prop.listData.data()), numVals, delta);
+      return;
+    }
+    uint8_t* val = prop.listData.data();
+    for (size_t i = 0; i < numVals; i++, val += valBytes) {
+      int idx = 0;
+      copy_and_convert_to(&idx, val, prop.type);
+      idx += int(delta);
+      copy_and_convert(val, prop.type, reinterpret_cast<const uint8_t*>(&idx), PLYPropertyType::Int);
     }
+  }
 
-    if (keyword("list")) {
-      // This is a list property
-      m_valid = advance() && which_property_type(&countType) && advance();
-      if (!m_valid) {
-        return false;
+
+  // Serializes the loaded rows of a variable-size element back into binary
+  // little-endian PLY format, appending them to `out`.
+  static void encode_variable_size_rows(const PLYElement& elem, const uint8_t* rowData, uint32_t numRows, std::vector<uint8_t>& out)
+  {
+    size_t total = size_t(numRows) * elem.rowStride;
+    std::vector<const uint8_t*> listPos(elem.properties.size(), nullptr);
+    for (size_t p = 0; p < elem.properties.size(); p++) {
+      const PLYProperty& prop = elem.properties[p];
+      if (prop.countType != PLYPropertyType::None) {
+        total += size_t(numRows) * kPLYPropertySize[uint32_t(prop.countType)] + prop.listData.size();
+        listPos[p] = prop.listData.data();
       }
     }
 
-    m_valid = which_property_type(&type) && advance() &&
-              identifier(m_tmpBuf, kPLYTempBufferSize) && next_line();
-    if (!m_valid) {
-      return false;
+    size_t back = out.size();
+    out.resize(back + total);
+    uint8_t* to = out.data() + back;
+    for (uint32_t row = 0; row < numRows; row++, rowData += elem.rowStride) {
+      for (size_t p = 0; p < elem.properties.size(); p++) {
+        const PLYProperty& prop = elem.properties[p];
+        if (prop.countType == PLYPropertyType::None) {
+          const size_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
+          std::memcpy(to, rowData + prop.offset, numBytes);
+          to += numBytes;
+          continue;
+        }
+        const uint32_t count = prop.rowCount[row];
+        copy_and_convert(to, prop.countType, reinterpret_cast<const uint8_t*>(&count), PLYPropertyType::UInt);
+        to += kPLYPropertySize[uint32_t(prop.countType)];
+        const size_t listBytes = size_t(count) * kPLYPropertySize[uint32_t(prop.type)];
+        std::memcpy(to, listPos[p], listBytes);
+        listPos[p] += listBytes;
+        to += listBytes;
+      }
     }
+  }
 
-    properties.push_back(PLYProperty());
-    PLYProperty& prop = properties.back();
-    prop.name = m_tmpBuf;
-    prop.type = type;
-    prop.countType = countType;
 
-    return true;
+  // Opens `filename` and moves to element `elemIdx`.
+  static bool open_at_element(PLYReader& reader, uint32_t elemIdx)
+  {
+    for (uint32_t e = 0; e < elemIdx && reader.has_element(); e++) {
+      reader.next_element();
+    }
+    return reader.valid() && reader.has_element();
   }
 
 
-  bool PLYReader::load_fixed_size_element(PLYElement& elem)
+  bool merge_ply_files(const char* const inputs[], uint32_t numInputs, const char* outFilename, uint32_t numThreads)
   {
-    size_t numBytes = static_cast<size_t>(elem.count) * elem.rowStride;
-
-    m_elementData.resize(numBytes);
+    if (numInputs == 0) {
+      return false;
+    }
+    if (numThreads == 0) {
+      numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
 
-    if (m_fileType == PLYFileType::ASCII) {
-      size_t back = 0;
+    // Read all the headers, check that every input has the same schema and
+    // work out the total row count for each element.
+    std::vector<PLYElement> outElements;
+    std::vector<uint64_t> totals;
+    std::vector<PLYMergeInput> merged(numInputs);
+    for (uint32_t i = 0; i < numInputs; i++) {
+      PLYReader reader(inputs[i]);
+      if (!reader.valid()) {
+        return false;
+      }
+      if (i == 0) {
+        for (uint32_t e = 0; e < reader.num_elements(); e++) {
+          outElements.push_back(*reader.get_element(e));
+        }
+        totals.resize(outElements.size(), 0);
+      }
+      else if (!same_schema(outElements, reader)) {
+        return false;
+      }
 
-      for (uint32_t row = 0; row < elem.count; row++) {
-        for (PLYProperty& prop : elem.properties) {
-          if (!load_ascii_scalar_property(prop, back)) {
-            m_valid = false;
-            return false;
-          }
+      PLYMergeInput& input = merged[i];
+      input.fileType = reader.file_type();
+      input.counts.resize(outElements.size());
+      input.elementOffsets.resize(outElements.size(), -1);
+      int64_t offset = reader.data_offset();
+      for (uint32_t e = 0; e < uint32_t(outElements.size()); e++) {
+        input.counts[e] = reader.get_element(e)->count;
+        totals[e] += input.counts[e];
+        if (offset >= 0 && input.fileType == PLYFileType::Binary) {
+          input.elementOffsets[e] = offset;
+          offset = outElements[e].fixedSize ? offset + int64_t(outElements[e].rowStride) * input.counts[e] : -1;
         }
-        next_line();
       }
     }
-    else {
-      uint8_t* dst = m_elementData.data();
-      uint8_t* dstEnd = dst + numBytes;
-      while (dst < dstEnd) {
-        size_t bytesAvailable = static_cast<size_t>(m_bufEnd - m_pos);
-        if (dst + bytesAvailable > dstEnd) {
-          bytesAvailable = static_cast<size_t>(dstEnd - dst);
+
+    // Face indices in each input need offsetting by the number of vertices in
+    // all of the inputs before it.
+    uint32_t vertexElem = kInvalidIndex, faceElem = kInvalidIndex;
+    for (uint32_t e = 0; e < uint32_t(outElements.size()); e++) {
+      if (outElements[e].name == kPLYVertexElement) {
+        vertexElem = e;
+      }
+      else if (outElements[e].name == kPLYFaceElement) {
+        faceElem = e;
+      }
+    }
+    std::vector<uint32_t> indexProps;
+    if (vertexElem != kInvalidIndex && faceElem != kInvalidIndex) {
+      const PLYElement& face = outElements[faceElem];
+      for (uint32_t p = 0; p < uint32_t(face.properties.size()); p++) {
+        const PLYProperty& prop = face.properties[p];
+        if (prop.countType != PLYPropertyType::None && prop.type < PLYPropertyType::Float &&
+            (prop.name == "vertex_indices" || prop.name == "vertex_index")) {
+          indexProps.push_back(p);
         }
-        std::memcpy(dst, m_pos, bytesAvailable);
-        m_pos += bytesAvailable;
-        m_end = m_pos;
-        dst += bytesAvailable;
-        if (!refill_buffer()) {
-          break;
+      }
+      // Make sure the largest index will still fit in the property's type.
+      static const uint64_t kMaxIndex[] = { 0x7F, 0xFF, 0x7FFF, 0xFFFF, 0x7FFFFFFF, 0xFFFFFFFF };
+      for (uint32_t p : indexProps) {
+        if (totals[vertexElem] > 0 && totals[vertexElem] - 1 > kMaxIndex[uint32_t(face.properties[p].type)]) {
+          return false;
         }
       }
-      if (dst < dstEnd) {
-        m_valid = false;
+      uint32_t vertexBase = 0;
+      for (PLYMergeInput& input : merged) {
+        input.vertexBase = vertexBase;
+        vertexBase += input.counts[vertexElem];
+      }
+    }
+
+    for (size_t e = 0; e < outElements.size(); e++) {
+      if (totals[e] > 0xFFFFFFFFull) {
         return false;
       }
+      outElements[e].count = uint32_t(totals[e]);
+    }
 
-      // We assume the CPU is little endian, so if the file is big-endian we
-      // need to do an endianness swap on every data item in the block.
-      if (m_fileType == PLYFileType::BinaryBigEndian) {
-        uint8_t* data = m_elementData.data();
-        for (uint32_t row = 0; row < elem.count; row++) {
-          for (PLYProperty& prop : elem.properties) {
-            size_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
-            switch (numBytes) {
-            case 2:
-              endian_swap_2(data);
-              break;
-            case 4:
-              endian_swap_4(data);
-              break;
-            case 8:
-              endian_swap_8(data);
-              break;
-            default:
+    int64_t outOffset = 0;
+    {
+      PLYWriter writer(outFilename);
+      writer.add_comment("merged by miniply");
+      if (!writer.write_header(outElements) || !writer.close()) {
+        return false;
+      }
+      outOffset = writer.bytes_written();
+    }
+
+    FILE* out = nullptr;
+    if (file_open(&out, outFilename, "r+b") != 0) {
+      return false;
+    }
+
+    std::atomic<bool> ok(true);
+    for (uint32_t e = 0; e < uint32_t(outElements.size()) && ok; e++) {
+      const PLYElement& elem = outElements[e];
+      const bool offsetIndices = (e == faceElem) && !indexProps.empty();
+
+      if (elem.fixedSize) {
+        // Fixed-size: every input's output offset is known up front, so the
+        // inputs can all be copied in parallel.
+        std::vector<int64_t> dstOffsets(numInputs + 1);
+        dstOffsets[0] = outOffset;
+        for (uint32_t i = 0; i < numInputs; i++) {
+          dstOffsets[i + 1] = dstOffsets[i] + int64_t(elem.rowStride) * merged[i].counts[e];
+        }
+
+        std::atomic<uint32_t> nextInput(0);
+        parallel_for(std::min(numThreads, numInputs), [&](uint32_t) {
+          std::vector<uint8_t> chunk;
+          for (uint32_t i = nextInput++; i < numInputs && ok; i = nextInput++) {
+            const PLYMergeInput& input = merged[i];
+            int64_t dst = dstOffsets[i];
+            const int64_t numBytes = dstOffsets[i + 1] - dst;
+            if (numBytes == 0) {
+              continue;
+            }
+            if (input.elementOffsets[e] >= 0) {
+              // Same byte layout as the output: copy the raw bytes.
+              FILE* in = nullptr;
+              if (file_open(&in, inputs[i], "rb") != 0) {
+                ok = false;
+                break;
+              }
+              chunk.resize(size_t(std::min<int64_t>(numBytes, int64_t(kMergeCopyChunkSize))));
+              for (int64_t copied = 0; copied < numBytes && ok; ) {
+                size_t n = size_t(std::min<int64_t>(numBytes - copied, int64_t(chunk.size())));
+                if (!file_pread(in, chunk.data(), n, input.elementOffsets[e] + copied) ||
+                    !file_pwrite(out, chunk.data(), n, dst + copied)) {
+                  ok = false;
+                }
+                copied += int64_t(n);
+              }
+              fclose(in);
+            }
+            else {
+              // Needs parsing or byte swapping; go through the reader in
+              // batches so memory use stays bounded.
+              PLYReader reader(inputs[i]);
+              if (!open_at_element(reader, e)) {
+                ok = false;
+                break;
+              }
+              const uint32_t batchRows = uint32_t(std::max<size_t>(1, kMergeCopyChunkSize / std::max(1u, elem.rowStride)));
+              while (uint32_t numRows = reader.load_element_rows(batchRows)) {
+                size_t n = size_t(numRows) * elem.rowStride;
+                if (!file_pwrite(out, reader.get_element_data(), n, dst)) {
+                  ok = false;
+                  break;
+                }
+                dst += int64_t(n);
+              }
+              if (!reader.valid() || dst != dstOffsets[i + 1]) {
+                ok = false;
+              }
+            }
+          }
+        });
+        outOffset = dstOffsets[numInputs];
+        continue;
+      }
+
+      // Variable-size: we don't know how many bytes each input contributes
+      // until we've loaded it, so work through the inputs in windows. Each
+      // window is loaded & encoded in parallel, then written in parallel at
+      // offsets calculated from the encoded sizes.
+      const uint32_t windowSize = numThreads * 2;
+      std::vector<std::vector<uint8_t>> encoded(windowSize);
+      for (uint32_t windowStart = 0; windowStart < numInputs && ok; windowStart += windowSize) {
+        const uint32_t windowEnd = std::min(numInputs, windowStart + windowSize);
+        std::atomic<uint32_t> nextInput(windowStart);
+        parallel_for(std::min(numThreads, windowEnd - windowStart), [&](uint32_t) {
+          for (uint32_t i = nextInput++; i < windowEnd && ok; i = nextInput++) {
+            std::vector<uint8_t>& buf = encoded[i - windowStart];
+            buf.clear();
+            PLYReader reader(inputs[i]);
+            if (!open_at_element(reader, e) || !reader.load_element()) {
+              ok = false;
               break;
             }
-            data += numBytes;
+            PLYElement* inElem = reader.get_element(e);
+            if (offsetIndices) {
+              for (uint32_t p : indexProps) {
+                offset_list_values(inElem->properties[p], merged[i].vertexBase);
+              }
+            }
+            encode_variable_size_rows(*inElem, reader.get_element_data(), reader.num_loaded_rows(), buf);
           }
+        });
+
+        std::vector<int64_t> dstOffsets(windowEnd - windowStart);
+        for (uint32_t i = windowStart; i < windowEnd; i++) {
+          dstOffsets[i - windowStart] = outOffset;
+          outOffset += int64_t(encoded[i - windowStart].size());
         }
+
+        nextInput = windowStart;
+        parallel_for(std::min(numThreads, windowEnd - windowStart), [&](uint32_t) {
+          for (uint32_t i = nextInput++; i < windowEnd && ok; i = nextInput++) {
+            const std::vector<uint8_t>& buf = encoded[i - windowStart];
+            if (!buf.empty() && !file_pwrite(out, buf.data(), buf.size(), dstOffsets[i - windowStart])) {
+              ok = false;
+            }
+          }
+        });
       }
     }
 
-    m_elementLoaded = true;
-    return true;
+    if (fclose(out) != 0) {
+      ok = false;
+    }
+    return ok;
+  }
+
+
+  //
+  // ASCII to binary transcoding
+  //
+
+  static constexpr size_t kTranscodeBytesPerThread = 8 * 1024 * 1024;
+
+
+  // A run of consecutive rows from a single element, within the current
+  // window of the input file, which gets parsed by a single thread.
+  struct PLYTranscodeTask {
+    uint32_t elemIdx    = 0;
+    uint32_t firstLine  = 0;  //!< Index into the window's line array.
+    uint32_t numLines   = 0;
+    int64_t dstOffset   = -1; //!< Output offset, if known before parsing.
+    std::vector<uint8_t> out;
+  };
+
+
+  static inline const char* skip_ascii_whitespace(const char* pos)
+  {
+    while (is_whitespace(*pos)) {
+      ++pos;
+    }
+    return pos;
+  }
+
+
+  // Parses one ASCII value of the given type starting at `pos`, storing it in
+  // binary form at `dest`. Follows the same rules as `PLYReader::ascii_value`.
+  static bool parse_ascii_value(const char*& pos, PLYPropertyType type, uint8_t* dest)
+  {
+    int tmpInt = 0;
+    bool ok = false;
+    switch (type) {
+    case PLYPropertyType::Char:
+    case PLYPropertyType::UChar:
+    case PLYPropertyType::Short:
+    case PLYPropertyType::UShort:
+      ok = int_literal(pos, &pos, &tmpInt);
+      if (ok) {
+        copy_and_convert(dest, type, reinterpret_cast<const uint8_t*>(&tmpInt), PLYPropertyType::Int);
+      }
+      break;
+    case PLYPropertyType::Int:
+    case PLYPropertyType::UInt:
+      ok = int_literal(pos, &pos, &tmpInt);
+      std::memcpy(dest, &tmpInt, sizeof(tmpInt));
+      break;
+    case PLYPropertyType::Float:
+      {
+        float tmp = 0.0f;
+        ok = float_literal(pos, &pos, &tmp);
+        std::memcpy(dest, &tmp, sizeof(tmp));
+      }
+      break;
+    case PLYPropertyType::Double:
+    default:
+      {
+        double tmp = 0.0;
+        ok = double_literal(pos, &pos, &tmp);
+        std::memcpy(dest, &tmp, sizeof(tmp));
+      }
+      break;
+    }
+    pos = skip_ascii_whitespace(pos);
+    return ok;
   }
 
 
-  bool PLYReader::load_variable_size_element(PLYElement& elem)
+  // Parses a run of ASCII rows for an element into binary little-endian rows,
+  // appended to `out`. Each entry in `lines` points at the start of a row,
+  // which is terminated by a newline.
+  static bool transcode_ascii_rows(const PLYElement& elem, const char* const lines[], uint32_t numLines, std::vector<uint8_t>& out)
   {
-    m_elementData.resize(static_cast<size_t>(elem.count) * elem.rowStride);
-
-    // Preallocate enough space for each row in the property to contain three
-    // items. This is based on the assumptions that (a) the most common use for
-    // list properties is vertex indices; and (b) most faces are triangles.
-    // This gives a performance boost because we won't have to grow the
-    // listData vector as many times during loading.
-    for (PLYProperty& prop : elem.properties) {
-      if (prop.countType != PLYPropertyType::None) {
-        prop.listData.reserve(elem.count * kPLYPropertySize[uint32_t(prop.type)] * 3);
-      }
+    if (elem.fixedSize) {
+      out.resize(size_t(numLines) * elem.rowStride);
+    }
+    else {
+      out.reserve(size_t(numLines) * (elem.rowStride + 16));
     }
 
-    if (m_fileType == PLYFileType::Binary) {
-      size_t back = 0;
-      for (uint32_t row = 0; row < elem.count; row++) {
-        for (PLYProperty& prop : elem.properties) {
-          if (prop.countType == PLYPropertyType::None) {
-            m_valid = load_binary_scalar_property(prop, back);
+    uint8_t* to = out.data();
+    uint8_t value[8];
+    for (uint32_t i = 0; i < numLines; i++) {
+      const char* pos = skip_ascii_whitespace(lines[i]);
+      for (const PLYProperty& prop : elem.properties) {
+        const size_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
+        if (prop.countType == PLYPropertyType::None) {
+          if (elem.fixedSize) {
+            if (!parse_ascii_value(pos, prop.type, to)) {
+              return false;
+            }
+            to += numBytes;
           }
           else {
-            load_binary_list_property(prop);
+            if (!parse_ascii_value(pos, prop.type, value)) {
+              return false;
+            }
+            out.insert(out.end(), value, value + numBytes);
           }
+          continue;
         }
-      }
-    }
-    else if (m_fileType == PLYFileType::ASCII) {
-      size_t back = 0;
-      for (uint32_t row = 0; row < elem.count; row++) {
-        for (PLYProperty& prop : elem.properties) {
-          if (prop.countType == PLYPropertyType::None) {
-            m_valid = load_ascii_scalar_property(prop, back);
-          }
-          else {
-            load_ascii_list_property(prop);
-          }
+
+        int count = 0;
+        if (prop.countType >= PLYPropertyType::Float || !int_literal(pos, &pos, &count) || count < 0) {
+          return false;
         }
-        next_line();
-      }
-    }
-    else { // m_fileType == PLYFileType::BinaryBigEndian
-      size_t back = 0;
-      for (uint32_t row = 0; row < elem.count; row++) {
-        for (PLYProperty& prop : elem.properties) {
-          if (prop.countType == PLYPropertyType::None) {
-            m_valid = load_binary_scalar_property_big_endian(prop, back);
-          }
-          else {
-            load_binary_list_property_big_endian(prop);
+        pos = skip_ascii_whitespace(pos);
+        copy_and_convert(value, prop.countType, reinterpret_cast<const uint8_t*>(&count), PLYPropertyType::Int);
+        out.insert(out.end(), value, value + kPLYPropertySize[uint32_t(prop.countType)]);
+
+        size_t back = out.size();
+        out.resize(back + numBytes * size_t(count));
+        for (int j = 0; j < count; j++) {
+          if (!parse_ascii_value(pos, prop.type, out.data() + back)) {
+            return false;
           }
+          back += numBytes;
         }
       }
     }
-
-    m_elementLoaded = true;
     return true;
   }
 
 
-  bool PLYReader::load_ascii_scalar_property(PLYProperty& prop, size_t& destIndex)
+  bool transcode_ascii_to_binary(const char* inFilename, const char* outFilename, uint32_t numThreads)
   {
-    uint8_t value[8];
-    if (!ascii_value(prop.type, value)) {
-      return false;
+    if (numThreads == 0) {
+      numThreads = std::max(1u, std::thread::hardware_concurrency());
     }
 
-    size_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
-    std::memcpy(m_elementData.data() + destIndex, value, numBytes);
-    destIndex += numBytes;
-    return true;
-  }
-
-
-  bool PLYReader::load_ascii_list_property(PLYProperty& prop)
-  {
-    int count = 0;
-    m_valid = (prop.countType < PLYPropertyType::Float) && int_literal(&count) && advance() && (count >= 0);
-    if (!m_valid) {
-      return false;
+    std::vector<PLYElement> elements;
+    int64_t dataOffset = 0;
+    {
+      PLYReader reader(inFilename);
+      if (!reader.valid() || reader.file_type() != PLYFileType::ASCII) {
+        return false;
+      }
+      for (uint32_t e = 0; e < reader.num_elements(); e++) {
+        elements.push_back(*reader.get_element(e));
+      }
+      dataOffset = reader.data_offset();
     }
 
-    const size_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
-
-    size_t back = prop.listData.size();
-    prop.rowCount.push_back(static_cast<uint32_t>(count));
-    prop.listData.resize(back + numBytes * size_t(count));
-
-    for (uint32_t i = 0; i < uint32_t(count); i++) {
-      if (!ascii_value(prop.type, prop.listData.data() + back)) {
-        m_valid = false;
+    int64_t outOffset = 0;
+    {
+      PLYWriter writer(outFilename);
+      if (!writer.write_header(elements) || !writer.close()) {
         return false;
       }
-      back += numBytes;
+      outOffset = writer.bytes_written();
     }
 
-    return true;
-  }
-
+    FILE* in = nullptr;
+    if (file_open(&in, inFilename, "rb") != 0) {
+      return false;
+    }
+    FILE* out = nullptr;
+    if (file_open(&out, outFilename, "r+b") != 0) {
+      fclose(in);
+      return false;
+    }
 
-  bool PLYReader::load_binary_scalar_property(PLYProperty& prop, size_t& destIndex)
-  {
-    size_t numBytes = kPLYPropertySize[uint32_t(prop.type)];
-    if (m_pos + numBytes > m_bufEnd) {
-      if (!refill_buffer() || m_pos + numBytes > m_bufEnd) {
-        m_valid = false;
-        return false;
+    // The output offset of each element is known up front for as long as
+    // there are only fixed-size elements before it.
+    std::vector<int64_t> elemOutStart(elements.size(), -1);
+    {
+      int64_t offset = outOffset;
+      for (size_t e = 0; e < elements.size() && elements[e].fixedSize; e++) {
+        elemOutStart[e] = offset;
+        offset += int64_t(elements[e].rowStride) * elements[e].count;
       }
     }
-    std::memcpy(m_elementData.data() + destIndex, m_pos, numBytes);
-    m_pos += numBytes;
-    m_end = m_pos;
-    destIndex += numBytes;
-    return true;
-  }
 
+    // We read the input in large windows. Every window is split at line
+    // boundaries, with any partial line at the end carried over to the next
+    // window, so memory use is bounded by the window size.
+    const size_t windowSize = kTranscodeBytesPerThread * numThreads;
+    std::vector<char> window(windowSize + 1);
+    std::vector<const char*> lines;
+    std::vector<PLYTranscodeTask> tasks;
+
+    uint32_t elemIdx = 0, rowInElem = 0;
+    while (elemIdx < elements.size() && elements[elemIdx].count == 0) {
+      ++elemIdx;
+    }
 
-  bool PLYReader::load_binary_list_property(PLYProperty& prop)
-  {
-    size_t countBytes = kPLYPropertySize[uint32_t(prop.countType)];
-    if (m_pos + countBytes > m_bufEnd) {
-      if (!refill_buffer() || m_pos + countBytes > m_bufEnd) {
-        m_valid = false;
-        return false;
+    bool ok = file_seek(in, dataOffset, SEEK_SET) == 0;
+    size_t carried = 0;
+    bool atEOF = false;
+    while (ok && elemIdx < elements.size()) {
+      if (atEOF) {
+        ok = false; // Ran out of input before all elements were complete.
+        break;
+      }
+      size_t fetched = fread(window.data() + carried, 1, windowSize - carried, in);
+      size_t used = carried + fetched;
+      atEOF = used < windowSize;
+      if (atEOF && used > 0 && window[used - 1] != '\n') {
+        window[used++] = '\n'; // The last line doesn't need a newline.
+      }
+      window[used] = '\0';
+
+      // Find the start of every complete row in this window, skipping any
+      // comment lines.
+      lines.clear();
+      const char* lineStart = window.data();
+      const char* windowEnd = window.data() + used;
+      while (lineStart < windowEnd) {
+        const char* lineEnd = reinterpret_cast<const char*>(std::memchr(lineStart, '\n', size_t(windowEnd - lineStart)));
+        if (lineEnd == nullptr) {
+          break;
+        }
+        if (std::strncmp(lineStart, "comment", 7) != 0 && std::strncmp(lineStart, "obj_info", 8) != 0) {
+          lines.push_back(lineStart);
+        }
+        lineStart = lineEnd + 1;
+      }
+      if (lines.empty() && lineStart == window.data()) {
+        ok = false; // A single line bigger than the whole window.
+        break;
       }
-    }
 
-    int count = 0;
-    copy_and_convert_to(&count, reinterpret_cast<const uint8_t*>(m_pos), prop.countType);
+      // Split the rows into tasks, giving each thread an equal share of each
+      // element's rows in this window.
+      tasks.clear();
+      uint32_t lineIdx = 0;
+      const uint32_t numLines = uint32_t(lines.size());
+      while (lineIdx < numLines && elemIdx < elements.size()) {
+        const PLYElement& elem = elements[elemIdx];
+        const uint32_t segLines = std::min(numLines - lineIdx, elem.count - rowInElem);
+        const uint32_t perTask = std::max(1u, (segLines + numThreads - 1) / numThreads);
+        for (uint32_t start = 0; start < segLines; start += perTask) {
+          PLYTranscodeTask task;
+          task.elemIdx = elemIdx;
+          task.firstLine = lineIdx + start;
+          task.numLines = std::min(perTask, segLines - start);
+          if (elemOutStart[elemIdx] >= 0 && elem.fixedSize) {
+            task.dstOffset = elemOutStart[elemIdx] + int64_t(rowInElem + start) * elem.rowStride;
+          }
+          tasks.push_back(std::move(task));
+        }
+        lineIdx += segLines;
+        rowInElem += segLines;
+        while (elemIdx < elements.size() && rowInElem == elements[elemIdx].count) {
+          ++elemIdx;
+          rowInElem = 0;
+        }
+      }
 
-    if (count < 0) {
-      m_valid = false;
-      return false;
-    }
+      // Parse all the tasks in parallel. Tasks with a known output offset
+      // write their results immediately; the others are held until we've
+      // worked out where they go.
+      std::atomic<uint32_t> nextTask(0);
+      std::atomic<bool> parsedOK(true);
+      const uint32_t numTasks = uint32_t(tasks.size());
+      parallel_for(std::min(numThreads, numTasks), [&](uint32_t) {
+        for (uint32_t t = nextTask++; t < numTasks && parsedOK; t = nextTask++) {
+          PLYTranscodeTask& task = tasks[t];
+          if (!transcode_ascii_rows(elements[task.elemIdx], lines.data() + task.firstLine, task.numLines, task.out)) {
+            parsedOK = false;
+            break;
+          }
+          if (task.dstOffset >= 0) {
+            if (!file_pwrite(out, task.out.data(), task.out.size(), task.dstOffset)) {
+              parsedOK = false;
+              break;
+            }
+            std::vector<uint8_t>().swap(task.out);
+          }
+        }
+      });
+      ok = parsedOK;
 
-    m_pos += countBytes;
-    m_end = m_pos;
+      // Write out the remaining tasks in order.
+      for (PLYTranscodeTask& task : tasks) {
+        if (!ok) {
+          break;
+        }
+        if (task.dstOffset >= 0) {
+          outOffset = task.dstOffset + int64_t(task.numLines) * elements[task.elemIdx].rowStride;
+          continue;
+        }
+        ok = file_pwrite(out, task.out.data(), task.out.size(), outOffset);
+        outOffset += int64_t(task.out.size());
+      }
 
-    const size_t listBytes = kPLYPropertySize[uint32_t(prop.type)] * uint32_t(count);
-    if (m_pos + listBytes > m_bufEnd) {
-      if (!refill_buffer() || m_pos + listBytes > m_bufEnd) {
-        m_valid = false;
-        return false;
+      // Carry any unprocessed bytes over to the start of the next window.
+      const char* consumed = (lineIdx < numLines) ? lines[lineIdx] : lineStart;
+      carried = size_t(windowEnd - consumed);
+      if (carried > 0) {
+        std::memmove(window.data(), consumed, carried);
       }
     }
-    size_t back = prop.listData.size();
-    prop.rowCount.push_back(static_cast<uint32_t>(count));
-    prop.listData.resize(back + listBytes);
-    std::memcpy(prop.listData.data() + back, m_pos, listBytes);
 
-    m_pos += listBytes;
-    m_end = m_pos;
-    return true;
+    fclose(in);
+    if (fclose(out) != 0) {
+      ok = false;
+    }
+    return ok;
   }
 
 
-  bool PLYReader::load_binary_scalar_property_big_endian(PLYProperty &prop, size_t &destIndex)
+  //
+  // Prefetching
+  //
+
+  // Bytes at the start of each prefetched file which we read ourselves,
+  // rather than just advising the OS. This makes sure the open and first
+  // read have really happened, even on file systems which ignore advice.
+  static constexpr size_t kPrefetchHeadSize = 64 * 1024;
+
+
+  // Opens `filename`, advises the OS to read up to `maxBytes` of it and reads
+  // the first part. Returns the number of bytes requested.
+  static uint64_t prefetch_file(const char* filename, uint64_t maxBytes, std::vector<uint8_t>& scratch)
   {
-    size_t startIndex = destIndex;
-    if (load_binary_scalar_property(prop, destIndex)) {
-      endian_swap(m_elementData.data() + startIndex, prop.type);
-      return true;
+    FILE* f = nullptr;
+    if (file_open(&f, filename, "rb") != 0 || f == nullptr) {
+      return 0;
     }
-    else {
-      return false;
+    uint64_t fileSize = 0;
+    if (file_seek(f, 0, SEEK_END) == 0) {
+    #ifdef _WIN32
+      fileSize = uint64_t(_ftelli64(f));
+    #else
+      fileSize = uint64_t(ftello(f));
+    #endif
+    }
+    const uint64_t numBytes = std::min(fileSize, maxBytes);
+  #if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+    if (numBytes > 0) {
+      posix_fadvise(fileno(f), 0, static_cast<off_t>(numBytes), POSIX_FADV_WILLNEED);
     }
+  #endif
+    scratch.resize(kPrefetchHeadSize);
+    file_pread(f, scratch.data(), size_t(std::min(numBytes, uint64_t(kPrefetchHeadSize))), 0);
+    fclose(f);
+    return numBytes;
   }
 
 
-  bool PLYReader::load_binary_list_property_big_endian(PLYProperty &prop)
-  {
-    size_t countBytes = kPLYPropertySize[uint32_t(prop.countType)];
-    if (m_pos + countBytes > m_bufEnd) {
-      if (!refill_buffer() || m_pos + countBytes > m_bufEnd) {
-        m_valid = false;
-        return false;
-      }
-    }
+  struct PLYPrefetcher::State {
+    std::vector<std::string> filenames;
+    uint32_t lookahead;
+    uint64_t byteBudget;
 
-    int count = 0;
-    uint8_t tmp[8];
-    std::memcpy(tmp, m_pos, countBytes);
-    endian_swap(tmp, prop.countType);
-    copy_and_convert_to(&count, tmp, prop.countType);
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stop = false;
+    size_t first = 0;                 // Index of the first file that hasn't been started yet.
+    size_t next = 0;                  // Index of the next file to prefetch.
+    uint64_t bytesAhead = 0;          // Bytes requested for files from `first` onwards.
+    std::vector<uint64_t> requested;  // Bytes requested for each file.
+    std::thread worker;
 
-    if (count < 0) {
-      m_valid = false;
-      return false;
-    }
+    void run();
+  };
 
-    m_pos += countBytes;
-    m_end = m_pos;
 
-    const size_t typeBytes = kPLYPropertySize[uint32_t(prop.type)];
-    const size_t listBytes = typeBytes * uint32_t(count);
-    if (m_pos + listBytes > m_bufEnd) {
-      if (!refill_buffer() || m_pos + listBytes > m_bufEnd) {
-        m_valid = false;
-        return false;
+  void PLYPrefetcher::State::run()
+  {
+    std::vector<uint8_t> scratch;
+    std::unique_lock<std::mutex> guard(lock);
+    while (!stop) {
+      next = std::max(next, first);
+      const size_t windowEnd = std::min(filenames.size(), first + lookahead);
+      if (next >= windowEnd || bytesAhead >= byteBudget) {
+        wake.wait(guard);
+        continue;
+      }
+      const size_t idx = next++;
+      const uint64_t maxBytes = byteBudget - bytesAhead;
+      guard.unlock();
+      const uint64_t numBytes = prefetch_file(filenames[idx].c_str(), maxBytes, scratch);
+      guard.lock();
+      // The caller may have moved past this file while we were reading it.
+      if (idx >= first) {
+        requested[idx] = numBytes;
+        bytesAhead += numBytes;
       }
     }
-    size_t back = prop.listData.size();
-    prop.rowCount.push_back(static_cast<uint32_t>(count));
-    prop.listData.resize(back + listBytes);
-
-    uint8_t* list = prop.listData.data() + back;
-    std::memcpy(list, m_pos, listBytes);
-    endian_swap_array(list, prop.type, count);
-
-    m_pos += listBytes;
-    m_end = m_pos;
-    return true;
   }
 
 
-  bool PLYReader::ascii_value(PLYPropertyType propType, uint8_t value[8])
+  PLYPrefetcher::PLYPrefetcher(const std::vector<std::string>& filenames, uint32_t lookahead, uint64_t byteBudget)
   {
-    int tmpInt = 0;
-
-    switch (propType) {
-    case PLYPropertyType::Char:
-    case PLYPropertyType::UChar:
-    case PLYPropertyType::Short:
-    case PLYPropertyType::UShort:
-      m_valid = int_literal(&tmpInt);
-      break;
-    case PLYPropertyType::Int:
-    case PLYPropertyType::UInt:
-      m_valid = int_literal(reinterpret_cast<int*>(value));
-      break;
-    case PLYPropertyType::Float:
-      m_valid = float_literal(reinterpret_cast<float*>(value));
-      break;
-    case PLYPropertyType::Double:
-    default:
-      m_valid = double_literal(reinterpret_cast<double*>(value));
-      break;
-    }
-
-    if (!m_valid) {
-      return false;
+    m_state = new State();
+    m_state->filenames = filenames;
+    m_state->lookahead = lookahead;
+    m_state->byteBudget = byteBudget;
+    m_state->requested.resize(filenames.size(), 0);
+    if (lookahead > 0 && byteBudget > 0 && !filenames.empty()) {
+      m_state->worker = std::thread(&State::run, m_state);
     }
-    advance();
-
-    switch (propType) {
-    case PLYPropertyType::Char:
-      reinterpret_cast<int8_t*>(value)[0] = static_cast<int8_t>(tmpInt);
-      break;
-    case PLYPropertyType::UChar:
-      value[0] = static_cast<uint8_t>(tmpInt);
-      break;
-    case PLYPropertyType::Short:
-      reinterpret_cast<int16_t*>(value)[0] = static_cast<int16_t>(tmpInt);
-      break;
-    case PLYPropertyType::UShort:
-      reinterpret_cast<uint16_t*>(value)[0] = static_cast<uint16_t>(tmpInt);
-      break;
-    default:
-      break;
+  }
+
+
+  PLYPrefetcher::~PLYPrefetcher()
+  {
+    {
+      std::lock_guard<std::mutex> guard(m_state->lock);
+      m_state->stop = true;
     }
-    return true;
+    m_state->wake.notify_one();
+    if (m_state->worker.joinable()) {
+      m_state->worker.join();
+    }
+    delete m_state;
+  }
+
+
+  void PLYPrefetcher::set_current(size_t idx)
+  {
+    {
+      std::lock_guard<std::mutex> guard(m_state->lock);
+      const size_t newFirst = std::min(idx + 1, m_state->filenames.size());
+      for (size_t i = m_state->first; i < newFirst; i++) {
+        m_state->bytesAhead -= m_state->requested[i];
+        m_state->requested[i] = 0;
+      }
+      m_state->first = std::max(m_state->first, newFirst);
+    }
+    m_state->wake.notify_one();
   }
 
 
@@ -2054,4 +6422,878 @@ namespace miniply {
     return n - 2;
   }
 
+
+  //
+  // Triangle mesh helpers
+  //
+
+  // Vertex to triangle adjacency, with the triangles using vertex `v` stored
+  // in `tris[offsets[v]]` to `tris[offsets[v + 1] - 1]`.
+  struct VertexTriangleAdjacency {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> tris;
+  };
+
+
+  // All indices must be less than `numVerts`.
+  static void build_vertex_triangle_adjacency(const uint32_t indices[], size_t numTris, uint32_t numVerts, VertexTriangleAdjacency& adjacency)
+  {
+    adjacency.offsets.assign(size_t(numVerts) + 1, 0);
+    for (size_t i = 0; i < numTris * 3; i++) {
+      ++adjacency.offsets[indices[i] + 1];
+    }
+    for (uint32_t v = 0; v < numVerts; v++) {
+      adjacency.offsets[v + 1] += adjacency.offsets[v];
+    }
+    adjacency.tris.resize(numTris * 3);
+    std::vector<uint32_t> next(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+    for (size_t i = 0; i < numTris * 3; i++) {
+      adjacency.tris[next[indices[i]]++] = uint32_t(i / 3);
+    }
+  }
+
+
+  // Sets `order` to the triangle indices sorted along a Morton curve through
+  // the triangle centroids. Returns false if any vertex index is out of
+  // range.
+  static bool sort_triangles_by_morton_code(const float pos[], uint32_t numVerts, const uint32_t indices[], uint32_t numTris,
+                                            std::vector<uint32_t>& order)
+  {
+    const uint32_t numThreads = num_worker_threads(numTris);
+    const size_t chunkSize = (size_t(numTris) + numThreads - 1) / numThreads;
+
+    // Check the indices.
+    std::vector<uint8_t> threadOK(numThreads, 1);
+    parallel_for(numThreads, [&](uint32_t t) {
+      const size_t start = std::min(size_t(numTris), t * chunkSize);
+      const size_t end = std::min(size_t(numTris), start + chunkSize);
+      for (size_t i = start; i < end; i++) {
+        const uint32_t* tri = indices + i * 3;
+        if (tri[0] >= numVerts || tri[1] >= numVerts || tri[2] >= numVerts) {
+          threadOK[t] = 0;
+          return;
+        }
+      }
+    });
+    for (uint8_t ok : threadOK) {
+      if (!ok) {
+        return false;
+      }
+    }
+
+    std::vector<uint64_t> keys;
+    compute_morton_codes(numTris, [&](size_t i) {
+      const uint32_t* tri = indices + i * 3;
+      return (load_vec3(pos, tri[0]) + load_vec3(pos, tri[1]) + load_vec3(pos, tri[2])) * (1.0f / 3.0f);
+    }, keys);
+    radix_sort_indices(keys, order);
+    return true;
+  }
+
+
+  //
+  // Meshlets
+  //
+
+  static inline uint32_t find_meshlet_vertex(const uint32_t verts[], uint32_t numVerts, uint32_t vert)
+  {
+    for (uint32_t i = 0; i < numVerts; i++) {
+      if (verts[i] == vert) {
+        return i;
+      }
+    }
+    return kInvalidIndex;
+  }
+
+
+  // Fills in the bounding sphere and normal cone of a finished meshlet.
+  // `verts` and `tris` point at the meshlet's own vertex and triangle lists;
+  // `normals` and `corners` are scratch space.
+  static void compute_meshlet_bounds(PLYMeshlet& meshlet, const float pos[], const uint32_t verts[], const uint8_t tris[],
+                                     std::vector<Vec3>& normals, std::vector<Vec3>& corners)
+  {
+    // The sphere is centred on the bounding box rather than being minimal,
+    // which is close enough for culling and much cheaper.
+    Vec3 lo = load_vec3(pos, verts[0]);
+    Vec3 hi = lo;
+    for (uint32_t i = 1; i < meshlet.vertexCount; i++) {
+      Vec3 p = load_vec3(pos, verts[i]);
+      lo = min(lo, p);
+      hi = max(hi, p);
+    }
+    const Vec3 center = (lo + hi) * 0.5f;
+    float radiusSq = 0.0f;
+    for (uint32_t i = 0; i < meshlet.vertexCount; i++) {
+      Vec3 d = load_vec3(pos, verts[i]) - center;
+      radiusSq = std::max(radiusSq, dot(d, d));
+    }
+    meshlet.center[0] = center.x;
+    meshlet.center[1] = center.y;
+    meshlet.center[2] = center.z;
+    meshlet.radius = std::sqrt(radiusSq);
+
+    // Until we know better, the cone can't cull anything.
+    meshlet.coneAxis[0] = 0.0f;
+    meshlet.coneAxis[1] = 0.0f;
+    meshlet.coneAxis[2] = 0.0f;
+    meshlet.coneCutoff = 1.0f;
+    meshlet.coneApex[0] = center.x;
+    meshlet.coneApex[1] = center.y;
+    meshlet.coneApex[2] = center.z;
+
+    // The cone axis is the average of the unit triangle normals, ignoring
+    // degenerate triangles.
+    normals.clear();
+    corners.clear();
+    Vec3 axis{ 0.0f, 0.0f, 0.0f };
+    for (uint32_t t = 0; t < meshlet.triangleCount; t++) {
+      Vec3 a = load_vec3(pos, verts[tris[t * 3]]);
+      Vec3 b = load_vec3(pos, verts[tris[t * 3 + 1]]);
+      Vec3 c = load_vec3(pos, verts[tris[t * 3 + 2]]);
+      Vec3 n = cross(b - a, c - a);
+      float len = length(n);
+      if (len > 0.0f) {
+        n = n * (1.0f / len);
+        normals.push_back(n);
+        corners.push_back(a);
+        axis = axis + n;
+      }
+    }
+    float axisLen = length(axis);
+    if (normals.empty() || axisLen == 0.0f) {
+      return;
+    }
+    axis = axis * (1.0f / axisLen);
+
+    float minDot = 1.0f;
+    for (const Vec3& n : normals) {
+      minDot = std::min(minDot, dot(n, axis));
+    }
+    // A cone this wide would hardly ever be entirely back-facing.
+    if (minDot <= 0.1f) {
+      return;
+    }
+
+    // Move the apex back along the axis until every triangle's plane is in
+    // front of it, so the test is conservative for perspective projection.
+    float maxT = 0.0f;
+    for (size_t i = 0; i < normals.size(); i++) {
+      float t = dot(center - corners[i], normals[i]) / dot(normals[i], axis);
+      maxT = std::max(maxT, t);
+    }
+    Vec3 apex = center - axis * maxT;
+
+    meshlet.coneAxis[0] = axis.x;
+    meshlet.coneAxis[1] = axis.y;
+    meshlet.coneAxis[2] = axis.z;
+    meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+    meshlet.coneApex[0] = apex.x;
+    meshlet.coneApex[1] = apex.y;
+    meshlet.coneApex[2] = apex.z;
+  }
+
+
+  // Maps mesh vertex indices to meshlet vertex indices for the meshlet
+  // being built. Entries are stamped with a generation number so clearing
+  // the map between meshlets is free.
+  struct MeshletVertexMap {
+    static constexpr uint32_t kSize = 512; // Power of two, at least twice the 256 vertex maximum.
+
+    uint32_t keys[kSize];
+    uint32_t stamps[kSize] = {};
+    uint8_t vals[kSize];
+    uint32_t generation = 1;
+
+    void clear() { ++generation; }
+
+    uint32_t slot(uint32_t vert) const
+    {
+      uint32_t i = (vert * 2654435761u) >> 23;
+      while (stamps[i] == generation && keys[i] != vert) {
+        i = (i + 1) & (kSize - 1);
+      }
+      return i;
+    }
+
+    uint32_t find(uint32_t vert) const
+    {
+      uint32_t i = slot(vert);
+      return (stamps[i] == generation) ? vals[i] : kInvalidIndex;
+    }
+
+    void insert(uint32_t vert, uint32_t local)
+    {
+      uint32_t i = slot(vert);
+      keys[i] = vert;
+      vals[i] = uint8_t(local);
+      stamps[i] = generation;
+    }
+  };
+
+
+  // Cuts the triangles `order[start]` to `order[end - 1]` into meshlets,
+  // appending them to `out`. A meshlet is started from the first unused
+  // triangle in that order, then grown by repeatedly adding whichever
+  // unused triangle next to it needs the fewest new vertices, so meshlets
+  // stay compact and reuse as many vertices as possible. `rank[t]` is the
+  // position of triangle `t` in `order`; only triangles in our own range
+  // are considered, so ranges can be processed concurrently.
+  static void build_meshlets_for_range(const float pos[], const uint32_t indices[], const uint32_t order[], const uint32_t rank[],
+                                       const VertexTriangleAdjacency& adjacency, size_t start, size_t end,
+                                       uint32_t maxVerts, uint32_t maxTris, uint8_t used[], PLYMeshlets& out)
+  {
+    MeshletVertexMap vertexMap;
+    std::vector<uint32_t> candidates;
+    std::vector<Vec3> normals, corners;
+    normals.reserve(maxTris);
+    corners.reserve(maxTris);
+
+    auto num_new_verts = [&](const uint32_t* tri) {
+      uint32_t numNew = 0;
+      for (uint32_t k = 0; k < 3; k++) {
+        bool repeated = (k > 0 && tri[k] == tri[0]) || (k > 1 && tri[k] == tri[1]);
+        if (!repeated && vertexMap.find(tri[k]) == kInvalidIndex) {
+          ++numNew;
+        }
+      }
+      return numNew;
+    };
+
+    PLYMeshlet meshlet{};
+    auto finish_meshlet = [&]() {
+      if (meshlet.triangleCount > 0) {
+        compute_meshlet_bounds(meshlet, pos, out.vertices.data() + meshlet.vertexOffset,
+                               out.triangles.data() + meshlet.triangleOffset, normals, corners);
+        out.meshlets.push_back(meshlet);
+      }
+      meshlet = PLYMeshlet{};
+      meshlet.vertexOffset = uint32_t(out.vertices.size());
+      meshlet.triangleOffset = uint32_t(out.triangles.size());
+      vertexMap.clear();
+      candidates.clear();
+    };
+
+    size_t seed = start;
+    while (true) {
+      // Pick the candidate needing the fewest new vertices, dropping any
+      // which have been used since they were added.
+      uint32_t best = kInvalidIndex;
+      uint32_t bestNew = 4;
+      size_t numKept = 0;
+      for (size_t i = 0; i < candidates.size(); i++) {
+        uint32_t tri = candidates[i];
+        if (used[rank[tri] - start]) {
+          continue;
+        }
+        candidates[numKept++] = tri;
+        if (bestNew > 0) {
+          uint32_t numNew = num_new_verts(indices + size_t(tri) * 3);
+          if (numNew < bestNew) {
+            best = tri;
+            bestNew = numNew;
+          }
+        }
+      }
+      candidates.resize(numKept);
+
+      if (best == kInvalidIndex) {
+        while (seed < end && used[seed - start]) {
+          ++seed;
+        }
+        if (seed == end) {
+          break;
+        }
+        best = order[seed];
+        bestNew = num_new_verts(indices + size_t(best) * 3);
+      }
+      if (meshlet.vertexCount + bestNew > maxVerts || meshlet.triangleCount == maxTris) {
+        finish_meshlet();
+      }
+
+      const uint32_t* tri = indices + size_t(best) * 3;
+      used[rank[best] - start] = 1;
+      for (uint32_t k = 0; k < 3; k++) {
+        uint32_t local = vertexMap.find(tri[k]);
+        if (local == kInvalidIndex) {
+          local = meshlet.vertexCount++;
+          vertexMap.insert(tri[k], local);
+          out.vertices.push_back(tri[k]);
+          for (uint32_t a = adjacency.offsets[tri[k]]; a < adjacency.offsets[tri[k] + 1]; a++) {
+            uint32_t other = adjacency.tris[a];
+            if (rank[other] >= start && rank[other] < end && !used[rank[other] - start]) {
+              candidates.push_back(other);
+            }
+          }
+        }
+        out.triangles.push_back(uint8_t(local));
+      }
+      ++meshlet.triangleCount;
+    }
+    finish_meshlet();
+  }
+
+
+  bool build_meshlets(const float pos[], uint32_t numVerts, const uint32_t indices[], uint32_t numTris, PLYMeshlets& meshlets,
+                      uint32_t maxVerts, uint32_t maxTris)
+  {
+    meshlets.meshlets.clear();
+    meshlets.vertices.clear();
+    meshlets.triangles.clear();
+    if (maxVerts < 3 || maxVerts > 256 || maxTris == 0 || numTris > 0xFFFFFFFFu / 3) {
+      return false;
+    }
+    if (numTris == 0) {
+      return true;
+    }
+
+    const uint32_t numThreads = num_worker_threads(numTris);
+    const size_t chunkSize = (size_t(numTris) + numThreads - 1) / numThreads;
+
+    std::vector<uint32_t> order;
+    if (!sort_triangles_by_morton_code(pos, numVerts, indices, numTris, order)) {
+      return false;
+    }
+
+    std::vector<uint32_t> rank(numTris);
+    parallel_for(numThreads, [&](uint32_t t) {
+      const size_t start = std::min(size_t(numTris), t * chunkSize);
+      const size_t end = std::min(size_t(numTris), start + chunkSize);
+      for (size_t i = start; i < end; i++) {
+        rank[order[i]] = uint32_t(i);
+      }
+    });
+
+    VertexTriangleAdjacency adjacency;
+    build_vertex_triangle_adjacency(indices, numTris, numVerts, adjacency);
+
+    // Each thread cuts its own chunk of the sorted triangles into meshlets.
+    std::vector<uint8_t> used(numTris, 0);
+    std::vector<PLYMeshlets> parts(numThreads);
+    parallel_for(numThreads, [&](uint32_t t) {
+      const size_t start = std::min(size_t(numTris), t * chunkSize);
+      const size_t end = std::min(size_t(numTris), start + chunkSize);
+      PLYMeshlets& part = parts[t];
+      part.vertices.reserve((end - start) * 3 / 2);
+      part.triangles.reserve((end - start) * 3);
+      build_meshlets_for_range(pos, indices, order.data(), rank.data(), adjacency, start, end,
+                               maxVerts, maxTris, used.data() + start, part);
+    });
+
+    // Concatenate the parts, offsetting each part's meshlets to match.
+    std::vector<size_t> meshletBase(numThreads), vertexBase(numThreads), triangleBase(numThreads);
+    size_t numMeshlets = 0, numMeshletVerts = 0, numMeshletTris = 0;
+    for (uint32_t t = 0; t < numThreads; t++) {
+      meshletBase[t] = numMeshlets;
+      vertexBase[t] = numMeshletVerts;
+      triangleBase[t] = numMeshletTris;
+      numMeshlets += parts[t].meshlets.size();
+      numMeshletVerts += parts[t].vertices.size();
+      numMeshletTris += parts[t].triangles.size();
+    }
+    if (numMeshletVerts > 0xFFFFFFFFu) {
+      return false;
+    }
+    meshlets.meshlets.resize(numMeshlets);
+    meshlets.vertices.resize(numMeshletVerts);
+    meshlets.triangles.resize(numMeshletTris);
+    parallel_for(numThreads, [&](uint32_t t) {
+      PLYMeshlets& part = parts[t];
+      for (size_t i = 0; i < part.meshlets.size(); i++) {
+        PLYMeshlet meshlet = part.meshlets[i];
+        meshlet.vertexOffset += uint32_t(vertexBase[t]);
+        meshlet.triangleOffset += uint32_t(triangleBase[t]);
+        meshlets.meshlets[meshletBase[t] + i] = meshlet;
+      }
+      std::copy(part.vertices.begin(), part.vertices.end(), meshlets.vertices.begin() + ptrdiff_t(vertexBase[t]));
+      std::copy(part.triangles.begin(), part.triangles.end(), meshlets.triangles.begin() + ptrdiff_t(triangleBase[t]));
+      part = PLYMeshlets();
+    });
+    return true;
+  }
+
+
+  //
+  // Simplification
+  //
+
+  // A quadric error metric: the sum of squared distances from a point to a
+  // set of planes, each weighted by the area of the triangle it came from,
+  // stored as the upper triangle of a symmetric 4x4 matrix.
+  struct Quadric {
+    double a2 = 0.0, ab = 0.0, ac = 0.0, ad = 0.0;
+    double b2 = 0.0, bc = 0.0, bd = 0.0;
+    double c2 = 0.0, cd = 0.0;
+    double d2 = 0.0;
+    double weight = 0.0;
+
+    // `n` must be a unit vector.
+    void add_plane(Vec3 n, double d, double w)
+    {
+      a2 += w * n.x * n.x; ab += w * n.x * n.y; ac += w * n.x * n.z; ad += w * n.x * d;
+      b2 += w * n.y * n.y; bc += w * n.y * n.z; bd += w * n.y * d;
+      c2 += w * n.z * n.z; cd += w * n.z * d;
+      d2 += w * d * d;
+      weight += w;
+    }
+
+    void add(const Quadric& q)
+    {
+      a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+      b2 += q.b2; bc += q.bc; bd += q.bd;
+      c2 += q.c2; cd += q.cd;
+      d2 += q.d2;
+      weight += q.weight;
+    }
+
+    // Mean squared distance from `p` to the planes.
+    double eval(Vec3 p) const
+    {
+      if (weight <= 0.0) {
+        return 0.0;
+      }
+      const double x = p.x, y = p.y, z = p.z;
+      double err = a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x
+                 + b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y
+                 + c2 * z * z + 2.0 * cd * z
+                 + d2;
+      return std::max(0.0, err / weight);
+    }
+  };
+
+
+  // The inputs shared by every part of a simplification. Positions are
+  // scaled to fit the unit cube so that errors are relative to the mesh
+  // size.
+  struct SimplifyInput {
+    const Vec3* pos;
+    const float* normals;
+    const float* uvs;
+    double normalWeightSq;
+    double uvWeightSq;
+  };
+
+
+  // A set of triangles being simplified, with its own compact vertex
+  // numbering.
+  struct SimplifyPart {
+    std::vector<uint32_t> vertices;  // Original index of each local vertex.
+    std::vector<uint32_t> tris;      // Local vertex indices, 3 per triangle.
+    std::vector<uint8_t> locked;     // Per local vertex; locked vertices never move.
+    std::vector<Vec3> normals;       // Unit normal of each triangle before any collapses, or zero if it was degenerate.
+  };
+
+
+  struct SimplifyCollapse {
+    double cost;
+    uint32_t from, to;
+  };
+
+
+  // Sorts collapses by cost with a single counting sort pass on the top 11
+  // bits of each cost as a float (8 exponent bits and 3 mantissa bits).
+  // That only orders them to within about 12%, which is plenty for picking
+  // collapses, and takes linear time.
+  static inline uint32_t collapse_bucket(double cost)
+  {
+    float costf = float(cost);
+    uint32_t bits;
+    std::memcpy(&bits, &costf, sizeof(bits));
+    return (bits >> 20) & 0x7FFu;
+  }
+
+
+  static void sort_collapses(std::vector<SimplifyCollapse>& collapses, std::vector<SimplifyCollapse>& scratch)
+  {
+    uint32_t offsets[2049] = {};
+    for (const SimplifyCollapse& collapse : collapses) {
+      ++offsets[collapse_bucket(collapse.cost) + 1];
+    }
+    for (uint32_t i = 1; i < 2049; i++) {
+      offsets[i] += offsets[i - 1];
+    }
+    scratch.resize(collapses.size());
+    for (const SimplifyCollapse& collapse : collapses) {
+      scratch[offsets[collapse_bucket(collapse.cost)]++] = collapse;
+    }
+    collapses.swap(scratch);
+  }
+
+
+  static double attribute_error_sq(const SimplifyInput& in, uint32_t a, uint32_t b)
+  {
+    double err = 0.0;
+    if (in.normals != nullptr) {
+      Vec3 d = load_vec3(in.normals, a) - load_vec3(in.normals, b);
+      err += in.normalWeightSq * double(dot(d, d));
+    }
+    if (in.uvs != nullptr) {
+      float du = in.uvs[size_t(a) * 2] - in.uvs[size_t(b) * 2];
+      float dv = in.uvs[size_t(a) * 2 + 1] - in.uvs[size_t(b) * 2 + 1];
+      err += in.uvWeightSq * double(du * du + dv * dv);
+    }
+    return err;
+  }
+
+
+  // Sets `quadrics` to the quadric for each vertex of `part`, made from the
+  // planes of the triangles using it.
+  static void compute_quadrics(const SimplifyInput& in, const SimplifyPart& part, std::vector<Quadric>& quadrics)
+  {
+    quadrics.assign(part.vertices.size(), Quadric());
+    for (size_t i = 0; i < part.tris.size(); i += 3) {
+      Vec3 a = in.pos[part.vertices[part.tris[i]]];
+      Vec3 b = in.pos[part.vertices[part.tris[i + 1]]];
+      Vec3 c = in.pos[part.vertices[part.tris[i + 2]]];
+      Vec3 n = cross(b - a, c - a);
+      float len = length(n);
+      if (len <= 0.0f) {
+        continue;
+      }
+      n = n * (1.0f / len);
+      const double d = -double(dot(n, a));
+      for (uint32_t k = 0; k < 3; k++) {
+        quadrics[part.tris[i + k]].add_plane(n, d, 0.5 * double(len));
+      }
+    }
+  }
+
+
+  // Sets `part.normals` from the current positions of its triangles.
+  static void compute_triangle_normals(const SimplifyInput& in, SimplifyPart& part)
+  {
+    part.normals.resize(part.tris.size() / 3);
+    for (size_t i = 0; i < part.tris.size(); i += 3) {
+      Vec3 a = in.pos[part.vertices[part.tris[i]]];
+      Vec3 b = in.pos[part.vertices[part.tris[i + 1]]];
+      Vec3 c = in.pos[part.vertices[part.tris[i + 2]]];
+      Vec3 n = cross(b - a, c - a);
+      float len = length(n);
+      part.normals[i / 3] = (len > 0.0f) ? n * (1.0f / len) : Vec3{ 0.0f, 0.0f, 0.0f };
+    }
+  }
+
+
+  // Simplifies `part` in passes until it has `targetTris` triangles or no
+  // collapse costs `maxErrorSq` or less. `quadrics` holds the quadric for
+  // each vertex of the part; when a vertex is collapsed its quadric is added
+  // to the one it moved onto. Returns the largest squared error of any
+  // collapse made.
+  //
+  // Each pass finds the cheapest direction to collapse every edge, sorts
+  // the collapses by cost and makes as many as it can in that order, skipping
+  // any that touch a triangle already changed in this pass. That keeps
+  // every collapse in a pass independent of the others, so none of them
+  // need to be re-evaluated until the next pass.
+  static double simplify_part(const SimplifyInput& in, SimplifyPart& part, std::vector<Quadric>& quadrics,
+                               size_t targetTris, double maxErrorSq)
+  {
+    const uint32_t numLocal = uint32_t(part.vertices.size());
+    std::vector<uint32_t>& tris = part.tris;
+    auto vert_pos = [&](uint32_t v) { return in.pos[part.vertices[v]]; };
+
+    // Lock the ends of any edge which isn't shared by exactly two triangles.
+    std::vector<uint64_t> edges(tris.size());
+    for (size_t i = 0; i < tris.size(); i += 3) {
+      for (uint32_t k = 0; k < 3; k++) {
+        uint64_t a = tris[i + k], b = tris[i + (k + 1) % 3];
+        edges[i + k] = (a < b) ? ((a << 32) | b) : ((b << 32) | a);
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size(); ) {
+      size_t runEnd = i + 1;
+      while (runEnd < edges.size() && edges[runEnd] == edges[i]) {
+        ++runEnd;
+      }
+      if (runEnd - i != 2) {
+        part.locked[uint32_t(edges[i] >> 32)] = 1;
+        part.locked[uint32_t(edges[i])] = 1;
+      }
+      i = runEnd;
+    }
+    std::vector<uint64_t>().swap(edges);
+
+    if (part.normals.size() != tris.size() / 3) {
+      compute_triangle_normals(in, part);
+    }
+
+    double maxApplied = 0.0;
+    VertexTriangleAdjacency adjacency;
+    std::vector<SimplifyCollapse> collapses, sortedCollapses;
+    std::vector<uint32_t> collapseTo(numLocal, kInvalidIndex);
+    std::vector<uint8_t> touched(numLocal);
+
+    auto collapse_cost = [&](uint32_t from, uint32_t to) {
+      return quadrics[from].eval(vert_pos(to)) + attribute_error_sq(in, part.vertices[from], part.vertices[to]);
+    };
+
+    // True if moving `from` onto `to` would fold or squash any triangle
+    // which doesn't also use `to`. A triangle folds if its normal ends up
+    // more than 60 degrees from the one it had before simplification
+    // started; comparing against that rather than its current normal stops
+    // small rotations from adding up over many passes until it stands on
+    // its edge.
+    const float kMinFoldCos = 0.5f;
+    auto flips = [&](uint32_t from, uint32_t to) {
+      for (uint32_t a = adjacency.offsets[from]; a < adjacency.offsets[from + 1]; a++) {
+        const uint32_t t = adjacency.tris[a];
+        const uint32_t* tri = tris.data() + size_t(t) * 3;
+        if (tri[0] == to || tri[1] == to || tri[2] == to) {
+          continue;
+        }
+        Vec3 p[3], q[3];
+        for (uint32_t k = 0; k < 3; k++) {
+          p[k] = vert_pos(tri[k]);
+          q[k] = (tri[k] == from) ? vert_pos(to) : p[k];
+        }
+        Vec3 reference = part.normals[t];
+        if (dot(reference, reference) == 0.0f) {
+          reference = cross(p[1] - p[0], p[2] - p[0]);
+        }
+        Vec3 after = cross(q[1] - q[0], q[2] - q[0]);
+        if (dot(reference, after) <= kMinFoldCos * length(reference) * length(after)) {
+          return true;
+        }
+      }
+      return false;
+    };
+
+    size_t numTris = tris.size() / 3;
+    while (numTris > targetTris) {
+      build_vertex_triangle_adjacency(tris.data(), numTris, numLocal, adjacency);
+
+      // Every edge which can collapse has two triangles using it in opposite
+      // directions, so taking only the half-edges going from a lower to a
+      // higher index visits each of them once. Edges with any other number
+      // of triangles have both ends locked.
+      collapses.clear();
+      for (size_t i = 0; i < tris.size(); i++) {
+        const uint32_t a = tris[i];
+        const uint32_t b = tris[(i % 3 == 2) ? i - 2 : i + 1];
+        if (a >= b) {
+          continue;
+        }
+        SimplifyCollapse best{ DBL_MAX, kInvalidIndex, kInvalidIndex };
+        if (!part.locked[a]) {
+          best = SimplifyCollapse{ collapse_cost(a, b), a, b };
+        }
+        if (!part.locked[b]) {
+          double cost = collapse_cost(b, a);
+          if (cost < best.cost) {
+            best = SimplifyCollapse{ cost, b, a };
+          }
+        }
+        if (best.from != kInvalidIndex && best.cost <= maxErrorSq) {
+          collapses.push_back(best);
+        }
+      }
+      if (collapses.empty()) {
+        break;
+      }
+
+      // Each collapse removes about two triangles. Don't go much beyond the
+      // cost of the collapses we'd need to reach the target in this pass, so
+      // that cheaper collapses which open up in later passes get a chance.
+      // Only the collapses under that limit need sorting.
+      sort_collapses(collapses, sortedCollapses);
+      const size_t needed = std::min(collapses.size(), std::max<size_t>(1, (numTris - targetTris + 1) / 2));
+      const double passLimit = std::max(collapses[needed - 1].cost * 2.25, 1e-12);
+      const uint32_t passLimitBucket = collapse_bucket(passLimit);
+
+      std::fill(touched.begin(), touched.end(), uint8_t(0));
+      size_t removed = 0;
+      for (const SimplifyCollapse& collapse : collapses) {
+        if (numTris - removed <= targetTris || collapse_bucket(collapse.cost) > passLimitBucket) {
+          break;
+        }
+        if (collapse.cost > passLimit || touched[collapse.from] || touched[collapse.to] || flips(collapse.from, collapse.to)) {
+          continue;
+        }
+        for (uint32_t a = adjacency.offsets[collapse.from]; a < adjacency.offsets[collapse.from + 1]; a++) {
+          const uint32_t* tri = tris.data() + size_t(adjacency.tris[a]) * 3;
+          if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) {
+            ++removed;
+          }
+          touched[tri[0]] = 1;
+          touched[tri[1]] = 1;
+          touched[tri[2]] = 1;
+        }
+        collapseTo[collapse.from] = collapse.to;
+        quadrics[collapse.to].add(quadrics[collapse.from]);
+        maxApplied = std::max(maxApplied, collapse.cost);
+      }
+      if (removed == 0) {
+        break;
+      }
+
+      // Apply the collapses and drop the triangles they made degenerate.
+      size_t numKept = 0;
+      for (size_t i = 0; i < numTris; i++) {
+        uint32_t v[3];
+        for (uint32_t k = 0; k < 3; k++) {
+          v[k] = tris[i * 3 + k];
+          if (collapseTo[v[k]] != kInvalidIndex) {
+            v[k] = collapseTo[v[k]];
+          }
+        }
+        if (v[0] != v[1] && v[1] != v[2] && v[2] != v[0]) {
+          tris[numKept * 3] = v[0];
+          tris[numKept * 3 + 1] = v[1];
+          tris[numKept * 3 + 2] = v[2];
+          part.normals[numKept] = part.normals[i];
+          ++numKept;
+        }
+      }
+      tris.resize(numKept * 3);
+      part.normals.resize(numKept);
+      numTris = numKept;
+      for (uint32_t v = 0; v < numLocal; v++) {
+        collapseTo[v] = kInvalidIndex;
+      }
+    }
+    return maxApplied;
+  }
+
+
+  bool simplify_mesh(const float pos[], uint32_t numVerts, const uint32_t indices[], uint32_t numTris,
+                     const PLYSimplifyOptions& options, std::vector<uint32_t>& simplifiedIndices, float* resultError)
+  {
+    simplifiedIndices.clear();
+    if (resultError != nullptr) {
+      *resultError = 0.0f;
+    }
+    if (numTris > 0xFFFFFFFFu / 3) {
+      return false;
+    }
+    for (size_t i = 0; i < size_t(numTris) * 3; i++) {
+      if (indices[i] >= numVerts) {
+        return false;
+      }
+    }
+    if (numTris == 0) {
+      return true;
+    }
+
+    // Scale the positions into the unit cube.
+    Vec3 lo{ FLT_MAX, FLT_MAX, FLT_MAX };
+    Vec3 hi{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (uint32_t v = 0; v < numVerts; v++) {
+      Vec3 p = load_vec3(pos, v);
+      lo = min(lo, p);
+      hi = max(hi, p);
+    }
+    Vec3 extent = hi - lo;
+    float size = std::max(extent.x, std::max(extent.y, extent.z));
+    float scale = (size > 0.0f) ? 1.0f / size : 1.0f;
+    std::vector<Vec3> scaledPos(numVerts);
+    for (uint32_t v = 0; v < numVerts; v++) {
+      scaledPos[v] = (load_vec3(pos, v) - lo) * scale;
+    }
+
+    SimplifyInput in;
+    in.pos = scaledPos.data();
+    in.normals = options.normals;
+    in.uvs = options.uvs;
+    in.normalWeightSq = double(options.normalWeight) * double(options.normalWeight);
+    in.uvWeightSq = double(options.uvWeight) * double(options.uvWeight);
+    const double maxErrorSq = double(options.targetError) * double(options.targetError);
+    double errorSq = 0.0;
+
+    SimplifyPart whole;
+    std::vector<Quadric> quadrics;
+    const uint32_t numParts = options.partitioned ? num_worker_threads(numTris) : 1;
+    if (numParts > 1) {
+      std::vector<uint32_t> order;
+      sort_triangles_by_morton_code(pos, numVerts, indices, numTris, order);
+      const size_t chunkSize = (size_t(numTris) + numParts - 1) / numParts;
+
+      // Find which partition each vertex belongs to, so that vertices used
+      // by more than one can be locked.
+      const uint32_t kShared = kInvalidIndex - 1;
+      std::vector<uint32_t> owner(numVerts, kInvalidIndex);
+      for (size_t i = 0; i < numTris; i++) {
+        const uint32_t p = uint32_t(i / chunkSize);
+        const uint32_t* tri = indices + size_t(order[i]) * 3;
+        for (uint32_t k = 0; k < 3; k++) {
+          uint32_t& o = owner[tri[k]];
+          o = (o == kInvalidIndex || o == p) ? p : kShared;
+        }
+      }
+
+      std::vector<SimplifyPart> parts(numParts);
+      std::vector<std::vector<Quadric>> partQuadrics(numParts);
+      std::vector<double> partErrorSq(numParts, 0.0);
+      quadrics.resize(numVerts);
+      parallel_for(numParts, [&](uint32_t p) {
+        const size_t start = std::min(size_t(numTris), p * chunkSize);
+        const size_t end = std::min(size_t(numTris), start + chunkSize);
+        SimplifyPart& part = parts[p];
+        for (size_t i = start; i < end; i++) {
+          const uint32_t* tri = indices + size_t(order[i]) * 3;
+          part.vertices.insert(part.vertices.end(), tri, tri + 3);
+        }
+        std::sort(part.vertices.begin(), part.vertices.end());
+        part.vertices.erase(std::unique(part.vertices.begin(), part.vertices.end()), part.vertices.end());
+        part.tris.reserve((end - start) * 3);
+        for (size_t i = start; i < end; i++) {
+          const uint32_t* tri = indices + size_t(order[i]) * 3;
+          for (uint32_t k = 0; k < 3; k++) {
+            part.tris.push_back(uint32_t(std::lower_bound(part.vertices.begin(), part.vertices.end(), tri[k]) - part.vertices.begin()));
+          }
+        }
+        part.locked.resize(part.vertices.size());
+        for (size_t v = 0; v < part.vertices.size(); v++) {
+          part.locked[v] = (owner[part.vertices[v]] == kShared) ? 1 : 0;
+        }
+
+        const size_t partTarget = size_t((uint64_t(options.targetTriangles) * (end - start) + numTris - 1) / numTris);
+        compute_quadrics(in, part, partQuadrics[p]);
+        partErrorSq[p] = simplify_part(in, part, partQuadrics[p], partTarget, maxErrorSq);
+
+        // Vertices only this partition uses can go straight into the final
+        // pass's quadrics; shared ones are summed below.
+        for (size_t v = 0; v < part.vertices.size(); v++) {
+          if (owner[part.vertices[v]] != kShared) {
+            quadrics[part.vertices[v]] = partQuadrics[p][v];
+          }
+        }
+      });
+
+      // Stitch the partitions back together for the final pass.
+      for (uint32_t p = 0; p < numParts; p++) {
+        errorSq = std::max(errorSq, partErrorSq[p]);
+        for (uint32_t v : parts[p].tris) {
+          whole.tris.push_back(parts[p].vertices[v]);
+        }
+        whole.normals.insert(whole.normals.end(), parts[p].normals.begin(), parts[p].normals.end());
+        for (size_t v = 0; v < parts[p].vertices.size(); v++) {
+          if (owner[parts[p].vertices[v]] == kShared) {
+            quadrics[parts[p].vertices[v]].add(partQuadrics[p][v]);
+          }
+        }
+        parts[p] = SimplifyPart();
+        std::vector<Quadric>().swap(partQuadrics[p]);
+      }
+    }
+    else {
+      whole.tris.assign(indices, indices + size_t(numTris) * 3);
+    }
+
+    whole.vertices.resize(numVerts);
+    for (uint32_t v = 0; v < numVerts; v++) {
+      whole.vertices[v] = v;
+    }
+    whole.locked.assign(numVerts, 0);
+    if (numParts <= 1) {
+      compute_quadrics(in, whole, quadrics);
+    }
+    errorSq = std::max(errorSq, simplify_part(in, whole, quadrics, options.targetTriangles, maxErrorSq));
+
+    simplifiedIndices.swap(whole.tris);
+    if (resultError != nullptr) {
+      *resultError = float(std::sqrt(errorSq));
+    }
+    return true;
+  }
+
 } // namespace miniply
@@ -28,7 +28,9 @@ SOFTWARE.
 #include <cstdarg>
 #include <cstdint>
 #include <cstdio>
+#include <new>
 #include <string>
+#include <utility>
 #include <vector>
 
 
@@ -47,6 +49,9 @@ namespace miniply {
 
   static constexpr uint32_t kInvalidIndex = 0xFFFFFFFFu;
 
+  /// Alignment, in bytes, of the memory that loaded element data is stored in.
+  static constexpr size_t kPLYDataAlignment = 4096;
+
   // Standard PLY element names
   extern const char* kPLYVertexElement; // "vertex"
   extern const char* kPLYFaceElement;   // "face"
@@ -72,6 +77,7 @@ namespace miniply {
     UInt,
     Float,
     Double,
+    Half,   //!< IEEE 754 half precision float. Only valid as a destination type for the `extract_*` methods; it never appears in PLY files.
 
     None, //!< Special value used in Element::listCountType to indicate a non-list property.
   };
@@ -89,6 +95,61 @@ namespace miniply {
   };
 
 
+  /// Allocate & free memory aligned to `kPLYDataAlignment` bytes.
+  void* aligned_malloc(size_t numBytes);
+  void aligned_free(void* ptr);
+
+
+  /// Number of NUMA nodes in the system, or 1 if it can't be determined
+  /// (currently only Linux is supported).
+  uint32_t num_numa_nodes();
+
+  /// Restrict the calling thread to the CPUs of the given NUMA node. Returns
+  /// false if there's no such node or the platform isn't supported.
+  bool bind_thread_to_numa_node(uint32_t node);
+
+
+  /// Fast non-cryptographic 64-bit hash of a block of memory, in the style of
+  /// xxHash3: 64-byte stripes are mixed into eight 64-bit accumulators, using
+  /// SSE2 where it's available. This is the hash `PLYReader` computes for
+  /// each element when content hashing is on, so for a binary file
+  /// `content_hash()` over the element's bytes in the file gives the same
+  /// value as `PLYReader::element_hash()`. It's good for spotting duplicates,
+  /// but not for anything where someone might be trying to cause collisions.
+  uint64_t content_hash(const void* data, size_t numBytes);
+
+
+  /// Allocator for element storage. Memory is aligned to `kPLYDataAlignment`
+  /// bytes, and value-initialisation is skipped when a vector grows because
+  /// the loaders always overwrite every byte anyway.
+  template <class T>
+  struct PLYAlignedAllocator {
+    typedef T value_type;
+
+    PLYAlignedAllocator() {}
+    template <class U> PLYAlignedAllocator(const PLYAlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+      void* ptr = aligned_malloc(n * sizeof(T));
+      if (ptr == nullptr) {
+        throw std::bad_alloc();
+      }
+      return static_cast<T*>(ptr);
+    }
+    void deallocate(T* ptr, size_t) { aligned_free(ptr); }
+
+    template <class U> void construct(U* ptr) { ::new (static_cast<void*>(ptr)) U; }
+    template <class U, class... Args> void construct(U* ptr, Args&&... args) { ::new (static_cast<void*>(ptr)) U(std::forward<Args>(args)...); }
+
+    template <class U> struct rebind { typedef PLYAlignedAllocator<U> other; };
+  };
+
+  template <class T, class U> inline bool operator == (const PLYAlignedAllocator<T>&, const PLYAlignedAllocator<U>&) { return true; }
+  template <class T, class U> inline bool operator != (const PLYAlignedAllocator<T>&, const PLYAlignedAllocator<U>&) { return false; }
+
+  typedef std::vector<uint8_t, PLYAlignedAllocator<uint8_t>> PLYDataBuffer;
+
+
   struct PLYElement {
     std::string              name;              //!< Name of this element.
     std::vector<PLYProperty> properties;
@@ -141,9 +202,200 @@ namespace miniply {
     /// property it refers to is not a list property. In these cases it will
     /// not modify anything. Otherwise it will return true.
     bool convert_list_to_fixed_size(uint32_t listPropIdx, uint32_t listSize, uint32_t newPropIdxs[]);
+
+    /// Append `uchar` padding properties named `pad_0`, `pad_1`, etc. so that
+    /// `rowStride` becomes a multiple of `alignment`. Use this on an element
+    /// you're about to write with `PLYWriter` so that every row starts on an
+    /// aligned boundary. Returns the number of padding bytes added per row.
+    /// Only works for fixed-size elements.
+    uint32_t add_row_padding(uint32_t alignment);
+  };
+
+
+  /// The strategies `PLYReader::extract_properties` and
+  /// `PLYReader::extract_properties_with_stride` choose between, fastest
+  /// first.
+  enum class PLYExtractPath {
+    Block,      //!< The data for all rows is copied with a single memcpy.
+    PerRow,     //!< One memcpy per row.
+    PerColumn,  //!< One memcpy per property in each row.
+    PerValue,   //!< Every value is converted individually.
+    HalfChunks, //!< Values are converted to float a chunk at a time, then to half.
+    Invalid,    //!< The extraction would fail.
+  };
+
+  /// Returns a short name for an extraction path, e.g. "per-row".
+  const char* extract_path_name(PLYExtractPath path);
+
+
+  /// Describes how an extraction would be carried out and why. See
+  /// `PLYReader::explain_extraction`.
+  struct PLYExtractExplanation {
+    PLYExtractPath path     = PLYExtractPath::Invalid;
+    bool contiguousColumns  = false; //!< The properties are adjacent in each row, in the order requested.
+    bool wholeRow           = false; //!< The properties are contiguous and cover every byte of the row.
+    bool conversionRequired = false; //!< At least one property needs a type conversion.
+    uint64_t numOperations  = 0;     //!< Expected number of memcpy calls or value conversions.
+    uint64_t numBytes       = 0;     //!< Bytes written to the destination.
+    std::string reason;              //!< Why this path is used.
+    std::string suggestion;          //!< How to get onto a faster path; empty if there's nothing to suggest.
+  };
+
+
+  /// Where `PLYReader` runs the work for large binary elements. Workers
+  /// always process contiguous blocks of rows, split the same way in the
+  /// loading and extraction paths, so with `FirstTouch` the rows each worker
+  /// reads from later were first touched (and so placed in memory) by the
+  /// worker with the same index.
+  enum class PLYWorkerPlacement {
+    Serial,      //!< Load on the calling thread, so all of the element's pages are placed on its NUMA node.
+    FirstTouch,  //!< Load with several worker threads, each reading its own block of rows straight into the element storage. The default.
+    BindToNodes, //!< As `FirstTouch`, with the workers pinned to NUMA nodes so that consecutive blocks of rows stay on one node. Same as `FirstTouch` when there's only one node.
+  };
+
+
+  /// Property indexes for a 3D Gaussian Splatting vertex element, as found by
+  /// `PLYReader::find_splat`.
+  struct PLYSplatProperties {
+    uint32_t pos[3];          //!< `x`, `y`, `z`.
+    uint32_t scale[3];        //!< `scale_0` .. `scale_2`, stored as log scales.
+    uint32_t rot[4];          //!< `rot_0` .. `rot_3`, an unnormalised quaternion in (w, x, y, z) order.
+    uint32_t opacity;         //!< `opacity`, stored as a logit.
+    uint32_t dc[3];           //!< `f_dc_0` .. `f_dc_2`, the degree 0 spherical harmonic coefficients.
+    uint32_t rest[45];        //!< `f_rest_0` .. `f_rest_<numRest-1>`, the higher order coefficients.
+    uint32_t numRest = 0;     //!< Number of `f_rest_*` properties: 0, 9, 24 or 45 for SH degree 0 to 3.
+  };
+
+
+  /// Destination buffers for `PLYReader::extract_splats`. Any of the pointers
+  /// can be null if you don't want that attribute.
+  ///
+  /// If `stride` is zero each buffer is a tightly packed array (SoA layout):
+  /// 3 floats per splat for `pos` and `scale`, 4 for `rot`, 1 for `opacity`
+  /// and `3 + numRest` for `sh`. Otherwise every buffer is `stride` bytes from
+  /// one splat to the next, so you can point them at the members of the first
+  /// element in an array of your own splat structs (AoS layout).
+  struct PLYSplatBuffers {
+    float* pos      = nullptr;  //!< Position, as stored in the file.
+    float* scale    = nullptr;  //!< Scale, with `exp` applied.
+    float* rot      = nullptr;  //!< Rotation quaternion (w, x, y, z), normalised.
+    float* opacity  = nullptr;  //!< Opacity, with a sigmoid applied.
+    float* sh       = nullptr;  //!< Spherical harmonic coefficients in (coefficient, channel) order, starting with `f_dc_*`.
+    uint32_t stride = 0;        //!< Bytes between splats in every buffer, or 0 for tightly packed arrays.
+  };
+
+
+  /// Default meshlet size limits for `build_meshlets`. These are the limits
+  /// recommended for mesh shaders on most current GPUs.
+  static constexpr uint32_t kPLYMeshletMaxVerts = 64;
+  static constexpr uint32_t kPLYMeshletMaxTris  = 124;
+
+  /// A small cluster of triangles, as produced by `build_meshlets`. The
+  /// layout is meant to be copied straight into a GPU buffer.
+  struct PLYMeshlet {
+    uint32_t vertexOffset;   //!< Index of this meshlet's first entry in `PLYMeshlets::vertices`.
+    uint32_t triangleOffset; //!< Index of this meshlet's first entry in `PLYMeshlets::triangles`.
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+    float center[3];         //!< Bounding sphere centre.
+    float radius;            //!< Bounding sphere radius.
+    float coneAxis[3];       //!< Normal cone axis, for culling back-facing meshlets.
+    float coneCutoff;        //!< Cull the meshlet if `dot(normalize(coneApex - cameraPos), coneAxis) >= coneCutoff`. 1 if it can't be culled this way.
+    float coneApex[3];       //!< Normal cone apex.
+  };
+
+  /// The output of `build_meshlets`. Each meshlet has its own vertex list,
+  /// which holds indices into the mesh's vertex arrays, and its own triangle
+  /// list, which holds 8-bit indices into the meshlet's vertex list.
+  struct PLYMeshlets {
+    std::vector<PLYMeshlet> meshlets;
+    std::vector<uint32_t> vertices;   //!< Mesh vertex index for each meshlet vertex.
+    std::vector<uint8_t> triangles;   //!< Three meshlet vertex indices per triangle.
+  };
+
+
+  /// Half-edge connectivity for a polygon mesh, as built by
+  /// `PLYReader::build_half_edges`. Face `f` owns half-edges
+  /// `faceEdges[f]` to `faceEdges[f + 1] - 1`, one per corner, in the order
+  /// its vertices were listed. Half-edge `h` runs from `vertex[h]` to
+  /// `vertex[next[h]]`.
+  ///
+  /// `twin[h]` is the half-edge running the other way along the same edge,
+  /// or `kInvalidIndex` if `h` is on a boundary or a non-manifold edge.
+  /// `boundaryEdges` lists the half-edges used by only one face.
+  /// `nonManifoldEdges` lists every half-edge of each edge that's used by
+  /// more than two faces, or by two faces with inconsistent winding; both
+  /// lists are sorted by edge.
+  struct PLYHalfEdges {
+    std::vector<uint32_t> faceEdges;        //!< First half-edge of each face, plus one past the last.
+    std::vector<uint32_t> vertex;           //!< Start vertex of each half-edge.
+    std::vector<uint32_t> next;             //!< Next half-edge around the same face.
+    std::vector<uint32_t> twin;             //!< Opposite half-edge, or `kInvalidIndex`.
+    std::vector<uint32_t> face;             //!< Face each half-edge belongs to.
+    std::vector<uint32_t> boundaryEdges;
+    std::vector<uint32_t> nonManifoldEdges;
+  };
+
+
+  /// Connected components of a polygon mesh, as found by
+  /// `PLYReader::find_components`. Two faces are in the same component if
+  /// there's a path between them through shared vertices. Components are
+  /// numbered in order of their first face.
+  struct PLYComponents {
+    std::vector<uint32_t> faceComponent;          //!< Component of each face.
+    std::vector<uint32_t> vertexComponent;        //!< Component of each vertex, or `kInvalidIndex` if no face uses it.
+    std::vector<uint32_t> componentFaceCounts;    //!< Number of faces in each component.
+    std::vector<uint32_t> componentVertexCounts;  //!< Number of vertices in each component.
   };
 
+  /// One connected component split out of a mesh by
+  /// `PLYReader::split_components`.
+  struct PLYComponentMesh {
+    uint32_t component = kInvalidIndex;  //!< Index of the component in `PLYComponents`.
+    std::vector<uint32_t> vertices;      //!< Original index of each vertex in the component, ascending.
+    std::vector<uint32_t> faces;         //!< Original index of each face in the component, ascending.
+    std::vector<uint32_t> faceSizes;     //!< Number of indices for each face.
+    std::vector<uint32_t> indices;       //!< Vertex indices for all the faces, back to back, as positions in `vertices`.
+  };
+
+
+  /// Default number of histogram bins for `PLYReader::accumulate_property_stats`.
+  static constexpr uint32_t kPLYHistogramBins = 64;
+
+  /// Summary statistics and a histogram for one scalar property, built up by
+  /// `PLYReader::accumulate_property_stats`. NaNs and infinities are counted
+  /// in `nonFinite` but otherwise left out.
+  ///
+  /// Bin `i` of the histogram covers values from `histogramMin + i * binWidth`
+  /// up to the start of the next bin. Whenever new values fall outside the
+  /// histogram, its bin width is doubled (merging neighbouring bins) until
+  /// they fit, so no values are ever dropped or clamped.
+  struct PLYPropertyStats {
+    uint32_t propIdx    = kInvalidIndex;  //!< The property these are for.
+    uint64_t count      = 0;              //!< Number of finite values.
+    uint64_t nonFinite  = 0;              //!< Number of NaN or infinite values.
+    double minValue     = 0.0;
+    double maxValue     = 0.0;
+    double mean         = 0.0;
+    double m2           = 0.0;            //!< Sum of the squared differences from the mean.
+    double histogramMin = 0.0;            //!< Lower edge of the first histogram bin.
+    double binWidth     = 0.0;
+    std::vector<uint64_t> histogram;      //!< Number of values in each bin.
 
+    /// Population variance of the values.
+    double variance() const { return (count > 0) ? m2 / double(count) : 0.0; }
+  };
+
+
+  /// Thread safety: a reader holds no scratch memory after its constructor
+  /// returns, and the const methods never modify it. Any number of threads
+  /// can therefore call the const methods - `extract_properties`,
+  /// `extract_list_property`, `extract_triangles`, `get_list_counts` and so
+  /// on - at the same time on the same loaded element, e.g. to extract each
+  /// attribute on a different core. No thread may call a non-const method
+  /// (`load_element`, `next_element`, `sort_rows`, etc.) while that's going
+  /// on, and all of the destination buffers must be distinct. Different
+  /// readers are completely independent of each other.
   class PLYReader {
   public:
     PLYReader(const char* filename);
@@ -155,12 +407,136 @@ namespace miniply {
     bool load_element();
     void next_element();
 
+    /// Choose how the work for large binary elements is split across
+    /// threads. See `PLYWorkerPlacement`. This affects elements loaded after
+    /// the call, as well as `extract_splats` and the `sort_rows` methods.
+    void set_worker_placement(PLYWorkerPlacement placement);
+    PLYWorkerPlacement worker_placement() const;
+
+    /// Back the storage for elements loaded after this call with transparent
+    /// huge pages (via `madvise(MADV_HUGEPAGE)` on Linux), and prefault it in
+    /// parallel before reading into it. For multi-gigabyte elements this
+    /// replaces millions of 4 KiB page faults and TLB misses during loading
+    /// and extraction with a few thousand. Off by default; it has no effect
+    /// on other platforms, or if THP is disabled in the kernel. List
+    /// property values live in a `std::vector` which can't be allocated
+    /// aligned, so they only get huge pages for the part of each
+    /// reallocation that hasn't been written yet.
+    void set_huge_pages(bool enable);
+    bool huge_pages() const;
+
+    /// Read large binary elements (the ones loaded straight into element
+    /// storage) with direct I/O, bypassing the page cache: `O_DIRECT` on
+    /// Linux, `F_NOCACHE` on macOS. Use this for files much bigger than RAM,
+    /// so loading them doesn't evict everything else from the cache. The
+    /// header and small elements are still read normally.
+    ///
+    /// Reads are fastest when the element starts at a 4 KiB aligned offset
+    /// in the file (see `PLYWriter::set_data_alignment`), because then they
+    /// go straight into the element storage; otherwise they're copied
+    /// through a small aligned buffer. Returns false, leaving direct I/O
+    /// off, if the platform or file system doesn't support it.
+    bool set_direct_io(bool enable);
+    bool direct_io() const;
+
+    /// Hash the raw bytes of the header and of each element (see
+    /// `content_hash()`) as they pass through the reader, so that duplicate
+    /// files and elements can be found without a separate pass over the
+    /// data. Elements skipped with `next_element()` are read through rather
+    /// than seeked past, so that they get hashed too. This must be called
+    /// before loading or skipping any elements; returns false if it's too
+    /// late, or if the reader isn't valid.
+    bool set_content_hashing(bool enable);
+    bool content_hashing() const;
+
+    /// Hash of the header, up to and including the `end_header` line. Zero if
+    /// content hashing is off.
+    uint64_t header_hash() const;
+
+    /// Hash of the raw bytes of element `idx` as they appear in the file,
+    /// before any endian swapping. Zero if content hashing is off, or if the
+    /// element hasn't been completely loaded or skipped yet.
+    uint64_t element_hash(uint32_t idx) const;
+
+    /// Hash of the whole file, combining the header hash and the hashes of
+    /// every element. Zero if content hashing is off, or until all elements
+    /// have been loaded or skipped (i.e. `has_element()` returns false).
+    uint64_t file_hash() const;
+
+    /// Load the next batch of up to `maxRows` rows from the current element,
+    /// replacing any previously loaded batch. Returns the number of rows
+    /// loaded, which will be zero once all rows have been read. This only
+    /// works for fixed-size elements; for anything else it returns zero.
+    ///
+    /// This lets you process elements which are too large to hold in memory
+    /// all at once. All of the `extract_*` methods operate on the current
+    /// batch, so size your destination arrays using `num_loaded_rows()`
+    /// rather than `num_rows()`. You can't call `load_element()` once you've
+    /// started loading an element in batches; `next_element()` will skip any
+    /// rows you haven't loaded yet.
+    uint32_t load_element_rows(uint32_t maxRows);
+
+    /// Load a uniformly random sample of `numSamples` rows from the current
+    /// element, e.g. for a preview or for estimating statistics, without
+    /// loading the rest of it. Returns the number of rows sampled, which is
+    /// all of them if the element has `numSamples` rows or fewer, or zero on
+    /// failure. Like `load_element_rows()` this only works for fixed-size
+    /// elements, and only if none of the element has been loaded yet.
+    ///
+    /// Afterwards the sample is the set of loaded rows, so the `extract_*`
+    /// methods and `take_element_data()` work on it; size destination arrays
+    /// using `num_loaded_rows()`. The rows are kept in file order. If
+    /// `rowIndices` isn't null, it must have room for `numSamples` values and
+    /// gets the index of each sampled row within the element.
+    ///
+    /// This is reservoir sampling with a skip-ahead (Algorithm L), so most
+    /// rows are never converted. In binary files they're not even read: gaps
+    /// longer than the read buffer are seeked over, unless content hashing is
+    /// on. The same `seed` always gives the same sample.
+    uint32_t sample_element_rows(uint32_t numSamples, uint64_t seed = 0, uint32_t rowIndices[] = nullptr);
+
+    /// Number of rows currently held in memory for the current element. This
+    /// is the same as `num_rows()` after a call to `load_element()`, or the
+    /// size of the most recent batch after a call to `load_element_rows()`.
+    uint32_t num_loaded_rows() const;
+
+    /// Raw data for the non-list properties of the loaded rows. Each row is
+    /// `element()->rowStride` bytes long and there are `num_loaded_rows()`
+    /// rows. Values are always in the CPU's native (little-endian) byte order,
+    /// regardless of the file type.
+    const uint8_t* get_element_data() const;
+
+    /// Move the loaded row data (see `get_element_data`) out of the reader,
+    /// so that you can keep it after moving on to the next element without
+    /// copying it. Afterwards the reader behaves as though no rows of the
+    /// current element are loaded, so the `extract_*` methods won't see any
+    /// non-list data for it. List properties are unaffected.
+    PLYDataBuffer take_element_data();
+
+    /// Zero-copy view of a non-list property in the loaded rows: returns a
+    /// pointer to the property's value in the first row and sets `*stride` to
+    /// the number of bytes between rows. Returns null if the property index
+    /// is invalid or refers to a list property.
+    ///
+    /// The row data is always stored at a `kPLYDataAlignment` boundary, so
+    /// if the file has a row stride and property offset which are multiples
+    /// of 4 (or 16), the view can be used directly as an aligned array. Files
+    /// written by `PLYWriter` with `set_data_alignment()` and
+    /// `PLYElement::add_row_padding()` have this layout.
+    const uint8_t* get_property_data(uint32_t propIdx, uint32_t* stride) const;
+
     PLYFileType file_type() const;
+
+    /// Byte offset in the file where the data section (i.e. everything
+    /// after the header) starts.
+    int64_t data_offset() const;
+
     int version_major() const;
     int version_minor() const;
     uint32_t num_elements() const;
     uint32_t find_element(const char* name) const;
     PLYElement* get_element(uint32_t idx);
+    const PLYElement* get_element(uint32_t idx) const;
 
     /// Check whether the current element has the given name.
     bool element_is(const char* name) const;
@@ -193,6 +569,10 @@ namespace miniply {
     /// we must iterate over all values to be copied, applying type conversions
     /// as we go.
     ///
+    /// If `destType` is `PLYPropertyType::Half` the values are converted to
+    /// float and then to half precision, a chunk of rows at a time, using the
+    /// F16C instructions when the CPU has them.
+    ///
     /// Note that this function does not handle list-valued properties. Use
     /// `extract_list_column()` for those instead.
     bool extract_properties(const uint32_t propIdxs[], uint32_t numProps, PLYPropertyType destType, void* dest) const;
@@ -212,6 +592,41 @@ namespace miniply {
     /// you should use `extract_properties` in preference to this method.
     bool extract_properties_with_stride(const uint32_t propIdxs[], uint32_t numProps, PLYPropertyType destType, void* dest, uint32_t destStride) const;
 
+    /// Report which path `extract_properties_with_stride` would take for
+    /// these arguments (use `destStride = 0` for `extract_properties`), why,
+    /// what it would cost and what you could change to get a faster path,
+    /// e.g. requesting the properties in file order or extracting to the
+    /// file's own type. This only needs the header, so it can be called
+    /// before the element is loaded; the cost is then based on `num_rows()`.
+    /// Returns false if the extraction would fail, with the reason filled in.
+    bool explain_extraction(const uint32_t propIdxs[], uint32_t numProps, PLYPropertyType destType, uint32_t destStride, PLYExtractExplanation* explanation) const;
+
+    /// Extract colour channels as normalised floats. `propIdxs` lists the
+    /// source channels (e.g. from `find_color`, optionally followed by an
+    /// alpha property) and `numProps` must be between 1 and 4. Each row of
+    /// `dest` gets `destChannels` floats, where `numProps <= destChannels <= 4`;
+    /// the channels with no source property are set to `fill`, so you can ask
+    /// for RGBA from an RGB file and get a constant alpha.
+    ///
+    /// Unsigned integer values are divided by the maximum for their type
+    /// (255 for `uchar`, 65535 for `ushort`, etc.) to map them onto [0, 1].
+    /// Signed integer values are mapped onto [-1, 1] the same way. Float and
+    /// double values are copied unchanged. When the channels are all `uchar`
+    /// or all `ushort` and stored next to each other in channel order, four
+    /// rows at a time are converted with SIMD instructions where available.
+    bool extract_normalized_colors(const uint32_t propIdxs[], uint32_t numProps, uint32_t destChannels, float fill, float* dest) const;
+
+    /// Extract colour channels packed as 8-bit RGBA, 4 bytes per row in
+    /// R, G, B, A order. `propIdxs` and `numProps` are as for
+    /// `extract_normalized_colors`; missing channels are set to `fill`.
+    ///
+    /// Float and double values are clamped to [0, 1] and scaled to [0, 255]
+    /// with rounding, `uchar` values are copied as-is and other integer
+    /// types are normalised first, as for `extract_normalized_colors`.
+    /// Adjacent `uchar` or `float` channels in channel order are packed four
+    /// rows at a time with SIMD instructions where available.
+    bool extract_rgba8_colors(const uint32_t propIdxs[], uint32_t numProps, uint8_t fill, uint8_t* dest) const;
+
     /// Get the array of item counts for a list property. Entry `i` in this
     /// array is the number of items in the `i`th list.
     const uint32_t* get_list_counts(uint32_t propIdx) const;
@@ -223,20 +638,127 @@ namespace miniply {
     uint32_t sum_of_list_counts(uint32_t propIdx) const;
 
     const uint8_t* get_list_data(uint32_t propIdx) const;
+
+    /// Copy all the values for a list property into `dest`, converting them
+    /// to `destType` if necessary. `dest` must have space for at least
+    /// `sum_of_list_counts(propIdx)` values. `destType` can be
+    /// `PLYPropertyType::Half`, as for `extract_properties`.
     bool extract_list_property(uint32_t propIdx, PLYPropertyType destType, void* dest) const;
 
     uint32_t num_triangles(uint32_t propIdx) const;
     bool requires_triangulation(uint32_t propIdx) const;
     bool extract_triangles(uint32_t propIdx, const float pos[], uint32_t numVerts, PLYPropertyType destType, void* dest) const;
 
+    /// Triangulate the faces in list property `propIdx` of the current
+    /// element and group the triangles into meshlets, as `build_meshlets`
+    /// does. `pos` is the vertex positions, 3 floats per vertex.
+    bool extract_meshlets(uint32_t propIdx, const float pos[], uint32_t numVerts, PLYMeshlets& meshlets,
+                          uint32_t maxVerts = kPLYMeshletMaxVerts, uint32_t maxTris = kPLYMeshletMaxTris) const;
+
+    /// Build half-edge connectivity for the faces in list property `propIdx`
+    /// of the current element, straight from the loaded list data. Faces
+    /// aren't triangulated. Edges are matched by sorting the half-edges on
+    /// their (unordered) vertex pair in parallel, rather than with a hash
+    /// map, so memory use is a few arrays the size of the index list.
+    /// Returns false if the property isn't a loaded list or any index is
+    /// negative or not less than `numVerts`.
+    bool build_half_edges(uint32_t propIdx, uint32_t numVerts, PLYHalfEdges& halfEdges) const;
+
+    /// Label the connected components of the faces in list property
+    /// `propIdx` of the current element. Vertices are merged with a
+    /// lock-free union-find, with the faces processed on all cores at once.
+    /// Returns false if the property isn't a loaded list or any index is
+    /// negative or not less than `numVerts`.
+    bool find_components(uint32_t propIdx, uint32_t numVerts, PLYComponents& components) const;
+
+    /// Split the faces in list property `propIdx` into one mesh per
+    /// component, with the vertex indices remapped so each mesh can be used
+    /// on its own. `components` must have come from `find_components` for
+    /// the same property. Components with fewer than `minFaces` faces are
+    /// left out, which makes it easy to drop small fragments. Use the
+    /// `vertices` of each mesh to gather its vertex attributes.
+    bool split_components(uint32_t propIdx, const PLYComponents& components, std::vector<PLYComponentMesh>& meshes,
+                          uint32_t minFaces = 0) const;
+
+    /// Add the loaded rows of the current element to the running min, max,
+    /// mean, variance and histogram of each of the given scalar properties,
+    /// or of all of them if `propIdxs` is null. Call it once after
+    /// `load_element()`, or once per batch after each `load_element_rows()`.
+    /// If `stats` is empty it's set up with one entry per property and
+    /// `numBins` bins (rounded up to an even number); otherwise it must be
+    /// what a previous call for the same properties left behind.
+    ///
+    /// The rows are split across all cores, each of which gathers values a
+    /// block at a time into a column and reduces it; the per-thread results
+    /// are then combined. Means and variances are merged with Chan et al.'s
+    /// pairwise formula, so they stay accurate over billions of values.
+    /// Returns false if any of the properties is missing or a list.
+    bool accumulate_property_stats(const uint32_t propIdxs[], uint32_t numProps, std::vector<PLYPropertyStats>& stats,
+                                   uint32_t numBins = kPLYHistogramBins) const;
+
     bool find_pos(uint32_t propIdxs[3]) const;
     bool find_normal(uint32_t propIdxs[3]) const;
     bool find_texcoord(uint32_t propIdxs[2]) const;
     bool find_color(uint32_t propIdxs[3]) const;
     bool find_indices(uint32_t propIdxs[1]) const;
 
+    /// Find the properties of a 3D Gaussian Splatting vertex element. Returns
+    /// false unless the current element has all of the position, scale,
+    /// rotation, opacity and `f_dc_*` properties, none of them lists. The
+    /// `f_rest_*` properties are optional, but there must be a whole number
+    /// of SH degrees' worth of them if there are any.
+    bool find_splat(PLYSplatProperties* props) const;
+
+    /// Extract the loaded rows of a Gaussian Splatting element into `dest` in
+    /// a single pass, applying the usual activations as we go: `exp` for the
+    /// scales, a sigmoid for the opacity and normalisation for the rotation.
+    /// Positions and SH coefficients are copied unchanged, except that the
+    /// `f_rest_*` values are transposed from the file's channel-major order
+    /// into (coefficient, channel) order after the `f_dc_*` values, which is
+    /// what most renderers expect. `props` should come from `find_splat`.
+    ///
+    /// The activations are vectorised where SSE2 is available and large
+    /// elements are split across multiple threads. Like the `extract_*`
+    /// methods this works on the current batch if you're using
+    /// `load_element_rows`, so size the buffers with `num_loaded_rows()`.
+    bool extract_splats(const PLYSplatProperties& props, const PLYSplatBuffers& dest) const;
+
+    /// Reorder the rows of the current element so that they're in ascending
+    /// order of the values in the `keyPropIdx` property, which must be a
+    /// non-list property. The element must have been loaded already. Any
+    /// list properties in the element are reordered along with the rest of
+    /// the row, so the element remains consistent.
+    ///
+    /// The sort is a parallel LSD radix sort, so it's stable and takes time
+    /// linear in the number of rows.
+    ///
+    /// If `newRowIndex` is not null it must point to an array with at least
+    /// `num_rows()` entries. Entry `i` will be set to the new position of the
+    /// row which was previously at position `i`. If you're sorting the vertex
+    /// element, pass this array to `remap_indices` on the face element
+    /// afterwards to keep the faces pointing at the right vertices.
+    bool sort_rows(uint32_t keyPropIdx, uint32_t newRowIndex[] = nullptr);
+
+    /// The same as `sort_rows`, except that the sort key is a 63-bit Morton
+    /// code calculated from the three properties in `posPropIdxs`, quantized
+    /// relative to their bounding box with the same scale on every axis. This
+    /// gives the rows a spatially coherent ordering, the same one that
+    /// `build_meshlets` uses for triangles.
+    bool sort_rows_by_morton_code(const uint32_t posPropIdxs[3], uint32_t newRowIndex[] = nullptr);
+
+    /// Replace every value `v` of the given properties in the current element
+    /// with `remap[v]`. The properties may be integer list properties (e.g.
+    /// `vertex_indices`) or integer scalar properties (e.g. after calling
+    /// `convert_list_to_fixed_size`). The element must have been loaded.
+    ///
+    /// Values which are negative or not less than `remapSize` are left as-is.
+    /// Remapped values are stored in the property's existing type, so it's
+    /// up to you to make sure the type is wide enough.
+    bool remap_indices(const uint32_t propIdxs[], uint32_t numProps, const uint32_t remap[], uint32_t remapSize);
+
   private:
     bool refill_buffer();
+    bool seek_to(int64_t offset);
     bool rewind_to_safe_char();
     bool accept();
     bool advance();
@@ -261,7 +783,12 @@ namespace miniply {
     bool parse_property(std::vector<PLYProperty>& properties);
 
     bool load_fixed_size_element(PLYElement& elem);
+    bool load_fixed_size_rows(PLYElement& elem, uint32_t numRows);
+    bool load_fixed_size_row(PLYElement& elem, size_t destIndex);
     bool load_variable_size_element(PLYElement& elem);
+    bool skip_rows(const PLYElement& elem, uint32_t numRows);
+
+    bool sort_rows_by_key(const std::vector<uint64_t>& keys, uint32_t newRowIndex[]);
 
     bool load_ascii_scalar_property(PLYProperty& prop, size_t& destIndex);
     bool load_ascii_list_property(PLYProperty& prop);
@@ -272,7 +799,14 @@ namespace miniply {
 
     bool ascii_value(PLYPropertyType propType, uint8_t value[8]);
 
+    void hash_consumed_bytes();
+    bool hash_file_range(int64_t start, int64_t end);
+    void finish_element_hash(size_t idx);
+
   private:
+    struct HashState;
+
+
     FILE* m_f             = nullptr;
     char* m_buf           = nullptr;
     const char* m_bufEnd  = nullptr;
@@ -280,20 +814,179 @@ namespace miniply {
     const char* m_end     = nullptr;
     bool m_inDataSection  = false;
     bool m_atEOF          = false;
-    int64_t m_bufOffset   = 0;
+    int64_t m_bufOffset   = 0;                  //!< File offset corresponding to the start of `m_buf`.
+    int64_t m_fileOffset  = 0;                  //!< File offset just past the last byte we've read into `m_buf`.
 
     bool m_valid          = false;
 
     PLYFileType m_fileType = PLYFileType::ASCII; //!< Whether the file was ascii, binary little-endian, or binary big-endian.
+    int64_t m_dataOffset   = -1;                //!< File offset of the first byte after the header.
     int m_majorVersion     = 0;
     int m_minorVersion     = 0;
     std::vector<PLYElement> m_elements;         //!< Element descriptors for this file.
 
     size_t m_currentElement = 0;
     bool m_elementLoaded    = false;
-    std::vector<uint8_t> m_elementData;
+    uint32_t m_rowsRead     = 0;                //!< Rows of the current element consumed by `load_element_rows` so far.
+    uint32_t m_numLoadedRows = 0;               //!< Rows of the current element currently held in `m_elementData`.
+    PLYDataBuffer m_elementData;
+    PLYWorkerPlacement m_placement = PLYWorkerPlacement::FirstTouch;
+    bool m_hugePages = false;
+    std::string m_filename;                     //!< Kept so that we can open `m_directFD` on demand.
+    int m_directFD = -1;                        //!< File descriptor opened for direct I/O, or -1 if it's not in use.
+    HashState* m_hash = nullptr;                //!< Content hashing state, or null if content hashing is off.
 
-    char* m_tmpBuf = nullptr;
+    char* m_tmpBuf = nullptr;                   //!< Scratch space for names while parsing the header. Freed once the header has been parsed.
+  };
+
+
+  /// A minimal buffered writer for binary little-endian PLY files. You give it
+  /// the element descriptors for the header, then append the raw row data for
+  /// each element in order. It's up to you to make sure the data you write
+  /// matches the header.
+  ///
+  /// If you don't know the final element counts when writing the header, pass
+  /// `reserveCountSpace = true` to `write_header` and call
+  /// `set_element_count` once you do.
+  class PLYWriter {
+  public:
+    PLYWriter(const char* filename, size_t bufferSize = 128 * 1024);
+    ~PLYWriter();
+
+    bool valid() const;
+
+    /// Add a comment line to the header. Must be called before `write_header`.
+    void add_comment(const char* comment);
+
+    /// Pad the header with a comment line so that the data section starts at
+    /// a multiple of `alignment` bytes from the start of the file (e.g. 4096
+    /// for a page boundary). Combined with row padding (see
+    /// `PLYElement::add_row_padding`) this lets readers map or read the data
+    /// straight into aligned arrays. Must be called before `write_header`.
+    void set_data_alignment(uint32_t alignment);
+
+    /// Write the header. Only the name and count of each element and the
+    /// name, type and count type of each property are used.
+    bool write_header(const std::vector<PLYElement>& elements, bool reserveCountSpace = false);
+
+    /// Append raw bytes to the data section.
+    bool write_data(const void* data, size_t numBytes);
+
+    /// Append `numRows` rows which are `srcStride` bytes apart in `rows`, each
+    /// zero-padded out to `destStride` bytes in the output. Use this when the
+    /// output element has had padding added with `add_row_padding`.
+    bool write_padded_rows(const void* rows, uint32_t numRows, uint32_t srcStride, uint32_t destStride);
+
+    /// Rewrite the count for an element in a header which was written with
+    /// `reserveCountSpace = true`.
+    bool set_element_count(uint32_t elemIdx, uint32_t count);
+
+    /// Flush any buffered data and close the file. Called automatically by
+    /// the destructor if you don't call it yourself.
+    bool close();
+
+    /// Flush any buffered data, then close the file and free the write
+    /// buffer while keeping everything else about the writer. The next call
+    /// which needs the file reopens it and carries on appending. This lets a
+    /// program keep more writers than it can have files open or buffers
+    /// allocated at the same time, e.g. one for each of thousands of tiles.
+    bool suspend();
+
+    /// True if `suspend` has been called and the file hasn't been reopened.
+    bool suspended() const;
+
+    /// Total number of bytes written so far, including the header.
+    int64_t bytes_written() const;
+
+  private:
+    bool flush();
+    bool resume();
+
+  private:
+    std::string m_filename;
+    FILE* m_f               = nullptr;
+    uint8_t* m_buf          = nullptr;
+    size_t m_bufSize        = 0;
+    size_t m_bufUsed        = 0;
+    int64_t m_bytesWritten  = 0;
+    uint32_t m_alignment    = 0;
+    bool m_valid            = false;
+    bool m_suspended        = false;
+
+    std::vector<std::string> m_comments;
+    std::vector<int64_t> m_countOffsets; //!< File offset of the count field for each element, if space was reserved.
+  };
+
+
+  /// Merge several PLY files into a single binary little-endian PLY file.
+  /// All inputs must have exactly the same elements and properties, in the
+  /// same order, but they don't have to have the same file type. The output
+  /// contains the rows for each element from every input, in input order.
+  ///
+  /// If there are both `vertex` and `face` elements, the `vertex_indices` (or
+  /// `vertex_index`) values from each input are offset by the number of
+  /// vertices in the inputs before it, so the faces still refer to the
+  /// right vertices.
+  ///
+  /// Only the headers are read up front; the data for each input is streamed
+  /// straight to its final location in the output. Binary little-endian
+  /// inputs are copied as raw bytes where possible. `numThreads == 0` means
+  /// use all available cores.
+  ///
+  /// Returns false if any input can't be read, the schemas don't match, the
+  /// merged counts or indices won't fit in their types, or the output can't
+  /// be written.
+  bool merge_ply_files(const char* const inputs[], uint32_t numInputs, const char* outFilename, uint32_t numThreads = 0);
+
+
+  /// Convert an ASCII PLY file into an equivalent binary little-endian PLY
+  /// file. The input is read in large windows which are split at line
+  /// boundaries and parsed in parallel. Rows for fixed-size elements are
+  /// written straight to their final offsets in the output; rows for
+  /// variable-size elements are written in order once each window has been
+  /// parsed. Memory use is bounded by the window size, which is a few MB per
+  /// thread. `numThreads == 0` means use all available cores.
+  ///
+  /// Returns false if the input isn't a valid ASCII PLY file or the output
+  /// can't be written.
+  bool transcode_ascii_to_binary(const char* inFilename, const char* outFilename, uint32_t numThreads = 0);
+
+
+  /// Reads ahead through a list of files that you're going to load in order.
+  /// A background thread opens the next few files while you're working on
+  /// the current one, asks the OS to read them into the page cache
+  /// (`posix_fadvise(POSIX_FADV_WILLNEED)` where available) and reads the
+  /// start of each one itself. This hides the per-file open and first-read
+  /// latency, which dominates when loading lots of small files from network
+  /// storage.
+  ///
+  /// At most `lookahead` files after the current one are prefetched, and at
+  /// most `byteBudget` bytes are requested ahead of the current file at any
+  /// time; the part of a file beyond the budget isn't requested.
+  ///
+  /// ```
+  /// PLYPrefetcher prefetcher(filenames, 8);
+  /// for (size_t i = 0; i < filenames.size(); i++) {
+  ///   prefetcher.set_current(i);
+  ///   PLYReader reader(filenames[i].c_str());
+  ///   ...
+  /// }
+  /// ```
+  class PLYPrefetcher {
+  public:
+    PLYPrefetcher(const std::vector<std::string>& filenames, uint32_t lookahead = 4, uint64_t byteBudget = 256ull * 1024 * 1024);
+    ~PLYPrefetcher();
+
+    /// Call this before loading `filenames[idx]`. Prefetching moves on to the
+    /// files after it, and the budget used by earlier files is released.
+    void set_current(size_t idx);
+
+  private:
+    PLYPrefetcher(const PLYPrefetcher&) = delete;
+    PLYPrefetcher& operator = (const PLYPrefetcher&) = delete;
+
+    struct State;
+    State* m_state = nullptr;
   };
 
 
@@ -312,6 +1005,68 @@ namespace miniply {
   /// The return value is the number of triangles.
   uint32_t triangulate_polygon(uint32_t n, const float pos[], uint32_t numVerts, const int indices[], int dst[]);
 
+
+  /// Group a triangle list into meshlets of at most `maxVerts` vertices and
+  /// `maxTris` triangles each, replacing the contents of `meshlets`. `pos`
+  /// holds 3 floats per vertex and `indices` holds 3 vertex indices per
+  /// triangle. Every meshlet gets a bounding sphere and a normal cone for
+  /// culling.
+  ///
+  /// The triangles are sorted along a Morton curve through their centroids
+  /// and the sorted list is split into one contiguous chunk per thread.
+  /// Within a chunk, each meshlet is seeded from the next unused triangle in
+  /// Morton order and grown by adding whichever neighbouring triangle needs
+  /// the fewest new vertices. Meshlets never span two chunks, so at most one
+  /// partly filled meshlet per thread is added by running in parallel.
+  ///
+  /// Returns false if `maxVerts` is less than 3 or more than 256, `maxTris`
+  /// is zero, or any index is out of range.
+  bool build_meshlets(const float pos[], uint32_t numVerts, const uint32_t indices[], uint32_t numTris, PLYMeshlets& meshlets,
+                      uint32_t maxVerts = kPLYMeshletMaxVerts, uint32_t maxTris = kPLYMeshletMaxTris);
+
+
+  /// Options for `simplify_mesh`.
+  struct PLYSimplifyOptions {
+    uint32_t targetTriangles = 0;    //!< Stop once there are no more than this many triangles.
+    float targetError = 0.01f;       //!< Never make a change with an error above this, as a fraction of the mesh's largest dimension.
+    const float* normals = nullptr;  //!< Optional, 3 floats per vertex.
+    const float* uvs = nullptr;      //!< Optional, 2 floats per vertex.
+    float normalWeight = 0.01f;      //!< A unit difference in normals costs as much as moving this fraction of the mesh's size.
+    float uvWeight = 0.01f;          //!< The same for texture coordinates.
+    bool partitioned = false;        //!< Simplify spatial partitions of the mesh in parallel, then clean up the seams between them.
+  };
+
+  /// Simplify a triangle mesh by repeatedly collapsing edges, cheapest
+  /// first, writing the indices of the remaining triangles to
+  /// `simplifiedIndices`. Each collapse moves one vertex onto the other end
+  /// of the edge, so the output refers to the original vertices and their
+  /// attributes stay valid as they are.
+  ///
+  /// The cost of a collapse is the quadric error metric of Garland and
+  /// Heckbert: the area-weighted mean squared distance from the moved vertex
+  /// to the planes of its original triangles. If `normals` or `uvs` are
+  /// given, the difference in those attributes between the two vertices is
+  /// added in as well, so collapses across creases and texture distortion
+  /// are avoided. Collapses which would turn a triangle more than 60 degrees
+  /// away from its original orientation are skipped.
+  /// Vertices on open or non-manifold edges never move, which preserves
+  /// borders and the seams between split vertices.
+  ///
+  /// Simplification stops when there are `targetTriangles` or fewer
+  /// triangles, or when every remaining collapse would cost more than
+  /// `targetError`. If `resultError` isn't null it's set to the largest
+  /// error of any collapse that was made, on the same scale.
+  ///
+  /// With `partitioned` set the triangles are split into one spatially
+  /// coherent partition per thread, each partition is simplified on its own
+  /// with the vertices it shares with other partitions locked, and a final
+  /// pass over the whole mesh then simplifies the seams. This is much faster
+  /// for very large meshes but usually gives slightly worse results.
+  ///
+  /// Returns false if any index is out of range.
+  bool simplify_mesh(const float pos[], uint32_t numVerts, const uint32_t indices[], uint32_t numTris,
+                     const PLYSimplifyOptions& options, std::vector<uint32_t>& simplifiedIndices, float* resultError = nullptr);
+
 } // namespace miniply
 
 #endif // MINIPLY_H
@@ -0,0 +1,508 @@
+/*
+MIT License
+
+Copyright (c) 2019 Vilya Harvey
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "miniply_c.h"
+#include "miniply.h"
+
+#include <cstring>
+#include <utility>
+
+
+static_assert(int(miniply::PLYPropertyType::Half) == MINIPLY_TYPE_HALF, "miniply_property_type is out of sync with PLYPropertyType");
+static_assert(int(miniply::PLYPropertyType::None) == MINIPLY_TYPE_NONE, "miniply_property_type is out of sync with PLYPropertyType");
+static_assert(int(miniply::PLYFileType::BinaryBigEndian) == MINIPLY_FILE_BINARY_BIG_ENDIAN, "miniply_file_type is out of sync with PLYFileType");
+
+
+struct miniply_reader {
+  miniply::PLYReader reader;
+
+  explicit miniply_reader(const char* filename) : reader(filename) {}
+};
+
+
+struct miniply_buffer {
+  miniply::PLYDataBuffer data;
+  size_t numBytes = 0;
+};
+
+
+namespace {
+
+  // Nothing may throw across the C API, so allocation failures and
+  // exceptions from the constructor become a null return.
+  template <class T, class... Args>
+  static T* new_object(Args&&... args)
+  {
+    try {
+      return new T(std::forward<Args>(args)...);
+    }
+    catch (...) {
+      return nullptr;
+    }
+  }
+
+
+  static bool has_element(const miniply_reader* reader)
+  {
+    return reader != nullptr && reader->reader.has_element();
+  }
+
+
+  static bool valid_dest_type(miniply_property_type type)
+  {
+    return type >= MINIPLY_TYPE_CHAR && type <= MINIPLY_TYPE_HALF;
+  }
+
+
+  static const miniply::PLYProperty* current_property(const miniply_reader* reader, uint32_t propIdx)
+  {
+    if (!has_element(reader)) {
+      return nullptr;
+    }
+    const miniply::PLYElement* elem = reader->reader.element();
+    return (propIdx < elem->properties.size()) ? &elem->properties[propIdx] : nullptr;
+  }
+
+} // anonymous namespace
+
+
+extern "C" {
+
+  //
+  // Opening & closing
+  //
+
+  miniply_reader* miniply_open(const char* filename)
+  {
+    if (filename == nullptr) {
+      return nullptr;
+    }
+    miniply_reader* reader = new_object<miniply_reader>(filename);
+    if (reader != nullptr && !reader->reader.valid()) {
+      delete reader;
+      return nullptr;
+    }
+    return reader;
+  }
+
+
+  void miniply_close(miniply_reader* reader)
+  {
+    delete reader;
+  }
+
+
+  //
+  // Schema
+  //
+
+  miniply_file_type miniply_file_type_of(const miniply_reader* reader)
+  {
+    return (reader != nullptr) ? miniply_file_type(reader->reader.file_type()) : MINIPLY_FILE_ASCII;
+  }
+
+
+  int miniply_version_major(const miniply_reader* reader)
+  {
+    return (reader != nullptr) ? reader->reader.version_major() : 0;
+  }
+
+
+  int miniply_version_minor(const miniply_reader* reader)
+  {
+    return (reader != nullptr) ? reader->reader.version_minor() : 0;
+  }
+
+
+  uint32_t miniply_num_elements(const miniply_reader* reader)
+  {
+    return (reader != nullptr) ? reader->reader.num_elements() : 0;
+  }
+
+
+  uint32_t miniply_find_element(const miniply_reader* reader, const char* name)
+  {
+    return (reader != nullptr && name != nullptr) ? reader->reader.find_element(name) : MINIPLY_INVALID_INDEX;
+  }
+
+
+  int miniply_element_info_at(const miniply_reader* reader, uint32_t elemIdx, miniply_element_info* info)
+  {
+    const miniply::PLYElement* elem = (reader != nullptr) ? reader->reader.get_element(elemIdx) : nullptr;
+    if (elem == nullptr || info == nullptr) {
+      return 0;
+    }
+    info->name = elem->name.c_str();
+    info->count = elem->count;
+    info->num_properties = uint32_t(elem->properties.size());
+    info->row_stride = elem->rowStride;
+    info->fixed_size = elem->fixedSize ? 1 : 0;
+    return 1;
+  }
+
+
+  int miniply_property_info_at(const miniply_reader* reader, uint32_t elemIdx, uint32_t propIdx, miniply_property_info* info)
+  {
+    const miniply::PLYElement* elem = (reader != nullptr) ? reader->reader.get_element(elemIdx) : nullptr;
+    if (elem == nullptr || propIdx >= elem->properties.size() || info == nullptr) {
+      return 0;
+    }
+    const miniply::PLYProperty& prop = elem->properties[propIdx];
+    info->name = prop.name.c_str();
+    info->type = miniply_property_type(prop.type);
+    info->count_type = miniply_property_type(prop.countType);
+    info->offset = prop.offset;
+    return 1;
+  }
+
+
+  uint32_t miniply_property_type_size(miniply_property_type type)
+  {
+    static const uint32_t kSizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 2, 0 };
+    return (type >= MINIPLY_TYPE_CHAR && type <= MINIPLY_TYPE_NONE) ? kSizes[type] : 0;
+  }
+
+
+  //
+  // Element iteration & loading
+  //
+
+  int miniply_has_element(const miniply_reader* reader)
+  {
+    return has_element(reader) ? 1 : 0;
+  }
+
+
+  uint32_t miniply_element_index(const miniply_reader* reader)
+  {
+    if (!has_element(reader)) {
+      return MINIPLY_INVALID_INDEX;
+    }
+    const miniply::PLYElement* first = reader->reader.get_element(0);
+    return uint32_t(reader->reader.element() - first);
+  }
+
+
+  int miniply_element_is(const miniply_reader* reader, const char* name)
+  {
+    return (reader != nullptr && name != nullptr && reader->reader.element_is(name)) ? 1 : 0;
+  }
+
+
+  uint32_t miniply_num_rows(const miniply_reader* reader)
+  {
+    return has_element(reader) ? reader->reader.num_rows() : 0;
+  }
+
+
+  uint32_t miniply_num_loaded_rows(const miniply_reader* reader)
+  {
+    return has_element(reader) ? reader->reader.num_loaded_rows() : 0;
+  }
+
+
+  int miniply_load_element(miniply_reader* reader)
+  {
+    if (!has_element(reader)) {
+      return 0;
+    }
+    try {
+      return reader->reader.load_element() ? 1 : 0;
+    }
+    catch (...) {
+      return 0;
+    }
+  }
+
+
+  uint32_t miniply_load_element_rows(miniply_reader* reader, uint32_t maxRows)
+  {
+    if (!has_element(reader)) {
+      return 0;
+    }
+    try {
+      return reader->reader.load_element_rows(maxRows);
+    }
+    catch (...) {
+      return 0;
+    }
+  }
+
+
+  void miniply_next_element(miniply_reader* reader)
+  {
+    if (has_element(reader)) {
+      reader->reader.next_element();
+    }
+  }
+
+
+  int miniply_convert_list_to_fixed_size(miniply_reader* reader, uint32_t listPropIdx, uint32_t listSize, uint32_t newPropIdxs[])
+  {
+    if (!has_element(reader)) {
+      return 0;
+    }
+    miniply::PLYElement* elem = reader->reader.get_element(miniply_element_index(reader));
+    if (elem == nullptr || newPropIdxs == nullptr || reader->reader.num_loaded_rows() > 0) {
+      return 0;
+    }
+    try {
+      return elem->convert_list_to_fixed_size(listPropIdx, listSize, newPropIdxs) ? 1 : 0;
+    }
+    catch (...) {
+      return 0;
+    }
+  }
+
+
+  //
+  // Property lookup
+  //
+
+  uint32_t miniply_find_property(const miniply_reader* reader, const char* name)
+  {
+    return (has_element(reader) && name != nullptr) ? reader->reader.find_property(name) : MINIPLY_INVALID_INDEX;
+  }
+
+
+  int miniply_find_properties(const miniply_reader* reader, const char* const names[], uint32_t numProps, uint32_t propIdxs[])
+  {
+    if (!has_element(reader) || names == nullptr || propIdxs == nullptr) {
+      return 0;
+    }
+    for (uint32_t i = 0; i < numProps; i++) {
+      if (names[i] == nullptr) {
+        return 0;
+      }
+      propIdxs[i] = reader->reader.find_property(names[i]);
+      if (propIdxs[i] == MINIPLY_INVALID_INDEX) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+
+  int miniply_find_pos(const miniply_reader* reader, uint32_t propIdxs[3])
+  {
+    return (has_element(reader) && propIdxs != nullptr && reader->reader.find_pos(propIdxs)) ? 1 : 0;
+  }
+
+
+  int miniply_find_normal(const miniply_reader* reader, uint32_t propIdxs[3])
+  {
+    return (has_element(reader) && propIdxs != nullptr && reader->reader.find_normal(propIdxs)) ? 1 : 0;
+  }
+
+
+  int miniply_find_texcoord(const miniply_reader* reader, uint32_t propIdxs[2])
+  {
+    return (has_element(reader) && propIdxs != nullptr && reader->reader.find_texcoord(propIdxs)) ? 1 : 0;
+  }
+
+
+  int miniply_find_color(const miniply_reader* reader, uint32_t propIdxs[3])
+  {
+    return (has_element(reader) && propIdxs != nullptr && reader->reader.find_color(propIdxs)) ? 1 : 0;
+  }
+
+
+  int miniply_find_indices(const miniply_reader* reader, uint32_t propIdxs[1])
+  {
+    return (has_element(reader) && propIdxs != nullptr && reader->reader.find_indices(propIdxs)) ? 1 : 0;
+  }
+
+
+  //
+  // Extraction
+  //
+
+  int miniply_extract_properties(const miniply_reader* reader, const uint32_t propIdxs[], uint32_t numProps, miniply_property_type destType, void* dest, uint32_t destStride)
+  {
+    if (!has_element(reader) || propIdxs == nullptr || dest == nullptr || !valid_dest_type(destType)) {
+      return 0;
+    }
+    const miniply::PLYPropertyType type = miniply::PLYPropertyType(destType);
+    try {
+      bool ok = (destStride == 0) ?
+        reader->reader.extract_properties(propIdxs, numProps, type, dest) :
+        reader->reader.extract_properties_with_stride(propIdxs, numProps, type, dest, destStride);
+      return ok ? 1 : 0;
+    }
+    catch (...) {
+      return 0;
+    }
+  }
+
+
+  uint32_t miniply_sum_of_list_counts(const miniply_reader* reader, uint32_t propIdx)
+  {
+    const miniply::PLYProperty* prop = current_property(reader, propIdx);
+    if (prop == nullptr || prop->countType == miniply::PLYPropertyType::None) {
+      return 0;
+    }
+    return reader->reader.sum_of_list_counts(propIdx);
+  }
+
+
+  int miniply_extract_list_property(const miniply_reader* reader, uint32_t propIdx, miniply_property_type destType, void* dest)
+  {
+    if (current_property(reader, propIdx) == nullptr || dest == nullptr || !valid_dest_type(destType)) {
+      return 0;
+    }
+    try {
+      return reader->reader.extract_list_property(propIdx, miniply::PLYPropertyType(destType), dest) ? 1 : 0;
+    }
+    catch (...) {
+      return 0;
+    }
+  }
+
+
+  uint32_t miniply_num_triangles(const miniply_reader* reader, uint32_t propIdx)
+  {
+    const miniply::PLYProperty* prop = current_property(reader, propIdx);
+    if (prop == nullptr || prop->countType == miniply::PLYPropertyType::None) {
+      return 0;
+    }
+    return reader->reader.num_triangles(propIdx);
+  }
+
+
+  int miniply_requires_triangulation(const miniply_reader* reader, uint32_t propIdx)
+  {
+    if (current_property(reader, propIdx) == nullptr) {
+      return 0;
+    }
+    return reader->reader.requires_triangulation(propIdx) ? 1 : 0;
+  }
+
+
+  int miniply_extract_triangles(const miniply_reader* reader, uint32_t propIdx, const float pos[], uint32_t numVerts, miniply_property_type destType, void* dest)
+  {
+    if (current_property(reader, propIdx) == nullptr || pos == nullptr || dest == nullptr || !valid_dest_type(destType)) {
+      return 0;
+    }
+    try {
+      return reader->reader.extract_triangles(propIdx, pos, numVerts, miniply::PLYPropertyType(destType), dest) ? 1 : 0;
+    }
+    catch (...) {
+      return 0;
+    }
+  }
+
+
+  //
+  // Borrowed pointers
+  //
+
+  const void* miniply_element_data(const miniply_reader* reader, size_t* numBytes)
+  {
+    const bool loaded = has_element(reader) && reader->reader.num_loaded_rows() > 0;
+    if (numBytes != nullptr) {
+      *numBytes = loaded ? size_t(reader->reader.num_loaded_rows()) * reader->reader.element()->rowStride : 0;
+    }
+    return loaded ? reader->reader.get_element_data() : nullptr;
+  }
+
+
+  const void* miniply_property_data(const miniply_reader* reader, uint32_t propIdx, uint32_t* stride)
+  {
+    if (!has_element(reader) || reader->reader.num_loaded_rows() == 0) {
+      return nullptr;
+    }
+    uint32_t tmpStride = 0;
+    const uint8_t* data = reader->reader.get_property_data(propIdx, &tmpStride);
+    if (stride != nullptr) {
+      *stride = tmpStride;
+    }
+    return data;
+  }
+
+
+  const uint32_t* miniply_list_counts(const miniply_reader* reader, uint32_t propIdx)
+  {
+    const miniply::PLYProperty* prop = current_property(reader, propIdx);
+    if (prop == nullptr || prop->countType == miniply::PLYPropertyType::None || prop->rowCount.empty()) {
+      return nullptr;
+    }
+    return prop->rowCount.data();
+  }
+
+
+  const void* miniply_list_data(const miniply_reader* reader, uint32_t propIdx, size_t* numBytes)
+  {
+    const miniply::PLYProperty* prop = current_property(reader, propIdx);
+    if (prop == nullptr || prop->countType == miniply::PLYPropertyType::None || prop->rowCount.empty()) {
+      if (numBytes != nullptr) {
+        *numBytes = 0;
+      }
+      return nullptr;
+    }
+    if (numBytes != nullptr) {
+      *numBytes = size_t(reader->reader.sum_of_list_counts(propIdx)) * miniply_property_type_size(miniply_property_type(prop->type));
+    }
+    return reader->reader.get_list_data(propIdx);
+  }
+
+
+  //
+  // Owned element data
+  //
+
+  miniply_buffer* miniply_take_element_data(miniply_reader* reader)
+  {
+    if (!has_element(reader)) {
+      return nullptr;
+    }
+    size_t numBytes = 0;
+    miniply_element_data(reader, &numBytes);
+    miniply_buffer* buffer = new_object<miniply_buffer>();
+    if (buffer == nullptr) {
+      return nullptr;
+    }
+    buffer->data = reader->reader.take_element_data();
+    buffer->numBytes = numBytes;
+    return buffer;
+  }
+
+
+  void* miniply_buffer_data(miniply_buffer* buffer)
+  {
+    return (buffer != nullptr && buffer->numBytes > 0) ? buffer->data.data() : nullptr;
+  }
+
+
+  size_t miniply_buffer_size(const miniply_buffer* buffer)
+  {
+    return (buffer != nullptr) ? buffer->numBytes : 0;
+  }
+
+
+  void miniply_buffer_free(miniply_buffer* buffer)
+  {
+    delete buffer;
+  }
+
+} // extern "C"
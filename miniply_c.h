@@ -0,0 +1,237 @@
+/*
+MIT License
+
+Copyright (c) 2019 Vilya Harvey
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MINIPLY_C_H
+#define MINIPLY_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/// miniply C API
+/// =============
+///
+/// A plain C wrapper around `miniply::PLYReader`, for use from C and from
+/// other languages' foreign function interfaces. It only uses fixed-size
+/// integer types, opaque handles and caller-provided buffers, so there's
+/// nothing to marshal at the boundary.
+///
+/// Functions returning `int` return 1 on success and 0 on failure. Indexes
+/// are `uint32_t`, with `MINIPLY_INVALID_INDEX` meaning "not found". Nothing
+/// here throws or prints, and a null reader is treated like one with no
+/// elements rather than crashing.
+///
+/// Pointers described as *borrowed* point into the reader's own storage.
+/// They're valid until the next call to `miniply_load_element`,
+/// `miniply_load_element_rows`, `miniply_next_element`,
+/// `miniply_take_element_data` or `miniply_close` on the same reader, so copy
+/// the data (or take it) if you need it for longer. Strings in the schema
+/// queries are also borrowed and stay valid until the reader is closed,
+/// except that `miniply_convert_list_to_fixed_size` invalidates the property
+/// names of the current element.
+///
+/// A reader must only be used by one thread at a time, but different readers
+/// can be used on different threads.
+
+#if defined(_WIN32)
+  #if defined(MINIPLY_C_EXPORTS)
+    #define MINIPLY_C_API __declspec(dllexport)
+  #elif defined(MINIPLY_C_SHARED)
+    #define MINIPLY_C_API __declspec(dllimport)
+  #else
+    #define MINIPLY_C_API
+  #endif
+#elif defined(__GNUC__)
+  #define MINIPLY_C_API __attribute__((visibility("default")))
+#else
+  #define MINIPLY_C_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MINIPLY_INVALID_INDEX 0xFFFFFFFFu
+
+
+typedef enum miniply_file_type {
+  MINIPLY_FILE_ASCII = 0,
+  MINIPLY_FILE_BINARY = 1,
+  MINIPLY_FILE_BINARY_BIG_ENDIAN = 2,
+} miniply_file_type;
+
+
+/// Same values as `miniply::PLYPropertyType`.
+typedef enum miniply_property_type {
+  MINIPLY_TYPE_CHAR = 0,
+  MINIPLY_TYPE_UCHAR = 1,
+  MINIPLY_TYPE_SHORT = 2,
+  MINIPLY_TYPE_USHORT = 3,
+  MINIPLY_TYPE_INT = 4,
+  MINIPLY_TYPE_UINT = 5,
+  MINIPLY_TYPE_FLOAT = 6,
+  MINIPLY_TYPE_DOUBLE = 7,
+  MINIPLY_TYPE_HALF = 8,   //!< Only valid as a destination type.
+  MINIPLY_TYPE_NONE = 9,   //!< Used as the count type of non-list properties.
+} miniply_property_type;
+
+
+typedef struct miniply_element_info {
+  const char* name;         //!< Borrowed.
+  uint32_t count;           //!< Number of rows.
+  uint32_t num_properties;
+  uint32_t row_stride;      //!< Bytes per row of fixed-size data.
+  int fixed_size;           //!< 1 if the element has no list properties.
+} miniply_element_info;
+
+
+typedef struct miniply_property_info {
+  const char* name;                  //!< Borrowed.
+  miniply_property_type type;
+  miniply_property_type count_type;  //!< `MINIPLY_TYPE_NONE` unless this is a list property.
+  uint32_t offset;                   //!< Byte offset within a row, for non-list properties.
+} miniply_property_info;
+
+
+typedef struct miniply_reader miniply_reader;
+
+/// Element row data moved out of a reader. See `miniply_take_element_data`.
+typedef struct miniply_buffer miniply_buffer;
+
+
+//
+// Opening & closing
+//
+
+/// Open a PLY file and parse its header. Returns null if the file couldn't
+/// be opened, the header is invalid or we ran out of memory.
+MINIPLY_C_API miniply_reader* miniply_open(const char* filename);
+
+MINIPLY_C_API void miniply_close(miniply_reader* reader);
+
+
+//
+// Schema
+//
+
+MINIPLY_C_API miniply_file_type miniply_file_type_of(const miniply_reader* reader);
+MINIPLY_C_API int miniply_version_major(const miniply_reader* reader);
+MINIPLY_C_API int miniply_version_minor(const miniply_reader* reader);
+MINIPLY_C_API uint32_t miniply_num_elements(const miniply_reader* reader);
+MINIPLY_C_API uint32_t miniply_find_element(const miniply_reader* reader, const char* name);
+MINIPLY_C_API int miniply_element_info_at(const miniply_reader* reader, uint32_t elemIdx, miniply_element_info* info);
+MINIPLY_C_API int miniply_property_info_at(const miniply_reader* reader, uint32_t elemIdx, uint32_t propIdx, miniply_property_info* info);
+
+/// Size in bytes of one value of the given type, or 0 for `MINIPLY_TYPE_NONE`.
+MINIPLY_C_API uint32_t miniply_property_type_size(miniply_property_type type);
+
+
+//
+// Element iteration & loading
+//
+
+MINIPLY_C_API int miniply_has_element(const miniply_reader* reader);
+
+/// Index of the current element, or `MINIPLY_INVALID_INDEX` if there isn't one.
+MINIPLY_C_API uint32_t miniply_element_index(const miniply_reader* reader);
+MINIPLY_C_API int miniply_element_is(const miniply_reader* reader, const char* name);
+MINIPLY_C_API uint32_t miniply_num_rows(const miniply_reader* reader);
+MINIPLY_C_API uint32_t miniply_num_loaded_rows(const miniply_reader* reader);
+MINIPLY_C_API int miniply_load_element(miniply_reader* reader);
+MINIPLY_C_API uint32_t miniply_load_element_rows(miniply_reader* reader, uint32_t maxRows);
+MINIPLY_C_API void miniply_next_element(miniply_reader* reader);
+
+/// See `PLYElement::convert_list_to_fixed_size`. Applies to the current
+/// element, which mustn't have been loaded yet.
+MINIPLY_C_API int miniply_convert_list_to_fixed_size(miniply_reader* reader, uint32_t listPropIdx, uint32_t listSize, uint32_t newPropIdxs[]);
+
+
+//
+// Property lookup (current element)
+//
+
+MINIPLY_C_API uint32_t miniply_find_property(const miniply_reader* reader, const char* name);
+
+/// Array version of `PLYReader::find_properties`. Returns 0 unless all
+/// `numProps` names were found.
+MINIPLY_C_API int miniply_find_properties(const miniply_reader* reader, const char* const names[], uint32_t numProps, uint32_t propIdxs[]);
+MINIPLY_C_API int miniply_find_pos(const miniply_reader* reader, uint32_t propIdxs[3]);
+MINIPLY_C_API int miniply_find_normal(const miniply_reader* reader, uint32_t propIdxs[3]);
+MINIPLY_C_API int miniply_find_texcoord(const miniply_reader* reader, uint32_t propIdxs[2]);
+MINIPLY_C_API int miniply_find_color(const miniply_reader* reader, uint32_t propIdxs[3]);
+MINIPLY_C_API int miniply_find_indices(const miniply_reader* reader, uint32_t propIdxs[1]);
+
+
+//
+// Extraction into caller buffers (current element, loaded rows)
+//
+
+/// `destStride` is the number of bytes between rows in `dest`, or 0 for
+/// tightly packed rows. See `PLYReader::extract_properties_with_stride`.
+MINIPLY_C_API int miniply_extract_properties(const miniply_reader* reader, const uint32_t propIdxs[], uint32_t numProps, miniply_property_type destType, void* dest, uint32_t destStride);
+MINIPLY_C_API uint32_t miniply_sum_of_list_counts(const miniply_reader* reader, uint32_t propIdx);
+MINIPLY_C_API int miniply_extract_list_property(const miniply_reader* reader, uint32_t propIdx, miniply_property_type destType, void* dest);
+MINIPLY_C_API uint32_t miniply_num_triangles(const miniply_reader* reader, uint32_t propIdx);
+MINIPLY_C_API int miniply_requires_triangulation(const miniply_reader* reader, uint32_t propIdx);
+MINIPLY_C_API int miniply_extract_triangles(const miniply_reader* reader, uint32_t propIdx, const float pos[], uint32_t numVerts, miniply_property_type destType, void* dest);
+
+
+//
+// Borrowed pointers to loaded data (current element)
+//
+
+/// Fixed-size data for the loaded rows, in native byte order. Sets
+/// `*numBytes` (if not null) to `miniply_num_loaded_rows() * row_stride`.
+MINIPLY_C_API const void* miniply_element_data(const miniply_reader* reader, size_t* numBytes);
+
+/// Pointer to a non-list property's value in the first loaded row, with the
+/// row stride in `*stride`. Null for invalid or list properties.
+MINIPLY_C_API const void* miniply_property_data(const miniply_reader* reader, uint32_t propIdx, uint32_t* stride);
+
+/// Per-row item counts for a loaded list property; there's one per loaded row.
+MINIPLY_C_API const uint32_t* miniply_list_counts(const miniply_reader* reader, uint32_t propIdx);
+
+/// Values of a loaded list property, back to back in the property's own
+/// type. Sets `*numBytes` (if not null) to the size of the values.
+MINIPLY_C_API const void* miniply_list_data(const miniply_reader* reader, uint32_t propIdx, size_t* numBytes);
+
+
+//
+// Owned element data
+//
+
+/// Move the loaded rows of the current element out of the reader without
+/// copying them (see `PLYReader::take_element_data`). The data stays valid
+/// until you call `miniply_buffer_free`, even after the reader is closed.
+/// Returns null if there's no current element or allocating the handle failed.
+MINIPLY_C_API miniply_buffer* miniply_take_element_data(miniply_reader* reader);
+MINIPLY_C_API void* miniply_buffer_data(miniply_buffer* buffer);
+MINIPLY_C_API size_t miniply_buffer_size(const miniply_buffer* buffer);
+MINIPLY_C_API void miniply_buffer_free(miniply_buffer* buffer);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // MINIPLY_C_H